@@ -0,0 +1,305 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+#include "alarms.h"
+
+#define ERROR_RATE_SCALE   (16)     // fixed-point scale of the smoothed error rate
+#define ERROR_RATE_SHIFT   (3)      // smoothing factor of 1/8
+#define TASK_STACK_SIZE    (3072)
+#define TASK_PRIORITY      (5)
+
+static const char * TAG = "alarms";
+
+static const char * RULE_TYPE_NAMES[ALARMS_RULE_TYPES] = { "high", "low", "rate", "stale", "errors" };
+
+typedef struct
+{
+    alarms_rule_type_t type;
+    int target;                  // device index, or -1 for all devices
+    float set;
+    float clear;
+    int hold_off;
+} source_rule_t;
+
+const char * alarms_rule_type_name(alarms_rule_type_t type)
+{
+    return type < ALARMS_RULE_TYPES ? RULE_TYPE_NAMES[type] : "unknown";
+}
+
+// Convert a threshold from user units into the metric's internal units
+static int32_t _to_metric(alarms_rule_type_t type, float threshold)
+{
+    switch (type)
+    {
+    case ALARMS_RULE_HIGH: return lroundf(threshold * 16.0f);
+    case ALARMS_RULE_LOW: return -lroundf(threshold * 16.0f);
+    case ALARMS_RULE_RATE: return lroundf(threshold * 16.0f);
+    case ALARMS_RULE_STALE: return lroundf(threshold);
+    case ALARMS_RULE_ERRORS: return lroundf(threshold * ERROR_RATE_SCALE);
+    default: return 0;
+    }
+}
+
+static int _parse(const sensors_t * sensors, const char * spec, source_rule_t * rules)
+{
+    char * copy = strdup(spec);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+
+    int count = 0;
+    char * save = NULL;
+    for (char * def = strtok_r(copy, ";", &save); def != NULL; def = strtok_r(NULL, ";", &save))
+    {
+        char type[8] = { 0 };
+        char target[OWB_ROM_CODE_STRING_LENGTH] = { 0 };
+        source_rule_t rule = { 0 };
+        if (count >= ALARMS_MAX_SOURCE_RULES
+            || sscanf(def, " %7[^:]:%16[^:]:%f:%f:%d", type, target, &rule.set, &rule.clear, &rule.hold_off) != 5)
+        {
+            ESP_LOGE(TAG, "invalid rule: %s", def);
+            count = -1;
+            break;
+        }
+
+        rule.type = ALARMS_RULE_TYPES;
+        for (int t = 0; t < ALARMS_RULE_TYPES; ++t)
+        {
+            if (strcmp(type, RULE_TYPE_NAMES[t]) == 0)
+            {
+                rule.type = t;
+            }
+        }
+        rule.target = strcmp(target, "*") == 0 ? -1 : sensors_find_member(sensors, target);
+        if (rule.type == ALARMS_RULE_TYPES || (rule.target < 0 && strcmp(target, "*") != 0))
+        {
+            ESP_LOGE(TAG, "invalid rule type or target: %s", def);
+            count = -1;
+            break;
+        }
+        if (rule.hold_off < 1)
+        {
+            rule.hold_off = 1;
+        }
+        rules[count++] = rule;
+    }
+
+    free(copy);
+    return count;
+}
+
+alarms_t * alarms_compile(const sensors_t * sensors, const char * spec, loss_t * loss)
+{
+    source_rule_t source[ALARMS_MAX_SOURCE_RULES];
+    int num_source = _parse(sensors, spec, source);
+    if (num_source < 0)
+    {
+        return NULL;
+    }
+
+    alarms_t * alarms = calloc(1, sizeof(*alarms));
+    if (alarms == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+
+    // count compiled rules per device, then lay them out grouped by device
+    int total = 0;
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        alarms->first[i] = total;
+        for (int r = 0; r < num_source; ++r)
+        {
+            total += source[r].target < 0 || source[r].target == i;
+        }
+    }
+    for (int i = sensors->num_devices; i <= SENSORS_MAX_DEVICES; ++i)
+    {
+        alarms->first[i] = total;
+    }
+
+    alarms->num_rules = total;
+    alarms->rules = calloc(total > 0 ? total : 1, sizeof(alarms_rule_t));
+    alarms->state = calloc(total > 0 ? total : 1, sizeof(alarms_state_t));
+    alarms->events = xQueueCreate(ALARMS_EVENT_QUEUE_LENGTH, sizeof(alarms_event_t));
+    if (alarms->rules == NULL || alarms->state == NULL || alarms->events == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        free(alarms->rules);
+        free(alarms->state);
+        free(alarms);
+        return NULL;
+    }
+
+    int n = 0;
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        for (int r = 0; r < num_source; ++r)
+        {
+            if (source[r].target < 0 || source[r].target == i)
+            {
+                alarms->rules[n++] = (alarms_rule_t) {
+                    .metric = source[r].type,
+                    .source = r,
+                    .hold_off = source[r].hold_off,
+                    .set = _to_metric(source[r].type, source[r].set),
+                    .clear = _to_metric(source[r].type, source[r].clear),
+                };
+            }
+        }
+    }
+
+    alarms->loss = loss;
+    alarms->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    ESP_LOGI(TAG, "%d rules compiled to %d device rules", num_source, total);
+    return alarms;
+}
+
+void alarms_evaluate(alarms_t * alarms, const sensors_t * sensors, const sensors_frame_t * frame)
+{
+    int64_t start = esp_timer_get_time();
+    uint32_t evaluations = 0;
+    uint32_t dropped = 0;
+    uint32_t queued = 0;
+
+    for (int n = 0; n < frame->count; ++n)
+    {
+        int i = frame->index[n];
+        int64_t now = frame->timestamp[n];
+        bool ok = frame->status[n] == DS18B20_OK;
+        int16_t value = sensors->value[i];
+
+        // compute every metric once; rules then only index into this vector
+        int32_t metric[ALARMS_RULE_TYPES];
+        int64_t dt = now - alarms->last_good[i];
+        bool have_last = alarms->last_good[i] != 0;
+        metric[ALARMS_RULE_HIGH] = value;
+        metric[ALARMS_RULE_LOW] = -value;
+        metric[ALARMS_RULE_RATE] = (ok && have_last && dt > 0) ? (int32_t)llabs((int64_t)(value - alarms->last_value[i]) * 60000000 / dt) : 0;
+        metric[ALARMS_RULE_STALE] = have_last ? (int32_t)((ok ? 0 : dt) / 1000) : 0;
+        alarms->error_rate[i] += ((!ok * 1000 * ERROR_RATE_SCALE) - alarms->error_rate[i]) >> ERROR_RATE_SHIFT;
+        metric[ALARMS_RULE_ERRORS] = alarms->error_rate[i];
+
+        // value-based rules are only evaluated on good readings
+        uint8_t valid = ok ? 0xff : (1 << ALARMS_RULE_STALE) | (1 << ALARMS_RULE_ERRORS);
+
+        for (int r = alarms->first[i]; r < alarms->first[i + 1]; ++r)
+        {
+            const alarms_rule_t * rule = &alarms->rules[r];
+            alarms_state_t * state = &alarms->state[r];
+            int32_t m = metric[rule->metric];
+            bool evaluate = (valid >> rule->metric) & 1;
+
+            // a change is pending if inactive and over the set threshold, or active and under the clear threshold
+            bool pending = evaluate & (state->active ? (m < rule->clear) : (m >= rule->set));
+            state->count = pending ? state->count + 1 : 0;
+            evaluations += evaluate;
+
+            if (state->count >= rule->hold_off)
+            {
+                state->active ^= 1;
+                state->count = 0;
+                alarms_event_t event = {
+                    .timestamp = now,
+                    .device = i,
+                    .source = rule->source,
+                    .metric = rule->metric,
+                    .active = state->active,
+                    .value = m,
+                };
+                if (xQueueSend(alarms->events, &event, 0) == pdTRUE)
+                {
+                    ++queued;
+                }
+                else
+                {
+                    ++dropped;
+                }
+            }
+        }
+
+        if (ok)
+        {
+            alarms->last_value[i] = value;
+            alarms->last_good[i] = now;
+        }
+    }
+
+    if (queued > 0 || dropped > 0)
+    {
+        loss_record(alarms->loss, LOSS_HANDOFF_ALARM, queued, dropped);
+    }
+
+    int64_t elapsed = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&alarms->lock);
+    alarms->evaluations += evaluations;
+    alarms->eval_time += elapsed;
+    portEXIT_CRITICAL(&alarms->lock);
+}
+
+static void _event_task(void * pvParameter)
+{
+    alarms_t * alarms = pvParameter;
+    alarms_event_t event;
+    while (1)
+    {
+        if (xQueueReceive(alarms->events, &event, portMAX_DELAY) == pdTRUE)
+        {
+            ESP_LOGW(TAG, "%s alarm %s: device %u rule %u value %d at %" PRId64 " us",
+                     alarms_rule_type_name(event.metric), event.active ? "raised" : "cleared",
+                     event.device, event.source, (int)event.value, event.timestamp);
+        }
+    }
+}
+
+bool alarms_start(alarms_t * alarms)
+{
+    return xTaskCreate(_event_task, "alarms", TASK_STACK_SIZE, alarms, TASK_PRIORITY, NULL) == pdPASS;
+}
+
+void alarms_print_stats(alarms_t * alarms)
+{
+    portENTER_CRITICAL(&alarms->lock);
+    uint32_t evaluations = alarms->evaluations;
+    int64_t eval_time = alarms->eval_time;
+    alarms->evaluations = 0;
+    alarms->eval_time = 0;
+    portEXIT_CRITICAL(&alarms->lock);
+
+    ESP_LOGI(TAG, "metric alarms rules=%d evaluations=%u eval_us=%" PRId64 " ns_per_rule=%" PRId64,
+             alarms->num_rules, (unsigned int)evaluations, eval_time,
+             evaluations > 0 ? eval_time * 1000 / evaluations : 0);
+}
@@ -0,0 +1,177 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file alarms.h
+ * @brief Rule-based alarms with hysteresis and hold-off, evaluated as readings are processed.
+ *
+ * Rules are compiled into a table grouped by device, so that processing a frame evaluates
+ * only the rules for the devices in it. For each device a small vector of metrics is
+ * computed once (value, negated value, rate of change, age of last good reading, error
+ * rate) and every rule reduces to comparing one metric against its set and clear
+ * thresholds, so evaluation is a table lookup and two comparisons per rule.
+ *
+ * A rule raises an event when its metric has been at or above the set threshold for
+ * hold_off consecutive evaluations, and clears when the metric falls below the clear
+ * threshold for the same number of evaluations. Events are queued as soon as the frame
+ * is evaluated.
+ */
+
+#ifndef ALARMS_H
+#define ALARMS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "sensors.h"
+#include "loss.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ALARMS_MAX_SOURCE_RULES   (32)    ///< Maximum number of rules in a specification
+#define ALARMS_EVENT_QUEUE_LENGTH (32)    ///< Events that can be queued before they are dropped
+
+/**
+ * @brief Rule types. Each selects the metric the rule compares.
+ */
+typedef enum
+{
+    ALARMS_RULE_HIGH = 0,        ///< Reading above a threshold, degrees C
+    ALARMS_RULE_LOW,             ///< Reading below a threshold, degrees C
+    ALARMS_RULE_RATE,            ///< Rate of change above a threshold, degrees C per minute (either direction)
+    ALARMS_RULE_STALE,           ///< No good reading for longer than a threshold, milliseconds
+    ALARMS_RULE_ERRORS,          ///< Smoothed error rate above a threshold, per thousand reads
+    ALARMS_RULE_TYPES,
+} alarms_rule_type_t;
+
+/**
+ * @brief A compiled rule, bound to a single device.
+ */
+typedef struct
+{
+    uint8_t metric;              ///< alarms_rule_type_t
+    uint8_t source;              ///< Index of the rule in the specification
+    uint16_t hold_off;           ///< Consecutive evaluations before changing state
+    int32_t set;                 ///< Metric at or above which the condition is true
+    int32_t clear;               ///< Metric below which the condition is false
+} alarms_rule_t;
+
+/**
+ * @brief Runtime state of a compiled rule.
+ */
+typedef struct
+{
+    uint8_t active;              ///< 1 if the alarm is raised
+    uint16_t count;              ///< Consecutive evaluations pending a state change
+} alarms_state_t;
+
+/**
+ * @brief An alarm being raised or cleared.
+ */
+typedef struct
+{
+    int64_t timestamp;           ///< Time of the reading that caused the change, in microseconds since boot
+    uint16_t device;             ///< Index of the device
+    uint8_t source;              ///< Index of the rule in the specification
+    uint8_t metric;              ///< alarms_rule_type_t
+    bool active;                 ///< True if raised, false if cleared
+    int32_t value;               ///< Metric value at the time of the change, in the rule's internal units
+} alarms_event_t;
+
+/**
+ * @brief Compiled rule table and per-device history.
+ */
+typedef struct
+{
+    int num_rules;                                  ///< Number of compiled rules
+    alarms_rule_t * rules;                          ///< Compiled rules, grouped by device
+    alarms_state_t * state;                         ///< State of each compiled rule
+    uint16_t first[SENSORS_MAX_DEVICES + 1];        ///< Index of each device's first rule
+
+    int16_t last_value[SENSORS_MAX_DEVICES];        ///< Previous good reading, in 1/16 degrees C
+    int64_t last_good[SENSORS_MAX_DEVICES];         ///< Time of previous good reading, in microseconds since boot
+    int32_t error_rate[SENSORS_MAX_DEVICES];        ///< Smoothed error rate, per thousand reads, scaled by 16
+
+    QueueHandle_t events;                           ///< Queue of alarms_event_t
+    loss_t * loss;                                  ///< Loss counters for dropped events, may be NULL
+
+    portMUX_TYPE lock;                              ///< Protects statistics
+    uint32_t evaluations;                           ///< Rule evaluations since start
+    int64_t eval_time;                              ///< Time spent evaluating, in microseconds
+} alarms_t;
+
+/**
+ * @brief Compile a rule specification into a rule table.
+ *
+ * The specification is a semicolon-separated list of rules, each of the form
+ * type:target:set:clear:hold_off, where type is one of high, low, rate, stale or errors,
+ * and target is '*' for all devices or a device reference as accepted by
+ * sensors_find_member(). Thresholds are in degrees C, degrees C per minute, milliseconds
+ * or errors per thousand reads, according to the type. For example:
+ *
+ *     "high:*:30:29.5:3;stale:*:10000:5000:1;rate:0:2:1:2"
+ *
+ * @param[in] sensors Devices to bind rules to.
+ * @param[in] spec Rule specification.
+ * @param[in] loss Loss counters to record dropped events into, may be NULL.
+ * @return Pointer to the new instance, or NULL if the specification is invalid.
+ */
+alarms_t * alarms_compile(const sensors_t * sensors, const char * spec, loss_t * loss);
+
+/**
+ * @brief Evaluate the rules for every device in a processed frame, queueing any events.
+ *
+ * Must be called after sensors_process_frame() for the same frame. Frames with distinct
+ * devices may be evaluated concurrently.
+ */
+void alarms_evaluate(alarms_t * alarms, const sensors_t * sensors, const sensors_frame_t * frame);
+
+/**
+ * @brief Start a task that logs events as they are queued.
+ *
+ * Events may instead be received directly from alarms->events by another consumer.
+ * @return True if the task was created.
+ */
+bool alarms_start(alarms_t * alarms);
+
+/**
+ * @brief Log the number of rule evaluations and the time spent on them since the last call.
+ */
+void alarms_print_stats(alarms_t * alarms);
+
+/**
+ * @brief Return a short name for a rule type, for output.
+ */
+const char * alarms_rule_type_name(alarms_rule_type_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ALARMS_H
@@ -22,55 +22,295 @@
  * SOFTWARE.
  */
 
+#include <inttypes.h>
+#include <string.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "owb.h"
 #include "owb_rmt.h"
+#include "ds2482.h"
+#include "rmt_share.h"
 #include "ds18b20.h"
 
-#define GPIO_DS18B20_0       (CONFIG_ONE_WIRE_GPIO)
-#define MAX_DEVICES          (8)
-#define DS18B20_RESOLUTION   (DS18B20_RESOLUTION_12_BIT)
-#define SAMPLE_PERIOD        (1000)   // milliseconds
+#include "sensors.h"
 
-_Noreturn void app_main()
+#include "sampler.h"
+#include "postproc.h"
+#include "loss.h"
+#include "logical_id.h"
+#include "capacity.h"
+#include "governor.h"
+#include "network.h"
+#include "modbus.h"
+#include "web.h"
+#include "stream.h"
+#include "zones.h"
+#include "alarms.h"
+#include "settings.h"
+#include "history.h"
+#include "console.h"
+#include "retention.h"
+#include "energy.h"
+#include "quantiles.h"
+#include "resample.h"
+#include "autotune.h"
+#include "benchmark.h"
+#include "uplink.h"
+
+#define MAX_DEVICES          (SENSORS_MAX_DEVICES)
+
+static const char * TAG = "app";
+
+typedef struct
 {
-    // Override global log level
-    esp_log_level_set("*", ESP_LOG_INFO);
+    sensors_t * sensors;
+    postproc_t * postproc;
+    loss_t loss;
+    modbus_t * modbus;
+    stream_t * stream;
+    zones_t * zones;
+    alarms_t * alarms;
+    history_t * history;
+    retention_t * retention;
+    energy_t * energy;
+    quantiles_t * quantiles;
+    resample_t * resample;
+    autotune_t * autotune;
+    uplink_t * uplink;
+} app_context_t;
 
-    // To debug, use 'make menuconfig' to set default Log level to DEBUG, then uncomment:
-    //esp_log_level_set("owb", ESP_LOG_DEBUG);
-    //esp_log_level_set("ds18b20", ESP_LOG_DEBUG);
+// Runs in the sampling task: hand each bus's readings over to post-processing
+static void on_bus_sampled(void * context, int bus, uint32_t cycle)
+{
+    app_context_t * app = context;
+    postproc_submit_bus(app->postproc, app->sensors, bus, cycle);
+}
 
-    // Stable readings require a brief period before communication
-    vTaskDelay(2000.0 / portTICK_PERIOD_MS);
+// Runs in a post-processing worker, concurrently with other frames
+static void process_frame(void * context, const sensors_frame_t * frame, sensors_summary_t * summary)
+{
+    app_context_t * app = context;
+    int64_t start = esp_timer_get_time();
+    sensors_process_frame(app->sensors, frame, summary);
+    if (app->alarms != NULL)
+    {
+        alarms_evaluate(app->alarms, app->sensors, frame);
+    }
+    if (app->quantiles != NULL)
+    {
+        quantiles_add_frame(app->quantiles, app->sensors, frame);
+    }
+    if (app->resample != NULL)
+    {
+        resample_add_frame(app->resample, app->sensors, frame);
+    }
+    if (app->autotune != NULL)
+    {
+        autotune_add_frame(app->autotune, app->sensors, frame);
+    }
+    if (app->energy != NULL)
+    {
+        energy_add_cpu_time(app->energy, esp_timer_get_time() - start);
+    }
+}
+
+// Print the failed reads on each bus that has had any, by cause
+static void print_faults(sensors_t * sensors)
+{
+    for (int b = 0; b < sensors->num_buses; ++b)
+    {
+        uint32_t counts[SENSORS_FAULT_COUNT];
+        sensors_bus_faults(sensors, b, counts);
+        int printed = 0;
+        for (int f = 0; f < SENSORS_FAULT_COUNT; ++f)
+        {
+            if (counts[f] > 0)
+            {
+                if (printed++ == 0)
+                {
+                    printf("  bus %d faults:", b);
+                }
+                printf(" %s %u", sensors_fault_name(f), (unsigned int)counts[f]);
+            }
+        }
+        if (printed > 0)
+        {
+            printf("\n");
+        }
+    }
+}
+
+// Runs in a post-processing worker, once all frames of a cycle are processed
+static void process_cycle(void * context, uint32_t cycle, const sensors_summary_t * summary, const sensors_snapshot_t * snapshot)
+{
+    app_context_t * app = context;
+    int64_t start = esp_timer_get_time();
+    zone_result_t zone_results[ZONES_MAX];
+    if (app->zones != NULL)
+    {
+        zones_complete(app->zones, snapshot);
+        zones_snapshot(app->zones, zone_results);
+    }
+
+    if (app->modbus != NULL)
+    {
+        modbus_update(app->modbus, app->sensors, snapshot, summary);
+        if (app->zones != NULL)
+        {
+            modbus_update_zones(app->modbus, zone_results, app->zones->num_zones);
+        }
+    }
+#ifdef CONFIG_WEB_STREAM
+    if (app->stream != NULL)
+    {
+        stream_publish(app->stream, app->sensors, snapshot);
+    }
+#endif
+
+    if (app->resample != NULL)
+    {
+        resample_emit(app->resample, esp_timer_get_time());
+    }
+    else if (app->history != NULL)
+    {
+        history_append(app->history, snapshot);
+    }
+#ifdef CONFIG_UPLINK
+    if (app->uplink != NULL)
+    {
+        // retained cycles are acknowledged as the uplink delivers them
+        if (app->retention != NULL)
+        {
+            retention_ack_through(app->retention, uplink_delivered_cycle(app->uplink));
+        }
+        uplink_add_cycle(app->uplink, snapshot);
+    }
+#endif
+    if (app->retention != NULL)
+    {
+        retention_store(app->retention, snapshot);
+    }
+    if (app->quantiles != NULL)
+    {
+        quantiles_roll(app->quantiles, esp_timer_get_time());
+    }
+
+    sensors_print(app->sensors, cycle);
+    if (app->zones != NULL)
+    {
+        zones_print(app->zones);
+    }
+    if (app->alarms != NULL)
+    {
+        alarms_print_stats(app->alarms);
+    }
+
+    loss_counter_t counters[LOSS_HANDOFF_COUNT];
+    loss_snapshot(&app->loss, counters);
+    for (int h = 0; h < LOSS_HANDOFF_COUNT; ++h)
+    {
+        if (counters[h].dropped > 0)
+        {
+            printf("  lost at %s: %u of %u\n", loss_handoff_name(h), (unsigned int)counters[h].dropped,
+                   (unsigned int)(counters[h].passed + counters[h].dropped));
+        }
+    }
+    print_faults(app->sensors);
+
+    if (app->energy != NULL)
+    {
+        energy_add_cpu_time(app->energy, esp_timer_get_time() - start);
+    }
+}
+
+// Runs in a post-processing worker, with each grid point of the aligned readings
+static void on_resampled(void * context, const resample_frame_t * frame)
+{
+    app_context_t * app = context;
+    if (app->history != NULL)
+    {
+        history_append_values(app->history, frame->index, app->history->time_offset_ms + (uint32_t)(frame->time / 1000),
+                              frame->values, frame->num_devices);
+    }
+    if (frame->late > 0)
+    {
+        ESP_LOGD(TAG, "grid point %u: %d devices late", (unsigned int)frame->index, frame->late);
+    }
+}
 
-    // Create a 1-Wire bus, using the RMT timeslot driver
-    OneWireBus * owb;
-    owb_rmt_driver_info rmt_driver_info;
-    owb = owb_rmt_initialize(&rmt_driver_info, GPIO_DS18B20_0, RMT_CHANNEL_1, RMT_CHANNEL_0);
-    owb_use_crc(owb, true);  // enable CRC check for ROM code
+// Deliver a cycle retained from before a reboot, ahead of any new readings
+static void replay_cycle(void * context, uint32_t cycle, uint32_t time_ms, const int16_t * values, int num_devices)
+{
+    app_context_t * app = context;
+    if (app->history != NULL)
+    {
+        history_append_values(app->history, cycle, time_ms, values, num_devices);
+    }
+#ifdef CONFIG_UPLINK
+    if (app->uplink != NULL)
+    {
+        uplink_add_values(app->uplink, cycle, time_ms, values, num_devices);
+    }
+#endif
+}
 
+// Warn if the timing model predicts that the devices found cannot all be sampled within the period
+static void check_capacity(const sensors_t * sensors, uint32_t period_ms, DS18B20_RESOLUTION resolution)
+{
+    int devices_per_bus[SENSORS_MAX_BUSES] = { 0 };
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        ++devices_per_bus[sensors->bus[i]];
+    }
+
+    capacity_mode_t mode = { .resolution = resolution, .use_crc = true };
+    uint32_t cycle_us = capacity_cycle_time_us(&mode, devices_per_bus, sensors->num_buses);
+    uint32_t period_us = period_ms * 1000;
+    if (cycle_us > period_us)
+    {
+        ESP_LOGW(TAG, "estimated cycle time %u ms exceeds sample period %u ms: at most %d devices can be sampled",
+                 (unsigned int)(cycle_us / 1000), (unsigned int)period_ms,
+                 capacity_max_devices_per_controller(&mode, period_us, sensors->num_buses));
+    }
+    else
+    {
+        ESP_LOGI(TAG, "estimated cycle time %u ms of %u ms sample period",
+                 (unsigned int)(cycle_us / 1000), (unsigned int)period_ms);
+    }
+}
+
+// Search a bus for devices and add them to the sensor set. Returns the number of devices found.
+static int add_bus_devices(sensors_t * sensors, OneWireBus * owb, const settings_t * settings)
+{
     // Find all connected devices
     printf("Find devices:\n");
-    OneWireBus_ROMCode device_rom_codes[MAX_DEVICES] = {0};
+    static OneWireBus_ROMCode device_rom_codes[MAX_DEVICES];    // too large for the main task's stack
+    int max_devices = MAX_DEVICES - sensors->num_devices;
     int num_devices = 0;
     OneWireBus_SearchState search_state = {0};
     bool found = false;
-    owb_search_first(owb, &search_state, &found);
-    while (found)
+    // bridge buses search with the triplet command, which needs far fewer I2C transactions
+    bool bridge = ds2482_is_bus(owb);
+    owb_status (*search_first)(const OneWireBus *, OneWireBus_SearchState *, bool *) = bridge ? ds2482_search_first : owb_search_first;
+    owb_status (*search_next)(const OneWireBus *, OneWireBus_SearchState *, bool *) = bridge ? ds2482_search_next : owb_search_next;
+    int64_t search_start = esp_timer_get_time();
+    search_first(owb, &search_state, &found);
+    while (found && num_devices < max_devices)
     {
         char rom_code_s[17];
         owb_string_from_rom_code(search_state.rom_code, rom_code_s, sizeof(rom_code_s));
         printf("  %d : %s\n", num_devices, rom_code_s);
         device_rom_codes[num_devices] = search_state.rom_code;
         ++num_devices;
-        owb_search_next(owb, &search_state, &found);
+        search_next(owb, &search_state, &found);
     }
-    printf("Found %d device%s\n", num_devices, num_devices == 1 ? "" : "s");
+    printf("Found %d device%s in %" PRId64 " us\n", num_devices, num_devices == 1 ? "" : "s",
+           esp_timer_get_time() - search_start);
 
     // In this example, if a single device is present, then the ROM code is probably
     // not very interesting, so just print it out. If there are multiple devices,
@@ -92,15 +332,10 @@ _Noreturn void app_main()
             printf("An error occurred reading ROM code: %d", status);
         }
     }
-    else
+    else if (settings->has_known_device)
     {
-        // Search for a known ROM code (LSB first):
-        // For example: 0x1502162ca5b2ee28
-        OneWireBus_ROMCode known_device = {
-            .fields.family = { 0x28 },
-            .fields.serial_number = { 0xee, 0xb2, 0xa5, 0x2c, 0x16, 0x02 },
-            .fields.crc = { 0x15 },
-        };
+        // Search for a known ROM code
+        OneWireBus_ROMCode known_device = settings->known_device;
         char rom_code_s[OWB_ROM_CODE_STRING_LENGTH];
         owb_string_from_rom_code(known_device, rom_code_s, sizeof(rom_code_s));
         bool is_present = false;
@@ -116,24 +351,197 @@ _Noreturn void app_main()
         }
     }
 
+    // Check for parasitic-powered devices, before commissioning writes to their EEPROM
+    bool parasitic_power = false;
+    ds18b20_check_for_parasite_power(owb, &parasitic_power);
+    if (parasitic_power) {
+        printf("Parasitic-powered devices detected");
+    }
+
+    // In parasitic-power mode, devices cannot indicate when conversions are complete,
+    // so waiting for a temperature conversion must be done by waiting a prescribed duration
+    owb_use_parasitic_power(owb, parasitic_power);
+
     // Create DS18B20 devices on the 1-Wire bus
-    DS18B20_Info * devices[MAX_DEVICES] = {0};
+    int bus = sensors_add_bus(sensors, owb);
+    if (bus < 0)
+    {
+        printf("Too many buses\n");
+        return 0;
+    }
+    if (num_devices == 1)
+    {
+        printf("Single device optimisations enabled\n");
+    }
     for (int i = 0; i < num_devices; ++i)
     {
-        DS18B20_Info * ds18b20_info = ds18b20_malloc();  // heap allocation
-        devices[i] = ds18b20_info;
+        bool solo = num_devices == 1;
+        char rom_code_s[OWB_ROM_CODE_STRING_LENGTH];
+        owb_string_from_rom_code(device_rom_codes[i], rom_code_s, sizeof(rom_code_s));
+        const settings_device_t * device = settings_find_device(settings, rom_code_s);
+        DS18B20_RESOLUTION resolution = settings->resolution;
+        if (device != NULL && device->resolution != DS18B20_RESOLUTION_INVALID)
+        {
+            resolution = device->resolution;
+        }
 
-        if (num_devices == 1)
+        int index = sensors_add_device(sensors, bus, device_rom_codes[i], solo, resolution);
+        if (index < 0)
         {
-            printf("Single device optimisations enabled\n");
-            ds18b20_init_solo(ds18b20_info, owb);          // only one device on bus
+            continue;
         }
-        else
+        if (device != NULL)
+        {
+            sensors_set_label(sensors, index, device->name, device->calibration);
+        }
+
+#ifdef CONFIG_LOGICAL_ID_COMMISSION
+        // Assign logical IDs in search order, and store them in the devices' EEPROM
+        owb_status commission_status = logical_id_write(owb, device_rom_codes[i], solo, (uint16_t)index, resolution);
+        printf("Commission device %d as logical ID %d: %s\n", i, index, commission_status == OWB_STATUS_OK ? "ok" : "failed");
+#endif
+
+#ifdef CONFIG_LOGICAL_IDS
+        // Recover the device's logical ID from its scratchpad
+        uint16_t id = SENSORS_NO_LOGICAL_ID;
+        owb_status id_status = logical_id_read(owb, device_rom_codes[i], solo, &id);
+        if (id_status != OWB_STATUS_OK || !sensors_set_logical_id(sensors, index, id))
+        {
+            printf("Device %d has no valid logical ID (status %d, TH/TL 0x%04x)\n", i, id_status, id);
+        }
+#endif
+
+        // An ID in the settings takes precedence over one stored in the device
+        if (device != NULL && device->logical_id != SENSORS_NO_LOGICAL_ID
+            && !sensors_set_logical_id(sensors, index, device->logical_id))
         {
-            ds18b20_init(ds18b20_info, owb, device_rom_codes[i]); // associate with bus and device
+            printf("Device %d cannot take logical ID %d from settings\n", i, device->logical_id);
         }
-        ds18b20_use_crc(ds18b20_info, true);           // enable CRC check on all reads
-        ds18b20_set_resolution(ds18b20_info, DS18B20_RESOLUTION);
+    }
+
+    return num_devices;
+}
+
+#ifdef CONFIG_DS2482
+// Configure the I2C master and reset the DS2482 bridge on it
+static bool start_ds2482(ds2482_t * ds2482)
+{
+    i2c_config_t i2c_config = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = CONFIG_DS2482_SDA_GPIO,
+        .scl_io_num = CONFIG_DS2482_SCL_GPIO,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = CONFIG_DS2482_I2C_FREQUENCY,
+    };
+    if (i2c_param_config(CONFIG_DS2482_I2C_PORT, &i2c_config) != ESP_OK
+        || i2c_driver_install(CONFIG_DS2482_I2C_PORT, I2C_MODE_MASTER, 0, 0, 0) != ESP_OK)
+    {
+        printf("Failed to start I2C port %d\n", CONFIG_DS2482_I2C_PORT);
+        return false;
+    }
+    return ds2482_init_chip(ds2482, CONFIG_DS2482_I2C_PORT, CONFIG_DS2482_ADDRESS, CONFIG_DS2482_BUSES);
+}
+#endif
+
+_Noreturn void app_main()
+{
+    // Override global log level
+    esp_log_level_set("*", ESP_LOG_INFO);
+
+    // To debug, use 'idf.py menuconfig' to set default Log level to DEBUG, then uncomment:
+    //esp_log_level_set("owb", ESP_LOG_DEBUG);
+    //esp_log_level_set("ds18b20", ESP_LOG_DEBUG);
+    //esp_log_level_set("sampler", ESP_LOG_DEBUG);
+
+    // Stable readings require a brief period before communication
+    vTaskDelay(2000.0 / portTICK_PERIOD_MS);
+
+    // Runtime settings are parsed into static tables, before anything else is allocated
+    static settings_t settings;
+    if (!settings_load(&settings))
+    {
+        printf("Invalid stored settings, using defaults\n");
+    }
+
+    sensors_t * sensors = sensors_malloc();  // heap allocation
+    if (sensors == NULL)
+    {
+        printf("Failed to allocate sensor state\n");
+        esp_restart();
+    }
+
+    // Create the 1-Wire buses, using the RMT timeslot driver or a DS2482 bridge.
+    // Each RMT bus uses its own pair of RMT channels while pairs remain, and any
+    // further RMT buses share the next pair, re-routed to each bus as it is accessed.
+    // State that lives as long as the application is static, to keep the main task's stack small.
+    OneWireBus * owb[SETTINGS_MAX_BUSES];
+    static owb_rmt_driver_info rmt_driver_info[SETTINGS_MAX_RMT_PAIRS];
+    static rmt_share_t rmt_share;
+    static rmt_share_bus_t rmt_share_info[SETTINGS_MAX_BUSES];
+    bool rmt_shared = false;
+#ifdef CONFIG_DS2482
+    static ds2482_t ds2482;
+    static ds2482_driver_info ds2482_info[DS2482_MAX_CHANNELS];
+    bool have_ds2482 = start_ds2482(&ds2482);
+#endif
+    int num_rmt_buses = 0;
+    for (int b = 0; b < settings.num_buses; ++b)
+    {
+        num_rmt_buses += settings.buses[b].type == SETTINGS_BUS_RMT;
+    }
+#ifdef CONFIG_RMT_SHARED
+    int num_dedicated = 0;
+#else
+    int num_dedicated = num_rmt_buses > SETTINGS_MAX_RMT_PAIRS ? SETTINGS_MAX_RMT_PAIRS - 1 : num_rmt_buses;
+#endif
+    int r = 0;
+    int num_devices = 0;
+    for (int b = 0; b < settings.num_buses; ++b)
+    {
+        const settings_bus_t * bus = &settings.buses[b];
+        owb[b] = NULL;
+        if (bus->type == SETTINGS_BUS_RMT && r < num_dedicated)
+        {
+            printf("Bus %d on GPIO %d\n", b, bus->pin);
+            owb[b] = owb_rmt_initialize(&rmt_driver_info[r], bus->pin, (rmt_channel_t)(2 * r + 1), (rmt_channel_t)(2 * r));
+            ++r;
+        }
+        else if (bus->type == SETTINGS_BUS_RMT)
+        {
+            printf("Bus %d on GPIO %d, sharing RMT channels %d and %d\n", b, bus->pin, 2 * r + 1, 2 * r);
+            if (!rmt_shared)
+            {
+                rmt_shared = rmt_share_init(&rmt_share, bus->pin, (rmt_channel_t)(2 * r + 1), (rmt_channel_t)(2 * r));
+            }
+            if (rmt_shared)
+            {
+                owb[b] = rmt_share_initialize(&rmt_share_info[b], &rmt_share, bus->pin);
+            }
+        }
+#ifdef CONFIG_DS2482
+        else if (bus->type == SETTINGS_BUS_DS2482 && have_ds2482)
+        {
+            printf("Bus %d on DS2482 channel %d\n", b, bus->pin);
+            owb[b] = ds2482_initialize(&ds2482_info[bus->pin], &ds2482, bus->pin);
+        }
+#endif
+        if (owb[b] == NULL)
+        {
+            printf("Bus %d is not available\n", b);
+            continue;
+        }
+        owb_use_crc(owb[b], true);  // enable CRC check for ROM code
+#ifdef CONFIG_ENABLE_STRONG_PULLUP_GPIO
+        // An external pull-up circuit is used to supply extra current to OneWireBus devices
+        // during temperature conversions and EEPROM writes. There is one circuit, on the first bus,
+        // and it is attached before devices are added so that commissioning can use it.
+        if (b == 0)
+        {
+            owb_use_strong_pullup_gpio(owb[b], CONFIG_STRONG_PULLUP_GPIO);
+        }
+#endif
+        num_devices += add_bus_devices(sensors, owb[b], &settings);
     }
 
 //    // Read temperatures from all sensors sequentially
@@ -142,67 +550,219 @@ _Noreturn void app_main()
 //        printf("\nTemperature readings (degrees C):\n");
 //        for (int i = 0; i < num_devices; ++i)
 //        {
-//            float temp = ds18b20_get_temp(devices[i]);
+//            float temp = ds18b20_get_temp(sensors->cold[i].info);
 //            printf("  %d: %.3f\n", i, temp);
 //        }
 //        vTaskDelay(1000 / portTICK_PERIOD_MS);
 //    }
 
-    // Check for parasitic-powered devices
-    bool parasitic_power = false;
-    ds18b20_check_for_parasite_power(owb, &parasitic_power);
-    if (parasitic_power) {
-        printf("Parasitic-powered devices detected");
-    }
+    // Read temperatures more efficiently by starting conversions on all devices on a bus at the same time.
+    // All buses are driven from this task: while one bus is converting, others can be read.
+    if (num_devices > 0)
+    {
+        check_capacity(sensors, settings.period_ms, settings.resolution);
+#ifdef CONFIG_BENCHMARK
+        benchmark_run(sensors, CONFIG_BENCHMARK_CYCLES);
+#endif
 
-    // In parasitic-power mode, devices cannot indicate when conversions are complete,
-    // so waiting for a temperature conversion must be done by waiting a prescribed duration
-    owb_use_parasitic_power(owb, parasitic_power);
+        static app_context_t app;
+        app.sensors = sensors;
+        loss_init(&app.loss);
 
-#ifdef CONFIG_ENABLE_STRONG_PULLUP_GPIO
-    // An external pull-up circuit is used to supply extra current to OneWireBus devices
-    // during temperature conversions.
-    owb_use_strong_pullup_gpio(owb, CONFIG_STRONG_PULLUP_GPIO);
+        // Aggregate groups of devices into zones
+        if (strlen(settings.zones) > 0)
+        {
+            app.zones = zones_malloc();
+            if (app.zones != NULL && zones_parse(app.zones, sensors, settings.zones) < 0)
+            {
+                printf("Invalid zone definitions: %s\n", settings.zones);
+            }
+        }
+
+        // Compile alarm rules against the devices found
+        if (strlen(settings.alarms) > 0)
+        {
+            app.alarms = alarms_compile(sensors, settings.alarms, &app.loss);
+            if (app.alarms == NULL)
+            {
+                printf("Invalid alarm rules: %s\n", settings.alarms);
+            }
+            else
+            {
+                alarms_start(app.alarms);
+            }
+        }
+
+#ifdef CONFIG_NETWORK
+        network_start();
 #endif
 
-    // Read temperatures more efficiently by starting conversions on all devices at the same time
-    int errors_count[MAX_DEVICES] = {0};
-    int sample_count = 0;
-    if (num_devices > 0)
-    {
-        TickType_t last_wake_time = xTaskGetTickCount();
+#ifdef CONFIG_WEB_SERVER
+        httpd_handle_t web_server = web_start(CONFIG_WEB_SERVER_PORT);
+#endif
+#ifdef CONFIG_WEB_STREAM
+        // Live view of all devices, streamed to browsers over a WebSocket
+        app.stream = stream_malloc(web_server);
+#endif
 
-        while (1)
+#ifdef CONFIG_HISTORY
+        // Keep recent readings for queries over HTTP and the console
+        app.history = history_malloc(sensors, CONFIG_HISTORY_BLOCKS, CONFIG_HISTORY_INTERVAL);
+#ifdef CONFIG_WEB_SERVER
+        history_serve(app.history, web_server);
+#endif
+#endif
+
+#ifdef CONFIG_QUANTILES
+        // Sketch the distribution of each device's readings over long windows
+        app.quantiles = quantiles_malloc(sensors, CONFIG_QUANTILES_WINDOW);
+#endif
+
+#ifdef CONFIG_RESAMPLE
+        // Align all devices on a common time grid
+#ifdef CONFIG_RESAMPLE_HOLD
+        resample_mode_t resample_mode = RESAMPLE_HOLD;
+#else
+        resample_mode_t resample_mode = RESAMPLE_LINEAR;
+#endif
+        app.resample = resample_malloc(sensors, resample_mode, CONFIG_RESAMPLE_STEP, CONFIG_RESAMPLE_LATENCY, on_resampled, &app);
+#endif
+
+#ifdef CONFIG_AUTOTUNE
+        // Read slowly changing devices less often
+        app.autotune = autotune_malloc(sensors, CONFIG_AUTOTUNE_MAX_PERIODS, CONFIG_AUTOTUNE_TOLERANCE);
+#endif
+
+#ifdef CONFIG_UPLINK
+        // Forward every cycle to a collector, holding blocks in RAM through network outages
+        app.uplink = uplink_malloc(sensors, CONFIG_UPLINK_URL, CONFIG_UPLINK_BATCH, CONFIG_UPLINK_QUEUE_SIZE, CONFIG_UPLINK_RATE);
+#endif
+
+#ifdef CONFIG_RETENTION
+        // Recover cycles not yet delivered before the last reset, then continue the time scale from them
+        static retention_t retention;
+        app.retention = &retention;
+        if (retention_init(&retention, sensors))
+        {
+            printf("Recovered %d cycles from before reset\n", retention_replay(&retention, replay_cycle, &app));
+        }
+        if (app.uplink == NULL)
+        {
+            retention_ack(&retention);    // otherwise acknowledged as the uplink delivers them
+        }
+        if (app.history != NULL)
+        {
+            app.history->time_offset_ms = retention.time_offset_ms;
+        }
+        if (app.uplink != NULL)
+        {
+            app.uplink->time_offset_ms = retention.time_offset_ms;
+        }
+#endif
+#ifdef CONFIG_UPLINK
+        if (app.uplink != NULL && !uplink_start(app.uplink))
         {
-            ds18b20_convert_all(owb);
+            printf("Failed to start uplink\n");
+        }
+#endif
 
-            // In this application all devices use the same resolution,
-            // so use the first device to determine the delay
-            ds18b20_wait_for_conversion(devices[0]);
+#if defined(CONFIG_MODBUS_TCP) || defined(CONFIG_MODBUS_RTU)
+        // Serve the most recent readings to Modbus clients from a preformatted register map
+        app.modbus = modbus_malloc();
+#endif
+#ifdef CONFIG_MODBUS_TCP
+        modbus_start_tcp(app.modbus, settings.modbus_tcp_port);
+#endif
+#ifdef CONFIG_MODBUS_RTU
+        static const modbus_rtu_config_t rtu_config = {
+            .uart_num = CONFIG_MODBUS_RTU_UART,
+            .baud_rate = CONFIG_MODBUS_RTU_BAUD_RATE,
+            .tx_gpio = CONFIG_MODBUS_RTU_TX_GPIO,
+            .rx_gpio = CONFIG_MODBUS_RTU_RX_GPIO,
+            .rts_gpio = CONFIG_MODBUS_RTU_RTS_GPIO,
+            .address = CONFIG_MODBUS_RTU_ADDRESS,
+        };
+        modbus_start_rtu(app.modbus, &rtu_config);
+#endif
 
-            // Read the results immediately after conversion otherwise it may fail
-            // (using printf before reading may take too long)
-            float readings[MAX_DEVICES] = { 0 };
-            DS18B20_ERROR errors[MAX_DEVICES] = { 0 };
+        // Post-processing and printing happen in worker tasks, after all have been read
+        // (using printf before reading may take too long)
+        postproc_config_t postproc_config = {
+            .num_workers = CONFIG_POSTPROC_WORKERS,
+            .num_frames = CONFIG_POSTPROC_FRAMES,
+            .frame_fn = process_frame,
+            .cycle_fn = process_cycle,
+            .context = &app,
+            .sensors = sensors,
+            .loss = &app.loss,
+        };
+        app.postproc = postproc_malloc(&postproc_config);
+        if (app.postproc == NULL)
+        {
+            printf("Failed to start post-processing\n");
+            esp_restart();
+        }
 
-            for (int i = 0; i < num_devices; ++i)
-            {
-                errors[i] = ds18b20_read_temp(devices[i], &readings[i]);
-            }
+#ifdef CONFIG_ENERGY
+        // Account for the energy spent on each cycle, including post-processing
+        static energy_t energy;
+        energy_init(&energy);
+        app.energy = &energy;
+#endif
+
+        static sampler_t sampler;
+        sampler_init(&sampler, sensors, settings.period_ms);
+        sampler_set_bus_callback(&sampler, on_bus_sampled, &app);
+#ifdef CONFIG_RETENTION
+        sampler.cycle = retention_last_cycle(&retention) + 1;    // cycle numbers continue across resets
+#endif
+#ifdef CONFIG_CONSOLE
+        console_start(app.history, &sampler, app.quantiles);
+#endif
 
-            // Print results in a separate loop, after all have been read
-            printf("\nTemperature readings (degrees C): sample %d\n", ++sample_count);
-            for (int i = 0; i < num_devices; ++i)
+#ifdef CONFIG_GOVERNOR
+        // Degrade sampling settings automatically if cycles overrun the period
+        static governor_t governor;
+        static const governor_config_t governor_config = {
+#ifdef CONFIG_GOVERNOR_POLICY_FIDELITY
+            .policy = GOVERNOR_POLICY_FIDELITY,
+#else
+            .policy = GOVERNOR_POLICY_PERIOD,
+#endif
+            .budget_percent = CONFIG_GOVERNOR_BUDGET_PERCENT,
+            .max_period_ms = CONFIG_GOVERNOR_MAX_PERIOD,
+            .min_resolution = DS18B20_RESOLUTION_9_BIT,
+#ifdef CONFIG_ENERGY
+            .power_budget_mw = CONFIG_POWER_BUDGET_MW,
+#endif
+        };
+        governor_init(&governor, &governor_config, &sampler, sensors, settings.period_ms, true);
+#endif
+
+        while (1)
+        {
+            if (sampler_step(&sampler))
             {
-                if (errors[i] != DS18B20_OK)
+                postproc_close_cycle(app.postproc, sampler.cycle - 1);
+#ifdef CONFIG_ENERGY
+#ifdef CONFIG_NETWORK
+                energy_update(&energy, &sampler, network_is_connected());
+#else
+                energy_update(&energy, &sampler, false);
+#endif
+#endif
+#ifdef CONFIG_GOVERNOR
+#ifdef CONFIG_ENERGY
+                governor_report_power(&governor, energy.power_mw);
+#endif
+                governor_update(&governor);
+#endif
+                if (rmt_shared)
                 {
-                    ++errors_count[i];
+                    rmt_share_print_stats(&rmt_share);
                 }
-
-                printf("  %d: %.1f    %d errors\n", i, readings[i], errors_count[i]);
             }
-
-            vTaskDelayUntil(&last_wake_time, SAMPLE_PERIOD / portTICK_PERIOD_MS);
+            sampler_wait(&sampler);
         }
     }
     else
@@ -211,11 +771,18 @@ _Noreturn void app_main()
     }
 
     // clean up dynamically allocated data
-    for (int i = 0; i < num_devices; ++i)
+    sensors_free(&sensors);
+    for (int b = 0; b < settings.num_buses; ++b)
+    {
+        if (owb[b] != NULL)
+        {
+            owb_uninitialize(owb[b]);
+        }
+    }
+    if (rmt_shared)
     {
-        ds18b20_free(&devices[i]);
+        rmt_share_free(&rmt_share);
     }
-    owb_uninitialize(owb);
 
     printf("Restarting now.\n");
     fflush(stdout);
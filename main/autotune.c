@@ -0,0 +1,127 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "esp_log.h"
+
+#include "autotune.h"
+
+#define STABLE_READINGS      (8)       // consecutive readings within tolerance before lengthening a period
+#define RATE_SHIFT           (3)       // smoothing of the rate of change, as a power of two
+#define RATE_SCALE           (16)      // rate is in 1/16 reading steps
+#define US_PER_MINUTE        (60000000LL)
+
+static const char * TAG = "autotune";
+
+autotune_t * autotune_malloc(const sensors_t * sensors, int max_periods, int16_t tolerance)
+{
+    autotune_t * autotune = calloc(1, sizeof(*autotune));
+    if (autotune != NULL)
+    {
+        autotune->devices = calloc(sensors->num_devices, sizeof(autotune_device_t));
+        if (autotune->devices == NULL)
+        {
+            free(autotune);
+            autotune = NULL;
+        }
+    }
+    if (autotune == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+
+    int max_divisor = 1;
+    while (max_divisor * 2 <= max_periods && max_divisor * 2 <= AUTOTUNE_MAX_DIVISOR)
+    {
+        max_divisor *= 2;
+    }
+    autotune->num_devices = sensors->num_devices;
+    autotune->max_divisor = (uint8_t)max_divisor;
+    autotune->tolerance = tolerance;
+    return autotune;
+}
+
+// Choose the divisor for a device after a good reading, given the change since the previous one
+static int _tune(const autotune_t * autotune, autotune_device_t * device, int divisor, int32_t change, int64_t dt, int32_t tolerance)
+{
+    if (change > tolerance)
+    {
+        device->stable = 0;
+        return change > 4 * tolerance ? 1 : (divisor > 1 ? divisor / 2 : 1);
+    }
+
+    if (++device->stable < STABLE_READINGS || divisor >= autotune->max_divisor)
+    {
+        return divisor;
+    }
+
+    // change expected over twice the current interval, in 1/16 degrees C
+    int64_t predicted = (int64_t)device->rate * 2 * dt / (US_PER_MINUTE * RATE_SCALE);
+    if (2 * predicted <= tolerance)
+    {
+        device->stable = 0;
+        return divisor * 2;
+    }
+    return divisor;
+}
+
+void autotune_add_frame(autotune_t * autotune, sensors_t * sensors, const sensors_frame_t * frame)
+{
+    for (int n = 0; n < frame->count; ++n)
+    {
+        int i = frame->index[n];
+        if (frame->status[n] != DS18B20_OK || i >= autotune->num_devices)
+        {
+            continue;
+        }
+
+        autotune_device_t * device = &autotune->devices[i];
+        int16_t value = sensors->value[i];
+        int64_t now = frame->timestamp[n];
+        int64_t dt = now - device->last_time;
+        if (device->last_time != 0 && dt > 0)
+        {
+            int32_t change = abs(value - device->last_value);
+            int32_t rate = (int32_t)(change * RATE_SCALE * US_PER_MINUTE / dt);
+            device->rate += (rate - device->rate) >> RATE_SHIFT;
+
+            // a single step of the device's resolution is always within tolerance
+            int32_t step = 1 << (DS18B20_RESOLUTION_12_BIT - sensors->cold[i].resolution);
+            int32_t tolerance = autotune->tolerance > step ? autotune->tolerance : step;
+
+            int divisor = sensors->target_divisor[i];
+            int tuned = _tune(autotune, device, divisor, change, dt, tolerance);
+            if (tuned != divisor)
+            {
+                sensors->target_divisor[i] = (uint8_t)tuned;
+                ESP_LOGI(TAG, "metric autotune device=%d divisor=%d rate=%.4f", i, tuned,
+                         (float)device->rate / (16.0f * RATE_SCALE));
+            }
+        }
+        device->last_time = now;
+        device->last_value = value;
+    }
+}
@@ -0,0 +1,99 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file autotune.h
+ * @brief Automatic per-device sample periods, from the observed rate of change of each device.
+ *
+ * Every device starts by being read every cycle. A device whose readings change slowly, such as
+ * a probe in a large thermal mass, is read every 2, 4, 8... cycles, up to a maximum, so the bus
+ * time spent on it falls while the change between successive readings stays within a tolerance.
+ *
+ * For each device a smoothed rate of change is kept. After several consecutive readings within
+ * the tolerance, the period doubles if the change predicted over the doubled period is at most
+ * half the tolerance. As soon as a reading moves by more than the tolerance the period halves,
+ * and a large step returns the device to every cycle, so fidelity recovers within one reading.
+ *
+ * Conversions are still started on every bus that has a device due, so each reading is as
+ * fresh as with a fixed period; only the reads are skipped.
+ */
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUTOTUNE_MAX_DIVISOR     (128)    ///< Longest period, in cycles
+
+/**
+ * @brief Tuning state of one device.
+ */
+typedef struct
+{
+    int64_t last_time;           ///< Time of the previous good reading, or 0
+    int16_t last_value;          ///< Previous good reading, in 1/16 degrees C
+    uint8_t stable;              ///< Consecutive readings within the tolerance
+    int32_t rate;                ///< Smoothed rate of change, in 1/256 degrees C per minute
+} autotune_device_t;
+
+/**
+ * @brief Tuning state of all devices.
+ */
+typedef struct
+{
+    int num_devices;             ///< Number of devices
+    uint8_t max_divisor;         ///< Longest period, in cycles, a power of two
+    int16_t tolerance;           ///< Largest acceptable change between readings, in 1/16 degrees C
+    autotune_device_t * devices; ///< State of each device
+} autotune_t;
+
+/**
+ * @brief Construct tuning state for the devices found.
+ * @param[in] sensors Devices to tune.
+ * @param[in] max_periods Longest period, in cycles, rounded down to a power of two.
+ * @param[in] tolerance Largest acceptable change between readings, in 1/16 degrees C.
+ * @return Pointer to the new instance, or NULL if it cannot be allocated.
+ */
+autotune_t * autotune_malloc(const sensors_t * sensors, int max_periods, int16_t tolerance);
+
+/**
+ * @brief Update the rate of change of each device in a processed frame, and its period.
+ *
+ * Called from post-processing, after sensors_process_frame(). New periods are set as
+ * target divisors, which the sampler applies from the next cycle.
+ */
+void autotune_add_frame(autotune_t * autotune, sensors_t * sensors, const sensors_frame_t * frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AUTOTUNE_H
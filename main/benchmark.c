@@ -0,0 +1,173 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "ds2482.h"
+#include "capacity.h"
+#include "benchmark.h"
+
+#define READ_REPEATS     (4)       // reads of each device for the latency measurement
+
+static const char * TAG = "benchmark";
+
+// Start a conversion on every device on a bus and wait for it to complete
+static void _convert(const OneWireBus * owb, DS18B20_RESOLUTION resolution)
+{
+    ds18b20_convert_all(owb);
+    int64_t conversion_us = capacity_conversion_time_us(resolution);
+    vTaskDelay((TickType_t)((conversion_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000)));
+    if (owb->use_parasitic_power)
+    {
+        owb_set_strong_pullup(owb, false);
+    }
+}
+
+// Time a search of the bus, returning the number of devices found
+static int _search(const OneWireBus * owb, int64_t * elapsed)
+{
+    bool bridge = ds2482_is_bus(owb);
+    owb_status (*search_first)(const OneWireBus *, OneWireBus_SearchState *, bool *) = bridge ? ds2482_search_first : owb_search_first;
+    owb_status (*search_next)(const OneWireBus *, OneWireBus_SearchState *, bool *) = bridge ? ds2482_search_next : owb_search_next;
+
+    OneWireBus_SearchState state = { 0 };
+    bool found = false;
+    int count = 0;
+    int64_t start = esp_timer_get_time();
+    search_first(owb, &state, &found);
+    while (found && count < SENSORS_MAX_DEVICES)
+    {
+        ++count;
+        search_next(owb, &state, &found);
+    }
+    *elapsed = esp_timer_get_time() - start;
+    return count;
+}
+
+static void _bench_bus(sensors_t * sensors, int b, int cycles, bool first)
+{
+    const OneWireBus * owb = sensors->buses[b];
+    int num_devices = 0;
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        num_devices += sensors->bus[i] == b;
+    }
+
+    int64_t search_us = 0;
+    int found = _search(owb, &search_us);
+
+    // read latency, at the configured resolution
+    int64_t read_total = 0;
+    int64_t read_max = 0;
+    int reads = 0;
+    _convert(owb, DS18B20_RESOLUTION_12_BIT);
+    for (int r = 0; r < READ_REPEATS; ++r)
+    {
+        for (int i = 0; i < sensors->num_devices; ++i)
+        {
+            if (sensors->bus[i] == b)
+            {
+                float value = 0.0f;
+                int64_t start = esp_timer_get_time();
+                ds18b20_read_temp(sensors->cold[i].info, &value);
+                int64_t elapsed = esp_timer_get_time() - start;
+                read_total += elapsed;
+                read_max = elapsed > read_max ? elapsed : read_max;
+                ++reads;
+            }
+        }
+    }
+
+    printf("%s{\"bus\":%d,\"devices\":%d,\"found\":%d,\"search_us\":%" PRId64 ",\"read_us\":{\"mean\":%" PRId64 ",\"max\":%" PRId64 "},\"resolutions\":[",
+           first ? "" : ",", b, num_devices, found, search_us, reads > 0 ? read_total / reads : 0, read_max);
+
+    for (int bits = DS18B20_RESOLUTION_9_BIT; bits <= DS18B20_RESOLUTION_12_BIT; ++bits)
+    {
+        for (int i = 0; i < sensors->num_devices; ++i)
+        {
+            if (sensors->bus[i] == b)
+            {
+                ds18b20_set_resolution(sensors->cold[i].info, bits);
+            }
+        }
+
+        uint32_t total = 0;
+        uint32_t crc_errors = 0;
+        uint32_t errors = 0;
+        int64_t start = esp_timer_get_time();
+        for (int c = 0; c < cycles; ++c)
+        {
+            _convert(owb, bits);
+            for (int i = 0; i < sensors->num_devices; ++i)
+            {
+                if (sensors->bus[i] == b)
+                {
+                    float value = 0.0f;
+                    DS18B20_ERROR error = ds18b20_read_temp(sensors->cold[i].info, &value);
+                    ++total;
+                    crc_errors += error == DS18B20_ERROR_CRC;
+                    errors += error != DS18B20_OK && error != DS18B20_ERROR_CRC;
+                }
+            }
+        }
+        int64_t cycle_us = cycles > 0 ? (esp_timer_get_time() - start) / cycles : 0;
+
+        printf("%s{\"bits\":%d,\"reads\":%u,\"crc_errors\":%u,\"errors\":%u,\"cycle_us\":%" PRId64 ",\"max_rate_hz\":%.2f}",
+               bits == DS18B20_RESOLUTION_9_BIT ? "" : ",", bits, (unsigned int)total, (unsigned int)crc_errors,
+               (unsigned int)errors, cycle_us, cycle_us > 0 ? 1000000.0 / cycle_us : 0.0);
+    }
+    printf("]}");
+
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        if (sensors->bus[i] == b)
+        {
+            ds18b20_set_resolution(sensors->cold[i].info, sensors->cold[i].resolution);
+        }
+    }
+}
+
+void benchmark_run(sensors_t * sensors, int cycles)
+{
+    ESP_LOGI(TAG, "running on %d buses, %d cycles per resolution", sensors->num_buses, cycles);
+    int64_t start = esp_timer_get_time();
+
+    printf("BENCHMARK BEGIN\n");
+    printf("{\"benchmark\":1,\"cycles\":%d,\"buses\":[", cycles);
+    for (int b = 0; b < sensors->num_buses; ++b)
+    {
+        _bench_bus(sensors, b, cycles, b == 0);
+    }
+    printf("]}\n");
+    printf("BENCHMARK END\n");
+    fflush(stdout);
+
+    ESP_LOGI(TAG, "completed in %" PRId64 " ms", (esp_timer_get_time() - start) / 1000);
+}
@@ -0,0 +1,68 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file benchmark.h
+ * @brief Self-benchmark of the attached buses, reported as a single JSON document.
+ *
+ * The benchmark runs a fixed sequence on each bus, so results are comparable between
+ * installations:
+ *
+ *  - the time to search the bus for devices;
+ *  - the latency of reading each device's result;
+ *  - for each resolution, the CRC and other error rates over a number of full cycles,
+ *    the measured cycle time, and the highest sample rate that cycle time sustains.
+ *
+ * The report is printed on one line, between "BENCHMARK BEGIN" and "BENCHMARK END" lines,
+ * for example (wrapped here):
+ *
+ *     {"benchmark":1,"cycles":20,"buses":[{"bus":0,"devices":2,"search_us":11520,
+ *      "read_us":{"mean":5710,"max":5902},"resolutions":[{"bits":9,"reads":40,
+ *      "crc_errors":0,"errors":0,"cycle_us":106015,"max_rate_hz":9.43},...]}]}
+ *
+ * The buses must not be in use by the sampler while the benchmark runs. Each device's
+ * configured resolution is restored afterwards.
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Run the benchmark on every bus and print the report.
+ * @param[in] sensors Devices found on each bus.
+ * @param[in] cycles Cycles to run at each resolution.
+ */
+void benchmark_run(sensors_t * sensors, int cycles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BENCHMARK_H
@@ -0,0 +1,109 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "capacity.h"
+
+// Time to transfer a number of bytes, including driver overhead
+static uint32_t _bytes_time(int bytes)
+{
+    return bytes * (8 * CAPACITY_SLOT_US + CAPACITY_BYTE_OVERHEAD_US);
+}
+
+uint32_t capacity_conversion_time_us(int resolution)
+{
+    // halves for each bit less than 12
+    int shift = 12 - resolution;
+    if (shift < 0 || shift > 3)
+    {
+        shift = 0;
+    }
+    return CAPACITY_CONVERSION_12_BIT_US >> shift;
+}
+
+uint32_t capacity_convert_time_us(const capacity_mode_t * mode)
+{
+    // presence check, then reset, SKIP ROM, CONVERT T
+    return 2 * CAPACITY_RESET_US + _bytes_time(2) + capacity_conversion_time_us(mode->resolution);
+}
+
+uint32_t capacity_read_time_us(const capacity_mode_t * mode)
+{
+    // reset, MATCH ROM + ROM code (or SKIP ROM), READ SCRATCHPAD, data
+    int address_bytes = mode->solo ? 1 : 1 + CAPACITY_ROM_CODE_BYTES;
+    int data_bytes = mode->use_crc ? CAPACITY_SCRATCHPAD_BYTES : CAPACITY_TRUNCATED_READ_BYTES;
+    return CAPACITY_RESET_US + _bytes_time(address_bytes + 1 + data_bytes);
+}
+
+uint32_t capacity_cycle_time_us(const capacity_mode_t * mode, const int * devices_per_bus, int num_buses)
+{
+    uint32_t reads = 0;
+    uint32_t commands = 0;
+    for (int b = 0; b < num_buses; ++b)
+    {
+        if (devices_per_bus[b] > 0)
+        {
+            capacity_mode_t bus_mode = *mode;
+            bus_mode.solo = devices_per_bus[b] == 1;
+            reads += devices_per_bus[b] * capacity_read_time_us(&bus_mode);
+            commands += capacity_convert_time_us(mode) - capacity_conversion_time_us(mode->resolution);
+        }
+    }
+
+    // conversion commands are issued in turn, then all conversions overlap
+    return reads > 0 ? commands + capacity_conversion_time_us(mode->resolution) + reads : 0;
+}
+
+int capacity_max_devices_per_bus(const capacity_mode_t * mode, uint32_t period_us)
+{
+    return capacity_max_devices_per_controller(mode, period_us, 1);
+}
+
+int capacity_max_devices_per_controller(const capacity_mode_t * mode, uint32_t period_us, int num_buses)
+{
+    if (num_buses <= 0)
+    {
+        return 0;
+    }
+
+    uint32_t fixed = capacity_conversion_time_us(mode->resolution)
+                     + num_buses * (capacity_convert_time_us(mode) - capacity_conversion_time_us(mode->resolution));
+    if (fixed >= period_us)
+    {
+        return 0;
+    }
+
+    capacity_mode_t addressed = *mode;
+    addressed.solo = false;
+    int devices = (period_us - fixed) / capacity_read_time_us(&addressed);
+
+    // a bus with a single device is cheaper to read
+    if (devices < num_buses)
+    {
+        capacity_mode_t solo = *mode;
+        solo.solo = true;
+        int solo_devices = (period_us - fixed) / capacity_read_time_us(&solo);
+        devices = solo_devices < num_buses ? solo_devices : num_buses;
+    }
+    return devices;
+}
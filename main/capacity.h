@@ -0,0 +1,113 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file capacity.h
+ * @brief Timing model of DS18B20 sampling on a 1-Wire bus, used to plan bus capacity.
+ *
+ * Estimates the time taken by each part of a sample cycle (reset, ROM addressing,
+ * conversion, scratchpad read) for a given mode, and from that the maximum number of
+ * devices that can be sampled within a period. This file has no ESP-IDF dependencies,
+ * so the same model and constants are used by the firmware and by the host-side
+ * planner in tools/capacity_planner.c.
+ */
+
+#ifndef CAPACITY_H
+#define CAPACITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Standard-speed 1-Wire timing, in microseconds
+#define CAPACITY_RESET_US              (960)    ///< Reset pulse and presence detect
+#define CAPACITY_SLOT_US               (70)     ///< Single read or write time slot
+#define CAPACITY_BYTE_OVERHEAD_US      (40)     ///< Estimated driver overhead per byte transferred
+
+#define CAPACITY_ROM_CODE_BYTES        (8)      ///< Bytes in a ROM code
+#define CAPACITY_SCRATCHPAD_BYTES      (9)      ///< Bytes read when CRC checking is enabled
+#define CAPACITY_TRUNCATED_READ_BYTES  (2)      ///< Bytes read when only the temperature is needed
+#define CAPACITY_CONVERSION_12_BIT_US  (750000) ///< Maximum conversion time at 12-bit resolution
+
+/**
+ * @brief Sampling mode that determines per-device costs.
+ */
+typedef struct
+{
+    int resolution;          ///< Resolution in bits, 9 to 12
+    bool use_crc;            ///< Read the full scratchpad and check its CRC
+    bool solo;               ///< Single device on the bus, so ROM addressing is skipped
+} capacity_mode_t;
+
+/**
+ * @brief Maximum conversion time at a resolution.
+ * @return Conversion time in microseconds.
+ */
+uint32_t capacity_conversion_time_us(int resolution);
+
+/**
+ * @brief Time for a bus-wide convert command followed by the conversion itself.
+ * @return Time in microseconds.
+ */
+uint32_t capacity_convert_time_us(const capacity_mode_t * mode);
+
+/**
+ * @brief Time to address one device and read its result.
+ * @return Time in microseconds.
+ */
+uint32_t capacity_read_time_us(const capacity_mode_t * mode);
+
+/**
+ * @brief Estimated duration of one sample cycle.
+ *
+ * Conversions on different buses overlap, but reads are issued from a single task and
+ * so are serialised across all buses.
+ *
+ * @param[in] mode Sampling mode.
+ * @param[in] devices_per_bus Number of devices on each bus.
+ * @param[in] num_buses Number of buses.
+ * @return Time in microseconds.
+ */
+uint32_t capacity_cycle_time_us(const capacity_mode_t * mode, const int * devices_per_bus, int num_buses);
+
+/**
+ * @brief Maximum devices on a single bus that can be sampled within a period.
+ * @return Number of devices, 0 if even the conversion exceeds the period.
+ */
+int capacity_max_devices_per_bus(const capacity_mode_t * mode, uint32_t period_us);
+
+/**
+ * @brief Maximum devices across a number of buses on one controller that can be sampled within a period.
+ * @return Number of devices, 0 if even the conversion exceeds the period.
+ */
+int capacity_max_devices_per_controller(const capacity_mode_t * mode, uint32_t period_us, int num_buses);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // CAPACITY_H
@@ -0,0 +1,246 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_CONSOLE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+
+#include "console.h"
+
+static const char * TAG = "console";
+
+#define READ_TIMEOUT    (5000 / portTICK_PERIOD_MS)
+#define MAX_QUANTILES   (8)
+
+// esp_console commands take no context, so the modules they use are held here
+static history_t * console_history = NULL;
+static sampler_t * console_sampler = NULL;
+static quantiles_t * console_quantiles = NULL;
+
+static int _history_command(int argc, char ** argv)
+{
+    if (console_history == NULL || argc < 2)
+    {
+        printf("usage: history <device> [from_ms] [to_ms] [points]\n");
+        return 1;
+    }
+
+    history_query_t query = {
+        .device = sensors_find_member(console_history->sensors, argv[1]),
+        .from_ms = argc > 2 ? strtoul(argv[2], NULL, 10) : 0,
+        .to_ms = argc > 3 ? strtoul(argv[3], NULL, 10) : history_now_ms(console_history),
+        .points = argc > 4 ? atoi(argv[4]) : 0,
+    };
+    if (query.device < 0 || query.points < 0 || query.points > HISTORY_MAX_POINTS)
+    {
+        printf("device not found or too many points\n");
+        return 1;
+    }
+
+    history_point_t * points = malloc(HISTORY_MAX_POINTS * sizeof(history_point_t));
+    if (points == NULL)
+    {
+        return 1;
+    }
+    history_stats_t stats;
+    int num_points = history_query(console_history, &query, points, HISTORY_MAX_POINTS, &stats);
+    for (int p = 0; p < num_points; ++p)
+    {
+        if (points[p].count > 0)
+        {
+            printf("  %10u  %.2f  [%.2f, %.2f]  %u\n", (unsigned int)points[p].time_ms,
+                   sensors_raw_to_celsius(points[p].mean), sensors_raw_to_celsius(points[p].min),
+                   sensors_raw_to_celsius(points[p].max), points[p].count);
+        }
+    }
+    printf("%d points%s, %d blocks scanned, %d skipped, %d samples, %" PRId64 " us\n",
+           num_points, stats.truncated ? " (truncated)" : "", stats.blocks_scanned, stats.blocks_skipped,
+           stats.samples_scanned, stats.time);
+    free(points);
+    return 0;
+}
+
+static int _read_command(int argc, char ** argv)
+{
+    if (console_sampler == NULL || argc < 2)
+    {
+        printf("usage: read <device> [max_age_ms]\n");
+        return 1;
+    }
+
+    int device = sensors_find_member(console_sampler->sensors, argv[1]);
+    uint32_t max_age_ms = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+    if (device < 0)
+    {
+        printf("device not found\n");
+        return 1;
+    }
+
+    float value = 0.0f;
+    int64_t start = esp_timer_get_time();
+    DS18B20_ERROR error = sampler_read_now(console_sampler, device, max_age_ms, READ_TIMEOUT, &value);
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (error != DS18B20_OK)
+    {
+        printf("read failed: %d, after %" PRId64 " us\n", error, elapsed);
+        return 1;
+    }
+    printf("  %d: %.4f after %" PRId64 " us\n", device, value, elapsed);
+    return 0;
+}
+
+static int _quantiles_command(int argc, char ** argv)
+{
+    if (console_quantiles == NULL || console_sampler == NULL || argc < 2)
+    {
+        printf("usage: quantiles <device> [q...]\n");
+        return 1;
+    }
+
+    int device = sensors_find_member(console_sampler->sensors, argv[1]);
+    float q[MAX_QUANTILES] = { 0.01f, 0.5f, 0.99f };
+    int n = 3;
+    if (argc > 2)
+    {
+        n = argc - 2 < MAX_QUANTILES ? argc - 2 : MAX_QUANTILES;
+        for (int k = 0; k < n; ++k)
+        {
+            q[k] = strtof(argv[k + 2], NULL);
+            if (q[k] < 0.0f || q[k] > 1.0f)
+            {
+                printf("quantiles must be from 0 to 1\n");
+                return 1;
+            }
+        }
+    }
+
+    int16_t values[MAX_QUANTILES];
+    int16_t error = 0;
+    uint32_t count = quantiles_query(console_quantiles, device, q, values, n, &error);
+    if (count == 0)
+    {
+        printf("device not found or no readings\n");
+        return 1;
+    }
+    for (int k = 0; k < n; ++k)
+    {
+        printf("  q%.3f: %.4f\n", q[k], sensors_raw_to_celsius(values[k]));
+    }
+    printf("%u readings, error within %.4f\n", (unsigned int)count, sensors_raw_to_celsius(error));
+    return 0;
+}
+
+static int _faults_command(int argc, char ** argv)
+{
+    if (console_sampler == NULL)
+    {
+        return 1;
+    }
+
+    sensors_t * sensors = console_sampler->sensors;
+    uint32_t counts[SENSORS_FAULT_COUNT];
+    if (argc > 1)
+    {
+        int device = sensors_find_member(sensors, argv[1]);
+        if (device < 0)
+        {
+            printf("device not found\n");
+            return 1;
+        }
+        sensors_device_faults(sensors, device, counts);
+        printf("  device %d on bus %d:", device, sensors->bus[device]);
+        for (int f = 0; f < SENSORS_FAULT_COUNT; ++f)
+        {
+            printf(" %s %u", sensors_fault_name(f), (unsigned int)counts[f]);
+        }
+        printf("\n");
+        return 0;
+    }
+
+    for (int b = 0; b < sensors->num_buses; ++b)
+    {
+        sensors_bus_faults(sensors, b, counts);
+        printf("  bus %d:", b);
+        for (int f = 0; f < SENSORS_FAULT_COUNT; ++f)
+        {
+            printf(" %s %u", sensors_fault_name(f), (unsigned int)counts[f]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+void console_start(history_t * history, sampler_t * sampler, quantiles_t * quantiles)
+{
+    console_history = history;
+    console_sampler = sampler;
+    console_quantiles = quantiles;
+
+    esp_console_repl_t * repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "ds18b20>";
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    if (esp_console_new_repl_uart(&uart_config, &repl_config, &repl) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "failed to create console");
+        return;
+    }
+
+    esp_console_register_help_command();
+    const esp_console_cmd_t history_cmd = {
+        .command = "history",
+        .help = "Query history: history <device> [from_ms] [to_ms] [points]",
+        .func = _history_command,
+    };
+    esp_console_cmd_register(&history_cmd);
+    const esp_console_cmd_t read_cmd = {
+        .command = "read",
+        .help = "Read a device on demand: read <device> [max_age_ms]",
+        .func = _read_command,
+    };
+    esp_console_cmd_register(&read_cmd);
+    const esp_console_cmd_t quantiles_cmd = {
+        .command = "quantiles",
+        .help = "Report quantiles in the current window: quantiles <device> [q...]",
+        .func = _quantiles_command,
+    };
+    esp_console_cmd_register(&quantiles_cmd);
+    const esp_console_cmd_t faults_cmd = {
+        .command = "faults",
+        .help = "Report failed reads by cause: faults [device]",
+        .func = _faults_command,
+    };
+    esp_console_cmd_register(&faults_cmd);
+    esp_console_start_repl(repl);
+}
+
+#endif  // CONFIG_CONSOLE
@@ -0,0 +1,60 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file console.h
+ * @brief Interactive command console on the default UART.
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "history.h"
+#include "sampler.h"
+#include "quantiles.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Start the console, with commands to query history, read devices on demand and report
+ * quantiles and failed reads.
+ *
+ *     history <device> [from_ms] [to_ms] [points]
+ *     read <device> [max_age_ms]
+ *     quantiles <device> [q...]
+ *     faults [device]
+ *
+ * @param[in] history History to query, may be NULL.
+ * @param[in] sampler Scheduler to request readings from.
+ * @param[in] quantiles Quantile sketches to query, may be NULL.
+ */
+void console_start(history_t * history, sampler_t * sampler, quantiles_t * quantiles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // CONSOLE_H
@@ -0,0 +1,341 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "ds2482.h"
+
+// Commands
+#define CMD_DEVICE_RESET       (0xf0)
+#define CMD_SET_READ_POINTER   (0xe1)
+#define CMD_WRITE_CONFIG       (0xd2)
+#define CMD_CHANNEL_SELECT     (0xc3)
+#define CMD_1WIRE_RESET        (0xb4)
+#define CMD_1WIRE_SINGLE_BIT   (0x87)
+#define CMD_1WIRE_WRITE_BYTE   (0xa5)
+#define CMD_1WIRE_READ_BYTE    (0x96)
+#define CMD_1WIRE_TRIPLET      (0x78)
+
+// Register codes for the read pointer
+#define REG_STATUS             (0xf0)
+#define REG_DATA               (0xe1)
+
+// Status register bits
+#define STATUS_1WB             (0x01)    // 1-Wire busy
+#define STATUS_PPD             (0x02)    // presence pulse detected
+#define STATUS_SD              (0x04)    // short detected
+#define STATUS_RST             (0x10)    // device reset
+#define STATUS_SBR             (0x20)    // single bit result
+#define STATUS_TSB             (0x40)    // triplet second bit
+#define STATUS_DIR             (0x80)    // branch direction taken
+
+#define CFG_APU             (0x01)    // active pull-up
+
+#define I2C_TIMEOUT            (10 / portTICK_PERIOD_MS)
+#define MAX_POLLS              (100)     // a 1-Wire reset, the longest operation, takes about 1.2 ms
+
+static const char * TAG = "ds2482";
+
+// Channel select codes, and the values read back to confirm them
+static const uint8_t CHANNEL_CODES[DS2482_MAX_CHANNELS] = { 0xf0, 0xe1, 0xd2, 0xc3, 0xb4, 0xa5, 0x96, 0x87 };
+static const uint8_t CHANNEL_READBACK[DS2482_MAX_CHANNELS] = { 0xb8, 0xb1, 0xaa, 0xa3, 0x9c, 0x95, 0x8e, 0x87 };
+
+static owb_status _command(ds2482_t * chip, uint8_t command, const uint8_t * param, int param_len)
+{
+    uint8_t buffer[2] = { command, param_len > 0 ? param[0] : 0 };
+    esp_err_t err = i2c_master_write_to_device(chip->port, chip->address, buffer, 1 + param_len, I2C_TIMEOUT);
+    return err == ESP_OK ? OWB_STATUS_OK : OWB_STATUS_HW_ERROR;
+}
+
+// Poll the status register until the 1-Wire operation in progress completes
+static owb_status _wait(ds2482_t * chip, uint8_t * status)
+{
+    for (int i = 0; i < MAX_POLLS; ++i)
+    {
+        ++chip->polls;
+        if (i2c_master_read_from_device(chip->port, chip->address, status, 1, I2C_TIMEOUT) != ESP_OK)
+        {
+            return OWB_STATUS_HW_ERROR;
+        }
+        if ((*status & STATUS_1WB) == 0)
+        {
+            return OWB_STATUS_OK;
+        }
+    }
+    ESP_LOGE(TAG, "bridge 0x%02x busy", chip->address);
+    return OWB_STATUS_HW_ERROR;
+}
+
+static owb_status _select(ds2482_driver_info * info)
+{
+    ds2482_t * chip = info->chip;
+    if (chip->num_channels == 1 || chip->channel == info->channel)
+    {
+        return OWB_STATUS_OK;
+    }
+
+    uint8_t code = CHANNEL_CODES[info->channel];
+    uint8_t readback = 0;
+    if (_command(chip, CMD_CHANNEL_SELECT, &code, 1) != OWB_STATUS_OK
+        || i2c_master_read_from_device(chip->port, chip->address, &readback, 1, I2C_TIMEOUT) != ESP_OK
+        || readback != CHANNEL_READBACK[info->channel])
+    {
+        chip->channel = -1;
+        return OWB_STATUS_HW_ERROR;
+    }
+    chip->channel = info->channel;
+    return OWB_STATUS_OK;
+}
+
+static owb_status _uninitialize(const OneWireBus * bus)
+{
+    return OWB_STATUS_OK;
+}
+
+static owb_status _reset(const OneWireBus * bus, bool * is_present)
+{
+    ds2482_driver_info * info = container_of(bus, ds2482_driver_info, bus);
+    uint8_t status = 0;
+    owb_status result = _select(info);
+    if (result == OWB_STATUS_OK)
+    {
+        result = _command(info->chip, CMD_1WIRE_RESET, NULL, 0);
+    }
+    if (result == OWB_STATUS_OK)
+    {
+        result = _wait(info->chip, &status);
+    }
+    if (result == OWB_STATUS_OK && (status & STATUS_SD))
+    {
+        ESP_LOGW(TAG, "short on channel %d", info->channel);
+    }
+    *is_present = result == OWB_STATUS_OK && (status & STATUS_PPD) && !(status & STATUS_SD);
+    return result;
+}
+
+static owb_status _single_bit(ds2482_driver_info * info, bool bit, bool * result)
+{
+    uint8_t param = bit ? 0x80 : 0x00;
+    uint8_t status = 0;
+    owb_status err = _command(info->chip, CMD_1WIRE_SINGLE_BIT, &param, 1);
+    if (err == OWB_STATUS_OK)
+    {
+        err = _wait(info->chip, &status);
+    }
+    *result = (status & STATUS_SBR) != 0;
+    return err;
+}
+
+static owb_status _write_bits(const OneWireBus * bus, uint8_t out, int number_of_bits_to_write)
+{
+    ds2482_driver_info * info = container_of(bus, ds2482_driver_info, bus);
+    uint8_t status = 0;
+    owb_status err = _select(info);
+    if (err != OWB_STATUS_OK)
+    {
+        return err;
+    }
+
+    if (number_of_bits_to_write == 8)
+    {
+        err = _command(info->chip, CMD_1WIRE_WRITE_BYTE, &out, 1);
+        return err == OWB_STATUS_OK ? _wait(info->chip, &status) : err;
+    }
+
+    for (int i = 0; i < number_of_bits_to_write && err == OWB_STATUS_OK; ++i)
+    {
+        bool unused;
+        err = _single_bit(info, (out >> i) & 1, &unused);
+    }
+    return err;
+}
+
+static owb_status _read_bits(const OneWireBus * bus, uint8_t * in, int number_of_bits_to_read)
+{
+    ds2482_driver_info * info = container_of(bus, ds2482_driver_info, bus);
+    ds2482_t * chip = info->chip;
+    uint8_t status = 0;
+    owb_status err = _select(info);
+    if (err != OWB_STATUS_OK)
+    {
+        return err;
+    }
+
+    if (number_of_bits_to_read == 8)
+    {
+        uint8_t reg = REG_DATA;
+        err = _command(chip, CMD_1WIRE_READ_BYTE, NULL, 0);
+        if (err == OWB_STATUS_OK)
+        {
+            err = _wait(chip, &status);
+        }
+        if (err == OWB_STATUS_OK)
+        {
+            err = _command(chip, CMD_SET_READ_POINTER, &reg, 1);
+        }
+        if (err == OWB_STATUS_OK && i2c_master_read_from_device(chip->port, chip->address, in, 1, I2C_TIMEOUT) != ESP_OK)
+        {
+            err = OWB_STATUS_HW_ERROR;
+        }
+        return err;
+    }
+
+    *in = 0;
+    for (int i = 0; i < number_of_bits_to_read && err == OWB_STATUS_OK; ++i)
+    {
+        bool bit = false;
+        err = _single_bit(info, true, &bit);
+        *in |= (uint8_t)bit << i;
+    }
+    return err;
+}
+
+static const struct owb_driver ds2482_driver = {
+    .name = "owb_ds2482",
+    .uninitialize = _uninitialize,
+    .reset = _reset,
+    .write_bits = _write_bits,
+    .read_bits = _read_bits,
+};
+
+bool ds2482_init_chip(ds2482_t * chip, i2c_port_t port, uint8_t address, int num_channels)
+{
+    memset(chip, 0, sizeof(*chip));
+    chip->port = port;
+    chip->address = address;
+    chip->num_channels = num_channels > 1 ? DS2482_MAX_CHANNELS : 1;
+    chip->channel = -1;
+
+    // the configuration byte is written with its complement in the upper nibble
+    uint8_t config = CFG_APU | ((~CFG_APU & 0x0f) << 4);
+    uint8_t status = 0;
+    if (_command(chip, CMD_DEVICE_RESET, NULL, 0) != OWB_STATUS_OK
+        || _wait(chip, &status) != OWB_STATUS_OK
+        || !(status & STATUS_RST)
+        || _command(chip, CMD_WRITE_CONFIG, &config, 1) != OWB_STATUS_OK)
+    {
+        ESP_LOGE(TAG, "no bridge at 0x%02x on I2C port %d", address, port);
+        return false;
+    }
+    ESP_LOGI(TAG, "DS2482-%s at 0x%02x", chip->num_channels > 1 ? "800" : "100", address);
+    return true;
+}
+
+OneWireBus * ds2482_initialize(ds2482_driver_info * info, ds2482_t * chip, int channel)
+{
+    if (channel < 0 || channel >= chip->num_channels)
+    {
+        return NULL;
+    }
+    memset(info, 0, sizeof(*info));
+    info->chip = chip;
+    info->channel = channel;
+    info->bus.driver = &ds2482_driver;
+    return &info->bus;
+}
+
+bool ds2482_is_bus(const OneWireBus * bus)
+{
+    return bus != NULL && bus->driver == &ds2482_driver;
+}
+
+// Maxim search algorithm, with each step performed by a single triplet command
+static owb_status _search(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device)
+{
+    ds2482_driver_info * info = container_of(bus, ds2482_driver_info, bus);
+    *found_device = false;
+    if (state->last_device_flag)
+    {
+        return OWB_STATUS_OK;
+    }
+
+    bool is_present = false;
+    owb_status err = owb_reset(bus, &is_present);
+    if (err != OWB_STATUS_OK || !is_present)
+    {
+        memset(state, 0, sizeof(*state));
+        return err;
+    }
+    err = owb_write_byte(bus, OWB_ROM_SEARCH);
+
+    int last_zero = 0;
+    int id_bit_number = 1;
+    for (; id_bit_number <= 64 && err == OWB_STATUS_OK; ++id_bit_number)
+    {
+        int byte = (id_bit_number - 1) / 8;
+        uint8_t mask = 1 << ((id_bit_number - 1) % 8);
+        bool direction = id_bit_number < state->last_discrepancy
+                         ? (state->rom_code.bytes[byte] & mask) != 0
+                         : id_bit_number == state->last_discrepancy;
+
+        uint8_t param = direction ? 0x80 : 0x00;
+        uint8_t status = 0;
+        err = _command(info->chip, CMD_1WIRE_TRIPLET, &param, 1);
+        if (err == OWB_STATUS_OK)
+        {
+            err = _wait(info->chip, &status);
+        }
+        if (err != OWB_STATUS_OK || ((status & STATUS_SBR) && (status & STATUS_TSB)))
+        {
+            break;    // no devices responded
+        }
+
+        direction = (status & STATUS_DIR) != 0;
+        if (!(status & STATUS_SBR) && !(status & STATUS_TSB) && !direction)
+        {
+            last_zero = id_bit_number;
+            if (last_zero < 9)
+            {
+                state->last_family_discrepancy = last_zero;
+            }
+        }
+        state->rom_code.bytes[byte] = direction ? state->rom_code.bytes[byte] | mask : state->rom_code.bytes[byte] & ~mask;
+    }
+
+    if (err == OWB_STATUS_OK && id_bit_number > 64
+        && owb_crc8_bytes(0, state->rom_code.bytes, sizeof(state->rom_code.bytes)) == 0)
+    {
+        state->last_discrepancy = last_zero;
+        state->last_device_flag = last_zero == 0;
+        *found_device = true;
+    }
+    else
+    {
+        memset(state, 0, sizeof(*state));
+    }
+    return err;
+}
+
+owb_status ds2482_search_first(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device)
+{
+    memset(state, 0, sizeof(*state));
+    return _search(bus, state, found_device);
+}
+
+owb_status ds2482_search_next(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device)
+{
+    return _search(bus, state, found_device);
+}
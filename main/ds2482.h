@@ -0,0 +1,119 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file ds2482.h
+ * @brief 1-Wire bus driver for the DS2482-100 and DS2482-800 I2C bridges.
+ *
+ * Each bridge channel is presented as a OneWireBus, so the owb and ds18b20 components use it
+ * exactly as they use an RMT bus. Slot timing is generated by the bridge, so the CPU only
+ * exchanges whole bytes over I2C, and bridge buses do not consume RMT channels. A DS2482-800
+ * provides eight buses; the channel is selected automatically before each transaction.
+ *
+ * ROM searches use the bridge's triplet command, which performs both read slots and the
+ * write slot of each search step in a single I2C transaction. Use ds2482_search_first()
+ * and ds2482_search_next() in place of owb_search_first() and owb_search_next().
+ *
+ * Buses on the same bridge share its state and must be driven from a single task.
+ * Strong pull-up through the bridge is not supported.
+ */
+
+#ifndef DS2482_H
+#define DS2482_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driver/i2c.h"
+
+#include "owb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DS2482_DEFAULT_ADDRESS   (0x18)   ///< I2C address with AD0-AD2 low
+#define DS2482_MAX_CHANNELS      (8)      ///< Channels on a DS2482-800
+
+/**
+ * @brief Bridge chip state, shared by all of its buses.
+ */
+typedef struct
+{
+    i2c_port_t port;             ///< I2C port, already configured as a master
+    uint8_t address;             ///< 7-bit I2C address
+    int num_channels;            ///< 1 for a DS2482-100, 8 for a DS2482-800
+    int channel;                 ///< Currently selected channel, or -1 if unknown
+    uint32_t polls;              ///< Status polls made while waiting for the bus
+} ds2482_t;
+
+/**
+ * @brief Per-bus driver state.
+ */
+typedef struct
+{
+    ds2482_t * chip;             ///< Bridge the bus is on
+    int channel;                 ///< Channel of the bus
+    OneWireBus bus;              ///< Bus instance passed to the owb component
+} ds2482_driver_info;
+
+/**
+ * @brief Reset and configure a bridge.
+ * @param[out] chip Bridge state to initialise.
+ * @param[in] port I2C port, already configured as a master.
+ * @param[in] address 7-bit I2C address.
+ * @param[in] num_channels 1 for a DS2482-100, 8 for a DS2482-800.
+ * @return True if the bridge responded.
+ */
+bool ds2482_init_chip(ds2482_t * chip, i2c_port_t port, uint8_t address, int num_channels);
+
+/**
+ * @brief Initialise a bus on one channel of a bridge.
+ * @param[out] info Per-bus driver state, which must remain valid while the bus is in use.
+ * @param[in] chip Bridge, initialised by ds2482_init_chip().
+ * @param[in] channel Channel, less than the bridge's number of channels.
+ * @return Pointer to the bus, or NULL if the channel is invalid.
+ */
+OneWireBus * ds2482_initialize(ds2482_driver_info * info, ds2482_t * chip, int channel);
+
+/**
+ * @brief Return true if a bus is driven by a DS2482 bridge.
+ */
+bool ds2482_is_bus(const OneWireBus * bus);
+
+/**
+ * @brief Find the first device on a bridge bus, using the triplet command.
+ */
+owb_status ds2482_search_first(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device);
+
+/**
+ * @brief Find the next device on a bridge bus, using the triplet command.
+ */
+owb_status ds2482_search_next(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // DS2482_H
@@ -0,0 +1,90 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "energy.h"
+
+static const char * TAG = "energy";
+
+void energy_init(energy_t * energy)
+{
+    memset(energy, 0, sizeof(*energy));
+    energy->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+}
+
+void energy_add_cpu_time(energy_t * energy, int64_t time)
+{
+    portENTER_CRITICAL(&energy->lock);
+    energy->cpu_time += time;
+    portEXIT_CRITICAL(&energy->lock);
+}
+
+void energy_update(energy_t * energy, const sampler_t * sampler, bool radio_on)
+{
+    portENTER_CRITICAL(&energy->lock);
+    int64_t cpu_time = energy->cpu_time;
+    energy->cpu_time = 0;
+    portEXIT_CRITICAL(&energy->lock);
+
+    energy_times_t * times = &energy->times;
+    times->period = sampler->cycle_time > sampler->period ? sampler->cycle_time : sampler->period;
+    times->bus_active = sampler->cycle_busy_time;
+    times->cpu_active = sampler->cycle_busy_time + cpu_time;
+    if (times->cpu_active > times->period)
+    {
+        times->cpu_active = times->period;
+    }
+    times->pullup = sampler->cycle_pullup_time;
+    times->radio = radio_on ? times->period : 0;
+
+    // only buses with a device due convert, and only due devices are read
+    times->convert = sampler->cycle_convert_time;
+    int samples = sampler->cycle_reads;
+
+    // milliwatts times microseconds gives nanojoules
+    int64_t nj = times->cpu_active * ENERGY_CPU_ACTIVE_MW
+                 + (times->period - times->cpu_active) * ENERGY_CPU_IDLE_MW
+                 + times->radio * ENERGY_RADIO_MW
+                 + times->bus_active * ENERGY_BUS_MW
+                 + times->pullup * ENERGY_PULLUP_MW
+                 + times->convert * ENERGY_CONVERT_MW;
+
+    energy->cycle_uj = (uint32_t)(nj / 1000);
+    energy->sample_uj = samples > 0 ? energy->cycle_uj / samples : 0;
+    energy->power_mw = times->period > 0 ? (uint32_t)(nj / times->period) : 0;
+    energy->total_uj += energy->cycle_uj;
+
+    if (++energy->cycles % ENERGY_LOG_CYCLES == 0)
+    {
+        ESP_LOGI(TAG, "metric energy cycle_uj=%u sample_uj=%u power_mw=%u total_j=%u cpu_us=%" PRId64
+                 " bus_us=%" PRId64 " pullup_us=%" PRId64 " radio_us=%" PRId64,
+                 (unsigned int)energy->cycle_uj, (unsigned int)energy->sample_uj, (unsigned int)energy->power_mw,
+                 (unsigned int)(energy->total_uj / 1000000), times->cpu_active, times->bus_active,
+                 times->pullup, times->radio);
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file energy.h
+ * @brief Estimate of the energy spent on each cycle and each sample.
+ *
+ * Each cycle, the time spent in each power state is measured or derived:
+ *
+ *  - CPU active: time spent stepping the buses plus time spent post-processing,
+ *  - CPU idle: the remainder of the period,
+ *  - bus active: time spent in 1-Wire transactions,
+ *  - strong pull-up: time the pull-up was on to power parasitic conversions,
+ *  - conversion: time each device spent converting, summed over the devices converted,
+ *  - radio: the whole period while the network is connected.
+ *
+ * Each is multiplied by the typical power drawn in that state to give the energy of the
+ * cycle, and that is divided by the number of devices read in the cycle, which may be fewer
+ * than all of them, to give the energy per sample.
+ * The power figures are nominal and are intended for comparing settings, not for billing.
+ */
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "sensors.h"
+#include "sampler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Nominal power drawn in each state at 3.3 V, in milliwatts
+#define ENERGY_CPU_ACTIVE_MW     (130)    ///< CPU running at 160 MHz, radio off
+#define ENERGY_CPU_IDLE_MW       (65)     ///< CPU idle in the FreeRTOS idle task, clocks running
+#define ENERGY_RADIO_MW          (100)    ///< Wi-Fi station associated, modem sleep, average
+#define ENERGY_BUS_MW            (5)      ///< 1-Wire line driven, including device communication current
+#define ENERGY_PULLUP_MW         (5)      ///< Strong pull-up switch and gate drive
+#define ENERGY_CONVERT_MW        (5)      ///< One DS18B20 converting, 1.5 mA
+
+#define ENERGY_LOG_CYCLES        (60)     ///< Cycles between metric lines
+
+/**
+ * @brief Time spent in each state during a cycle, in microseconds.
+ */
+typedef struct
+{
+    int64_t period;              ///< Length of the cycle
+    int64_t cpu_active;          ///< CPU running
+    int64_t bus_active;          ///< 1-Wire transactions in progress
+    int64_t pullup;              ///< Strong pull-up on, summed over buses
+    int64_t convert;             ///< Devices converting, summed over devices
+    int64_t radio;               ///< Radio on
+} energy_times_t;
+
+/**
+ * @brief Energy accounting state.
+ */
+typedef struct
+{
+    portMUX_TYPE lock;           ///< Protects cpu_time
+    int64_t cpu_time;            ///< CPU time reported by other tasks since the last cycle, in microseconds
+
+    energy_times_t times;        ///< Times of the most recent cycle
+    uint32_t cycle_uj;           ///< Energy of the most recent cycle, in microjoules
+    uint32_t sample_uj;          ///< Energy per sample in the most recent cycle, in microjoules
+    uint32_t power_mw;           ///< Mean power over the most recent cycle, in milliwatts
+    uint64_t total_uj;           ///< Energy since start, in microjoules
+    uint32_t cycles;             ///< Cycles accounted
+} energy_t;
+
+/**
+ * @brief Initialise energy accounting.
+ */
+void energy_init(energy_t * energy);
+
+/**
+ * @brief Report CPU time spent on sampling work in another task, such as post-processing.
+ *
+ * May be called from any task.
+ */
+void energy_add_cpu_time(energy_t * energy, int64_t time);
+
+/**
+ * @brief Account for the most recently completed cycle.
+ *
+ * Must be called from the sampling task, after sampler_step() reports a completed cycle.
+ * @param[in] radio_on True if the radio was on during the cycle.
+ */
+void energy_update(energy_t * energy, const sampler_t * sampler, bool radio_on);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ENERGY_H
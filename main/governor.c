@@ -0,0 +1,181 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "governor.h"
+
+#define OVER_CYCLES       (3)     // consecutive cycles over budget before degrading
+#define UNDER_CYCLES      (20)    // consecutive cycles under half budget before restoring
+#define POWER_RESTORE_PCT (75)    // percentage of the power budget to be under before restoring
+
+static const char * TAG = "governor";
+
+static void _add_step(governor_t * governor, governor_step_t step)
+{
+    if (governor->num_steps < GOVERNOR_MAX_STEPS)
+    {
+        governor->steps[governor->num_steps++] = step;
+    }
+}
+
+// Compute the settings for a level by walking the ladder from the base settings
+static void _settings(const governor_t * governor, int level, uint32_t * period_ms, int * resolution_steps, bool * use_crc)
+{
+    *period_ms = governor->base_period_ms;
+    *resolution_steps = 0;
+    *use_crc = governor->base_use_crc;
+    for (int i = 0; i < level; ++i)
+    {
+        switch (governor->steps[i])
+        {
+        case GOVERNOR_STEP_CRC: *use_crc = false; break;
+        case GOVERNOR_STEP_RESOLUTION: ++*resolution_steps; break;
+        case GOVERNOR_STEP_PERIOD: *period_ms *= 2; break;
+        default: break;
+        }
+    }
+}
+
+static void _apply(governor_t * governor, int level, int64_t cycle_time)
+{
+    uint32_t period_ms;
+    int resolution_steps;
+    bool use_crc;
+    _settings(governor, level, &period_ms, &resolution_steps, &use_crc);
+
+    sensors_t * sensors = governor->sensors;
+    if (resolution_steps != governor->resolution_steps || use_crc != governor->use_crc)
+    {
+        for (int i = 0; i < sensors->num_devices; ++i)
+        {
+            ds18b20_use_crc(sensors->cold[i].info, use_crc);
+
+            DS18B20_RESOLUTION resolution = governor->base_resolution[i] - resolution_steps;
+            if (resolution < governor->config.min_resolution)
+            {
+                resolution = governor->config.min_resolution;
+            }
+            if (resolution != sensors->cold[i].resolution)
+            {
+                ds18b20_set_resolution(sensors->cold[i].info, resolution);
+                sensors->cold[i].resolution = resolution;
+            }
+        }
+        sampler_refresh(governor->sampler);
+    }
+    if (period_ms != governor->period_ms)
+    {
+        sampler_set_period(governor->sampler, period_ms);
+    }
+
+    governor->level = level;
+    governor->period_ms = period_ms;
+    governor->resolution_steps = resolution_steps;
+    governor->use_crc = use_crc;
+    ++governor->changes;
+
+    ESP_LOGI(TAG, "metric governor level=%d period_ms=%u resolution_steps=%d crc=%d cycle_us=%" PRId64 " power_mw=%u changes=%u",
+             level, (unsigned int)period_ms, resolution_steps, use_crc, cycle_time, (unsigned int)governor->power_mw,
+             (unsigned int)governor->changes);
+}
+
+void governor_init(governor_t * governor, const governor_config_t * config, sampler_t * sampler, sensors_t * sensors,
+                   uint32_t period_ms, bool use_crc)
+{
+    memset(governor, 0, sizeof(*governor));
+    governor->config = *config;
+    governor->sampler = sampler;
+    governor->sensors = sensors;
+    governor->base_period_ms = governor->period_ms = period_ms;
+    governor->base_use_crc = governor->use_crc = use_crc;
+
+    // The ladder is long enough to bring the highest configured resolution down to the minimum
+    DS18B20_RESOLUTION max_resolution = config->min_resolution;
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        governor->base_resolution[i] = sensors->cold[i].resolution;
+        if (sensors->cold[i].resolution > max_resolution)
+        {
+            max_resolution = sensors->cold[i].resolution;
+        }
+    }
+
+    if (config->policy == GOVERNOR_POLICY_FIDELITY)
+    {
+        if (use_crc)
+        {
+            _add_step(governor, GOVERNOR_STEP_CRC);
+        }
+        for (int r = max_resolution; r > config->min_resolution; --r)
+        {
+            _add_step(governor, GOVERNOR_STEP_RESOLUTION);
+        }
+    }
+    for (uint32_t p = period_ms * 2; p <= config->max_period_ms; p *= 2)
+    {
+        _add_step(governor, GOVERNOR_STEP_PERIOD);
+    }
+}
+
+void governor_report_power(governor_t * governor, uint32_t power_mw)
+{
+    governor->power_mw = power_mw;
+}
+
+void governor_update(governor_t * governor)
+{
+    int64_t cycle_time = governor->sampler->cycle_time;
+    int64_t budget = (int64_t)governor->period_ms * 10 * governor->config.budget_percent;
+    uint32_t power_budget = governor->config.power_budget_mw;
+    bool over_power = power_budget > 0 && governor->power_mw > power_budget;
+    bool under_power = power_budget == 0 || governor->power_mw * 100 < power_budget * POWER_RESTORE_PCT;
+
+    if (cycle_time > budget || over_power)
+    {
+        governor->under_count = 0;
+        if (++governor->over_count >= OVER_CYCLES && governor->level < governor->num_steps)
+        {
+            governor->over_count = 0;
+            _apply(governor, governor->level + 1, cycle_time);
+        }
+    }
+    else if (cycle_time < budget / 2 && under_power && governor->level > 0)
+    {
+        governor->over_count = 0;
+        if (++governor->under_count >= UNDER_CYCLES)
+        {
+            governor->under_count = 0;
+            _apply(governor, governor->level - 1, cycle_time);
+        }
+    }
+    else
+    {
+        governor->over_count = 0;
+        governor->under_count = 0;
+    }
+}
@@ -0,0 +1,143 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file governor.h
+ * @brief Adjusts sampling settings to keep each cycle within a time budget.
+ *
+ * After every cycle, the governor compares the measured cycle time against a fraction
+ * of the sample period and, if a power budget is set, the estimated mean power against
+ * that budget. If either budget is exceeded for several consecutive cycles it degrades
+ * one step along a ladder fixed by the policy; when cycles are comfortably within both
+ * budgets for a longer run, it restores the most recent step. Steps are:
+ *
+ *  - read mode: disable CRC checking, so only the temperature bytes are read,
+ *  - resolution: reduce by one bit, shortening the conversion time,
+ *  - period: double the sample period.
+ *
+ * Every change is logged as a metric line.
+ */
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ds18b20.h"
+#include "sensors.h"
+#include "sampler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GOVERNOR_MAX_STEPS  (16)    ///< Maximum length of the degradation ladder
+
+/**
+ * @brief Order in which settings are degraded.
+ */
+typedef enum
+{
+    GOVERNOR_POLICY_PERIOD = 0,     ///< Only lengthen the sample period
+    GOVERNOR_POLICY_FIDELITY,       ///< Disable CRC, then reduce resolution, then lengthen the period
+} governor_policy_t;
+
+/**
+ * @brief A single step on the degradation ladder.
+ */
+typedef enum
+{
+    GOVERNOR_STEP_CRC = 0,          ///< Disable CRC checking
+    GOVERNOR_STEP_RESOLUTION,       ///< Reduce each device's resolution by one bit
+    GOVERNOR_STEP_PERIOD,           ///< Double the sample period
+} governor_step_t;
+
+/**
+ * @brief Governor configuration.
+ */
+typedef struct
+{
+    governor_policy_t policy;          ///< Degradation order
+    uint32_t budget_percent;           ///< Cycle time budget, as a percentage of the period
+    uint32_t max_period_ms;            ///< Longest period the governor may select
+    DS18B20_RESOLUTION min_resolution; ///< Lowest resolution the governor may select
+    uint32_t power_budget_mw;          ///< Mean power budget, in milliwatts, or 0 for none
+} governor_config_t;
+
+/**
+ * @brief Governor state.
+ */
+typedef struct
+{
+    governor_config_t config;
+    sampler_t * sampler;
+    sensors_t * sensors;
+
+    governor_step_t steps[GOVERNOR_MAX_STEPS];  ///< Degradation ladder
+    int num_steps;                              ///< Length of the ladder
+    int level;                                  ///< Number of steps currently applied
+
+    uint32_t base_period_ms;                    ///< Settings with no steps applied
+    bool base_use_crc;
+    DS18B20_RESOLUTION base_resolution[SENSORS_MAX_DEVICES];  ///< Configured resolution of each device
+
+    uint32_t period_ms;                         ///< Settings currently applied
+    int resolution_steps;                       ///< Bits removed from each device's configured resolution
+    bool use_crc;
+
+    uint32_t power_mw;                          ///< Most recent mean power estimate, in milliwatts
+
+    int over_count;                             ///< Consecutive cycles over budget
+    int under_count;                            ///< Consecutive cycles well under budget
+    uint32_t changes;                           ///< Number of setting changes made
+} governor_t;
+
+/**
+ * @brief Initialise a governor with the settings currently in use.
+ *
+ * Each device's current resolution is taken as its configured resolution. Resolution steps
+ * lower every device by the same number of bits from its own configured resolution, never
+ * below config->min_resolution, so per-device settings are preserved relative to each other.
+ */
+void governor_init(governor_t * governor, const governor_config_t * config, sampler_t * sampler, sensors_t * sensors,
+                   uint32_t period_ms, bool use_crc);
+
+/**
+ * @brief Report the estimated mean power of the most recent cycle, before calling governor_update().
+ */
+void governor_report_power(governor_t * governor, uint32_t power_mw);
+
+/**
+ * @brief Evaluate the most recent cycle and adjust settings if required.
+ *
+ * Must be called from the sampling task, after sampler_step() reports a completed cycle.
+ */
+void governor_update(governor_t * governor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // GOVERNOR_H
@@ -0,0 +1,332 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "history.h"
+
+#define QUERY_VALUE_LENGTH   (24)
+
+static const char * TAG = "history";
+
+history_t * history_malloc(const sensors_t * sensors, int num_blocks, int interval)
+{
+    history_t * history = calloc(1, sizeof(*history));
+    if (history == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+    history->sensors = sensors;
+    history->num_blocks = num_blocks;
+    history->interval = interval > 0 ? interval : 1;
+    history->mutex = xSemaphoreCreateMutex();
+    history->index = calloc(num_blocks, sizeof(history_index_t));
+    history->blocks = malloc((size_t)num_blocks * HISTORY_BLOCK_SAMPLES * sizeof(history_sample_t));
+    if (history->mutex == NULL || history->index == NULL || history->blocks == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        free(history->index);
+        free(history->blocks);
+        free(history);
+        return NULL;
+    }
+    ESP_LOGI(TAG, "%d samples in %d blocks, every %d cycles", num_blocks * HISTORY_BLOCK_SAMPLES, num_blocks, history->interval);
+    return history;
+}
+
+// Index entry of the n-th oldest block
+static inline history_index_t * _index(history_t * history, int n)
+{
+    int oldest = (history->head - history->used + 1 + history->num_blocks) % history->num_blocks;
+    return &history->index[(oldest + n) % history->num_blocks];
+}
+
+// Append one sample. Called with the mutex held.
+static void _append(history_t * history, uint32_t time_ms, int device, int16_t value)
+{
+    history_index_t * index = &history->index[history->head];
+    if (index->count == HISTORY_BLOCK_SAMPLES || history->used == 0)
+    {
+        // start a new block, overwriting the oldest once the ring is full
+        uint32_t last_ms = history->used > 0 ? index->last_ms : 0;
+        if (history->used > 0)
+        {
+            history->head = (history->head + 1) % history->num_blocks;
+        }
+        if (history->used < history->num_blocks)
+        {
+            ++history->used;
+        }
+        index = &history->index[history->head];
+        memset(index, 0, sizeof(*index));
+        index->first_ms = UINT32_MAX;
+        index->last_ms = last_ms;
+    }
+
+    history_sample_t * sample = &history->blocks[history->head * HISTORY_BLOCK_SAMPLES + index->count];
+    sample->time_ms = time_ms;
+    sample->device = (uint16_t)device;
+    sample->value = value;
+    index->last_ms = time_ms > index->last_ms ? time_ms : index->last_ms;
+    index->devices |= 1u << (device % 32);
+    ++index->count;
+
+    // buses are read in parallel, so a cycle's samples are not appended in time order and
+    // this one may be older than earlier blocks' first samples; lower their bounds
+    for (int n = history->used - 1; n >= 0 && _index(history, n)->first_ms > time_ms; --n)
+    {
+        _index(history, n)->first_ms = time_ms;
+    }
+}
+
+void history_append(history_t * history, const sensors_snapshot_t * snapshot)
+{
+    uint32_t cycle = snapshot->cycle;
+    xSemaphoreTake(history->mutex, portMAX_DELAY);
+    for (int i = 0; i < snapshot->num_devices; ++i)
+    {
+        // a device that was not read this cycle still holds the reading already recorded
+        if (snapshot->fresh[i] && snapshot->status[i] == DS18B20_OK && (int32_t)(cycle - history->next_cycle[i]) >= 0)
+        {
+            _append(history, history->time_offset_ms + (uint32_t)(snapshot->timestamp[i] / 1000), i, snapshot->value[i]);
+            history->next_cycle[i] = cycle + history->interval;
+        }
+    }
+    xSemaphoreGive(history->mutex);
+}
+
+void history_append_values(history_t * history, uint32_t cycle, uint32_t time_ms, const int16_t * values, int num_devices)
+{
+    if (cycle % history->interval != 0)
+    {
+        return;
+    }
+
+    xSemaphoreTake(history->mutex, portMAX_DELAY);
+    for (int i = 0; i < num_devices; ++i)
+    {
+        if (values[i] != INT16_MIN)
+        {
+            _append(history, time_ms, i, values[i]);
+        }
+    }
+    xSemaphoreGive(history->mutex);
+}
+
+uint32_t history_now_ms(const history_t * history)
+{
+    return history->time_offset_ms + (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+int history_query(history_t * history, const history_query_t * query, history_point_t * points, int max_points, history_stats_t * stats)
+{
+    int64_t start = esp_timer_get_time();
+    history_stats_t local_stats;
+    stats = stats != NULL ? stats : &local_stats;
+    memset(stats, 0, sizeof(*stats));
+
+    int num_points = 0;
+    int buckets = query->points < max_points ? query->points : max_points;
+    uint64_t span = (uint64_t)query->to_ms - query->from_ms + 1;
+    if (buckets > 0)
+    {
+        // bucket b covers [from + b * span / buckets, from + (b + 1) * span / buckets)
+        for (int b = 0; b < buckets; ++b)
+        {
+            points[b] = (history_point_t) { .time_ms = query->from_ms + (uint32_t)(b * span / buckets) };
+        }
+        num_points = buckets;
+    }
+    if (query->to_ms < query->from_ms || query->device < 0)
+    {
+        return 0;
+    }
+
+    xSemaphoreTake(history->mutex, portMAX_DELAY);
+
+    // last_ms only increases from block to block, so find the first that may reach the range
+    int lo = 0;
+    int hi = history->used;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (_index(history, mid)->last_ms < query->from_ms)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    uint32_t mask = 1u << (query->device % 32);
+    for (int n = lo; n < history->used; ++n)
+    {
+        const history_index_t * index = _index(history, n);
+        if (index->first_ms > query->to_ms)
+        {
+            break;
+        }
+        if ((index->devices & mask) == 0)
+        {
+            ++stats->blocks_skipped;
+            continue;
+        }
+        ++stats->blocks_scanned;
+        stats->samples_scanned += index->count;
+
+        const history_sample_t * block = &history->blocks[(index - history->index) * HISTORY_BLOCK_SAMPLES];
+        for (int s = 0; s < index->count; ++s)
+        {
+            const history_sample_t * sample = &block[s];
+            if (sample->device != query->device || sample->time_ms < query->from_ms || sample->time_ms > query->to_ms)
+            {
+                continue;
+            }
+            if (buckets > 0)
+            {
+                int b = (int)((uint64_t)(sample->time_ms - query->from_ms) * buckets / span);
+                history_point_t * point = &points[b];
+                point->min = point->count == 0 || sample->value < point->min ? sample->value : point->min;
+                point->max = point->count == 0 || sample->value > point->max ? sample->value : point->max;
+                point->sum += sample->value;
+                ++point->count;
+            }
+            else if (num_points < max_points)
+            {
+                points[num_points++] = (history_point_t) {
+                    .time_ms = sample->time_ms,
+                    .mean = sample->value,
+                    .min = sample->value,
+                    .max = sample->value,
+                    .count = 1,
+                    .sum = sample->value,
+                };
+            }
+            else
+            {
+                stats->truncated = true;
+            }
+        }
+    }
+
+    xSemaphoreGive(history->mutex);
+
+    for (int b = 0; b < buckets; ++b)
+    {
+        if (points[b].count > 0)
+        {
+            int32_t sum = points[b].sum;
+            int32_t count = points[b].count;
+            points[b].mean = (int16_t)((sum >= 0 ? sum + count / 2 : sum - count / 2) / count);
+        }
+    }
+
+    stats->time = esp_timer_get_time() - start;
+    return num_points;
+}
+
+#ifdef CONFIG_WEB_SERVER
+
+static uint32_t _query_uint(const char * query_string, const char * key, uint32_t default_value)
+{
+    char value[QUERY_VALUE_LENGTH];
+    if (httpd_query_key_value(query_string, key, value, sizeof(value)) != ESP_OK)
+    {
+        return default_value;
+    }
+    return (uint32_t)strtoul(value, NULL, 10);
+}
+
+static esp_err_t _history_handler(httpd_req_t * req)
+{
+    history_t * history = req->user_ctx;
+
+    char query_string[128] = { 0 };
+    char device[QUERY_VALUE_LENGTH] = { 0 };
+    httpd_req_get_url_query_str(req, query_string, sizeof(query_string));
+    history_query_t query = {
+        .device = -1,
+        .from_ms = _query_uint(query_string, "from", 0),
+        .to_ms = _query_uint(query_string, "to", history_now_ms(history)),
+        .points = _query_uint(query_string, "points", 0),
+    };
+    if (httpd_query_key_value(query_string, "device", device, sizeof(device)) == ESP_OK)
+    {
+        query.device = sensors_find_member(history->sensors, device);
+    }
+    if (query.device < 0 || query.points > HISTORY_MAX_POINTS)
+    {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "device not found or too many points");
+    }
+
+    history_point_t * points = malloc(HISTORY_MAX_POINTS * sizeof(history_point_t));
+    if (points == NULL)
+    {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "out of memory");
+    }
+    history_stats_t stats;
+    int num_points = history_query(history, &query, points, HISTORY_MAX_POINTS, &stats);
+
+    char line[96];
+    httpd_resp_set_type(req, "application/json");
+    snprintf(line, sizeof(line), "{\"device\":%d,\"from\":%u,\"to\":%u,\"blocks\":%d,\"skipped\":%d,\"us\":%" PRId64 ",\"points\":[",
+             query.device, (unsigned int)query.from_ms, (unsigned int)query.to_ms,
+             stats.blocks_scanned, stats.blocks_skipped, stats.time);
+    httpd_resp_sendstr_chunk(req, line);
+    for (int p = 0; p < num_points; ++p)
+    {
+        snprintf(line, sizeof(line), "%s[%u,%d,%d,%d,%u]", p > 0 ? "," : "", (unsigned int)points[p].time_ms,
+                 points[p].mean, points[p].min, points[p].max, points[p].count);
+        httpd_resp_sendstr_chunk(req, line);
+    }
+    httpd_resp_sendstr_chunk(req, "]}");
+    free(points);
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+void history_serve(history_t * history, httpd_handle_t server)
+{
+    if (history == NULL || server == NULL)
+    {
+        return;
+    }
+    httpd_uri_t uri = {
+        .uri = "/history",
+        .method = HTTP_GET,
+        .handler = _history_handler,
+        .user_ctx = history,
+    };
+    httpd_register_uri_handler(server, &uri);
+}
+
+#endif  // CONFIG_WEB_SERVER
@@ -0,0 +1,198 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file history.h
+ * @brief In-memory history of readings, with time-range queries over a sparse block index.
+ *
+ * Good readings are appended, every interval cycles, to a ring of fixed-size blocks. Alongside
+ * the blocks, a small index records bounds on each block's times and a mask of the devices it
+ * holds. Buses are read in parallel, so blocks of one cycle overlap in time; the bounds are
+ * widened to be ordered from block to block. A query locates the first block of its time
+ * range by binary search on the index, then walks forward only while blocks may overlap the
+ * range, skipping any whose device mask excludes the device queried. Only the samples of the
+ * remaining blocks are read.
+ *
+ * Results are either the raw samples, or the range divided into equal buckets, each reduced
+ * to a mean with a min/max envelope.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_http_server.h"
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISTORY_BLOCK_SAMPLES   (64)     ///< Samples per block
+#define HISTORY_MAX_POINTS      (500)    ///< Maximum points returned by an HTTP or console query
+
+/**
+ * @brief A stored reading.
+ */
+typedef struct
+{
+    uint32_t time_ms;                ///< Time of the reading, in milliseconds since boot plus time offset
+    uint16_t device;                 ///< Index of the device
+    int16_t value;                   ///< Calibrated reading, in 1/16 degrees C
+} history_sample_t;
+
+/**
+ * @brief Index entry describing one block.
+ */
+typedef struct
+{
+    uint32_t first_ms;               ///< Earliest sample time in this or any later block
+    uint32_t last_ms;                ///< Latest sample time in this or any earlier block
+    uint32_t devices;                ///< Bit (device % 32) is set for each device with a sample in the block
+    uint16_t count;                  ///< Number of samples in the block
+} history_index_t;
+
+/**
+ * @brief History store.
+ */
+typedef struct
+{
+    const sensors_t * sensors;       ///< Devices being recorded
+    SemaphoreHandle_t mutex;         ///< Protects the blocks and index
+    int num_blocks;                  ///< Number of blocks in the ring
+    int used;                        ///< Number of blocks holding samples
+    int head;                        ///< Block currently being filled
+    int interval;                    ///< Cycles between recorded readings
+    uint32_t time_offset_ms;         ///< Added to time since boot, so that times continue across reboots
+    history_index_t * index;         ///< Index entry of each block
+    history_sample_t * blocks;       ///< num_blocks * HISTORY_BLOCK_SAMPLES samples
+    uint32_t next_cycle[SENSORS_MAX_DEVICES]; ///< Earliest cycle at which each device is recorded again
+} history_t;
+
+/**
+ * @brief A query over a time range for one device.
+ */
+typedef struct
+{
+    int device;                      ///< Index of the device
+    uint32_t from_ms;                ///< Start of range, inclusive, in milliseconds
+    uint32_t to_ms;                  ///< End of range, inclusive, in milliseconds
+    int points;                      ///< Number of buckets to reduce the range to, or 0 for raw samples
+} history_query_t;
+
+/**
+ * @brief A query result: a raw sample, or a bucket of samples.
+ */
+typedef struct
+{
+    uint32_t time_ms;                ///< Time of the sample, or start of the bucket
+    int16_t mean;                    ///< Reading, or mean of the bucket's readings, in 1/16 degrees C
+    int16_t min;                     ///< Lowest reading in the bucket
+    int16_t max;                     ///< Highest reading in the bucket
+    uint16_t count;                  ///< Number of readings in the bucket; 0 for an empty bucket
+    int32_t sum;                     ///< Sum of the bucket's readings
+} history_point_t;
+
+/**
+ * @brief Cost of a query.
+ */
+typedef struct
+{
+    int blocks_scanned;              ///< Blocks whose samples were read
+    int blocks_skipped;              ///< Blocks in the time range excluded by device mask
+    int samples_scanned;             ///< Samples read
+    bool truncated;                  ///< More raw samples matched than could be returned
+    int64_t time;                    ///< Time taken, in microseconds
+} history_stats_t;
+
+/**
+ * @brief Construct a history store.
+ * @param[in] sensors Devices to record.
+ * @param[in] num_blocks Number of blocks of HISTORY_BLOCK_SAMPLES samples to retain.
+ * @param[in] interval Record readings every interval cycles.
+ * @return Pointer to the new instance, or NULL if it cannot be allocated.
+ */
+history_t * history_malloc(const sensors_t * sensors, int num_blocks, int interval);
+
+/**
+ * @brief Append the good readings taken in a completed cycle.
+ *
+ * Only devices read in the cycle are recorded, so a device that is read less often is
+ * not recorded again with the time of its previous read. Each device is recorded at most
+ * once per interval cycles.
+ *
+ * @param[in] history Pointer to history store.
+ * @param[in] snapshot Processed readings at the end of the cycle.
+ */
+void history_append(history_t * history, const sensors_snapshot_t * snapshot);
+
+/**
+ * @brief Append readings taken at a single time, such as those recovered from before a reboot,
+ *        if the cycle falls on the recording interval.
+ * @param[in] history History store.
+ * @param[in] cycle Cycle of the readings.
+ * @param[in] time_ms Time of the readings, including the time offset.
+ * @param[in] values Readings in 1/16 degrees C, indexed by device. Values of INT16_MIN are skipped.
+ * @param[in] num_devices Number of values.
+ */
+void history_append_values(history_t * history, uint32_t cycle, uint32_t time_ms, const int16_t * values, int num_devices);
+
+/**
+ * @brief Return the current time on the history's time scale, in milliseconds.
+ */
+uint32_t history_now_ms(const history_t * history);
+
+/**
+ * @brief Run a query.
+ * @param[in] history History store.
+ * @param[in] query Device, range and number of buckets.
+ * @param[out] points Results, in time order. For a bucketed query, query->points entries are written.
+ * @param[in] max_points Capacity of points.
+ * @param[out] stats Cost of the query, may be NULL.
+ * @return Number of points written.
+ */
+int history_query(history_t * history, const history_query_t * query, history_point_t * points, int max_points, history_stats_t * stats);
+
+/**
+ * @brief Register a query handler on an HTTP server.
+ *
+ * GET /history?device=D&from=T0&to=T1&points=N returns
+ *
+ *     {"device":D,"from":T0,"to":T1,"blocks":B,"skipped":S,"us":U,"points":[[t,mean,min,max,count],...]}
+ *
+ * where device is a reference as accepted by sensors_find_member(), and times are in
+ * milliseconds on the history's time scale. The range defaults to all history up to now, and points to 0 for raw samples.
+ */
+void history_serve(history_t * history, httpd_handle_t server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // HISTORY_H
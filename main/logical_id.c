@@ -0,0 +1,134 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "logical_id.h"
+
+// DS18B20 function commands
+#define DS18B20_FUNCTION_SCRATCHPAD_WRITE  0x4E
+#define DS18B20_FUNCTION_SCRATCHPAD_READ   0xBE
+#define DS18B20_FUNCTION_SCRATCHPAD_COPY   0x48
+
+#define SCRATCHPAD_SIZE       (9)
+#define SCRATCHPAD_TRIGGER_H  (2)
+#define SCRATCHPAD_TRIGGER_L  (3)
+#define EEPROM_WRITE_TIME_MS  (10)
+
+static const char * TAG = "logical_id";
+
+// Reset the bus and address the device
+static owb_status _address(const OneWireBus * bus, OneWireBus_ROMCode rom_code, bool solo)
+{
+    bool is_present = false;
+    owb_status status = owb_reset(bus, &is_present);
+    if (status != OWB_STATUS_OK)
+    {
+        return status;
+    }
+    if (!is_present)
+    {
+        return OWB_STATUS_DEVICE_NOT_RESPONDING;
+    }
+
+    if (solo)
+    {
+        return owb_write_byte(bus, OWB_ROM_SKIP);
+    }
+
+    status = owb_write_byte(bus, OWB_ROM_MATCH);
+    if (status == OWB_STATUS_OK)
+    {
+        status = owb_write_rom_code(bus, rom_code);
+    }
+    return status;
+}
+
+owb_status logical_id_write(const OneWireBus * bus, OneWireBus_ROMCode rom_code, bool solo, uint16_t id, DS18B20_RESOLUTION resolution)
+{
+    uint8_t config = ((resolution - DS18B20_RESOLUTION_9_BIT) << 5) | 0x1f;
+    uint8_t data[] = { DS18B20_FUNCTION_SCRATCHPAD_WRITE, (uint8_t)(id >> 8), (uint8_t)(id & 0xff), config };
+
+    owb_status status = _address(bus, rom_code, solo);
+    if (status == OWB_STATUS_OK)
+    {
+        status = owb_write_bytes(bus, data, sizeof(data));
+    }
+
+    // verify before committing to EEPROM, which has limited write endurance
+    uint16_t readback = 0;
+    if (status == OWB_STATUS_OK)
+    {
+        status = logical_id_read(bus, rom_code, solo, &readback);
+    }
+    if (status == OWB_STATUS_OK && readback != id)
+    {
+        ESP_LOGE(TAG, "readback mismatch: wrote %u, read %u", id, readback);
+        status = OWB_STATUS_CRC_FAILED;
+    }
+
+    if (status == OWB_STATUS_OK)
+    {
+        status = _address(bus, rom_code, solo);
+    }
+    if (status == OWB_STATUS_OK)
+    {
+        status = owb_write_byte(bus, DS18B20_FUNCTION_SCRATCHPAD_COPY);
+    }
+    if (status == OWB_STATUS_OK)
+    {
+        // parasitic-powered devices need the strong pull-up while writing EEPROM
+        owb_set_strong_pullup(bus, true);
+        vTaskDelay(EEPROM_WRITE_TIME_MS / portTICK_PERIOD_MS + 1);
+        owb_set_strong_pullup(bus, false);
+    }
+
+    return status;
+}
+
+owb_status logical_id_read(const OneWireBus * bus, OneWireBus_ROMCode rom_code, bool solo, uint16_t * id)
+{
+    uint8_t scratchpad[SCRATCHPAD_SIZE] = { 0 };
+
+    owb_status status = _address(bus, rom_code, solo);
+    if (status == OWB_STATUS_OK)
+    {
+        status = owb_write_byte(bus, DS18B20_FUNCTION_SCRATCHPAD_READ);
+    }
+    if (status == OWB_STATUS_OK)
+    {
+        status = owb_read_bytes(bus, scratchpad, sizeof(scratchpad));
+    }
+    if (status == OWB_STATUS_OK && owb_crc8_bytes(0, scratchpad, sizeof(scratchpad)) != 0)
+    {
+        status = OWB_STATUS_CRC_FAILED;
+    }
+    if (status == OWB_STATUS_OK)
+    {
+        *id = (uint16_t)((scratchpad[SCRATCHPAD_TRIGGER_H] << 8) | scratchpad[SCRATCHPAD_TRIGGER_L]);
+    }
+    return status;
+}
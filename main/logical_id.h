@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file logical_id.h
+ * @brief Logical device IDs stored in the DS18B20 TH and TL alarm bytes.
+ *
+ * During commissioning, a 16-bit logical ID is written into each device's TH (high byte)
+ * and TL (low byte) scratchpad registers and copied to EEPROM. Thereafter the ID can be
+ * recovered from a scratchpad read, so that devices keep their identity regardless of
+ * search order, and mapping an ID to a device is a direct table index.
+ *
+ * Devices with logical IDs cannot use the TH/TL alarm thresholds or alarm search.
+ */
+
+#ifndef LOGICAL_ID_H
+#define LOGICAL_ID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "owb.h"
+#include "ds18b20.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Write a logical ID into a device's TH/TL registers and copy it to EEPROM.
+ *
+ * The configuration register is rewritten at the same time, so the resolution must be supplied.
+ *
+ * @param[in] bus Pointer to the bus.
+ * @param[in] rom_code ROM code of the device. Ignored if solo is true.
+ * @param[in] solo True if this is the only device on the bus.
+ * @param[in] id Logical ID to store.
+ * @param[in] resolution Resolution to write into the configuration register.
+ * @return OWB_STATUS_OK on success, otherwise an error code.
+ */
+owb_status logical_id_write(const OneWireBus * bus, OneWireBus_ROMCode rom_code, bool solo, uint16_t id, DS18B20_RESOLUTION resolution);
+
+/**
+ * @brief Read the logical ID from a device's scratchpad.
+ * @param[in] bus Pointer to the bus.
+ * @param[in] rom_code ROM code of the device. Ignored if solo is true.
+ * @param[in] solo True if this is the only device on the bus.
+ * @param[out] id Logical ID read from TH/TL.
+ * @return OWB_STATUS_OK on success, OWB_STATUS_CRC_FAILED if the scratchpad is corrupt, otherwise an error code.
+ */
+owb_status logical_id_read(const OneWireBus * bus, OneWireBus_ROMCode rom_code, bool solo, uint16_t * id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LOGICAL_ID_H
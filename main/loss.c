@@ -0,0 +1,62 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "loss.h"
+
+void loss_init(loss_t * loss)
+{
+    memset(loss, 0, sizeof(*loss));
+    loss->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+}
+
+void loss_record(loss_t * loss, loss_handoff_t handoff, uint32_t passed, uint32_t dropped)
+{
+    if (loss != NULL && handoff < LOSS_HANDOFF_COUNT)
+    {
+        portENTER_CRITICAL(&loss->lock);
+        loss->handoff[handoff].passed += passed;
+        loss->handoff[handoff].dropped += dropped;
+        portEXIT_CRITICAL(&loss->lock);
+    }
+}
+
+void loss_snapshot(loss_t * loss, loss_counter_t counters[LOSS_HANDOFF_COUNT])
+{
+    portENTER_CRITICAL(&loss->lock);
+    memcpy(counters, loss->handoff, sizeof(loss->handoff));
+    portEXIT_CRITICAL(&loss->lock);
+}
+
+const char * loss_handoff_name(loss_handoff_t handoff)
+{
+    switch (handoff)
+    {
+    case LOSS_HANDOFF_CAPTURE: return "capture";
+    case LOSS_HANDOFF_CYCLE: return "cycle";
+    case LOSS_HANDOFF_ALARM: return "alarm";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file loss.h
+ * @brief Counters of samples passed and dropped at each hand-off in the output pipeline.
+ *
+ * Every stage that can discard data records how many device samples it accepted and how
+ * many it dropped, so that losses under load can be attributed to a particular buffer.
+ * Together with the per-cycle and per-device sequence numbers carried in every frame,
+ * this lets a consumer detect gaps and the firmware explain them.
+ */
+
+#ifndef LOSS_H
+#define LOSS_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Points in the pipeline at which samples can be lost.
+ */
+typedef enum
+{
+    LOSS_HANDOFF_CAPTURE = 0,    ///< Sampler to post-processing frame pool
+    LOSS_HANDOFF_CYCLE,          ///< Post-processing frames to completed cycle
+    LOSS_HANDOFF_ALARM,          ///< Alarm events to the event queue
+    LOSS_HANDOFF_COUNT,
+} loss_handoff_t;
+
+/**
+ * @brief Counts for a single hand-off.
+ */
+typedef struct
+{
+    uint32_t passed;             ///< Device samples accepted
+    uint32_t dropped;            ///< Device samples discarded
+} loss_counter_t;
+
+/**
+ * @brief Counts for all hand-offs.
+ */
+typedef struct
+{
+    portMUX_TYPE lock;
+    loss_counter_t handoff[LOSS_HANDOFF_COUNT];
+} loss_t;
+
+/**
+ * @brief Initialise all counters to zero.
+ */
+void loss_init(loss_t * loss);
+
+/**
+ * @brief Record samples passed and dropped at a hand-off. Safe to call from any task.
+ * @param[in] loss Pointer to counters. May be NULL, in which case nothing is recorded.
+ */
+void loss_record(loss_t * loss, loss_handoff_t handoff, uint32_t passed, uint32_t dropped);
+
+/**
+ * @brief Take a consistent copy of all counters.
+ */
+void loss_snapshot(loss_t * loss, loss_counter_t counters[LOSS_HANDOFF_COUNT]);
+
+/**
+ * @brief Return a short name for a hand-off, for output.
+ */
+const char * loss_handoff_name(loss_handoff_t handoff);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LOSS_H
@@ -0,0 +1,139 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "lz.h"
+
+#define MIN_MATCH      (4)
+#define MAX_OFFSET     (UINT16_MAX)
+#define HASH_MULTIPLY  (2654435761u)    // Knuth's multiplicative hash
+
+static inline uint32_t _read32(const uint8_t * p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t _hash(uint32_t v)
+{
+    return (v * HASH_MULTIPLY) >> (32 - LZ_TABLE_BITS);
+}
+
+// Write the extra bytes of a length whose nibble was 15. Returns the new position, or capacity + 1 on overflow.
+static size_t _put_length(uint8_t * out, size_t op, size_t capacity, size_t extra)
+{
+    for (;;)
+    {
+        if (op >= capacity)
+        {
+            return capacity + 1;
+        }
+        out[op++] = (uint8_t)(extra < 255 ? extra : 255);
+        if (extra < 255)
+        {
+            return op;
+        }
+        extra -= 255;
+    }
+}
+
+// Write a sequence, with a match unless match_length is 0. Returns the new position, or capacity + 1 on overflow.
+static size_t _put_sequence(uint8_t * out, size_t op, size_t capacity, const uint8_t * literals, size_t num_literals,
+                            size_t offset, size_t match_length)
+{
+    if (op >= capacity)
+    {
+        return capacity + 1;
+    }
+    size_t match_code = match_length > 0 ? match_length - MIN_MATCH : 0;
+    out[op++] = (uint8_t)(((num_literals < 15 ? num_literals : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (num_literals >= 15)
+    {
+        op = _put_length(out, op, capacity, num_literals - 15);
+    }
+    if (op > capacity || capacity - op < num_literals)
+    {
+        return capacity + 1;
+    }
+    memcpy(&out[op], literals, num_literals);
+    op += num_literals;
+
+    if (match_length > 0)
+    {
+        if (capacity - op < 2)
+        {
+            return capacity + 1;
+        }
+        out[op++] = (uint8_t)(offset & 0xff);
+        out[op++] = (uint8_t)(offset >> 8);
+        if (match_code >= 15)
+        {
+            op = _put_length(out, op, capacity, match_code - 15);
+        }
+    }
+    return op;
+}
+
+size_t lz_compress(const uint8_t * in, size_t length, uint8_t * out, size_t capacity, uint16_t * table)
+{
+    if (length > LZ_MAX_INPUT)
+    {
+        return 0;
+    }
+    memset(table, 0, LZ_TABLE_SIZE * sizeof(*table));
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+    while (ip + MIN_MATCH <= length && op <= capacity)
+    {
+        uint32_t sequence = _read32(&in[ip]);
+        uint32_t h = _hash(sequence);
+        size_t ref = table[h];
+        table[h] = (uint16_t)ip;
+        if (ref >= ip || ip - ref > MAX_OFFSET || _read32(&in[ref]) != sequence)
+        {
+            ++ip;
+            continue;
+        }
+
+        size_t match_length = MIN_MATCH;
+        while (ip + match_length < length && in[ref + match_length] == in[ip + match_length])
+        {
+            ++match_length;
+        }
+        op = _put_sequence(out, op, capacity, &in[anchor], ip - anchor, ip - ref, match_length);
+        ip += match_length;
+        anchor = ip;
+    }
+
+    // the remaining input is sent as literals, which also marks the end of the stream
+    if (op <= capacity)
+    {
+        op = _put_sequence(out, op, capacity, &in[anchor], length - anchor, 0, 0);
+    }
+    return op <= capacity ? op : 0;
+}
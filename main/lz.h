@@ -0,0 +1,72 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file lz.h
+ * @brief Small LZ77 compressor for uplink blocks, in a byte format similar to LZ4.
+ *
+ * The compressed stream is a series of sequences, each a token byte followed by literals
+ * and, except for the last sequence, a match:
+ *
+ *     token      high nibble: literal count, low nibble: match length - 4
+ *     [count]    if the literal count nibble is 15, further bytes are added to it until one is not 255
+ *     literals
+ *     offset     2 bytes, little-endian: distance back to the start of the match, 1 or more
+ *     [length]   if the match length nibble is 15, further bytes as for the literal count
+ *
+ * The last sequence has literals only, and ends the stream. The compressor keeps no state
+ * between calls, and needs a hash table of LZ_TABLE_SIZE entries that the caller provides,
+ * so that it can run without a large stack.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LZ_TABLE_BITS     (10)                    ///< log2 of the number of hash table entries
+#define LZ_TABLE_SIZE     (1 << LZ_TABLE_BITS)    ///< Number of hash table entries
+#define LZ_MAX_INPUT      (UINT16_MAX)            ///< Largest input that can be compressed, in bytes
+
+/**
+ * @brief Compress a buffer.
+ * @param[in] in Data to compress.
+ * @param[in] length Length of the data, at most LZ_MAX_INPUT bytes.
+ * @param[out] out Buffer for the compressed data.
+ * @param[in] capacity Size of out.
+ * @param[in] table Hash table of LZ_TABLE_SIZE entries, used as work space.
+ * @return Length of the compressed data, or 0 if it does not fit in out.
+ */
+size_t lz_compress(const uint8_t * in, size_t length, uint8_t * out, size_t capacity, uint16_t * table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LZ_H
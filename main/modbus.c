@@ -0,0 +1,476 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "driver/uart.h"
+
+#include "modbus.h"
+
+#define FUNCTION_READ_HOLDING_REGISTERS  (0x03)
+#define FUNCTION_READ_INPUT_REGISTERS    (0x04)
+#define EXCEPTION_ILLEGAL_FUNCTION       (0x01)
+#define EXCEPTION_ILLEGAL_ADDRESS        (0x02)
+#define EXCEPTION_ILLEGAL_VALUE          (0x03)
+#define MAX_READ_REGISTERS               (125)
+
+#define MBAP_HEADER_SIZE                 (7)
+#define TCP_MAX_CLIENTS                  (4)
+#define RTU_MAX_FRAME                    (256)
+#define RTU_GAP_SYMBOLS                  (3)       // silence that ends a frame, in character times
+#define RTU_QUEUE_SIZE                   (8)
+#define SERVER_STACK_SIZE                (4096)
+#define SERVER_PRIORITY                  (4)
+
+static const char * TAG = "modbus";
+
+static inline void _put_u16(uint8_t * dst, uint16_t value)
+{
+    dst[0] = value >> 8;
+    dst[1] = value & 0xff;
+}
+
+modbus_t * modbus_malloc(void)
+{
+    modbus_t * modbus = calloc(1, sizeof(*modbus));
+    if (modbus == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+    modbus->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    modbus->registers = modbus->buffers[0];
+    return modbus;
+}
+
+void modbus_update(modbus_t * modbus, const sensors_t * sensors, const sensors_snapshot_t * snapshot, const sensors_summary_t * summary)
+{
+    uint32_t cycle = snapshot->cycle;
+    uint8_t header[MODBUS_HEADER_REGISTERS * 2] = { 0 };
+    _put_u16(&header[0], cycle >> 16);
+    _put_u16(&header[2], cycle & 0xffff);
+    _put_u16(&header[4], snapshot->num_devices);
+    _put_u16(&header[6], summary->num_ok);
+    _put_u16(&header[8], summary->num_errors);
+    _put_u16(&header[10], summary->num_ok > 0 ? summary->min_raw : 0);
+    _put_u16(&header[12], summary->num_ok > 0 ? summary->max_raw : 0);
+
+    // only this task replaces the served map, so it can be read here without the lock
+    uint8_t * registers = modbus->registers == modbus->buffers[0] ? modbus->buffers[1] : modbus->buffers[0];
+    memcpy(registers, header, sizeof(header));
+    memset(&registers[MODBUS_LOGICAL_BASE * 2], 0, (MODBUS_ZONE_BASE - MODBUS_LOGICAL_BASE) * 2);
+    for (int i = 0; i < snapshot->num_devices; ++i)
+    {
+        uint8_t * reg = &registers[(MODBUS_HEADER_REGISTERS + i * MODBUS_DEVICE_REGISTERS) * 2];
+        uint32_t sequence = snapshot->sequence[i];
+        _put_u16(&reg[0], (uint16_t)snapshot->value[i]);
+        _put_u16(&reg[2], (uint16_t)snapshot->status[i]);
+        _put_u16(&reg[4], sequence >> 16);
+        _put_u16(&reg[6], sequence & 0xffff);
+
+        uint16_t id = sensors->cold[i].logical_id;
+        if (id < SENSORS_MAX_DEVICES)
+        {
+            memcpy(&registers[(MODBUS_LOGICAL_BASE + id * MODBUS_DEVICE_REGISTERS) * 2], reg, MODBUS_DEVICE_REGISTERS * 2);
+        }
+    }
+    memcpy(&registers[MODBUS_ZONE_BASE * 2], &modbus->registers[MODBUS_ZONE_BASE * 2],
+           (MODBUS_NUM_REGISTERS - MODBUS_ZONE_BASE) * 2);
+
+    portENTER_CRITICAL(&modbus->lock);
+    modbus->registers = registers;
+    portEXIT_CRITICAL(&modbus->lock);
+}
+
+void modbus_update_zones(modbus_t * modbus, const zone_result_t * results, int num_zones)
+{
+    portENTER_CRITICAL(&modbus->lock);
+    for (int z = 0; z < num_zones && z < ZONES_MAX; ++z)
+    {
+        uint8_t * reg = &modbus->registers[(MODBUS_ZONE_BASE + z * MODBUS_ZONE_REGISTERS) * 2];
+        _put_u16(&reg[0], (uint16_t)results[z].mean);
+        _put_u16(&reg[2], (uint16_t)results[z].min);
+        _put_u16(&reg[4], (uint16_t)results[z].max);
+        _put_u16(&reg[6], (uint16_t)results[z].spread);
+        _put_u16(&reg[8], (uint16_t)results[z].count);
+    }
+    portEXIT_CRITICAL(&modbus->lock);
+}
+
+// The TCP and RTU servers run in separate tasks
+static void _count(modbus_t * modbus, uint32_t * counter)
+{
+    portENTER_CRITICAL(&modbus->lock);
+    ++*counter;
+    portEXIT_CRITICAL(&modbus->lock);
+}
+
+static size_t _exception(modbus_t * modbus, uint8_t function, uint8_t code, uint8_t * response)
+{
+    _count(modbus, &modbus->exceptions);
+    response[0] = function | 0x80;
+    response[1] = code;
+    return 2;
+}
+
+size_t modbus_handle_pdu(modbus_t * modbus, const uint8_t * request, size_t request_len, uint8_t * response)
+{
+    if (request_len < 1)
+    {
+        return 0;
+    }
+
+    uint8_t function = request[0];
+    _count(modbus, &modbus->requests);
+    if (function != FUNCTION_READ_HOLDING_REGISTERS && function != FUNCTION_READ_INPUT_REGISTERS)
+    {
+        return _exception(modbus, function, EXCEPTION_ILLEGAL_FUNCTION, response);
+    }
+    if (request_len != 5)
+    {
+        return _exception(modbus, function, EXCEPTION_ILLEGAL_VALUE, response);
+    }
+
+    uint16_t start = (request[1] << 8) | request[2];
+    uint16_t quantity = (request[3] << 8) | request[4];
+    if (quantity < 1 || quantity > MAX_READ_REGISTERS)
+    {
+        return _exception(modbus, function, EXCEPTION_ILLEGAL_VALUE, response);
+    }
+    if (start + quantity > MODBUS_NUM_REGISTERS)
+    {
+        return _exception(modbus, function, EXCEPTION_ILLEGAL_ADDRESS, response);
+    }
+
+    response[0] = function;
+    response[1] = quantity * 2;
+    portENTER_CRITICAL(&modbus->lock);
+    memcpy(&response[2], &modbus->registers[start * 2], quantity * 2);
+    portEXIT_CRITICAL(&modbus->lock);
+    return 2 + quantity * 2;
+}
+
+// Modbus TCP
+
+typedef struct
+{
+    modbus_t * modbus;
+    uint16_t port;
+} tcp_args_t;
+
+typedef struct
+{
+    int sock;
+    size_t len;
+    uint8_t buffer[MBAP_HEADER_SIZE + MODBUS_MAX_PDU];
+} tcp_client_t;
+
+// Process every complete frame in a client's buffer. Returns false if the client should be closed.
+static bool _tcp_process(modbus_t * modbus, tcp_client_t * client)
+{
+    while (client->len >= MBAP_HEADER_SIZE)
+    {
+        uint16_t protocol = (client->buffer[2] << 8) | client->buffer[3];
+        uint16_t length = (client->buffer[4] << 8) | client->buffer[5];
+        if (protocol != 0 || length < 2 || length > MODBUS_MAX_PDU + 1)
+        {
+            return false;
+        }
+        size_t frame_len = 6 + length;
+        if (client->len < frame_len)
+        {
+            break;
+        }
+
+        uint8_t response[MBAP_HEADER_SIZE + MODBUS_MAX_PDU];
+        size_t pdu_len = modbus_handle_pdu(modbus, &client->buffer[MBAP_HEADER_SIZE], length - 1, &response[MBAP_HEADER_SIZE]);
+        memcpy(response, client->buffer, 4);                    // transaction and protocol identifiers
+        _put_u16(&response[4], pdu_len + 1);
+        response[6] = client->buffer[6];                        // unit identifier
+        if (send(client->sock, response, MBAP_HEADER_SIZE + pdu_len, 0) < 0)
+        {
+            return false;
+        }
+
+        memmove(client->buffer, &client->buffer[frame_len], client->len - frame_len);
+        client->len -= frame_len;
+    }
+    return true;
+}
+
+static void _tcp_task(void * pvParameter)
+{
+    tcp_args_t args = *(tcp_args_t *)pvParameter;
+    free(pvParameter);
+
+    int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(args.port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int opt = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (listen_sock < 0 || bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_sock, 2) != 0)
+    {
+        ESP_LOGE(TAG, "unable to listen on port %u: errno %d", args.port, errno);
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Modbus TCP listening on port %u", args.port);
+
+    tcp_client_t * clients = calloc(TCP_MAX_CLIENTS, sizeof(tcp_client_t));
+    if (clients == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        close(listen_sock);
+        vTaskDelete(NULL);
+        return;
+    }
+    for (int c = 0; c < TCP_MAX_CLIENTS; ++c)
+    {
+        clients[c].sock = -1;
+    }
+
+    while (1)
+    {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(listen_sock, &readfds);
+        int max_fd = listen_sock;
+        for (int c = 0; c < TCP_MAX_CLIENTS; ++c)
+        {
+            if (clients[c].sock >= 0)
+            {
+                FD_SET(clients[c].sock, &readfds);
+                max_fd = clients[c].sock > max_fd ? clients[c].sock : max_fd;
+            }
+        }
+
+        if (select(max_fd + 1, &readfds, NULL, NULL, NULL) <= 0)
+        {
+            continue;
+        }
+
+        if (FD_ISSET(listen_sock, &readfds))
+        {
+            int sock = accept(listen_sock, NULL, NULL);
+            int c = 0;
+            while (c < TCP_MAX_CLIENTS && clients[c].sock >= 0)
+            {
+                ++c;
+            }
+            if (c < TCP_MAX_CLIENTS)
+            {
+                int nodelay = 1;
+                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+                clients[c].sock = sock;
+                clients[c].len = 0;
+            }
+            else if (sock >= 0)
+            {
+                close(sock);
+            }
+        }
+
+        for (int c = 0; c < TCP_MAX_CLIENTS; ++c)
+        {
+            tcp_client_t * client = &clients[c];
+            if (client->sock < 0 || !FD_ISSET(client->sock, &readfds))
+            {
+                continue;
+            }
+            int n = recv(client->sock, &client->buffer[client->len], sizeof(client->buffer) - client->len, 0);
+            if (n > 0)
+            {
+                client->len += n;
+            }
+            if (n <= 0 || !_tcp_process(args.modbus, client))
+            {
+                close(client->sock);
+                client->sock = -1;
+            }
+        }
+    }
+}
+
+void modbus_start_tcp(modbus_t * modbus, uint16_t port)
+{
+    tcp_args_t * args = malloc(sizeof(*args));
+    if (args == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return;
+    }
+    args->modbus = modbus;
+    args->port = port;
+    xTaskCreate(_tcp_task, "modbus_tcp", SERVER_STACK_SIZE, args, SERVER_PRIORITY, NULL);
+}
+
+// Modbus RTU
+
+typedef struct
+{
+    modbus_t * modbus;
+    modbus_rtu_config_t config;
+} rtu_args_t;
+
+static uint16_t _crc16(const uint8_t * data, size_t len)
+{
+    uint16_t crc = 0xffff;
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+// Answer a complete frame, if it is addressed to this server and its CRC is correct
+static void _rtu_frame(const rtu_args_t * args, const uint8_t * request, size_t len)
+{
+    if (len < 4 || request[0] != args->config.address || _crc16(request, len) != 0)
+    {
+        return;
+    }
+
+    uint8_t response[MODBUS_MAX_PDU + 3];
+    size_t pdu_len = modbus_handle_pdu(args->modbus, &request[1], len - 3, &response[1]);
+    response[0] = args->config.address;
+    uint16_t crc = _crc16(response, pdu_len + 1);
+    response[pdu_len + 1] = crc & 0xff;
+    response[pdu_len + 2] = crc >> 8;
+    uart_write_bytes(args->config.uart_num, response, pdu_len + 3);
+}
+
+static void _rtu_task(void * pvParameter)
+{
+    rtu_args_t args = *(rtu_args_t *)pvParameter;
+    free(pvParameter);
+
+    uart_config_t uart_config = {
+        .baud_rate = args.config.baud_rate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+        .source_clk = UART_SCLK_DEFAULT,
+#else
+        .source_clk = UART_SCLK_APB,
+#endif
+    };
+    QueueHandle_t events = NULL;
+    ESP_ERROR_CHECK(uart_driver_install(args.config.uart_num, RTU_MAX_FRAME * 2, 0, RTU_QUEUE_SIZE, &events, 0));
+    ESP_ERROR_CHECK(uart_param_config(args.config.uart_num, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(args.config.uart_num, args.config.tx_gpio, args.config.rx_gpio,
+                                 args.config.rts_gpio >= 0 ? args.config.rts_gpio : UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    if (args.config.rts_gpio >= 0)
+    {
+        ESP_ERROR_CHECK(uart_set_mode(args.config.uart_num, UART_MODE_RS485_HALF_DUPLEX));
+    }
+
+    // A frame ends with 3.5 character times of silence, and characters within a frame are at
+    // most 1.5 apart. The receive timeout is in whole characters, so 3 ends every frame at its
+    // gap and never within one. The driver flags the data event that follows the timeout.
+    ESP_ERROR_CHECK(uart_set_rx_timeout(args.config.uart_num, RTU_GAP_SYMBOLS));
+    ESP_LOGI(TAG, "Modbus RTU on UART %d, address %u", args.config.uart_num, args.config.address);
+
+    uint8_t request[RTU_MAX_FRAME];
+    size_t len = 0;
+    bool overrun = false;
+    while (1)
+    {
+        uart_event_t event;
+        if (xQueueReceive(events, &event, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+        if (event.type != UART_DATA)
+        {
+            // a FIFO or buffer overflow, or a line error, loses the frame in progress
+            uart_flush_input(args.config.uart_num);
+            len = 0;
+            overrun = false;
+            continue;
+        }
+
+        // accumulate the frame, discarding anything beyond the longest valid frame
+        size_t size = event.size;
+        while (size > 0)
+        {
+            uint8_t discard[32];
+            size_t space = sizeof(request) - len;
+            uint8_t * dst = space > 0 ? &request[len] : discard;
+            size_t chunk = space > 0 ? (size < space ? size : space) : (size < sizeof(discard) ? size : sizeof(discard));
+            int n = uart_read_bytes(args.config.uart_num, dst, chunk, 0);
+            if (n <= 0)
+            {
+                break;
+            }
+            if (space > 0)
+            {
+                len += n;
+            }
+            else
+            {
+                overrun = true;
+            }
+            size -= n;
+        }
+
+        if (event.timeout_flag)
+        {
+            if (!overrun)
+            {
+                _rtu_frame(&args, request, len);
+            }
+            len = 0;
+            overrun = false;
+        }
+    }
+}
+
+void modbus_start_rtu(modbus_t * modbus, const modbus_rtu_config_t * config)
+{
+    rtu_args_t * args = malloc(sizeof(*args));
+    if (args == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return;
+    }
+    args->modbus = modbus;
+    args->config = *config;
+    xTaskCreate(_rtu_task, "modbus_rtu", SERVER_STACK_SIZE, args, SERVER_PRIORITY, NULL);
+}
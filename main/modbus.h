@@ -0,0 +1,161 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file modbus.h
+ * @brief Modbus RTU and TCP server exposing the most recent readings.
+ *
+ * The register map is held preformatted in Modbus (big-endian) byte order, so read requests
+ * are answered by copying a range of the map and never touch the 1-Wire bus. Each cycle's
+ * map is built in a second buffer and swapped in, so the lock is only held for the swap.
+ * Function codes 03 (read holding registers) and 04 (read input registers) both read the
+ * same map:
+ *
+ *   Address  Contents
+ *   0        Cycle sequence number, high word
+ *   1        Cycle sequence number, low word
+ *   2        Number of devices
+ *   3        Devices read successfully in the cycle
+ *   4        Devices that failed to read in the cycle
+ *   5        Lowest reading in the cycle, 1/16 degrees C
+ *   6        Highest reading in the cycle, 1/16 degrees C
+ *   7        Reserved
+ *   8 + 4n   Device at index n: reading, 1/16 degrees C (signed)
+ *   9 + 4n   Device at index n: status of most recent read (DS18B20_ERROR or SENSORS_ERROR_, signed)
+ *   10 + 4n  Device at index n: sequence number, high word
+ *   11 + 4n  Device at index n: sequence number, low word
+ *   L + 4k   Device with logical ID k: the same four registers
+ *   Z + 5z   Zone z: mean, 1/16 degrees C (signed)
+ *   Z+1 + 5z Zone z: minimum, 1/16 degrees C (signed)
+ *   Z+2 + 5z Zone z: maximum, 1/16 degrees C (signed)
+ *   Z+3 + 5z Zone z: spread, 1/16 degrees C
+ *   Z+4 + 5z Zone z: number of devices contributing
+ *
+ * where L is MODBUS_LOGICAL_BASE and Z is MODBUS_ZONE_BASE.
+ *
+ * Every device appears in the index range, in the order devices were found. A device with a
+ * logical ID also appears at its ID in the logical range, so that its address does not change
+ * when devices are added or replaced; blocks for IDs no device has are zero. Keeping the two
+ * ranges apart means a logical ID can never collide with the index of another device.
+ */
+
+#ifndef MODBUS_H
+#define MODBUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "sensors.h"
+#include "zones.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODBUS_HEADER_REGISTERS   (8)      ///< Registers before the first device
+#define MODBUS_DEVICE_REGISTERS   (4)      ///< Registers per device
+#define MODBUS_LOGICAL_BASE       (MODBUS_HEADER_REGISTERS + SENSORS_MAX_DEVICES * MODBUS_DEVICE_REGISTERS)
+#define MODBUS_ZONE_BASE          (MODBUS_LOGICAL_BASE + SENSORS_MAX_DEVICES * MODBUS_DEVICE_REGISTERS)
+#define MODBUS_ZONE_REGISTERS     (5)      ///< Registers per zone
+#define MODBUS_NUM_REGISTERS      (MODBUS_ZONE_BASE + ZONES_MAX * MODBUS_ZONE_REGISTERS)
+#define MODBUS_MAX_PDU            (253)    ///< Largest Modbus PDU, in bytes
+
+/**
+ * @brief Register map and server statistics.
+ */
+typedef struct
+{
+    portMUX_TYPE lock;                                 ///< Protects registers and the counters
+    uint8_t buffers[2][MODBUS_NUM_REGISTERS * 2];      ///< Register maps in Modbus byte order
+    uint8_t * registers;                               ///< Map being served, one of buffers
+    uint32_t requests;                                 ///< Requests answered
+    uint32_t exceptions;                               ///< Requests answered with an exception
+} modbus_t;
+
+/**
+ * @brief RTU transport configuration.
+ */
+typedef struct
+{
+    int uart_num;            ///< UART peripheral
+    int baud_rate;           ///< Baud rate
+    int tx_gpio;             ///< TX GPIO
+    int rx_gpio;             ///< RX GPIO
+    int rts_gpio;            ///< RS-485 driver enable GPIO, or -1 if not used
+    uint8_t address;         ///< Server (slave) address
+} modbus_rtu_config_t;
+
+/**
+ * @brief Construct a Modbus register map with all registers zero.
+ * @return Pointer to the new instance, or NULL if it cannot be created.
+ */
+modbus_t * modbus_malloc(void);
+
+/**
+ * @brief Update the register map from the processed readings of a cycle.
+ *
+ * Must not be called concurrently with itself or modbus_update_zones().
+ *
+ * @param[in] modbus Pointer to register map.
+ * @param[in] sensors Devices, for their logical IDs.
+ * @param[in] snapshot Processed readings at the end of the cycle.
+ * @param[in] summary Summary of the cycle.
+ */
+void modbus_update(modbus_t * modbus, const sensors_t * sensors, const sensors_snapshot_t * snapshot, const sensors_summary_t * summary);
+
+/**
+ * @brief Update the zone registers from the most recent zone results.
+ * @param[in] modbus Pointer to register map.
+ * @param[in] results Zone results.
+ * @param[in] num_zones Number of zones.
+ */
+void modbus_update_zones(modbus_t * modbus, const zone_result_t * results, int num_zones);
+
+/**
+ * @brief Handle a request PDU and build the response PDU.
+ * @param[in] modbus Pointer to register map.
+ * @param[in] request Request PDU, starting with the function code.
+ * @param[in] request_len Length of the request PDU.
+ * @param[out] response Buffer of at least MODBUS_MAX_PDU bytes for the response PDU.
+ * @return Length of the response PDU.
+ */
+size_t modbus_handle_pdu(modbus_t * modbus, const uint8_t * request, size_t request_len, uint8_t * response);
+
+/**
+ * @brief Start a task serving Modbus TCP on the given port.
+ */
+void modbus_start_tcp(modbus_t * modbus, uint16_t port);
+
+/**
+ * @brief Start a task serving Modbus RTU on a UART.
+ */
+void modbus_start_rtu(modbus_t * modbus, const modbus_rtu_config_t * config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // MODBUS_H
@@ -0,0 +1,64 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file network.h
+ * @brief Wi-Fi station connection used by the network services.
+ */
+
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Connect to the configured Wi-Fi access point, reconnecting automatically if the connection is lost.
+ *
+ * Returns immediately; use network_wait_connected() to wait for an IP address.
+ */
+void network_start(void);
+
+/**
+ * @brief Wait until the station has an IP address.
+ * @param[in] timeout Maximum time to wait, in ticks.
+ * @return True if connected.
+ */
+bool network_wait_connected(TickType_t timeout);
+
+/**
+ * @brief Return true if the station currently has an IP address.
+ */
+bool network_is_connected(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // NETWORK_H
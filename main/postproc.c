@@ -0,0 +1,463 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "postproc.h"
+
+#define WORKER_STACK_SIZE   (4096)
+#define WORKER_PRIORITY     (5)
+
+static const char * TAG = "postproc";
+
+typedef struct
+{
+    postproc_t * postproc;
+    int id;
+} worker_args_t;
+
+// A cycle whose frames have all been processed, waiting for the per-cycle stage
+typedef struct
+{
+    uint32_t cycle;
+    uint32_t devices;
+    sensors_summary_t summary;
+    sensors_snapshot_t * snapshot;
+} completion_t;
+
+// Find or claim the slot for a cycle. Must be called with the lock held.
+// Returns NULL if the slot is still in use by an earlier cycle, so the cycle cannot be accepted.
+static postproc_cycle_slot_t * _slot(postproc_t * postproc, uint32_t cycle)
+{
+    if (!postproc->started)
+    {
+        postproc->active = cycle;
+        postproc->latest = cycle;
+        postproc->started = true;
+    }
+    if ((int32_t)(cycle - postproc->latest) > 0)
+    {
+        postproc->latest = cycle;
+    }
+
+    postproc_cycle_slot_t * slot = &postproc->slots[cycle % POSTPROC_CYCLE_SLOTS];
+    if (slot->cycle != cycle)
+    {
+        if (slot->cycle != 0 && !slot->done)
+        {
+            return NULL;
+        }
+        slot->cycle = cycle;
+        slot->pending = 0;
+        slot->devices = 0;
+        slot->closed = false;
+        slot->done = false;
+        sensors_summary_init(&slot->summary);
+    }
+    return slot;
+}
+
+static void _complete(postproc_t * postproc, const completion_t * completion)
+{
+    loss_record(postproc->config.loss, LOSS_HANDOFF_CYCLE, completion->devices, 0);
+    if (postproc->config.cycle_fn != NULL)
+    {
+        postproc->config.cycle_fn(postproc->config.context, completion->cycle, &completion->summary, completion->snapshot);
+    }
+    if (completion->snapshot != NULL)
+    {
+        xQueueSend(postproc->free_snapshots, &completion->snapshot, 0);
+    }
+}
+
+static void _process(postproc_t * postproc, const sensors_frame_t * frame);
+
+// Queue a frame to the next worker, or process it here if there are none
+static void _dispatch(postproc_t * postproc, sensors_frame_t * frame)
+{
+    if (postproc->config.num_workers == 0)
+    {
+        _process(postproc, frame);
+        xQueueSend(postproc->free_frames, &frame, 0);
+        return;
+    }
+
+    portENTER_CRITICAL(&postproc->lock);
+    int w = postproc->next_worker;
+    postproc->next_worker = (w + 1) % postproc->config.num_workers;
+    portEXIT_CRITICAL(&postproc->lock);
+    xQueueSend(postproc->queues[w], &frame, 0);
+    xSemaphoreGive(postproc->work);
+}
+
+// Dispatch the deferred frames of cycles no later than the active one
+static void _release(postproc_t * postproc)
+{
+    while (1)
+    {
+        sensors_frame_t * frame = NULL;
+        portENTER_CRITICAL(&postproc->lock);
+        for (int k = 0; k < postproc->num_deferred; ++k)
+        {
+            if ((int32_t)(postproc->deferred[k]->cycle - postproc->active) <= 0)
+            {
+                frame = postproc->deferred[k];
+                postproc->deferred[k] = postproc->deferred[--postproc->num_deferred];
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&postproc->lock);
+        if (frame == NULL)
+        {
+            return;
+        }
+        _dispatch(postproc, frame);
+    }
+}
+
+// Queue the completion of the active cycle once all of its frames are processed, then let the
+// next cycle's frames through. Repeats while the next cycle is also complete.
+static void _advance(postproc_t * postproc)
+{
+    xSemaphoreTake(postproc->advance, portMAX_DELAY);
+    while (1)
+    {
+        bool ready = false;
+        bool skipped = false;
+        completion_t completion;
+        portENTER_CRITICAL(&postproc->lock);
+        postproc_cycle_slot_t * slot = &postproc->slots[postproc->active % POSTPROC_CYCLE_SLOTS];
+        if (postproc->started && slot->cycle == postproc->active && slot->closed && slot->pending == 0 && !slot->done)
+        {
+            slot->done = true;
+            completion.cycle = slot->cycle;
+            completion.devices = slot->devices;
+            completion.summary = slot->summary;
+            completion.snapshot = NULL;
+            ready = true;
+        }
+        else if (postproc->started && slot->cycle != postproc->active && (int32_t)(postproc->latest - postproc->active) > 0)
+        {
+            // the active cycle never got a slot and was dropped, and the sampler has moved on
+            ++postproc->active;
+            skipped = true;
+        }
+        portEXIT_CRITICAL(&postproc->lock);
+        if (skipped)
+        {
+            _release(postproc);
+            continue;
+        }
+        if (!ready)
+        {
+            break;
+        }
+
+        // no frame of the next cycle can run until active moves on, so the snapshot is consistent
+        bool queued = true;
+        if (postproc->config.sensors != NULL)
+        {
+            queued = xQueueReceive(postproc->free_snapshots, &completion.snapshot, 0) == pdTRUE;
+            if (queued)
+            {
+                sensors_snapshot(postproc->config.sensors, completion.cycle, completion.snapshot);
+            }
+        }
+        portENTER_CRITICAL(&postproc->lock);
+        ++postproc->active;
+        portEXIT_CRITICAL(&postproc->lock);
+
+        if (!queued)
+        {
+            // the per-cycle stage is too far behind
+            loss_record(postproc->config.loss, LOSS_HANDOFF_CYCLE, 0, completion.devices);
+        }
+        else if (postproc->config.num_workers == 0)
+        {
+            _complete(postproc, &completion);
+        }
+        else
+        {
+            // never full, as there are no more snapshots than entries
+            xQueueSend(postproc->completions, &completion, 0);
+            xSemaphoreGive(postproc->work);
+        }
+        _release(postproc);
+    }
+    xSemaphoreGive(postproc->advance);
+}
+
+static void _process(postproc_t * postproc, const sensors_frame_t * frame)
+{
+    sensors_summary_t summary;
+    sensors_summary_init(&summary);
+    postproc->config.frame_fn(postproc->config.context, frame, &summary);
+
+    bool complete = false;
+    portENTER_CRITICAL(&postproc->lock);
+    postproc_cycle_slot_t * slot = &postproc->slots[frame->cycle % POSTPROC_CYCLE_SLOTS];
+    if (slot->cycle == frame->cycle)
+    {
+        sensors_summary_merge(&slot->summary, &summary);
+        --slot->pending;
+        complete = slot->closed && slot->pending == 0;
+    }
+    portEXIT_CRITICAL(&postproc->lock);
+
+    if (complete)
+    {
+        _advance(postproc);
+    }
+}
+
+// Run every queued completion, unless another worker already is. Returns true if any ran.
+static bool _run_completions(postproc_t * postproc)
+{
+    if (uxQueueMessagesWaiting(postproc->completions) == 0 || xSemaphoreTake(postproc->completing, 0) != pdTRUE)
+    {
+        return false;
+    }
+    completion_t completion;
+    while (xQueueReceive(postproc->completions, &completion, 0) == pdTRUE)
+    {
+        _complete(postproc, &completion);
+    }
+    xSemaphoreGive(postproc->completing);
+
+    // a completion queued while another worker found the semaphore taken is picked up here
+    if (uxQueueMessagesWaiting(postproc->completions) > 0)
+    {
+        xSemaphoreGive(postproc->work);
+    }
+    return true;
+}
+
+static void _worker_task(void * pvParameter)
+{
+    worker_args_t args = *(worker_args_t *)pvParameter;
+    free(pvParameter);
+    postproc_t * postproc = args.postproc;
+    int num_workers = postproc->config.num_workers;
+
+    while (1)
+    {
+        xSemaphoreTake(postproc->work, portMAX_DELAY);
+        if (_run_completions(postproc))
+        {
+            continue;
+        }
+
+        portENTER_CRITICAL(&postproc->lock);
+        bool advance = postproc->advance_requested;
+        postproc->advance_requested = false;
+        portEXIT_CRITICAL(&postproc->lock);
+        if (advance)
+        {
+            _advance(postproc);
+            continue;
+        }
+
+        // A frame may be queued somewhere: prefer our own queue, otherwise steal
+        sensors_frame_t * frame = NULL;
+        for (int n = 0; n < num_workers && frame == NULL; ++n)
+        {
+            int w = (args.id + n) % num_workers;
+            if (xQueueReceive(postproc->queues[w], &frame, 0) == pdTRUE && w != args.id)
+            {
+                portENTER_CRITICAL(&postproc->lock);
+                ++postproc->frames_stolen;
+                portEXIT_CRITICAL(&postproc->lock);
+            }
+        }
+        if (frame == NULL)
+        {
+            continue;    // its completion was run by another worker
+        }
+
+        _process(postproc, frame);
+        xQueueSend(postproc->free_frames, &frame, portMAX_DELAY);
+    }
+}
+
+postproc_t * postproc_malloc(const postproc_config_t * config)
+{
+    if (config == NULL || config->frame_fn == NULL || config->num_frames <= 0
+        || config->num_workers < 0 || config->num_workers > POSTPROC_MAX_WORKERS)
+    {
+        ESP_LOGE(TAG, "invalid configuration");
+        return NULL;
+    }
+
+    postproc_t * postproc = calloc(1, sizeof(*postproc));
+    if (postproc == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+    postproc->config = *config;
+    postproc->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+
+    postproc->frames = calloc(config->num_frames, sizeof(sensors_frame_t));
+    postproc->deferred = calloc(config->num_frames, sizeof(sensors_frame_t *));
+    postproc->free_frames = xQueueCreate(config->num_frames, sizeof(sensors_frame_t *));
+    postproc->completions = xQueueCreate(POSTPROC_COMPLETIONS, sizeof(completion_t));
+    postproc->work = xSemaphoreCreateCounting(config->num_frames + POSTPROC_COMPLETIONS + 1, 0);
+    postproc->advance = xSemaphoreCreateMutex();
+    postproc->completing = xSemaphoreCreateMutex();
+    postproc->free_snapshots = xQueueCreate(POSTPROC_COMPLETIONS, sizeof(sensors_snapshot_t *));
+    if (config->sensors != NULL)
+    {
+        postproc->snapshots = calloc(POSTPROC_COMPLETIONS, sizeof(sensors_snapshot_t));
+    }
+    if (postproc->frames == NULL || postproc->deferred == NULL || postproc->free_frames == NULL
+        || postproc->completions == NULL || postproc->work == NULL || postproc->advance == NULL
+        || postproc->completing == NULL || postproc->free_snapshots == NULL
+        || (config->sensors != NULL && postproc->snapshots == NULL))
+    {
+        ESP_LOGE(TAG, "failed to allocate frame pool");
+        abort();
+    }
+    for (int i = 0; i < config->num_frames; ++i)
+    {
+        sensors_frame_t * frame = &postproc->frames[i];
+        xQueueSend(postproc->free_frames, &frame, 0);
+    }
+    for (int i = 0; postproc->snapshots != NULL && i < POSTPROC_COMPLETIONS; ++i)
+    {
+        sensors_snapshot_t * snapshot = &postproc->snapshots[i];
+        xQueueSend(postproc->free_snapshots, &snapshot, 0);
+    }
+
+    for (int w = 0; w < config->num_workers; ++w)
+    {
+        postproc->queues[w] = xQueueCreate(config->num_frames, sizeof(sensors_frame_t *));
+        worker_args_t * args = malloc(sizeof(*args));
+        if (postproc->queues[w] == NULL || args == NULL)
+        {
+            ESP_LOGE(TAG, "failed to allocate worker %d", w);
+            abort();
+        }
+        args->postproc = postproc;
+        args->id = w;
+
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "postproc%d", w);
+        xTaskCreatePinnedToCore(_worker_task, name, WORKER_STACK_SIZE, args, WORKER_PRIORITY, NULL, w % portNUM_PROCESSORS);
+    }
+
+    return postproc;
+}
+
+// Count the devices on a bus, from index start, that are due in a cycle.
+static uint32_t _count_due(const sensors_t * sensors, int bus, int start, uint32_t cycle)
+{
+    uint32_t count = 0;
+    for (int i = start; i < sensors->num_devices; ++i)
+    {
+        count += sensors->bus[i] == bus && sensors_is_due(sensors, i, cycle);
+    }
+    return count;
+}
+
+void postproc_submit_bus(postproc_t * postproc, const sensors_t * sensors, int bus, uint32_t cycle)
+{
+    // a bus with nothing due this cycle needs neither a frame nor a cycle slot
+    if (_count_due(sensors, bus, 0, cycle) == 0)
+    {
+        return;
+    }
+
+    int start = 0;
+    while (start >= 0)
+    {
+        sensors_frame_t * frame = NULL;
+        if (xQueueReceive(postproc->free_frames, &frame, 0) != pdTRUE)
+        {
+            uint32_t dropped = _count_due(sensors, bus, start, cycle);
+            loss_record(postproc->config.loss, LOSS_HANDOFF_CAPTURE, 0, dropped);
+            ESP_LOGW(TAG, "frame pool exhausted, bus %d cycle %u: %u samples dropped", bus, (unsigned int)cycle, (unsigned int)dropped);
+            return;
+        }
+
+        int next = sensors_capture_frame(sensors, bus, start, cycle, frame);
+
+        portENTER_CRITICAL(&postproc->lock);
+        postproc_cycle_slot_t * slot = _slot(postproc, cycle);
+        bool deferred = (int32_t)(cycle - postproc->active) > 0;
+        if (slot != NULL)
+        {
+            ++slot->pending;
+            slot->devices += frame->count;
+            if (deferred)
+            {
+                postproc->deferred[postproc->num_deferred++] = frame;
+            }
+        }
+        portEXIT_CRITICAL(&postproc->lock);
+
+        if (slot == NULL)
+        {
+            // every slot holds an earlier cycle still in progress, so this cycle is dropped
+            uint32_t dropped = _count_due(sensors, bus, start, cycle);
+            xQueueSend(postproc->free_frames, &frame, 0);
+            loss_record(postproc->config.loss, LOSS_HANDOFF_CAPTURE, 0, dropped);
+            ESP_LOGW(TAG, "cycles in flight exhausted, bus %d cycle %u: %u samples dropped", bus, (unsigned int)cycle, (unsigned int)dropped);
+            return;
+        }
+        loss_record(postproc->config.loss, LOSS_HANDOFF_CAPTURE, frame->count, 0);
+        start = next;
+        if (!deferred)
+        {
+            _dispatch(postproc, frame);
+        }
+    }
+}
+
+void postproc_close_cycle(postproc_t * postproc, uint32_t cycle)
+{
+    portENTER_CRITICAL(&postproc->lock);
+    postproc_cycle_slot_t * slot = _slot(postproc, cycle);
+    if (slot != NULL)
+    {
+        slot->closed = true;
+    }
+    portEXIT_CRITICAL(&postproc->lock);
+
+    if (postproc->config.num_workers == 0)
+    {
+        _advance(postproc);
+        return;
+    }
+
+    // A worker queues the completion if every frame has already been processed, so that the
+    // sampling task neither waits for the advance mutex nor takes the snapshot itself
+    portENTER_CRITICAL(&postproc->lock);
+    postproc->advance_requested = true;
+    portEXIT_CRITICAL(&postproc->lock);
+    xSemaphoreGive(postproc->work);
+}
@@ -0,0 +1,174 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file postproc.h
+ * @brief Pool of worker tasks that post-process sample frames off the sampling task.
+ *
+ * The sampling task captures each bus's readings into frames and submits them. Frames
+ * are distributed round-robin over per-worker queues; a worker that runs out of work
+ * steals frames from the other workers' queues. Workers are pinned alternately to each
+ * core. When every frame of a cycle has been processed and the cycle has been closed by
+ * the sampler, the cycle's completion is queued and the per-cycle stage runs once with the
+ * merged summary, in a worker, never in the sampling task. The processed readings are
+ * snapshot before any frame of the next cycle runs, so the per-cycle stage sees each value
+ * with the status of the read that produced it. A completed cycle that finds no free
+ * snapshot is dropped and recorded against LOSS_HANDOFF_CYCLE.
+ *
+ * Frames within a cycle never share devices and are processed concurrently. Frames of a
+ * later cycle are held back until every frame of the cycle before has been processed, so
+ * that a device is never processed for two cycles at once. Completions run one at a time,
+ * in cycle order.
+ *
+ * With no workers configured, frames and completions are processed inline in the
+ * submitting task.
+ */
+
+#ifndef POSTPROC_H
+#define POSTPROC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "sensors.h"
+#include "loss.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POSTPROC_MAX_WORKERS   (4)     ///< Maximum number of worker tasks
+#define POSTPROC_CYCLE_SLOTS   (4)     ///< Number of cycles that may be in flight at once
+#define POSTPROC_COMPLETIONS   (4)     ///< Number of completed cycles, with their snapshots, that may wait for the per-cycle stage
+
+/**
+ * @brief Per-frame stage. Called concurrently from several workers, with distinct frames.
+ * @param[in] context Context pointer from postproc_config_t.
+ * @param[in] frame Frame to process.
+ * @param[in,out] summary Summary to accumulate the frame into, private to this call.
+ */
+typedef void (*postproc_frame_fn_t)(void * context, const sensors_frame_t * frame, sensors_summary_t * summary);
+
+/**
+ * @brief Per-cycle stage. Called once per cycle, after all of its frames have been processed,
+ * from one worker at a time and in cycle order.
+ * @param[in] context Context pointer from postproc_config_t.
+ * @param[in] cycle Sample cycle that completed.
+ * @param[in] summary Summary of all frames in the cycle.
+ * @param[in] snapshot Processed readings at the end of the cycle, or NULL if no sensors are configured.
+ */
+typedef void (*postproc_cycle_fn_t)(void * context, uint32_t cycle, const sensors_summary_t * summary,
+                                    const sensors_snapshot_t * snapshot);
+
+/**
+ * @brief Post-processing configuration.
+ */
+typedef struct
+{
+    int num_workers;                   ///< Number of worker tasks, 0 to process inline
+    int num_frames;                    ///< Number of frames in the pool
+    postproc_frame_fn_t frame_fn;      ///< Per-frame stage
+    postproc_cycle_fn_t cycle_fn;      ///< Per-cycle stage, may be NULL
+    void * context;                    ///< Passed to both stages
+    const sensors_t * sensors;         ///< Devices to snapshot for the per-cycle stage, may be NULL
+    loss_t * loss;                     ///< Loss counters to record into, may be NULL
+} postproc_config_t;
+
+/**
+ * @brief Completion state of a cycle that has frames in flight.
+ */
+typedef struct
+{
+    uint32_t cycle;                    ///< Cycle number using this slot
+    int pending;                       ///< Frames submitted but not yet processed
+    uint32_t devices;                  ///< Device samples submitted
+    bool closed;                       ///< True once the sampler has finished the cycle
+    bool done;                         ///< True once every frame is processed and the completion is queued
+    sensors_summary_t summary;         ///< Merged summary of processed frames
+} postproc_cycle_slot_t;
+
+/**
+ * @brief Worker pool state.
+ */
+typedef struct
+{
+    postproc_config_t config;
+    sensors_frame_t * frames;                       ///< Frame storage (heap allocated)
+    QueueHandle_t free_frames;                      ///< Frames available for capture
+    QueueHandle_t queues[POSTPROC_MAX_WORKERS];     ///< Per-worker queues of frames to process
+    QueueHandle_t completions;                      ///< Completed cycles waiting for the per-cycle stage
+    QueueHandle_t free_snapshots;                   ///< Snapshots available for completed cycles
+    sensors_snapshot_t * snapshots;                 ///< Snapshot storage (heap allocated), or NULL
+    SemaphoreHandle_t work;                         ///< Counts frames, completions and advance requests queued, at least
+    SemaphoreHandle_t advance;                      ///< Serialises queueing completions, so that they queue in cycle order
+    SemaphoreHandle_t completing;                   ///< Held by the worker running the per-cycle stage
+    int next_worker;                                ///< Worker to receive the next frame
+    portMUX_TYPE lock;                              ///< Protects the fields below
+    postproc_cycle_slot_t slots[POSTPROC_CYCLE_SLOTS];
+    bool started;                                   ///< True once active has been set from the first cycle
+    bool advance_requested;                         ///< A closed cycle is waiting for a worker to queue its completion
+    uint32_t active;                                ///< Oldest cycle whose frames may still be in progress
+    uint32_t latest;                                ///< Newest cycle submitted or closed
+    sensors_frame_t ** deferred;                    ///< Frames of cycles after active, held back
+    int num_deferred;                               ///< Number of deferred frames
+    uint32_t frames_stolen;                         ///< Frames processed by a worker other than the one queued to
+} postproc_t;
+
+/**
+ * @brief Construct a worker pool and start its worker tasks.
+ * @return Pointer to the new instance, or NULL if it cannot be created.
+ */
+postproc_t * postproc_malloc(const postproc_config_t * config);
+
+/**
+ * @brief Capture all devices on a bus into frames and submit them for processing.
+ *
+ * Called from the sampling task. If the frame pool is exhausted, or POSTPROC_CYCLE_SLOTS
+ * earlier cycles are still in progress, the remaining due devices of the bus are dropped
+ * for this cycle and recorded against LOSS_HANDOFF_CAPTURE. Only devices due in the cycle
+ * are captured; a bus with nothing due submits no frames.
+ *
+ * @param[in] postproc Pointer to worker pool.
+ * @param[in] sensors Devices to capture.
+ * @param[in] bus Index of the bus.
+ * @param[in] cycle Sample cycle the readings belong to.
+ */
+void postproc_submit_bus(postproc_t * postproc, const sensors_t * sensors, int bus, uint32_t cycle);
+
+/**
+ * @brief Mark a cycle as complete from the sampler's point of view; no more frames will be submitted for it.
+ *
+ * Does not wait: a worker queues the cycle's completion if its frames are already processed.
+ */
+void postproc_close_cycle(postproc_t * postproc, uint32_t cycle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // POSTPROC_H
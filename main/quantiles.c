@@ -0,0 +1,251 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "quantiles.h"
+
+static const char * TAG = "quantiles";
+
+// Quantiles logged at the end of each window
+static const float REPORTED[] = { 0.01f, 0.5f, 0.99f };
+#define NUM_REPORTED  (sizeof(REPORTED) / sizeof(REPORTED[0]))
+
+// Floor division of a by a power of two, for negative values too
+static int32_t _align_down(int32_t a, int shift)
+{
+    return (a >> shift) << shift;
+}
+
+// Merge pairs of bins, doubling the width of the window towards value
+static void _collapse(quantiles_sketch_t * sketch, int32_t value)
+{
+    int32_t width = 1 << sketch->shift;
+    int32_t base = sketch->base;
+    int shift = sketch->shift + 1;
+
+    // the new window is aligned to the new bin width, and still covers the old window
+    int32_t new_base;
+    if (value >= base)
+    {
+        new_base = _align_down(base, shift);
+    }
+    else
+    {
+        new_base = _align_down(base + QUANTILES_BINS * width + (2 * width - 1), shift) - (QUANTILES_BINS << shift);
+    }
+
+    // each old bin lies within a single new bin; moving up the window moves bins down the
+    // array, and vice versa, so iterate in the direction that never overwrites an unmoved bin
+    if (value >= base)
+    {
+        for (int i = 0; i < QUANTILES_BINS; ++i)
+        {
+            int j = (base + i * width - new_base) >> shift;
+            uint32_t count = sketch->bins[i];
+            sketch->bins[i] = 0;
+            sketch->bins[j] += count;
+        }
+    }
+    else
+    {
+        for (int i = QUANTILES_BINS - 1; i >= 0; --i)
+        {
+            int j = (base + i * width - new_base) >> shift;
+            uint32_t count = sketch->bins[i];
+            sketch->bins[i] = 0;
+            sketch->bins[j] += count;
+        }
+    }
+
+    sketch->base = new_base;
+    sketch->shift = (uint8_t)shift;
+}
+
+static void _add(quantiles_sketch_t * sketch, int16_t value)
+{
+    if (sketch->count == 0)
+    {
+        memset(sketch->bins, 0, sizeof(sketch->bins));
+        sketch->shift = 0;
+        sketch->base = value - QUANTILES_BINS / 2;
+        sketch->min = value;
+        sketch->max = value;
+    }
+
+    while ((value < sketch->base || value >= sketch->base + (QUANTILES_BINS << sketch->shift))
+           && sketch->shift < QUANTILES_MAX_SHIFT)
+    {
+        _collapse(sketch, value);
+    }
+
+    ++sketch->bins[(value - sketch->base) >> sketch->shift];
+    ++sketch->count;
+    if (value < sketch->min)
+    {
+        sketch->min = value;
+    }
+    if (value > sketch->max)
+    {
+        sketch->max = value;
+    }
+}
+
+// Estimate a quantile as the centre of the bin that holds it, within the observed range
+static int16_t _quantile(const quantiles_sketch_t * sketch, float q)
+{
+    uint32_t rank = (uint32_t)(q * (float)(sketch->count - 1) + 0.5f);
+    uint32_t seen = 0;
+    int i = 0;
+    for (; i < QUANTILES_BINS - 1; ++i)
+    {
+        seen += sketch->bins[i];
+        if (seen > rank)
+        {
+            break;
+        }
+    }
+
+    int32_t value = sketch->base + (i << sketch->shift) + ((1 << sketch->shift) >> 1);
+    if (value < sketch->min)
+    {
+        value = sketch->min;
+    }
+    if (value > sketch->max)
+    {
+        value = sketch->max;
+    }
+    return (int16_t)value;
+}
+
+quantiles_t * quantiles_malloc(const sensors_t * sensors, uint32_t window_minutes)
+{
+    quantiles_t * quantiles = calloc(1, sizeof(*quantiles));
+    if (quantiles != NULL)
+    {
+        quantiles->sketches = calloc(sensors->num_devices, sizeof(quantiles_sketch_t));
+        if (quantiles->sketches == NULL)
+        {
+            free(quantiles);
+            quantiles = NULL;
+        }
+    }
+    if (quantiles == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+
+    quantiles->num_devices = sensors->num_devices;
+    quantiles->window = (int64_t)window_minutes * 60 * 1000000;
+    quantiles->window_start = esp_timer_get_time();
+    quantiles->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    ESP_LOGI(TAG, "%d sketches, %u bytes", quantiles->num_devices,
+             (unsigned int)(quantiles->num_devices * sizeof(quantiles_sketch_t)));
+    return quantiles;
+}
+
+void quantiles_add_frame(quantiles_t * quantiles, const sensors_t * sensors, const sensors_frame_t * frame)
+{
+    int64_t start = esp_timer_get_time();
+    uint32_t updates = 0;
+
+    portENTER_CRITICAL(&quantiles->lock);
+    for (int n = 0; n < frame->count; ++n)
+    {
+        int i = frame->index[n];
+        if (frame->status[n] == DS18B20_OK && i < quantiles->num_devices)
+        {
+            _add(&quantiles->sketches[i], sensors->value[i]);
+            ++updates;
+        }
+    }
+    quantiles->updates += updates;
+    quantiles->update_time += esp_timer_get_time() - start;
+    portEXIT_CRITICAL(&quantiles->lock);
+}
+
+uint32_t quantiles_query(quantiles_t * quantiles, int device, const float * q, int16_t * values, int n, int16_t * error)
+{
+    if (device < 0 || device >= quantiles->num_devices)
+    {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&quantiles->lock);
+    const quantiles_sketch_t * sketch = &quantiles->sketches[device];
+    uint32_t count = sketch->count;
+    if (count > 0)
+    {
+        for (int k = 0; k < n; ++k)
+        {
+            values[k] = _quantile(sketch, q[k]);
+        }
+        *error = (int16_t)((1 << sketch->shift) >> 1);
+    }
+    portEXIT_CRITICAL(&quantiles->lock);
+    return count;
+}
+
+void quantiles_roll(quantiles_t * quantiles, int64_t now)
+{
+    if (now - quantiles->window_start < quantiles->window)
+    {
+        return;
+    }
+    quantiles->window_start = now;
+
+    for (int i = 0; i < quantiles->num_devices; ++i)
+    {
+        int16_t values[NUM_REPORTED];
+        int16_t error = 0;
+        uint32_t count = quantiles_query(quantiles, i, REPORTED, values, NUM_REPORTED, &error);
+
+        portENTER_CRITICAL(&quantiles->lock);
+        quantiles->sketches[i].count = 0;
+        portEXIT_CRITICAL(&quantiles->lock);
+
+        if (count > 0)
+        {
+            ESP_LOGI(TAG, "metric quantiles device=%d count=%u p1=%.4f p50=%.4f p99=%.4f error=%.4f", i,
+                     (unsigned int)count, sensors_raw_to_celsius(values[0]), sensors_raw_to_celsius(values[1]),
+                     sensors_raw_to_celsius(values[2]), sensors_raw_to_celsius(error));
+        }
+    }
+
+    portENTER_CRITICAL(&quantiles->lock);
+    uint32_t updates = quantiles->updates;
+    int64_t update_time = quantiles->update_time;
+    quantiles->updates = 0;
+    quantiles->update_time = 0;
+    portEXIT_CRITICAL(&quantiles->lock);
+
+    ESP_LOGI(TAG, "metric quantiles_update updates=%u update_us=%" PRId64 " ns_per_update=%" PRId64,
+             (unsigned int)updates, update_time, updates > 0 ? update_time * 1000 / updates : 0);
+}
@@ -0,0 +1,123 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file quantiles.h
+ * @brief Fixed-memory streaming quantile sketches, one per device.
+ *
+ * Each sketch is a histogram of QUANTILES_BINS counters over a window of values. Bins start
+ * one reading step (1/16 degree C) wide, centred on the first reading. When a reading falls
+ * outside the window, adjacent bins are merged in pairs so the window doubles in width, as in
+ * a collapsing DDSketch. Because Celsius readings cross zero, bins are equal width rather than
+ * logarithmic, which bounds the absolute error of a quantile instead of its relative error: a
+ * quantile is within half a bin width of the true value. With 128 bins, a day that spans 32
+ * degrees C reports quantiles within 0.125 degrees C.
+ *
+ * Sketches are updated from processed frames, and cover a window of time. At the end of each
+ * window the quantiles of every device are logged and the sketches restart.
+ */
+
+#ifndef QUANTILES_H
+#define QUANTILES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QUANTILES_BINS           (128)    ///< Counters per sketch
+#define QUANTILES_MAX_SHIFT      (12)     ///< Widest bins, 256 degrees C, cover every reading
+
+/**
+ * @brief Sketch of the readings of one device.
+ */
+typedef struct
+{
+    int32_t base;                         ///< Lower edge of the first bin, in 1/16 degrees C
+    uint8_t shift;                        ///< Bins are (1 << shift) / 16 degrees C wide
+    int16_t min;                          ///< Lowest reading, in 1/16 degrees C
+    int16_t max;                          ///< Highest reading, in 1/16 degrees C
+    uint32_t count;                       ///< Number of readings
+    uint32_t bins[QUANTILES_BINS];        ///< Readings in each bin
+} quantiles_sketch_t;
+
+/**
+ * @brief Sketches for all devices.
+ */
+typedef struct
+{
+    int num_devices;                      ///< Number of sketches
+    quantiles_sketch_t * sketches;        ///< One sketch per device
+    int64_t window;                       ///< Length of each window, in microseconds
+    int64_t window_start;                 ///< Start of the current window, in microseconds since boot
+
+    portMUX_TYPE lock;                    ///< Protects sketches and statistics
+    uint32_t updates;                     ///< Readings added during the current window
+    int64_t update_time;                  ///< Time spent adding them, in microseconds
+} quantiles_t;
+
+/**
+ * @brief Allocate empty sketches for the devices found.
+ * @param[in] sensors Devices to sketch.
+ * @param[in] window_minutes Length of each window, in minutes.
+ * @return Pointer to the sketches, or NULL if allocation failed.
+ */
+quantiles_t * quantiles_malloc(const sensors_t * sensors, uint32_t window_minutes);
+
+/**
+ * @brief Add the good readings in a processed frame to the sketches.
+ *
+ * Called from post-processing, after sensors_process_frame().
+ */
+void quantiles_add_frame(quantiles_t * quantiles, const sensors_t * sensors, const sensors_frame_t * frame);
+
+/**
+ * @brief Estimate quantiles of a device's readings in the current window, from any task.
+ * @param[in] quantiles Sketches.
+ * @param[in] device Index of the device.
+ * @param[in] q Quantiles to estimate, each from 0 to 1.
+ * @param[out] values Estimates, in 1/16 degrees C.
+ * @param[in] n Number of quantiles.
+ * @param[out] error Maximum absolute error of each estimate, in 1/16 degrees C.
+ * @return Number of readings in the window. The estimates are not set if this is 0.
+ */
+uint32_t quantiles_query(quantiles_t * quantiles, int device, const float * q, int16_t * values, int n, int16_t * error);
+
+/**
+ * @brief If the current window has ended, log each device's quantiles and start a new window.
+ * @param[in] now Current time, in microseconds since boot.
+ */
+void quantiles_roll(quantiles_t * quantiles, int64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // QUANTILES_H
@@ -0,0 +1,187 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "resample.h"
+
+static const char * TAG = "resample";
+
+resample_t * resample_malloc(const sensors_t * sensors, resample_mode_t mode, uint32_t step_ms, uint32_t max_latency_ms,
+                             resample_fn_t fn, void * context)
+{
+    resample_t * resample = calloc(1, sizeof(*resample));
+    if (resample != NULL)
+    {
+        resample->tracks = calloc(sensors->num_devices, sizeof(resample_track_t));
+        resample->values = calloc(sensors->num_devices, sizeof(int16_t));
+        if (resample->tracks == NULL || resample->values == NULL)
+        {
+            free(resample->tracks);
+            free(resample->values);
+            free(resample);
+            resample = NULL;
+        }
+    }
+    if (resample == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+
+    resample->mode = mode;
+    resample->step = (int64_t)step_ms * 1000;
+    resample->max_latency = (int64_t)max_latency_ms * 1000;
+    resample->fn = fn;
+    resample->context = context;
+    resample->num_devices = sensors->num_devices;
+    resample->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+
+    // the grid starts at the first whole step after now
+    int64_t now = esp_timer_get_time();
+    resample->next_time = (now / resample->step + 1) * resample->step;
+    return resample;
+}
+
+void resample_add_frame(resample_t * resample, const sensors_t * sensors, const sensors_frame_t * frame)
+{
+    portENTER_CRITICAL(&resample->lock);
+    for (int n = 0; n < frame->count; ++n)
+    {
+        int i = frame->index[n];
+        if (frame->status[n] != DS18B20_OK || i >= resample->num_devices)
+        {
+            continue;
+        }
+
+        // frames of successive cycles may be processed out of order: keep only newer readings
+        resample_track_t * track = &resample->tracks[i];
+        if (track->count > 0 && frame->converted <= track->time[track->count - 1])
+        {
+            continue;
+        }
+        if (track->count == RESAMPLE_DEPTH)
+        {
+            memmove(&track->time[0], &track->time[1], (RESAMPLE_DEPTH - 1) * sizeof(track->time[0]));
+            memmove(&track->value[0], &track->value[1], (RESAMPLE_DEPTH - 1) * sizeof(track->value[0]));
+            --track->count;
+        }
+        track->time[track->count] = frame->converted;
+        track->value[track->count] = sensors->value[i];
+        ++track->count;
+    }
+    portEXIT_CRITICAL(&resample->lock);
+}
+
+// Estimate a device's value at time t. Sets *late if no reading at or after t has arrived.
+static int16_t _value_at(const resample_t * resample, const resample_track_t * track, int64_t t, bool * late)
+{
+    // find the latest reading at or before t
+    int a = track->count - 1;
+    while (a >= 0 && track->time[a] > t)
+    {
+        --a;
+    }
+
+    *late = track->count > 0 && track->time[track->count - 1] < t;
+    if (a < 0)
+    {
+        return RESAMPLE_NO_VALUE;    // no reading old enough, or none at all
+    }
+    if (resample->mode == RESAMPLE_HOLD || a == track->count - 1 || track->time[a] == t)
+    {
+        return track->value[a];
+    }
+
+    int64_t t0 = track->time[a];
+    int64_t t1 = track->time[a + 1];
+    int32_t v0 = track->value[a];
+    int32_t v1 = track->value[a + 1];
+    return (int16_t)(v0 + (int32_t)((v1 - v0) * (t - t0) / (t1 - t0)));
+}
+
+// Return true if every device with readings has one at or after t
+static bool _ready(const resample_t * resample, int64_t t)
+{
+    for (int i = 0; i < resample->num_devices; ++i)
+    {
+        const resample_track_t * track = &resample->tracks[i];
+        if (track->count > 0 && track->time[track->count - 1] < t)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void resample_emit(resample_t * resample, int64_t now)
+{
+    // readings older than the kept depth are gone, so skip grid points that far behind
+    int64_t oldest = now - resample->max_latency - RESAMPLE_DEPTH * resample->step;
+    if (resample->next_time < oldest)
+    {
+        int64_t skip = (oldest - resample->next_time) / resample->step + 1;
+        resample->next_time += skip * resample->step;
+        resample->next_index += (uint32_t)skip;
+        resample->skipped += (uint32_t)skip;
+    }
+
+    while (resample->next_time <= now)
+    {
+        resample_frame_t frame = {
+            .index = resample->next_index,
+            .time = resample->next_time,
+            .num_devices = resample->num_devices,
+            .values = resample->values,
+        };
+
+        portENTER_CRITICAL(&resample->lock);
+        bool ready = _ready(resample, frame.time);
+        if (ready || now - frame.time >= resample->max_latency)
+        {
+            for (int i = 0; i < resample->num_devices; ++i)
+            {
+                bool late = false;
+                resample->values[i] = _value_at(resample, &resample->tracks[i], frame.time, &late);
+                frame.late += late;
+            }
+            ++resample->emitted;
+            resample->late += frame.late;
+            ready = true;
+        }
+        portEXIT_CRITICAL(&resample->lock);
+
+        if (!ready)
+        {
+            break;
+        }
+        resample->fn(resample->context, &frame);
+        resample->next_time += resample->step;
+        ++resample->next_index;
+    }
+}
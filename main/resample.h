@@ -0,0 +1,150 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file resample.h
+ * @brief Resampling of every device's readings onto a common, uniform time grid.
+ *
+ * Devices are read at different times within a cycle, depending on their bus and their
+ * position on it. This stage keeps the last few readings of each device, stamped with the
+ * time their conversion completed, and produces an aligned frame for each point of a grid
+ * with a fixed step: each device's value at the grid time is interpolated linearly between
+ * the readings either side of it, or held from the latest reading at or before it.
+ *
+ * Grid points are emitted by resample_emit(), normally at the end of each cycle. A grid point
+ * is emitted as soon as every device has a reading at or after it, or once it is max_latency
+ * old, whichever is first. Devices without a later reading by then are held at their latest
+ * value and counted as late, so buffering latency is bounded.
+ */
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RESAMPLE_DEPTH           (4)            ///< Readings kept per device
+#define RESAMPLE_NO_VALUE        (INT16_MIN)    ///< Value of a device with no reading to resample
+
+/**
+ * @brief How values between readings are estimated.
+ */
+typedef enum
+{
+    RESAMPLE_LINEAR = 0,         ///< Interpolate linearly between the readings either side
+    RESAMPLE_HOLD,               ///< Hold the latest reading at or before the grid time
+} resample_mode_t;
+
+/**
+ * @brief The most recent readings of one device, oldest first.
+ */
+typedef struct
+{
+    int count;                              ///< Number of readings held
+    int64_t time[RESAMPLE_DEPTH];           ///< Conversion times, in microseconds since boot
+    int16_t value[RESAMPLE_DEPTH];          ///< Readings, in 1/16 degrees C
+} resample_track_t;
+
+/**
+ * @brief Values of all devices at one grid point.
+ */
+typedef struct
+{
+    uint32_t index;              ///< Number of the grid point, starting from 0
+    int64_t time;                ///< Grid time, in microseconds since boot
+    int late;                    ///< Number of devices held because no later reading had arrived
+    int num_devices;             ///< Number of values
+    const int16_t * values;      ///< Values in 1/16 degrees C, indexed by device, or RESAMPLE_NO_VALUE
+} resample_frame_t;
+
+/**
+ * @brief Called with each aligned frame, from the task that calls resample_emit().
+ */
+typedef void (*resample_fn_t)(void * context, const resample_frame_t * frame);
+
+/**
+ * @brief Resampling state.
+ */
+typedef struct
+{
+    resample_mode_t mode;        ///< Estimation between readings
+    int64_t step;                ///< Grid step, in microseconds
+    int64_t max_latency;         ///< Maximum time from a grid point to its emission, in microseconds
+    resample_fn_t fn;            ///< Called with each aligned frame
+    void * context;              ///< Context for fn
+
+    int num_devices;             ///< Number of devices
+    resample_track_t * tracks;   ///< Recent readings of each device
+    int16_t * values;            ///< Values of the frame being emitted
+    int64_t next_time;           ///< Time of the next grid point to emit
+    uint32_t next_index;         ///< Number of the next grid point to emit
+
+    portMUX_TYPE lock;           ///< Protects tracks and statistics
+    uint32_t emitted;            ///< Frames emitted
+    uint32_t late;               ///< Device values held because their readings were late
+    uint32_t skipped;            ///< Grid points skipped after falling too far behind
+} resample_t;
+
+/**
+ * @brief Construct a resampling stage.
+ * @param[in] sensors Devices to resample.
+ * @param[in] mode Estimation between readings.
+ * @param[in] step_ms Grid step, in milliseconds.
+ * @param[in] max_latency_ms Maximum time from a grid point to its emission, in milliseconds.
+ * @param[in] fn Called with each aligned frame.
+ * @param[in] context Context for fn.
+ * @return Pointer to the new instance, or NULL if it cannot be allocated.
+ */
+resample_t * resample_malloc(const sensors_t * sensors, resample_mode_t mode, uint32_t step_ms, uint32_t max_latency_ms,
+                             resample_fn_t fn, void * context);
+
+/**
+ * @brief Add the good readings in a processed frame, stamped with the frame's conversion time.
+ *
+ * Called from post-processing, after sensors_process_frame().
+ */
+void resample_add_frame(resample_t * resample, const sensors_t * sensors, const sensors_frame_t * frame);
+
+/**
+ * @brief Emit every grid point that is ready, in order.
+ *
+ * Must be called from a single task at a time.
+ *
+ * @param[in] now Current time, in microseconds since boot.
+ */
+void resample_emit(resample_t * resample, int64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // RESAMPLE_H
@@ -0,0 +1,241 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+
+#include "retention.h"
+
+#define RETENTION_MAGIC   (0x31525452)    // "RTR1"
+
+static const char * TAG = "retention";
+
+typedef struct
+{
+    uint32_t cycle;
+    uint32_t time_ms;
+    uint32_t crc;                // of the record with this field zero
+    int16_t values[];
+} record_t;
+
+// Retained memory is necessarily static: it must be at a fixed address to survive a reset
+static RTC_NOINIT_ATTR retention_header_t retained_headers[2];
+static RTC_NOINIT_ATTR uint8_t retained_records[RETENTION_SIZE] __attribute__((aligned(4)));
+
+static uint32_t _header_crc(const retention_header_t * header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(retention_header_t, crc));
+}
+
+// Write the header to the copy not holding the previous one, so a reset part-way through leaves
+// that one intact
+static void _commit(retention_t * retention)
+{
+    retention_header_t * header = &retention->header;
+    ++header->generation;
+    header->crc = _header_crc(header);
+    retention->copies[header->generation & 1] = *header;
+}
+
+// Return the newer of the header copies that are intact, or NULL if neither is
+static const retention_header_t * _current(const retention_header_t copies[2])
+{
+    const retention_header_t * current = NULL;
+    for (int k = 0; k < 2; ++k)
+    {
+        const retention_header_t * copy = &copies[k];
+        if (copy->magic == RETENTION_MAGIC && copy->crc == _header_crc(copy)
+            && (current == NULL || (int32_t)(copy->generation - current->generation) > 0))
+        {
+            current = copy;
+        }
+    }
+    return current;
+}
+
+static uint32_t _record_crc(record_t * record, int record_size)
+{
+    uint32_t crc = record->crc;
+    record->crc = 0;
+    uint32_t computed = esp_rom_crc32_le(0, (const uint8_t *)record, record_size);
+    record->crc = crc;
+    return computed;
+}
+
+static uint32_t _devices_crc(const sensors_t * sensors)
+{
+    uint32_t crc = 0;
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        crc = esp_rom_crc32_le(crc, sensors->cold[i].rom_code.bytes, sizeof(sensors->cold[i].rom_code.bytes));
+    }
+    return crc;
+}
+
+static inline record_t * _record(retention_t * retention, uint32_t n)
+{
+    return (record_t *)(retention->records + (n % retention->capacity) * retention->header.record_size);
+}
+
+bool retention_init(retention_t * retention, const sensors_t * sensors)
+{
+    retention_header_t * header = &retention->header;
+    memset(retention, 0, sizeof(*retention));
+    retention->copies = retained_headers;
+    retention->records = retained_records;
+
+    size_t record_size = (sizeof(record_t) + sensors->num_devices * sizeof(int16_t) + 3) & ~3;
+    if (RETENTION_SIZE / record_size < 2)
+    {
+        ESP_LOGE(TAG, "records for %d devices do not fit, retention disabled", sensors->num_devices);
+        return false;
+    }
+    retention->capacity = RETENTION_SIZE / record_size;
+
+    const retention_header_t * current = _current(retention->copies);
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool valid = reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT
+        && current != NULL
+        && current->num_devices == sensors->num_devices
+        && current->record_size == record_size
+        && current->devices_crc == _devices_crc(sensors)
+        && current->acked <= current->written;
+
+    if (valid)
+    {
+        *header = *current;
+        uint32_t pending = header->written - header->acked;
+        retention->recovered = pending < (uint32_t)retention->capacity ? (int)pending : retention->capacity;
+        retention->time_offset_ms = header->last_time_ms;
+        ++header->boots;
+        ESP_LOGI(TAG, "boot %u: %d unsent records, last cycle %u", (unsigned int)header->boots,
+                 retention->recovered, (unsigned int)header->last_cycle);
+    }
+    else
+    {
+        memset(header, 0, sizeof(*header));
+        header->magic = RETENTION_MAGIC;
+        header->num_devices = sensors->num_devices;
+        header->record_size = (uint16_t)record_size;
+        header->devices_crc = _devices_crc(sensors);
+        header->generation = current != NULL ? current->generation : 0;    // stays newer than a stale copy
+        ESP_LOGI(TAG, "initialised for %d devices, %d records", sensors->num_devices, retention->capacity);
+    }
+    _commit(retention);
+    return retention->recovered > 0;
+}
+
+void retention_store(retention_t * retention, const sensors_snapshot_t * snapshot)
+{
+    retention_header_t * header = &retention->header;
+    if (retention->capacity == 0)
+    {
+        return;
+    }
+    uint32_t cycle = snapshot->cycle;
+    record_t * record = _record(retention, header->written);
+    record->cycle = cycle;
+    record->time_ms = retention->time_offset_ms + (uint32_t)(esp_timer_get_time() / 1000);
+    for (int i = 0; i < header->num_devices; ++i)
+    {
+        record->values[i] = snapshot->status[i] == DS18B20_OK ? snapshot->value[i] : RETENTION_NO_VALUE;
+    }
+    record->crc = 0;
+    record->crc = _record_crc(record, header->record_size);
+
+    // the header is updated last, so a reset during the record write leaves the previous state intact
+    ++header->written;
+    if (header->written - header->acked > (uint32_t)retention->capacity)
+    {
+        header->acked = header->written - retention->capacity;    // oldest record overwritten
+    }
+    header->last_cycle = cycle;
+    header->last_time_ms = record->time_ms;
+    _commit(retention);
+}
+
+int retention_replay(retention_t * retention, retention_replay_fn fn, void * context)
+{
+    retention_header_t * header = &retention->header;
+    int replayed = 0;
+    for (uint32_t n = header->written - retention->recovered; n != header->written; ++n)
+    {
+        record_t * record = _record(retention, n);
+        if (record->crc != _record_crc(record, header->record_size))
+        {
+            ESP_LOGW(TAG, "record %u corrupt, skipped", (unsigned int)n);
+            continue;
+        }
+        fn(context, record->cycle, record->time_ms, record->values, header->num_devices);
+        ++replayed;
+    }
+    return replayed;
+}
+
+void retention_ack(retention_t * retention)
+{
+    retention_header_t * header = &retention->header;
+    if (retention->capacity == 0)
+    {
+        return;
+    }
+    header->acked = header->written;
+    _commit(retention);
+    retention->recovered = 0;
+}
+
+void retention_ack_through(retention_t * retention, uint32_t cycle)
+{
+    retention_header_t * header = &retention->header;
+    if (retention->capacity == 0)
+    {
+        return;
+    }
+    uint32_t acked = header->acked;
+    while (acked != header->written)
+    {
+        record_t * record = _record(retention, acked);
+        if ((int32_t)(record->cycle - cycle) > 0 && record->crc == _record_crc(record, header->record_size))
+        {
+            break;
+        }
+        ++acked;
+    }
+    if (acked != header->acked)
+    {
+        header->acked = acked;
+        _commit(retention);
+    }
+}
+
+uint32_t retention_last_cycle(const retention_t * retention)
+{
+    return retention->header.last_cycle;
+}
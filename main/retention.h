@@ -0,0 +1,147 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file retention.h
+ * @brief Retention of recent cycles across reboots, in RTC memory that is not initialised at start-up.
+ *
+ * Every cycle's readings are written as a record into a ring in RTC_NOINIT memory, which keeps
+ * its contents through software resets, panics, watchdog resets and OTA restarts. A header
+ * holds the ring position, the number of records already acknowledged by their consumer, the
+ * last cycle number and time, and a checksum of the device set, and is itself checked by CRC.
+ * Each record carries its own CRC, so a reset part-way through a write loses only that record.
+ * The header is kept in two copies that are written alternately, each with a generation
+ * number, so a reset part-way through a header update leaves the previous header intact.
+ *
+ * If fewer than two records fit in RETENTION_SIZE, retention is disabled.
+ *
+ * At boot the header is validated. Unacknowledged records are then replayed, oldest first, so
+ * they can be delivered before any new readings, and cycle numbers and times continue from
+ * where they stopped.
+ */
+
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RETENTION_SIZE           (4096)     ///< Bytes of RTC memory used for records
+#define RETENTION_NO_VALUE       (INT16_MIN) ///< Stored in place of a failed reading
+
+/**
+ * @brief Header of the retained area. Stored in RTC memory.
+ */
+typedef struct
+{
+    uint32_t magic;              ///< RETENTION_MAGIC if initialised
+    uint16_t num_devices;        ///< Number of devices in each record
+    uint16_t record_size;        ///< Size of each record, in bytes
+    uint32_t devices_crc;        ///< CRC of the ROM codes of the devices, in index order
+    uint32_t written;            ///< Records written since initialisation
+    uint32_t acked;              ///< Records acknowledged by their consumer
+    uint32_t last_cycle;         ///< Cycle of the most recent record
+    uint32_t last_time_ms;       ///< Time of the most recent record
+    uint32_t boots;              ///< Boots since initialisation
+    uint32_t generation;         ///< Header updates, so that the newer valid copy is used
+    uint32_t crc;                ///< CRC of the fields above
+} retention_header_t;
+
+/**
+ * @brief Handle to the retained area.
+ */
+typedef struct
+{
+    retention_header_t header;   ///< Current header, written alternately to the copies in RTC memory
+    retention_header_t * copies; ///< The two header copies in RTC memory
+    uint8_t * records;           ///< Record ring in RTC memory
+    int capacity;                ///< Number of records the ring holds, 0 if retention is disabled
+    int recovered;               ///< Unacknowledged records found at boot
+    uint32_t time_offset_ms;     ///< Added to time since boot, so that record times continue across reboots
+} retention_t;
+
+/**
+ * @brief Called for each record replayed.
+ * @param[in] context Caller context.
+ * @param[in] cycle Cycle of the record.
+ * @param[in] time_ms Time of the record, including the time offset.
+ * @param[in] values Calibrated readings in 1/16 degrees C, indexed by device, or RETENTION_NO_VALUE.
+ * @param[in] num_devices Number of values.
+ */
+typedef void (*retention_replay_fn)(void * context, uint32_t cycle, uint32_t time_ms, const int16_t * values, int num_devices);
+
+/**
+ * @brief Attach to the retained area, validating it against the devices found.
+ *
+ * The area is reinitialised after a power-on reset, if neither header copy is valid, or if
+ * the devices found differ from those it was written for. Retention is disabled if a record
+ * for every device is too large for the ring to hold two.
+ * @return True if valid records from a previous boot were found.
+ */
+bool retention_init(retention_t * retention, const sensors_t * sensors);
+
+/**
+ * @brief Store the readings of a completed cycle.
+ * @param[in] retention Pointer to retention handle.
+ * @param[in] snapshot Processed readings at the end of the cycle.
+ */
+void retention_store(retention_t * retention, const sensors_snapshot_t * snapshot);
+
+/**
+ * @brief Replay unacknowledged records, oldest first. Records with a bad CRC are skipped.
+ * @return Number of records replayed.
+ */
+int retention_replay(retention_t * retention, retention_replay_fn fn, void * context);
+
+/**
+ * @brief Acknowledge all records written so far, so that they are not replayed after a reboot.
+ */
+void retention_ack(retention_t * retention);
+
+/**
+ * @brief Acknowledge the records of all cycles up to and including a cycle, oldest first.
+ *
+ * Records that fail their CRC are acknowledged as they are reached, as they cannot be replayed.
+ *
+ * @param[in] retention Pointer to retention handle.
+ * @param[in] cycle Last cycle delivered by the consumer.
+ */
+void retention_ack_through(retention_t * retention, uint32_t cycle);
+
+/**
+ * @brief Return the cycle of the most recent retained record, or 0 if there is none.
+ */
+uint32_t retention_last_cycle(const retention_t * retention);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // RETENTION_H
@@ -0,0 +1,142 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "esp_log.h"
+#include "soc/gpio_struct.h"
+#include "soc/io_mux_reg.h"
+
+#include "rmt_share.h"
+
+static const char * TAG = "rmt_share";
+
+// Route the pair to the bus's GPIO, if it is not already there
+static void _route(rmt_share_bus_t * info)
+{
+    rmt_share_t * share = info->share;
+    ++share->transactions;
+    if (share->gpio == info->gpio)
+    {
+        return;
+    }
+
+    // release the previous pin to its pull-up; this also disconnects the TX signal from it
+    gpio_set_direction(share->gpio, GPIO_MODE_INPUT);
+
+    // as in owb_rmt: set the pin for RX first, since routing TX disables the pin's input,
+    // then restore the input path to the RX channel and make the output open-drain
+    rmt_set_gpio(share->rmt.rx_channel, RMT_MODE_RX, info->gpio, false);
+    rmt_set_gpio(share->rmt.tx_channel, RMT_MODE_TX, info->gpio, false);
+    PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[info->gpio]);
+    GPIO.pin[info->gpio].pad_driver = 1;
+
+    share->gpio = info->gpio;
+    share->rmt.gpio = info->gpio;
+    ++share->switches;
+}
+
+static owb_status _uninitialize(const OneWireBus * bus)
+{
+    rmt_share_bus_t * info = container_of(bus, rmt_share_bus_t, bus);
+    if (info->share->gpio != info->gpio)
+    {
+        gpio_set_direction(info->gpio, GPIO_MODE_INPUT);
+    }
+    --info->share->num_buses;
+    return OWB_STATUS_OK;
+}
+
+static owb_status _reset(const OneWireBus * bus, bool * is_present)
+{
+    rmt_share_bus_t * info = container_of(bus, rmt_share_bus_t, bus);
+    const OneWireBus * rmt_bus = &info->share->rmt.bus;
+    _route(info);
+    return rmt_bus->driver->reset(rmt_bus, is_present);
+}
+
+static owb_status _write_bits(const OneWireBus * bus, uint8_t out, int number_of_bits_to_write)
+{
+    rmt_share_bus_t * info = container_of(bus, rmt_share_bus_t, bus);
+    const OneWireBus * rmt_bus = &info->share->rmt.bus;
+    _route(info);
+    return rmt_bus->driver->write_bits(rmt_bus, out, number_of_bits_to_write);
+}
+
+static owb_status _read_bits(const OneWireBus * bus, uint8_t * in, int number_of_bits_to_read)
+{
+    rmt_share_bus_t * info = container_of(bus, rmt_share_bus_t, bus);
+    const OneWireBus * rmt_bus = &info->share->rmt.bus;
+    _route(info);
+    return rmt_bus->driver->read_bits(rmt_bus, in, number_of_bits_to_read);
+}
+
+static const struct owb_driver rmt_share_driver =
+{
+    .name = "owb_rmt_share",
+    .uninitialize = _uninitialize,
+    .reset = _reset,
+    .write_bits = _write_bits,
+    .read_bits = _read_bits,
+};
+
+bool rmt_share_init(rmt_share_t * share, gpio_num_t gpio, rmt_channel_t tx_channel, rmt_channel_t rx_channel)
+{
+    *share = (rmt_share_t) { .gpio = gpio };
+    if (owb_rmt_initialize(&share->rmt, gpio, tx_channel, rx_channel) == NULL)
+    {
+        ESP_LOGE(TAG, "failed to install RMT channels %d and %d", tx_channel, rx_channel);
+        return false;
+    }
+    return true;
+}
+
+OneWireBus * rmt_share_initialize(rmt_share_bus_t * info, rmt_share_t * share, gpio_num_t gpio)
+{
+    *info = (rmt_share_bus_t) {
+        .share = share,
+        .gpio = gpio,
+        .bus = share->rmt.bus,    // inherit timing and defaults from the underlying bus
+    };
+    info->bus.driver = &rmt_share_driver;
+    if (share->gpio != gpio)
+    {
+        gpio_set_direction(gpio, GPIO_MODE_INPUT);    // idle until first routed
+    }
+    ++share->num_buses;
+    return &info->bus;
+}
+
+void rmt_share_free(rmt_share_t * share)
+{
+    owb_uninitialize(&share->rmt.bus);
+}
+
+void rmt_share_print_stats(rmt_share_t * share)
+{
+    uint32_t switches = share->switches;
+    uint32_t transactions = share->transactions;
+    share->switches = 0;
+    share->transactions = 0;
+    ESP_LOGI(TAG, "metric rmt_share buses=%d transactions=%u switches=%u",
+             share->num_buses, (unsigned int)transactions, (unsigned int)switches);
+}
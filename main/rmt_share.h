@@ -0,0 +1,114 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file rmt_share.h
+ * @brief 1-Wire buses on many GPIOs, sharing a single pair of RMT channels.
+ *
+ * The ESP32 has eight RMT channels, and each RMT bus normally holds a TX/RX pair for its
+ * lifetime, which limits the application to four RMT buses. A shared pair instead serves
+ * any number of buses: before each transaction the pair is re-routed through the GPIO
+ * matrix to the bus being accessed, and the pin it leaves is released to its pull-up.
+ *
+ * A bus only needs the RMT pair while a reset, write or read is in progress. Between
+ * transactions, including while its devices are converting, a bus is idle and holds no
+ * channels, so conversions on every bus still proceed in parallel while another bus is
+ * being read. Re-routing costs a few register writes and happens only when consecutive
+ * transactions are on different buses.
+ *
+ * Buses sharing a pair, and rmt_share_print_stats(), must be driven from a single task.
+ */
+
+#ifndef RMT_SHARE_H
+#define RMT_SHARE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "driver/rmt.h"
+
+#include "owb.h"
+#include "owb_rmt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief State of a shared RMT channel pair.
+ */
+typedef struct
+{
+    owb_rmt_driver_info rmt;     ///< Underlying RMT bus, which generates the timeslots
+    gpio_num_t gpio;             ///< GPIO the pair is currently routed to
+    int num_buses;               ///< Number of buses sharing the pair
+    uint32_t switches;           ///< Number of times the pair has been re-routed
+    uint32_t transactions;       ///< Number of resets, writes and reads performed
+} rmt_share_t;
+
+/**
+ * @brief Per-bus driver state.
+ */
+typedef struct
+{
+    rmt_share_t * share;         ///< Pair the bus uses
+    gpio_num_t gpio;             ///< GPIO of the bus
+    OneWireBus bus;              ///< Bus instance passed to the owb component
+} rmt_share_bus_t;
+
+/**
+ * @brief Install the RMT driver on a pair of channels for sharing.
+ * @param[out] share State to initialise.
+ * @param[in] gpio GPIO of the first bus, which the pair is initially routed to.
+ * @param[in] tx_channel RMT channel used to transmit.
+ * @param[in] rx_channel RMT channel used to receive.
+ * @return True if the RMT driver was installed.
+ */
+bool rmt_share_init(rmt_share_t * share, gpio_num_t gpio, rmt_channel_t tx_channel, rmt_channel_t rx_channel);
+
+/**
+ * @brief Initialise a bus on a GPIO, using a shared pair.
+ * @param[out] info Per-bus driver state, which must remain valid while the bus is in use.
+ * @param[in] share Pair, initialised by rmt_share_init().
+ * @param[in] gpio GPIO of the bus.
+ * @return Pointer to the bus.
+ */
+OneWireBus * rmt_share_initialize(rmt_share_bus_t * info, rmt_share_t * share, gpio_num_t gpio);
+
+/**
+ * @brief Release a shared pair, once all of its buses have been uninitialised.
+ */
+void rmt_share_free(rmt_share_t * share);
+
+/**
+ * @brief Log and reset the number of re-routes and transactions since the last call.
+ */
+void rmt_share_print_stats(rmt_share_t * share);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // RMT_SHARE_H
@@ -0,0 +1,687 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sampler.h"
+#include "capacity.h"
+
+#define PROBE_INTERVAL_MIN   (20000)    // first presence probe after a bus is found absent, in microseconds
+#define DEMAND_MARGIN        (5000)     // slack left before a bus's next cycle by an on-demand read, in microseconds
+#define CMD_CONVERT_T        (0x44)
+
+static const char * TAG = "sampler";
+
+// A task waiting in sampler_read_now(), on its own stack
+struct sampler_request
+{
+    int index;                         // device to read
+    TaskHandle_t waiter;               // task to notify once the device has been read
+    bool done;                         // set under the lock as the request is unlinked
+    struct sampler_request * next;
+};
+
+int64_t sampler_conversion_time(DS18B20_RESOLUTION resolution)
+{
+    return capacity_conversion_time_us(resolution);
+}
+
+// Find the next device on the bus at or after index, or -1 if there are none
+static int _next_device(const sensors_t * sensors, int bus, int index)
+{
+    for (int i = index; i < sensors->num_devices; ++i)
+    {
+        if (sensors->bus[i] == bus)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Find the next device on the bus at or after index that is due in the current cycle, or -1
+static int _next_due(const sampler_t * sampler, int bus, int index)
+{
+    const sensors_t * sensors = sampler->sensors;
+    for (int i = _next_device(sensors, bus, index); i >= 0; i = _next_device(sensors, bus, i + 1))
+    {
+        if (sensors_is_due(sensors, i, sampler->cycle))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void sampler_init(sampler_t * sampler, sensors_t * sensors, uint32_t period_ms)
+{
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->sensors = sensors;
+    sampler->task = xTaskGetCurrentTaskHandle();
+    sampler->period = (int64_t)period_ms * 1000;
+    sampler->cycle_start = esp_timer_get_time();
+    sampler->cycle = 1;
+    sampler->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        ++sampler->bus[sensors->bus[i]].num_devices;
+    }
+    sampler_refresh(sampler);
+
+    for (int b = 0; b < sensors->num_buses; ++b)
+    {
+        sampler->bus[b].state = SAMPLER_BUS_IDLE;
+        sampler->bus[b].wake_time = sampler->cycle_start;
+        sampler->bus[b].probe_time = INT64_MAX;
+        if (sampler->bus[b].num_devices > 0)
+        {
+            ++sampler->buses_pending;
+        }
+    }
+}
+
+void sampler_set_period(sampler_t * sampler, uint32_t period_ms)
+{
+    int64_t period = (int64_t)period_ms * 1000;
+    int64_t delta = period - sampler->period;
+    sampler->period = period;
+
+    // if the next cycle has been scheduled but not yet started, reschedule it
+    for (int b = 0; b < sampler->sensors->num_buses; ++b)
+    {
+        if (sampler->bus[b].state != SAMPLER_BUS_IDLE || sampler->bus[b].wake_time == INT64_MAX)
+        {
+            return;
+        }
+    }
+    sampler->cycle_start += delta;
+    for (int b = 0; b < sampler->sensors->num_buses; ++b)
+    {
+        if (sampler->bus[b].num_devices > 0)
+        {
+            sampler->bus[b].wake_time = sampler->cycle_start;
+        }
+    }
+}
+
+void sampler_refresh(sampler_t * sampler)
+{
+    const sensors_t * sensors = sampler->sensors;
+    for (int b = 0; b < sensors->num_buses; ++b)
+    {
+        sampler->bus[b].conversion_time = 0;
+    }
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        sampler_bus_t * bus = &sampler->bus[sensors->bus[i]];
+        int64_t conversion_time = sampler_conversion_time(sensors->cold[i].resolution);
+        if (conversion_time > bus->conversion_time)
+        {
+            bus->conversion_time = conversion_time;
+        }
+    }
+}
+
+void sampler_set_bus_callback(sampler_t * sampler, sampler_bus_callback_t callback, void * context)
+{
+    sampler->bus_callback = callback;
+    sampler->bus_callback_context = context;
+}
+
+// Find the next device on the bus at or after index that a task is waiting for, or -1 if there are none
+static int _next_requested(sampler_t * sampler, int bus, int index)
+{
+    const sensors_t * sensors = sampler->sensors;
+    int next = -1;
+    portENTER_CRITICAL(&sampler->lock);
+    for (const struct sampler_request * request = sampler->requests; request != NULL; request = request->next)
+    {
+        if (sensors->bus[request->index] == bus && request->index >= index && (next < 0 || request->index < next))
+        {
+            next = request->index;
+        }
+    }
+    portEXIT_CRITICAL(&sampler->lock);
+    return next;
+}
+
+// Remove a request from the waiting list. Returns false if it had already been removed.
+static bool _withdraw(sampler_t * sampler, struct sampler_request * target)
+{
+    bool found = false;
+    portENTER_CRITICAL(&sampler->lock);
+    for (struct sampler_request ** link = &sampler->requests; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == target)
+        {
+            *link = target->next;
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&sampler->lock);
+    return found;
+}
+
+// Wake the tasks waiting for a device that has just been read
+static void _publish(sampler_t * sampler, int index)
+{
+    if (sampler->requests == NULL)
+    {
+        return;    // a request added concurrently waits for the next read
+    }
+
+    // Unlink one request at a time: once done is set the waiter may return and its
+    // request go out of scope, so only the copied task handle is used after unlocking.
+    for (;;)
+    {
+        TaskHandle_t waiter = NULL;
+        portENTER_CRITICAL(&sampler->lock);
+        for (struct sampler_request ** link = &sampler->requests; *link != NULL; link = &(*link)->next)
+        {
+            struct sampler_request * request = *link;
+            if (request->index == index)
+            {
+                *link = request->next;
+                waiter = request->waiter;
+                request->done = true;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&sampler->lock);
+
+        if (waiter == NULL)
+        {
+            break;
+        }
+        xTaskNotifyGive(waiter);
+    }
+}
+
+// Start a conversion on a single device, addressed by its ROM code.
+// Returns false, without starting one, if no device answers the reset.
+static bool _convert_device(const sensors_t * sensors, int index)
+{
+    const OneWireBus * owb = sensors->buses[sensors->bus[index]];
+    bool present = false;
+    owb_reset(owb, &present);
+    if (!present)
+    {
+        return false;
+    }
+    owb_write_byte(owb, OWB_ROM_MATCH);
+    owb_write_rom_code(owb, sensors->cold[index].rom_code);
+    owb_write_byte(owb, CMD_CONVERT_T);
+    if (owb->use_parasitic_power)
+    {
+        owb_set_strong_pullup(owb, true);
+    }
+    return true;
+}
+
+static bool _check_presence(sampler_t * sampler, int b, int64_t now);
+static void _track_presence(sampler_t * sampler, int b, bool present, int64_t now);
+
+// Fit an on-demand conversion onto an idle bus, if it can be read before the bus's next cycle.
+// Returns true if a conversion was started.
+static bool _start_demand(sampler_t * sampler, int b, int64_t now)
+{
+    sampler_bus_t * bus = &sampler->bus[b];
+    sensors_t * sensors = sampler->sensors;
+    int first = _next_requested(sampler, b, 0);
+    if (first < 0 || bus->absent)
+    {
+        return false;
+    }
+    int count = 0;
+    for (int i = first; i >= 0; i = _next_requested(sampler, b, i + 1))
+    {
+        ++count;
+    }
+
+    // a lone device is converted by itself, several share a conversion of the whole bus
+    int64_t conversion_time = count == 1 ? sampler_conversion_time(sensors->cold[first].resolution) : bus->conversion_time;
+    capacity_mode_t mode = { .resolution = DS18B20_RESOLUTION_12_BIT, .use_crc = true };
+    int64_t next_cycle = bus->wake_time != INT64_MAX ? bus->wake_time : sampler->cycle_start + sampler->period;
+    if (now + conversion_time + count * (int64_t)capacity_read_time_us(&mode) + DEMAND_MARGIN > next_cycle)
+    {
+        return false;    // served by the periodic read instead
+    }
+
+    // as in a periodic cycle, an empty bus fails the requests rather than starting a conversion
+    bool present;
+    if (count == 1)
+    {
+        present = _convert_device(sensors, first);
+        _track_presence(sampler, b, present, now);
+    }
+    else
+    {
+        present = _check_presence(sampler, b, now);
+    }
+    if (!present)
+    {
+        for (int i = first; i >= 0; i = _next_requested(sampler, b, i + 1))
+        {
+            sensors_fail_device(sensors, i, SENSORS_ERROR_NO_PRESENCE);
+            _publish(sampler, i);
+        }
+        return false;
+    }
+
+    if (count == 1)
+    {
+        sampler->convert_time += conversion_time;
+    }
+    else
+    {
+        ds18b20_convert_all(sensors->buses[b]);
+        sampler->convert_time += bus->num_devices * conversion_time;
+    }
+    bus->on_demand = true;
+    bus->demand_device = count == 1 ? first : -1;
+    bus->resume_time = bus->wake_time;
+    bus->state = SAMPLER_BUS_CONVERTING;
+    bus->wake_time = now + conversion_time;
+    ++sampler->demand_conversions;
+    ESP_LOGD(TAG, "bus %d on-demand conversion for %d devices", b, count);
+    return true;
+}
+
+// Return a bus to its periodic schedule after an on-demand read
+static void _finish_demand(sampler_bus_t * bus)
+{
+    bus->on_demand = false;
+    bus->state = SAMPLER_BUS_IDLE;
+    bus->wake_time = bus->resume_time;
+}
+
+// Devices answered a reset on a bus that was absent: restore the resolutions they lost with power
+static void _recover_bus(sampler_t * sampler, int b)
+{
+    sampler_bus_t * bus = &sampler->bus[b];
+    sensors_t * sensors = sampler->sensors;
+    for (int i = _next_device(sensors, b, 0); i >= 0; i = _next_device(sensors, b, i + 1))
+    {
+        ds18b20_set_resolution(sensors->cold[i].info, sensors->cold[i].resolution);
+    }
+    bus->absent = false;
+    bus->probe_time = INT64_MAX;
+    ESP_LOGI(TAG, "bus %d present again", b);
+}
+
+// Track whether any device answered the most recent reset of a bus
+static void _track_presence(sampler_t * sampler, int b, bool present, int64_t now)
+{
+    sampler_bus_t * bus = &sampler->bus[b];
+    if (present && bus->absent)
+    {
+        _recover_bus(sampler, b);
+    }
+    else if (!present && !bus->absent)
+    {
+        ESP_LOGW(TAG, "no devices present on bus %d", b);
+        bus->absent = true;
+        bus->probe_interval = PROBE_INTERVAL_MIN;
+        bus->probe_time = now + bus->probe_interval;
+    }
+}
+
+// Reset a bus and track whether any device is present. Returns true if one is.
+static bool _check_presence(sampler_t * sampler, int b, int64_t now)
+{
+    bool present = false;
+    owb_reset(sampler->sensors->buses[b], &present);
+    _track_presence(sampler, b, present, now);
+    return present;
+}
+
+// Probe an absent bus between cycles, backing off until probes are a period apart
+static void _probe_bus(sampler_t * sampler, int b, int64_t now)
+{
+    sampler_bus_t * bus = &sampler->bus[b];
+    ++sampler->probes;
+    if (!_check_presence(sampler, b, now))
+    {
+        bus->probe_interval *= 2;
+        if (bus->probe_interval > sampler->period)
+        {
+            bus->probe_interval = sampler->period;
+        }
+        bus->probe_time = now + bus->probe_interval;
+    }
+}
+
+// Park a bus that has finished the cycle until every other bus has finished it too
+static void _complete_bus(sampler_t * sampler, int b)
+{
+    sampler_bus_t * bus = &sampler->bus[b];
+    bus->state = SAMPLER_BUS_IDLE;
+    bus->wake_time = INT64_MAX;
+
+    if (sampler->bus_callback != NULL)
+    {
+        sampler->bus_callback(sampler->bus_callback_context, b, sampler->cycle);
+    }
+}
+
+// Resume a single bus. Returns true if the bus completed its part of the cycle.
+static bool _step_bus(sampler_t * sampler, int b, int64_t now)
+{
+    sampler_bus_t * bus = &sampler->bus[b];
+    sensors_t * sensors = sampler->sensors;
+    const OneWireBus * owb = sensors->buses[b];
+    bool done = false;
+
+    switch (bus->state)
+    {
+    case SAMPLER_BUS_IDLE:
+        // a bus whose devices are all read less often than every cycle may have nothing to do
+        if (_next_due(sampler, b, 0) < 0)
+        {
+            _complete_bus(sampler, b);
+            done = true;
+            break;
+        }
+
+        // a single reset detects a disconnected bus, which then fails the whole cycle immediately
+        if (!_check_presence(sampler, b, now))
+        {
+            for (int i = _next_due(sampler, b, 0); i >= 0; i = _next_due(sampler, b, i + 1))
+            {
+                sensors_fail_device(sensors, i, SENSORS_ERROR_NO_PRESENCE);
+                _publish(sampler, i);
+            }
+            ++sampler->absent_cycles;
+            _complete_bus(sampler, b);
+            done = true;
+            break;
+        }
+
+        // start a conversion on all devices on this bus simultaneously, including any not due
+        ds18b20_convert_all(owb);
+        sampler->convert_time += bus->num_devices * bus->conversion_time;
+        bus->state = SAMPLER_BUS_CONVERTING;
+        bus->wake_time = now + bus->conversion_time;
+        break;
+
+    case SAMPLER_BUS_CONVERTING:
+        if (owb->use_parasitic_power)
+        {
+            // the conversion is complete, so release the strong pull-up
+            owb_set_strong_pullup(owb, false);
+            sampler->pullup_time += now - (bus->wake_time - bus->conversion_time);
+        }
+        if (bus->on_demand)
+        {
+            bus->cursor = bus->demand_device >= 0 ? bus->demand_device : _next_requested(sampler, b, 0);
+            if (bus->cursor < 0)
+            {
+                _finish_demand(bus);    // the requests timed out
+                break;
+            }
+        }
+        else
+        {
+            sensors->converted[b] = bus->wake_time;    // conversions finish by the end of the conversion time
+            bus->cursor = _next_due(sampler, b, 0);
+        }
+        bus->state = SAMPLER_BUS_READING;
+        bus->wake_time = now;
+        break;
+
+    case SAMPLER_BUS_READING:
+        if (bus->on_demand)
+        {
+            sensors_refresh_device(sensors, bus->cursor);
+            _publish(sampler, bus->cursor);
+            ++sampler->reads;
+
+            // after a whole-bus conversion, also read devices requested since it started
+            bus->cursor = bus->demand_device >= 0 ? -1 : _next_requested(sampler, b, bus->cursor + 1);
+            if (bus->cursor < 0)
+            {
+                _finish_demand(bus);
+            }
+            break;
+        }
+        sensors_read_device(sensors, bus->cursor);
+        _publish(sampler, bus->cursor);
+        ++sampler->reads;
+        bus->cursor = _next_due(sampler, b, bus->cursor + 1);
+        if (bus->cursor < 0)
+        {
+            _complete_bus(sampler, b);
+            done = true;
+        }
+        break;
+
+    default:
+        ESP_LOGE(TAG, "bus %d in invalid state %d", b, bus->state);
+        bus->state = SAMPLER_BUS_IDLE;
+        break;
+    }
+
+    return done;
+}
+
+bool sampler_step(sampler_t * sampler)
+{
+    bool cycle_complete = false;
+    bool progress = true;
+
+    ++sampler->wakeups;
+
+    // Round-robin over buses that are due, so reads on one bus are interleaved
+    // with conversion starts and reads on the others
+    while (progress)
+    {
+        progress = false;
+        for (int b = 0; b < sampler->sensors->num_buses; ++b)
+        {
+            sampler_bus_t * bus = &sampler->bus[b];
+            int64_t now = esp_timer_get_time();
+            if (bus->probe_time <= now && bus->state == SAMPLER_BUS_IDLE)
+            {
+                _probe_bus(sampler, b, now);
+                sampler->busy_time += esp_timer_get_time() - now;
+                now = esp_timer_get_time();
+            }
+            if (bus->num_devices == 0 || bus->wake_time > now)
+            {
+                // use the idle time before the bus's next periodic step for any on-demand reads
+                if (bus->num_devices > 0 && bus->state == SAMPLER_BUS_IDLE && sampler->requests != NULL
+                    && _start_demand(sampler, b, now))
+                {
+                    sampler->busy_time += esp_timer_get_time() - now;
+                    progress = true;
+                }
+                continue;
+            }
+
+            bool done = _step_bus(sampler, b, now);
+            sampler->busy_time += esp_timer_get_time() - now;
+            progress = true;
+
+            if (done && --sampler->buses_pending == 0)
+            {
+                int64_t end = esp_timer_get_time();
+                sampler->cycle_time = end - sampler->cycle_start;
+                ESP_LOGD(TAG, "cycle %" PRId64 " us, bus busy %" PRId64 " us, %u wakeups",
+                         sampler->cycle_time, sampler->busy_time, (unsigned int)sampler->wakeups);
+                cycle_complete = true;
+            }
+        }
+
+        if (cycle_complete)
+        {
+            break;
+        }
+    }
+
+    if (cycle_complete)
+    {
+        // begin the next cycle; if it is already overdue, it starts immediately,
+        // but if a whole period has been lost, skip ahead rather than trying to catch up
+        sampler->cycle_start += sampler->period;
+        int64_t now = esp_timer_get_time();
+        if (sampler->cycle_start + sampler->period < now)
+        {
+            sampler->cycle_start = now;
+            ++sampler->overruns;
+        }
+        ++sampler->cycle;
+        for (int i = 0; i < sampler->sensors->num_devices; ++i)
+        {
+            sampler->sensors->divisor[i] = sampler->sensors->target_divisor[i];    // frames of earlier cycles are already captured
+        }
+        sampler->cycle_busy_time = sampler->busy_time;
+        sampler->cycle_pullup_time = sampler->pullup_time;
+        sampler->cycle_convert_time = sampler->convert_time;
+        sampler->cycle_reads = sampler->reads;
+        sampler->wakeups = 0;
+        sampler->busy_time = 0;
+        sampler->pullup_time = 0;
+        sampler->convert_time = 0;
+        sampler->reads = 0;
+        for (int b = 0; b < sampler->sensors->num_buses; ++b)
+        {
+            sampler_bus_t * bus = &sampler->bus[b];
+            if (bus->num_devices > 0)
+            {
+                if (bus->on_demand)
+                {
+                    bus->resume_time = sampler->cycle_start;    // an on-demand read was fitted in before this time
+                }
+                else
+                {
+                    bus->wake_time = sampler->cycle_start;
+                }
+                ++sampler->buses_pending;
+            }
+        }
+    }
+
+    return cycle_complete;
+}
+
+void sampler_wait(const sampler_t * sampler)
+{
+    int64_t next = INT64_MAX;
+    for (int b = 0; b < sampler->sensors->num_buses; ++b)
+    {
+        if (sampler->bus[b].num_devices > 0 && sampler->bus[b].wake_time < next)
+        {
+            next = sampler->bus[b].wake_time;
+        }
+        if (sampler->bus[b].probe_time < next)
+        {
+            next = sampler->bus[b].probe_time;
+        }
+    }
+
+    if (next == INT64_MAX)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        return;
+    }
+
+    int64_t delay = next - esp_timer_get_time();
+    if (delay > 0)
+    {
+        // round up so the deadline has always passed on waking
+        TickType_t ticks = (TickType_t)((delay + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000));
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+}
+
+void sampler_wake(const sampler_t * sampler)
+{
+    xTaskNotifyGive(sampler->task);
+}
+
+DS18B20_ERROR sampler_read_now(sampler_t * sampler, int index, uint32_t max_age_ms, TickType_t timeout, float * value)
+{
+    sensors_t * sensors = sampler->sensors;
+    if (index < 0 || index >= sensors->num_devices)
+    {
+        return DS18B20_ERROR_NULL;
+    }
+
+    int16_t raw = 0;
+    int64_t timestamp = 0;
+    DS18B20_ERROR error = sensors_get_latest(sensors, index, &raw, &timestamp);
+    bool fresh = error == DS18B20_OK && esp_timer_get_time() - timestamp <= (int64_t)max_age_ms * 1000;
+
+    portENTER_CRITICAL(&sampler->lock);
+    ++sampler->demand_requests;
+    if (fresh)
+    {
+        ++sampler->demand_hits;
+    }
+    portEXIT_CRITICAL(&sampler->lock);
+
+    if (!fresh)
+    {
+        struct sampler_request request = { .index = index, .waiter = xTaskGetCurrentTaskHandle() };
+        portENTER_CRITICAL(&sampler->lock);
+        request.next = sampler->requests;
+        sampler->requests = &request;
+        portEXIT_CRITICAL(&sampler->lock);
+        sampler_wake(sampler);
+
+        TickType_t start = xTaskGetTickCount();
+        for (;;)
+        {
+            portENTER_CRITICAL(&sampler->lock);
+            bool done = request.done;
+            portEXIT_CRITICAL(&sampler->lock);
+            if (done)
+            {
+                break;
+            }
+
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= timeout)
+            {
+                if (_withdraw(sampler, &request))
+                {
+                    return DS18B20_ERROR_UNKNOWN;
+                }
+                break;    // the device was read just as the timeout expired
+            }
+            // other notifications to this task only cause the flag to be checked again
+            ulTaskNotifyTake(pdTRUE, timeout == portMAX_DELAY ? portMAX_DELAY : timeout - elapsed);
+        }
+        error = sensors_get_latest(sensors, index, &raw, &timestamp);
+    }
+
+    *value = sensors_raw_to_celsius(raw + sensors->calibration[index]);
+    return error;
+}
@@ -0,0 +1,211 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file sampler.h
+ * @brief Cooperative sampler that drives every 1-Wire bus from a single task.
+ *
+ * Each bus runs a small resumable state machine: start a conversion, yield until the
+ * conversion time has elapsed, then read its devices one at a time, yielding between
+ * each read so that other buses can start or finish their own conversions. A single
+ * scheduler task steps all buses and sleeps until the earliest bus deadline, so
+ * multiple buses convert concurrently without a task (and stack) per bus.
+ *
+ * Each cycle on a bus begins with a reset. If no device answers with a presence pulse,
+ * for example because the cable is unplugged, the bus fails the cycle for all of its
+ * devices at once instead of letting every read time out. The bus is then probed with
+ * a single reset at short intervals, backing off to the sample period, and its devices'
+ * resolutions are restored as soon as they answer again.
+ *
+ * Other tasks can ask for a reading with sampler_read_now(). A request that the latest
+ * reading is fresh enough for returns at once. Otherwise it waits for the device's next
+ * read, which is either the periodic one or an extra conversion that the scheduler fits
+ * onto an idle bus only if it completes before that bus's next periodic cycle. Requests
+ * for the same device share a read, a request for one device on a bus is served by an
+ * addressed conversion, and requests for several devices on a bus share one conversion.
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief State of a single bus within a sample cycle.
+ */
+typedef enum
+{
+    SAMPLER_BUS_IDLE = 0,        ///< Waiting for the start of the next cycle
+    SAMPLER_BUS_CONVERTING,      ///< Conversion started, waiting for it to complete
+    SAMPLER_BUS_READING,         ///< Reading devices, one per step
+} sampler_bus_state_t;
+
+/**
+ * @brief Resumable per-bus context.
+ */
+typedef struct
+{
+    sampler_bus_state_t state;   ///< Current state
+    int64_t wake_time;           ///< Time at which the bus next needs attention, in microseconds since boot
+    int64_t conversion_time;     ///< Conversion duration for the slowest device on the bus, in microseconds
+    int cursor;                  ///< Index of the next device to read
+    int num_devices;             ///< Number of devices on the bus
+    bool absent;                 ///< True if no presence pulse was seen at the last reset
+    int64_t probe_time;          ///< Time of the next presence probe while absent, or INT64_MAX
+    int64_t probe_interval;      ///< Interval from the last probe to the next, in microseconds
+    bool on_demand;              ///< True while converting or reading outside the periodic schedule
+    int demand_device;           ///< Device converted alone on demand, or -1 if the whole bus was converted
+    int64_t resume_time;         ///< Periodic wake time to restore once the on-demand read completes
+} sampler_bus_t;
+
+/**
+ * @brief Called from the scheduler task when a bus has read all of its devices in a cycle.
+ * @param[in] context Context pointer passed to sampler_set_bus_callback.
+ * @param[in] bus Index of the bus.
+ * @param[in] cycle Sample cycle the readings belong to.
+ */
+typedef void (*sampler_bus_callback_t)(void * context, int bus, uint32_t cycle);
+
+/**
+ * @brief Scheduler state for all buses.
+ */
+typedef struct
+{
+    sensors_t * sensors;         ///< Devices to sample
+    TaskHandle_t task;           ///< Task that runs the scheduler
+    int64_t period;              ///< Sample period, in microseconds
+    int64_t cycle_start;         ///< Start time of the current cycle, in microseconds since boot
+    int buses_pending;           ///< Number of buses yet to complete the current cycle
+    uint32_t cycle;              ///< Number of the current sample cycle, starting from 1
+
+    sampler_bus_callback_t bus_callback;  ///< Called when a bus completes a cycle, may be NULL
+    void * bus_callback_context;          ///< Context for bus_callback
+
+    uint32_t overruns;           ///< Number of times the schedule fell a whole period behind and was reset
+    uint32_t wakeups;            ///< Scheduler wakeups during the current cycle
+    int64_t busy_time;           ///< Time spent in bus transactions during the current cycle, in microseconds
+    int64_t cycle_busy_time;     ///< Time spent in bus transactions during the most recent completed cycle, in microseconds
+    int64_t cycle_time;          ///< Time from scheduled start to last read in the most recent completed cycle, in microseconds
+    int64_t pullup_time;         ///< Strong pull-up on-time summed over buses during the current cycle, in microseconds
+    int64_t cycle_pullup_time;   ///< Strong pull-up on-time summed over buses during the most recent completed cycle, in microseconds
+    int64_t convert_time;        ///< Conversion time summed over the devices converted during the current cycle, in microseconds
+    int64_t cycle_convert_time;  ///< Conversion time summed over the devices converted during the most recent completed cycle, in microseconds
+    int reads;                   ///< Number of devices read during the current cycle, periodically or on demand
+    int cycle_reads;             ///< Number of devices read during the most recent completed cycle
+    uint32_t absent_cycles;      ///< Number of bus cycles failed because no device was present
+    uint32_t probes;             ///< Number of presence probes made on absent buses
+
+    portMUX_TYPE lock;                    ///< Protects requests and the on-demand counters
+    struct sampler_request * requests;    ///< Tasks waiting in sampler_read_now()
+    uint32_t demand_requests;    ///< Number of calls to sampler_read_now()
+    uint32_t demand_hits;        ///< Calls satisfied by the latest reading without waiting
+    uint32_t demand_conversions; ///< Conversions started on demand, outside the periodic schedule
+
+    sampler_bus_t bus[SENSORS_MAX_BUSES];
+} sampler_t;
+
+/**
+ * @brief Return the maximum conversion time for the given resolution.
+ * @return Conversion time in microseconds.
+ */
+int64_t sampler_conversion_time(DS18B20_RESOLUTION resolution);
+
+/**
+ * @brief Initialise a sampler for all buses and devices currently registered.
+ *
+ * Must be called from the task that will run the scheduler.
+ *
+ * @param[out] sampler Pointer to sampler instance.
+ * @param[in] sensors Devices to sample.
+ * @param[in] period_ms Sample period, in milliseconds.
+ */
+void sampler_init(sampler_t * sampler, sensors_t * sensors, uint32_t period_ms);
+
+/**
+ * @brief Change the sample period.
+ *
+ * If called between cycles, the next cycle is rescheduled; otherwise the change takes
+ * effect from the following cycle.
+ */
+void sampler_set_period(sampler_t * sampler, uint32_t period_ms);
+
+/**
+ * @brief Recalculate per-bus conversion times after device resolutions have changed.
+ */
+void sampler_refresh(sampler_t * sampler);
+
+/**
+ * @brief Set a function to be called each time a bus has read all of its devices.
+ */
+void sampler_set_bus_callback(sampler_t * sampler, sampler_bus_callback_t callback, void * context);
+
+/**
+ * @brief Advance every bus that is due, until no bus has work that can be done immediately.
+ * @return True if a sample cycle completed during this call. The completed cycle number is
+ *         sampler->cycle - 1 on return.
+ */
+bool sampler_step(sampler_t * sampler);
+
+/**
+ * @brief Block until the earliest bus deadline, or until woken by sampler_wake().
+ */
+void sampler_wait(const sampler_t * sampler);
+
+/**
+ * @brief Wake the scheduler task early, from another task.
+ */
+void sampler_wake(const sampler_t * sampler);
+
+/**
+ * @brief Read a single device on demand, from another task.
+ *
+ * If the latest reading is good and no older than max_age_ms it is returned immediately.
+ * Otherwise the calling task blocks until the device is next read, waiting on its task
+ * notification; a notification from elsewhere meanwhile is consumed.
+ *
+ * @param[in] sampler Scheduler, running in another task.
+ * @param[in] index Index of the device.
+ * @param[in] max_age_ms Maximum age of an acceptable reading, in milliseconds.
+ * @param[in] timeout Maximum time to wait for a new reading, in ticks.
+ * @param[out] value Most recent good reading, calibrated, in degrees C.
+ * @return DS18B20_ERROR result of the read, DS18B20_ERROR_NULL if the device does not exist,
+ *         or DS18B20_ERROR_UNKNOWN if the timeout expired first.
+ */
+DS18B20_ERROR sampler_read_now(sampler_t * sampler, int index, uint32_t max_age_ms, TickType_t timeout, float * value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SAMPLER_H
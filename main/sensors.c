@@ -0,0 +1,454 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sensors.h"
+
+#define RAW_MIN             (-55 * 16)   // lowest reading the device can measure, in 1/16 degrees C
+#define RAW_MAX             (125 * 16)   // highest reading the device can measure
+#define RAW_RESET           (85 * 16)    // power-on value of the temperature register
+#define RESET_VALUE_MARGIN  (16)         // previous reading this close to RAW_RESET makes it believable
+
+static const char * TAG = "sensors";
+
+static const char * fault_names[SENSORS_FAULT_COUNT] = {
+    "no_presence", "crc", "timeout", "reset_value", "range", "missing",
+};
+
+sensors_t * sensors_malloc(void)
+{
+    sensors_t * sensors = calloc(1, sizeof(*sensors));
+    if (sensors == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+    }
+    else
+    {
+        memset(sensors->by_logical_id, 0xff, sizeof(sensors->by_logical_id));
+        sensors->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    }
+    return sensors;
+}
+
+void sensors_free(sensors_t ** sensors)
+{
+    if (sensors != NULL && *sensors != NULL)
+    {
+        for (int i = 0; i < (*sensors)->num_devices; ++i)
+        {
+            ds18b20_free(&(*sensors)->cold[i].info);
+        }
+        free(*sensors);
+        *sensors = NULL;
+    }
+}
+
+int sensors_add_bus(sensors_t * sensors, OneWireBus * bus)
+{
+    if (sensors == NULL || bus == NULL || sensors->num_buses >= SENSORS_MAX_BUSES)
+    {
+        return -1;
+    }
+    sensors->buses[sensors->num_buses] = bus;
+    return sensors->num_buses++;
+}
+
+int sensors_add_device(sensors_t * sensors, int bus, OneWireBus_ROMCode rom_code, bool solo, DS18B20_RESOLUTION resolution)
+{
+    if (sensors == NULL || bus < 0 || bus >= sensors->num_buses || sensors->num_devices >= SENSORS_MAX_DEVICES)
+    {
+        return -1;
+    }
+
+    DS18B20_Info * ds18b20_info = ds18b20_malloc();  // heap allocation
+    if (ds18b20_info == NULL)
+    {
+        return -1;
+    }
+
+    int index = sensors->num_devices;
+    sensor_cold_t * cold = &sensors->cold[index];
+    memset(cold, 0, sizeof(*cold));
+
+    if (solo)
+    {
+        ds18b20_init_solo(ds18b20_info, sensors->buses[bus]);          // only one device on bus
+    }
+    else
+    {
+        ds18b20_init(ds18b20_info, sensors->buses[bus], rom_code);     // associate with bus and device
+    }
+    ds18b20_use_crc(ds18b20_info, true);           // enable CRC check on all reads
+    ds18b20_set_resolution(ds18b20_info, resolution);
+
+    cold->info = ds18b20_info;
+    cold->rom_code = rom_code;
+    owb_string_from_rom_code(rom_code, cold->rom_code_s, sizeof(cold->rom_code_s));
+    cold->resolution = resolution;
+    cold->logical_id = SENSORS_NO_LOGICAL_ID;
+
+    sensors->bus[index] = (uint8_t)bus;
+    sensors->raw[index] = 0;
+    sensors->calibration[index] = 0;
+    sensors->value[index] = 0;
+    sensors->value_status[index] = DS18B20_ERROR_UNKNOWN;
+    sensors->value_time[index] = 0;
+    sensors->value_cycle[index] = 0;    // cycles are numbered from 1
+    sensors->value_sequence[index] = 0;
+    sensors->status[index] = DS18B20_ERROR_UNKNOWN;
+    sensors->timestamp[index] = 0;
+    sensors->sequence[index] = 0;
+    sensors->divisor[index] = 1;
+    sensors->target_divisor[index] = 1;
+
+    return sensors->num_devices++;
+}
+
+bool sensors_set_logical_id(sensors_t * sensors, int index, uint16_t id)
+{
+    if (index < 0 || index >= sensors->num_devices || id >= SENSORS_MAX_DEVICES)
+    {
+        return false;
+    }
+    if (sensors->by_logical_id[id] >= 0 && sensors->by_logical_id[id] != index)
+    {
+        ESP_LOGW(TAG, "logical ID %u already assigned to device %d", id, sensors->by_logical_id[id]);
+        return false;
+    }
+
+    uint16_t old_id = sensors->cold[index].logical_id;
+    if (old_id != SENSORS_NO_LOGICAL_ID)
+    {
+        sensors->by_logical_id[old_id] = -1;
+    }
+    sensors->cold[index].logical_id = id;
+    sensors->by_logical_id[id] = (int16_t)index;
+    return true;
+}
+
+void sensors_set_label(sensors_t * sensors, int index, const char * name, int16_t calibration)
+{
+    if (index >= 0 && index < sensors->num_devices)
+    {
+        strncpy(sensors->cold[index].name, name, SENSORS_NAME_LENGTH - 1);
+        sensors->cold[index].name[SENSORS_NAME_LENGTH - 1] = '\0';
+        sensors->calibration[index] = calibration;
+    }
+}
+
+int sensors_find_logical_id(const sensors_t * sensors, uint16_t id)
+{
+    return id < SENSORS_MAX_DEVICES ? sensors->by_logical_id[id] : -1;
+}
+
+int sensors_find_member(const sensors_t * sensors, const char * token)
+{
+    if (strlen(token) == OWB_ROM_CODE_STRING_LENGTH - 1)
+    {
+        for (int i = 0; i < sensors->num_devices; ++i)
+        {
+            if (strcasecmp(token, sensors->cold[i].rom_code_s) == 0)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    char * end = NULL;
+    long n = strtol(token, &end, 10);
+    if (*token == '\0' || *end != '\0' || n < 0 || n >= SENSORS_MAX_DEVICES)
+    {
+        return -1;
+    }
+    int index = sensors_find_logical_id(sensors, (uint16_t)n);
+    if (index < 0 && n < sensors->num_devices && sensors->cold[n].logical_id == SENSORS_NO_LOGICAL_ID)
+    {
+        index = n;
+    }
+    return index;
+}
+
+// Reject a reading the device cannot have measured. Only the sampler writes raw and status,
+// so the previous result can be read here without the lock.
+static int _check_reading(const sensors_t * sensors, int index, int16_t raw)
+{
+    if (raw < RAW_MIN || raw > RAW_MAX)
+    {
+        return SENSORS_ERROR_RANGE;
+    }
+
+    // the power-on value is read when a device lost power or its conversion never started; it is
+    // believed if the device was already near it, or returns it twice in a row
+    if (raw == RAW_RESET && abs(sensors->raw[index] - RAW_RESET) > RESET_VALUE_MARGIN
+        && sensors->status[index] != SENSORS_ERROR_RESET_VALUE)
+    {
+        return SENSORS_ERROR_RESET_VALUE;
+    }
+    return DS18B20_OK;
+}
+
+static void _read(sensors_t * sensors, int index, uint32_t advance)
+{
+    float value = 0.0f;
+    int error = ds18b20_read_temp(sensors->cold[index].info, &value);
+    int64_t timestamp = esp_timer_get_time();
+
+    // readings are exact multiples of 1/16 degree, so this conversion is lossless
+    int16_t raw = (int16_t)lroundf(value * 16.0f);
+    if (error == DS18B20_OK)
+    {
+        error = _check_reading(sensors, index, raw);
+    }
+
+    // other tasks may be reading this device's result through sensors_get_latest()
+    portENTER_CRITICAL(&sensors->lock);
+    sensors->timestamp[index] = timestamp;
+    sensors->status[index] = (int8_t)error;
+    sensors->sequence[index] += advance;
+    if (error == DS18B20_OK)
+    {
+        sensors->raw[index] = raw;
+    }
+    portEXIT_CRITICAL(&sensors->lock);
+}
+
+void sensors_read_device(sensors_t * sensors, int index)
+{
+    _read(sensors, index, 1);
+}
+
+void sensors_refresh_device(sensors_t * sensors, int index)
+{
+    _read(sensors, index, 0);
+}
+
+void sensors_fail_device(sensors_t * sensors, int index, int error)
+{
+    int64_t timestamp = esp_timer_get_time();
+    portENTER_CRITICAL(&sensors->lock);
+    sensors->timestamp[index] = timestamp;
+    sensors->status[index] = (int8_t)error;
+    ++sensors->sequence[index];
+    portEXIT_CRITICAL(&sensors->lock);
+}
+
+DS18B20_ERROR sensors_get_latest(sensors_t * sensors, int index, int16_t * raw, int64_t * timestamp)
+{
+    portENTER_CRITICAL(&sensors->lock);
+    DS18B20_ERROR error = sensors->status[index];
+    *raw = sensors->raw[index];
+    *timestamp = sensors->timestamp[index];
+    portEXIT_CRITICAL(&sensors->lock);
+    return error;
+}
+
+int sensors_capture_frame(const sensors_t * sensors, int bus, int start, uint32_t cycle, sensors_frame_t * frame)
+{
+    frame->cycle = cycle;
+    frame->bus = (uint8_t)bus;
+    frame->count = 0;
+    frame->converted = sensors->converted[bus];
+
+    int i = start;
+    for (; i < sensors->num_devices && frame->count < SENSORS_FRAME_DEVICES; ++i)
+    {
+        if (sensors->bus[i] == bus && sensors_is_due(sensors, i, cycle))
+        {
+            int n = frame->count++;
+            frame->index[n] = (uint16_t)i;
+            frame->raw[n] = sensors->raw[i];
+            frame->status[n] = sensors->status[i];
+            frame->timestamp[n] = sensors->timestamp[i];
+            frame->sequence[n] = sensors->sequence[i];
+        }
+    }
+
+    // the next frame starts at the next device on this bus, if there is one
+    for (; i < sensors->num_devices; ++i)
+    {
+        if (sensors->bus[i] == bus && sensors_is_due(sensors, i, cycle))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void sensors_summary_init(sensors_summary_t * summary)
+{
+    summary->num_ok = 0;
+    summary->num_errors = 0;
+    summary->min_raw = INT16_MAX;
+    summary->max_raw = INT16_MIN;
+}
+
+void sensors_summary_merge(sensors_summary_t * dst, const sensors_summary_t * src)
+{
+    dst->num_ok += src->num_ok;
+    dst->num_errors += src->num_errors;
+    if (src->min_raw < dst->min_raw)
+    {
+        dst->min_raw = src->min_raw;
+    }
+    if (src->max_raw > dst->max_raw)
+    {
+        dst->max_raw = src->max_raw;
+    }
+}
+
+void sensors_process_frame(sensors_t * sensors, const sensors_frame_t * frame, sensors_summary_t * summary)
+{
+    for (int n = 0; n < frame->count; ++n)
+    {
+        int i = frame->index[n];
+        sensor_cold_t * cold = &sensors->cold[i];
+
+        // any gap in the sequence means samples were dropped upstream; a frame older than one
+        // already processed would otherwise count as billions of lost samples
+        uint32_t gap = frame->sequence[n] - sensors->value_sequence[i];
+        if ((int32_t)gap <= 0)
+        {
+            continue;
+        }
+        if (gap > 1)
+        {
+            cold->samples_lost += gap - 1;
+        }
+        sensors->value_sequence[i] = frame->sequence[n];
+        sensors->value_status[i] = frame->status[n];
+        sensors->value_time[i] = frame->timestamp[n];
+        sensors->value_cycle[i] = frame->cycle;
+
+        if (frame->status[n] != DS18B20_OK)
+        {
+            // other frames on the same bus may be processed concurrently
+            sensors_fault_t fault = sensors_classify(frame->status[n]);
+            portENTER_CRITICAL(&sensors->lock);
+            if (cold->faults[fault] < UINT16_MAX)
+            {
+                ++cold->faults[fault];
+            }
+            ++sensors->bus_faults[frame->bus][fault];
+            portEXIT_CRITICAL(&sensors->lock);
+
+            ++cold->errors_count;
+            ++summary->num_errors;
+            continue;
+        }
+
+        int16_t value = frame->raw[n] + sensors->calibration[i];
+        sensors->value[i] = value;
+        ++summary->num_ok;
+        if (value < summary->min_raw)
+        {
+            summary->min_raw = value;
+        }
+        if (value > summary->max_raw)
+        {
+            summary->max_raw = value;
+        }
+    }
+}
+
+void sensors_snapshot(const sensors_t * sensors, uint32_t cycle, sensors_snapshot_t * snapshot)
+{
+    int count = sensors->num_devices;
+    snapshot->cycle = cycle;
+    snapshot->num_devices = count;
+    memcpy(snapshot->value, sensors->value, count * sizeof(snapshot->value[0]));
+    memcpy(snapshot->status, sensors->value_status, count * sizeof(snapshot->status[0]));
+    memcpy(snapshot->timestamp, sensors->value_time, count * sizeof(snapshot->timestamp[0]));
+    memcpy(snapshot->sequence, sensors->value_sequence, count * sizeof(snapshot->sequence[0]));
+    for (int i = 0; i < count; ++i)
+    {
+        snapshot->fresh[i] = sensors->value_cycle[i] == cycle;
+    }
+}
+
+sensors_fault_t sensors_classify(int status)
+{
+    switch (status)
+    {
+    case DS18B20_OK:
+        return SENSORS_FAULT_COUNT;
+    case SENSORS_ERROR_NO_PRESENCE:
+        return SENSORS_FAULT_NO_PRESENCE;
+    case DS18B20_ERROR_CRC:
+        return SENSORS_FAULT_CRC;
+    case DS18B20_ERROR_OWB:
+        return SENSORS_FAULT_TIMEOUT;
+    case SENSORS_ERROR_RESET_VALUE:
+        return SENSORS_FAULT_RESET_VALUE;
+    case SENSORS_ERROR_RANGE:
+        return SENSORS_FAULT_RANGE;
+    default:
+        // the device did not answer its addressed reset, or was never initialised
+        return SENSORS_FAULT_MISSING;
+    }
+}
+
+const char * sensors_fault_name(sensors_fault_t fault)
+{
+    return fault < SENSORS_FAULT_COUNT ? fault_names[fault] : "ok";
+}
+
+void sensors_device_faults(sensors_t * sensors, int index, uint32_t counts[SENSORS_FAULT_COUNT])
+{
+    portENTER_CRITICAL(&sensors->lock);
+    for (int f = 0; f < SENSORS_FAULT_COUNT; ++f)
+    {
+        counts[f] = sensors->cold[index].faults[f];
+    }
+    portEXIT_CRITICAL(&sensors->lock);
+}
+
+void sensors_bus_faults(sensors_t * sensors, int bus, uint32_t counts[SENSORS_FAULT_COUNT])
+{
+    portENTER_CRITICAL(&sensors->lock);
+    for (int f = 0; f < SENSORS_FAULT_COUNT; ++f)
+    {
+        counts[f] = sensors->bus_faults[bus][f];
+    }
+    portEXIT_CRITICAL(&sensors->lock);
+}
+
+void sensors_print(const sensors_t * sensors, uint32_t sample)
+{
+    printf("\nTemperature readings (degrees C): sample %u\n", (unsigned int)sample);
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        const sensor_cold_t * cold = &sensors->cold[i];
+        float reading = sensors_raw_to_celsius(sensors->value[i]);
+        int label = cold->logical_id != SENSORS_NO_LOGICAL_ID ? cold->logical_id : i;
+        printf("  %d: %.1f    %u errors    seq %u\n", label, reading, (unsigned int)cold->errors_count, (unsigned int)sensors->value_sequence[i]);
+    }
+}
@@ -0,0 +1,384 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file sensors.h
+ * @brief Per-device state for all DS18B20 devices managed by the application.
+ *
+ * Fields that are touched on every sample cycle (bus index, raw value, status, timestamp)
+ * are held in dense parallel arrays so that each pass over the devices only pulls the
+ * fields it actually uses into cache. Configuration and bookkeeping that is rarely
+ * accessed is kept separately in sensor_cold_t.
+ *
+ * The sampler writes raw, status and timestamp. Post-processing works on frames, which
+ * are snapshots of those fields for a group of devices on one bus, and writes value.
+ *
+ * A status is a DS18B20_ERROR, or one of the SENSORS_ERROR_ codes for failures the driver
+ * does not report itself. Every failed read is classified by sensors_classify() into a
+ * sensors_fault_t cause and counted per device and per bus, so that wiring faults (no
+ * presence, missing devices) can be told apart from signal and timing problems (CRC
+ * mismatches, timeouts) and from conversions that did not run (the reset value).
+ */
+
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "owb.h"
+#include "ds18b20.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SENSORS_MAX_DEVICES   (CONFIG_MAX_DEVICES)    ///< Maximum number of devices across all buses
+#define SENSORS_MAX_BUSES     (16)                    ///< Maximum number of 1-Wire buses
+#define SENSORS_NAME_LENGTH   (16)                    ///< Maximum length of a device name, including terminator
+#define SENSORS_FRAME_DEVICES (32)                    ///< Maximum number of devices in a single frame
+#define SENSORS_NO_LOGICAL_ID (0xffff)                ///< Logical ID of a device that has none
+
+#define SENSORS_ERROR_NO_PRESENCE  (-2)               ///< Status: no device answered the reset on the bus
+#define SENSORS_ERROR_RESET_VALUE  (-3)               ///< Status: the power-on value of 85 degrees C was read
+#define SENSORS_ERROR_RANGE        (-4)               ///< Status: reading outside the range the device can measure
+
+/**
+ * @brief Cause of a failed read.
+ */
+typedef enum
+{
+    SENSORS_FAULT_NO_PRESENCE = 0,                    ///< No device answered the bus reset
+    SENSORS_FAULT_CRC,                                ///< Scratchpad CRC mismatch
+    SENSORS_FAULT_TIMEOUT,                            ///< Bus driver error, such as a transfer that did not complete in time
+    SENSORS_FAULT_RESET_VALUE,                        ///< Power-on reset value read, so the conversion did not run
+    SENSORS_FAULT_RANGE,                              ///< Reading outside -55 to +125 degrees C
+    SENSORS_FAULT_MISSING,                            ///< The device did not answer, or has no driver instance
+    SENSORS_FAULT_COUNT,                              ///< Number of causes, and the cause of a successful read
+} sensors_fault_t;
+
+/**
+ * @brief Per-device data that is not needed on every sample cycle.
+ */
+typedef struct
+{
+    DS18B20_Info * info;                              ///< Device driver instance (heap allocated)
+    OneWireBus_ROMCode rom_code;                      ///< ROM code of the device
+    char rom_code_s[OWB_ROM_CODE_STRING_LENGTH];      ///< ROM code as a string, for output
+    char name[SENSORS_NAME_LENGTH];                   ///< Human-readable name, may be empty
+    DS18B20_RESOLUTION resolution;                    ///< Configured measurement resolution
+    uint16_t logical_id;                              ///< Logical ID, or SENSORS_NO_LOGICAL_ID
+    uint32_t errors_count;                            ///< Number of failed reads since initialisation
+    uint32_t samples_lost;                            ///< Number of samples that never reached processing
+    uint16_t faults[SENSORS_FAULT_COUNT];             ///< Failed reads by cause, saturating, see sensors_device_faults()
+} sensor_cold_t;
+
+/**
+ * @brief State for all devices on all buses.
+ */
+typedef struct
+{
+    // Hot data, indexed by device, accessed every sample cycle
+    uint8_t bus[SENSORS_MAX_DEVICES];                 ///< Index into buses[] of the device's bus
+    int16_t raw[SENSORS_MAX_DEVICES];                 ///< Most recent good reading, uncalibrated, in 1/16 degrees C
+    int8_t status[SENSORS_MAX_DEVICES];               ///< DS18B20_ERROR result of the most recent read
+    int64_t timestamp[SENSORS_MAX_DEVICES];           ///< Time of the most recent read, in microseconds since boot
+    uint32_t sequence[SENSORS_MAX_DEVICES];           ///< Number of periodic reads attempted, starting from 1
+    int16_t calibration[SENSORS_MAX_DEVICES];         ///< Offset added to each reading, in 1/16 degrees C
+    int16_t value[SENSORS_MAX_DEVICES];               ///< Most recent processed reading, in 1/16 degrees C
+    int8_t value_status[SENSORS_MAX_DEVICES];         ///< DS18B20_ERROR result of the most recent processed read
+    int64_t value_time[SENSORS_MAX_DEVICES];          ///< Time of the most recent processed read, in microseconds since boot
+    uint32_t value_cycle[SENSORS_MAX_DEVICES];        ///< Sample cycle of the most recent processed read
+    uint32_t value_sequence[SENSORS_MAX_DEVICES];     ///< Sequence number of the most recent processed read
+    uint8_t divisor[SENSORS_MAX_DEVICES];             ///< Device is read every this many cycles, a power of two
+    uint8_t target_divisor[SENSORS_MAX_DEVICES];      ///< Divisor to apply from the next cycle
+
+    portMUX_TYPE lock;                                ///< Held while a read result is stored, see sensors_get_latest()
+
+    int num_devices;                                  ///< Number of devices in use
+    int num_buses;                                    ///< Number of buses in use
+    OneWireBus * buses[SENSORS_MAX_BUSES];            ///< Buses, owned by the caller
+    int64_t converted[SENSORS_MAX_BUSES];             ///< Time the most recent periodic conversion on each bus completed
+    uint32_t bus_faults[SENSORS_MAX_BUSES][SENSORS_FAULT_COUNT]; ///< Failed reads on each bus by cause, see sensors_bus_faults()
+
+    // Cold data, indexed by device
+    sensor_cold_t cold[SENSORS_MAX_DEVICES];
+
+    // Device index for each logical ID, or -1
+    int16_t by_logical_id[SENSORS_MAX_DEVICES];
+} sensors_t;
+
+/**
+ * @brief Snapshot of the hot data for a group of devices on one bus, from one sample cycle.
+ */
+typedef struct
+{
+    uint32_t cycle;                                   ///< Sample cycle the readings belong to
+    uint8_t bus;                                      ///< Bus the devices are on
+    uint8_t count;                                    ///< Number of devices in the frame
+    uint16_t index[SENSORS_FRAME_DEVICES];            ///< Device indices
+    int16_t raw[SENSORS_FRAME_DEVICES];               ///< Uncalibrated readings, in 1/16 degrees C
+    int8_t status[SENSORS_FRAME_DEVICES];             ///< DS18B20_ERROR results
+    int64_t timestamp[SENSORS_FRAME_DEVICES];         ///< Read times, in microseconds since boot
+    uint32_t sequence[SENSORS_FRAME_DEVICES];         ///< Per-device sequence numbers
+    int64_t converted;                                ///< Time the conversion read by the frame completed, in microseconds since boot
+} sensors_frame_t;
+
+/**
+ * @brief Summary of a single sample cycle across all devices.
+ */
+typedef struct
+{
+    int num_ok;                                       ///< Number of devices read successfully
+    int num_errors;                                   ///< Number of devices that failed to read
+    int16_t min_raw;                                  ///< Lowest good reading, in 1/16 degrees C
+    int16_t max_raw;                                  ///< Highest good reading, in 1/16 degrees C
+} sensors_summary_t;
+
+/**
+ * @brief Processed readings of all devices as at the end of one sample cycle.
+ *
+ * Taken once every frame of the cycle has been processed and before any frame of a later
+ * cycle is, so that each value is paired with the status and time of the read that produced
+ * it. Output stages read from this rather than from the live sensors_t.
+ */
+typedef struct
+{
+    uint32_t cycle;                                   ///< Sample cycle the snapshot was taken at
+    int num_devices;                                  ///< Number of devices in the snapshot
+    int16_t value[SENSORS_MAX_DEVICES];               ///< Most recent good reading, in 1/16 degrees C
+    int8_t status[SENSORS_MAX_DEVICES];               ///< DS18B20_ERROR result of the most recent processed read
+    int64_t timestamp[SENSORS_MAX_DEVICES];           ///< Time of the most recent processed read, in microseconds since boot
+    uint32_t sequence[SENSORS_MAX_DEVICES];           ///< Sequence number of the most recent processed read
+    bool fresh[SENSORS_MAX_DEVICES];                  ///< True if the device was read in this cycle
+} sensors_snapshot_t;
+
+/**
+ * @brief Return true if a device is read in a cycle.
+ *
+ * Devices with a divisor greater than 1 are read every divisor cycles, staggered by index
+ * so that slow devices on a bus are spread across cycles.
+ */
+static inline bool sensors_is_due(const sensors_t * sensors, int index, uint32_t cycle)
+{
+    return ((cycle + (uint32_t)index) & (sensors->divisor[index] - 1u)) == 0;
+}
+
+/**
+ * @brief Convert a raw reading in 1/16 degrees C to degrees Celsius.
+ */
+static inline float sensors_raw_to_celsius(int16_t raw)
+{
+    return raw / 16.0f;
+}
+
+/**
+ * @brief Construct a new sensors instance, with no buses or devices.
+ * @return Pointer to the new instance, or NULL if it cannot be created.
+ */
+sensors_t * sensors_malloc(void);
+
+/**
+ * @brief Delete an existing sensors instance, including all device driver instances.
+ * @param[in,out] sensors Pointer to instance pointer. Set to NULL on return.
+ */
+void sensors_free(sensors_t ** sensors);
+
+/**
+ * @brief Register a 1-Wire bus. The bus remains owned by the caller.
+ * @return Index of the bus, or -1 if no more buses can be added.
+ */
+int sensors_add_bus(sensors_t * sensors, OneWireBus * bus);
+
+/**
+ * @brief Create and initialise a DS18B20 device on a registered bus.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] bus Index of the bus, as returned by sensors_add_bus.
+ * @param[in] rom_code ROM code of the device. Ignored if solo is true.
+ * @param[in] solo True if this is the only device on the bus, to enable addressing optimisations.
+ * @param[in] resolution Measurement resolution to configure.
+ * @return Index of the device, or -1 if the device cannot be added.
+ */
+int sensors_add_device(sensors_t * sensors, int bus, OneWireBus_ROMCode rom_code, bool solo, DS18B20_RESOLUTION resolution);
+
+/**
+ * @brief Assign a logical ID to a device.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] index Index of the device.
+ * @param[in] id Logical ID, less than SENSORS_MAX_DEVICES.
+ * @return True if successful, false if the ID is out of range or already assigned to another device.
+ */
+bool sensors_set_logical_id(sensors_t * sensors, int index, uint16_t id);
+
+/**
+ * @brief Set the name and calibration offset of a device.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] index Index of the device.
+ * @param[in] name Name, truncated to SENSORS_NAME_LENGTH - 1 characters.
+ * @param[in] calibration Offset added to each reading, in 1/16 degrees C.
+ */
+void sensors_set_label(sensors_t * sensors, int index, const char * name, int16_t calibration);
+
+/**
+ * @brief Find the device with a logical ID.
+ * @return Index of the device, or -1 if no device has that ID.
+ */
+int sensors_find_logical_id(const sensors_t * sensors, uint16_t id);
+
+/**
+ * @brief Find a device from a textual reference.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] token A 16-digit hexadecimal ROM code, or a decimal number which is a logical ID
+ *                  if a device has that ID, otherwise a device index.
+ * @return Index of the device, or -1 if not found.
+ */
+int sensors_find_member(const sensors_t * sensors, const char * token);
+
+/**
+ * @brief Read the most recent conversion result from a single device.
+ *
+ * Updates the hot arrays only. On error, the previous raw value is retained and the
+ * status records the failure.
+ *
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] index Index of the device.
+ */
+void sensors_read_device(sensors_t * sensors, int index);
+
+/**
+ * @brief Read a single device outside its periodic schedule.
+ *
+ * As sensors_read_device(), but the sequence number is not advanced, since the result is
+ * not captured in a frame.
+ */
+void sensors_refresh_device(sensors_t * sensors, int index);
+
+/**
+ * @brief Record a failed read for a single device, without accessing the bus.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] index Index of the device.
+ * @param[in] error DS18B20_ERROR or SENSORS_ERROR_ code to record as the device's status.
+ */
+void sensors_fail_device(sensors_t * sensors, int index, int error);
+
+/**
+ * @brief Get the most recent read result for a single device, from any task.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] index Index of the device.
+ * @param[out] raw Most recent good reading, uncalibrated, in 1/16 degrees C.
+ * @param[out] timestamp Time of the most recent read, in microseconds since boot.
+ * @return DS18B20_ERROR or SENSORS_ERROR_ result of the most recent read.
+ */
+DS18B20_ERROR sensors_get_latest(sensors_t * sensors, int index, int16_t * raw, int64_t * timestamp);
+
+/**
+ * @brief Copy the hot data for the devices on a bus that are due in a cycle into a frame.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] bus Index of the bus.
+ * @param[in] start Device index to start from.
+ * @param[in] cycle Sample cycle to record in the frame.
+ * @param[out] frame Frame to fill, with up to SENSORS_FRAME_DEVICES devices.
+ * @return Device index to pass as start for the next frame, or -1 if there are no more devices on the bus.
+ */
+int sensors_capture_frame(const sensors_t * sensors, int bus, int start, uint32_t cycle, sensors_frame_t * frame);
+
+/**
+ * @brief Initialise a summary so that it can be accumulated into.
+ */
+void sensors_summary_init(sensors_summary_t * summary);
+
+/**
+ * @brief Combine the summary in src into dst.
+ */
+void sensors_summary_merge(sensors_summary_t * dst, const sensors_summary_t * src);
+
+/**
+ * @brief Copy the processed readings of all devices into a snapshot.
+ *
+ * Must not be called while frames are being processed.
+ *
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] cycle Sample cycle whose frames have all been processed.
+ * @param[out] snapshot Snapshot to fill.
+ */
+void sensors_snapshot(const sensors_t * sensors, uint32_t cycle, sensors_snapshot_t * snapshot);
+
+/**
+ * @brief Apply calibration to a frame, publish the values and accumulate error counts.
+ *
+ * Failed reads are counted by cause against the device and its bus. Gaps in each device's
+ * sequence numbers are counted as lost samples; a device whose sequence number is not newer
+ * than the one last processed is skipped.
+ *
+ * Frames never share devices within a cycle, so frames may be processed concurrently.
+ * Frames of different cycles must not be processed concurrently.
+ *
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] frame Frame to process.
+ * @param[in,out] summary Summary to accumulate the frame into.
+ */
+void sensors_process_frame(sensors_t * sensors, const sensors_frame_t * frame, sensors_summary_t * summary);
+
+/**
+ * @brief Classify the status of a read.
+ * @param[in] status DS18B20_ERROR or SENSORS_ERROR_ status.
+ * @return Cause of the failure, or SENSORS_FAULT_COUNT if the read succeeded.
+ */
+sensors_fault_t sensors_classify(int status);
+
+/**
+ * @brief Get the short name of a fault cause, such as "crc".
+ */
+const char * sensors_fault_name(sensors_fault_t fault);
+
+/**
+ * @brief Take a consistent snapshot of the failed reads of a device by cause.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] index Index of the device.
+ * @param[out] counts Failed reads by cause, saturating at UINT16_MAX.
+ */
+void sensors_device_faults(sensors_t * sensors, int index, uint32_t counts[SENSORS_FAULT_COUNT]);
+
+/**
+ * @brief Take a consistent snapshot of the failed reads on a bus by cause.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] bus Index of the bus.
+ * @param[out] counts Failed reads by cause.
+ */
+void sensors_bus_faults(sensors_t * sensors, int bus, uint32_t counts[SENSORS_FAULT_COUNT]);
+
+/**
+ * @brief Print the most recent processed readings to the console.
+ * @param[in] sensors Pointer to sensors instance.
+ * @param[in] sample Sample number to print in the heading.
+ */
+void sensors_print(const sensors_t * sensors, uint32_t sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SENSORS_H
@@ -0,0 +1,569 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "settings.h"
+#include "ds2482.h"
+
+#define DEFAULT_PERIOD_MS    (1000)
+#define DEFAULT_RESOLUTION   (DS18B20_RESOLUTION_12_BIT)
+#define DEFAULT_MODBUS_PORT  (502)
+#define MAX_DEPTH            (8)      // deepest nesting skipped within unknown values
+#define KEY_LENGTH           (24)
+
+static const char * TAG = "settings";
+
+// Single-pass reader over a JSON document. Once an error is found, ok is cleared and
+// every function below stops consuming input, so loops over members terminate.
+typedef struct
+{
+    const char * p;
+    const char * end;
+    bool ok;
+} reader_t;
+
+static char _peek(reader_t * r)
+{
+    while (r->ok && r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\r' || *r->p == '\n'))
+    {
+        ++r->p;
+    }
+    return (r->ok && r->p < r->end) ? *r->p : '\0';
+}
+
+static bool _accept(reader_t * r, char c)
+{
+    if (_peek(r) == c)
+    {
+        ++r->p;
+        return true;
+    }
+    return false;
+}
+
+static void _expect(reader_t * r, char c)
+{
+    if (!_accept(r, c))
+    {
+        r->ok = false;
+    }
+}
+
+// Read a string into out, which may be NULL to skip it. Returns false if it was truncated to fit.
+static bool _string(reader_t * r, char * out, int size)
+{
+    _expect(r, '"');
+    int n = 0;
+    bool fits = true;
+    while (r->ok)
+    {
+        if (r->p >= r->end)
+        {
+            r->ok = false;
+            break;
+        }
+        char c = *r->p++;
+        if (c == '"')
+        {
+            break;
+        }
+        if (c == '\\')
+        {
+            c = r->p < r->end ? *r->p++ : '\0';
+            switch (c)
+            {
+            case '"': case '\\': case '/': break;
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            default: r->ok = false; break;    // other escapes are not needed in settings
+            }
+        }
+        if (out != NULL && n < size - 1)
+        {
+            out[n++] = c;
+        }
+        else
+        {
+            fits = out == NULL;
+        }
+    }
+    if (out != NULL && size > 0)
+    {
+        out[n] = '\0';
+    }
+    return fits;
+}
+
+// Read a string value, failing if it does not fit
+static void _string_value(reader_t * r, char * out, int size)
+{
+    if (!_string(r, out, size))
+    {
+        r->ok = false;
+    }
+}
+
+// Read a number without exponent. Parsed by hand, as the document need not be terminated.
+static float _number(reader_t * r)
+{
+    bool negative = _accept(r, '-');
+    const char * start = r->p;
+    float value = 0.0f;
+    while (r->p < r->end && *r->p >= '0' && *r->p <= '9')
+    {
+        value = value * 10.0f + (*r->p++ - '0');
+    }
+    if (r->p < r->end && *r->p == '.')
+    {
+        float scale = 0.1f;
+        ++r->p;
+        while (r->p < r->end && *r->p >= '0' && *r->p <= '9')
+        {
+            value += (*r->p++ - '0') * scale;
+            scale *= 0.1f;
+        }
+    }
+    if (r->p == start)
+    {
+        r->ok = false;
+    }
+    return negative ? -value : value;
+}
+
+static int _integer(reader_t * r, int min, int max)
+{
+    float value = _number(r);
+    // range first, as converting an out-of-range float to int is undefined
+    if (!(value >= min && value <= max) || value != (float)(int)value)
+    {
+        r->ok = false;
+        return min;
+    }
+    return (int)value;
+}
+
+static bool _literal(reader_t * r, const char * literal)
+{
+    _peek(r);
+    int length = strlen(literal);
+    if (r->end - r->p >= length && memcmp(r->p, literal, length) == 0)
+    {
+        r->p += length;
+        return true;
+    }
+    return false;
+}
+
+// Advance to the next member of an object, reading its key. Long keys are truncated, so match
+// no known key and are skipped. Returns false at the end of the object or on error.
+static bool _next_member(reader_t * r, bool * first, char * key, int size)
+{
+    if (*first)
+    {
+        _expect(r, '{');
+        *first = false;
+        if (_accept(r, '}'))
+        {
+            return false;
+        }
+    }
+    else if (_accept(r, '}'))
+    {
+        return false;
+    }
+    else
+    {
+        _expect(r, ',');
+    }
+    _string(r, key, size);
+    _expect(r, ':');
+    return r->ok;
+}
+
+// Advance to the next element of an array. Returns false at the end of the array or on error.
+static bool _next_element(reader_t * r, bool * first)
+{
+    if (*first)
+    {
+        _expect(r, '[');
+        *first = false;
+        if (_accept(r, ']'))
+        {
+            return false;
+        }
+    }
+    else if (_accept(r, ']'))
+    {
+        return false;
+    }
+    else
+    {
+        _expect(r, ',');
+    }
+    return r->ok;
+}
+
+static void _skip_value(reader_t * r, int depth)
+{
+    bool first = true;
+    char key[KEY_LENGTH];
+    if (depth > MAX_DEPTH)
+    {
+        r->ok = false;
+        return;
+    }
+    switch (_peek(r))
+    {
+    case '{':
+        while (_next_member(r, &first, key, sizeof(key)))
+        {
+            _skip_value(r, depth + 1);
+        }
+        break;
+    case '[':
+        while (_next_element(r, &first))
+        {
+            _skip_value(r, depth + 1);
+        }
+        break;
+    case '"':
+        _string(r, NULL, 0);
+        break;
+    default:
+        if (!_literal(r, "true") && !_literal(r, "false") && !_literal(r, "null"))
+        {
+            _number(r);
+        }
+        break;
+    }
+}
+
+// Read a ROM code, as formatted by owb_string_from_rom_code (most significant byte first)
+static void _rom_code(reader_t * r, char * rom_code_s, OneWireBus_ROMCode * rom_code)
+{
+    char s[OWB_ROM_CODE_STRING_LENGTH];
+    _string_value(r, s, sizeof(s));
+    if (!r->ok || strlen(s) != OWB_ROM_CODE_STRING_LENGTH - 1)
+    {
+        r->ok = false;
+        return;
+    }
+    for (int i = 0; i < OWB_ROM_CODE_STRING_LENGTH - 1; ++i)
+    {
+        char c = s[i] | 0x20;    // lower case
+        int nibble = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+        if (nibble < 0)
+        {
+            r->ok = false;
+            return;
+        }
+        if (rom_code != NULL)
+        {
+            int byte = sizeof(rom_code->bytes) - 1 - i / 2;
+            rom_code->bytes[byte] = (rom_code->bytes[byte] << 4) | nibble;
+        }
+    }
+    if (rom_code_s != NULL)
+    {
+        strcpy(rom_code_s, s);
+    }
+}
+
+// 1-Wire drives the line, so input-only pins cannot carry a bus
+static int _gpio(reader_t * r)
+{
+    int pin = _integer(r, 0, GPIO_NUM_MAX - 1);
+    if (!GPIO_IS_VALID_OUTPUT_GPIO(pin))
+    {
+        r->ok = false;
+    }
+    return pin;
+}
+
+static void _bus(reader_t * r, settings_bus_t * bus)
+{
+    bus->type = SETTINGS_BUS_RMT;
+    bus->pin = -1;
+
+    bool first = true;
+    char key[KEY_LENGTH];
+    while (_next_member(r, &first, key, sizeof(key)))
+    {
+        if (strcmp(key, "gpio") == 0)
+        {
+            bus->type = SETTINGS_BUS_RMT;
+            bus->pin = _gpio(r);
+        }
+        else if (strcmp(key, "ds2482") == 0)
+        {
+            bus->type = SETTINGS_BUS_DS2482;
+            bus->pin = _integer(r, 0, DS2482_MAX_CHANNELS - 1);
+        }
+        else
+        {
+            _skip_value(r, 1);
+        }
+    }
+    if (bus->pin < 0)
+    {
+        r->ok = false;
+    }
+}
+
+static void _device(reader_t * r, settings_device_t * device)
+{
+    memset(device, 0, sizeof(*device));
+    device->logical_id = SENSORS_NO_LOGICAL_ID;
+    device->resolution = DS18B20_RESOLUTION_INVALID;
+
+    bool first = true;
+    char key[KEY_LENGTH];
+    while (_next_member(r, &first, key, sizeof(key)))
+    {
+        if (strcmp(key, "rom") == 0)
+        {
+            _rom_code(r, device->rom_code_s, NULL);
+        }
+        else if (strcmp(key, "name") == 0)
+        {
+            _string_value(r, device->name, sizeof(device->name));
+        }
+        else if (strcmp(key, "id") == 0)
+        {
+            device->logical_id = _integer(r, 0, SENSORS_MAX_DEVICES - 1);
+        }
+        else if (strcmp(key, "resolution") == 0)
+        {
+            device->resolution = _integer(r, DS18B20_RESOLUTION_9_BIT, DS18B20_RESOLUTION_12_BIT);
+        }
+        else if (strcmp(key, "offset") == 0)
+        {
+            device->calibration = (int16_t)lroundf(_number(r) * 16.0f);
+        }
+        else
+        {
+            _skip_value(r, 1);
+        }
+    }
+    if (device->rom_code_s[0] == '\0')
+    {
+        r->ok = false;
+    }
+}
+
+void settings_init(settings_t * settings)
+{
+    memset(settings, 0, sizeof(*settings));
+    settings->period_ms = DEFAULT_PERIOD_MS;
+    settings->resolution = DEFAULT_RESOLUTION;
+
+    settings->num_buses = CONFIG_ONE_WIRE_BUSES;
+    settings->buses[0].pin = CONFIG_ONE_WIRE_GPIO;
+#if CONFIG_ONE_WIRE_BUSES > 1
+    settings->buses[1].pin = CONFIG_ONE_WIRE_GPIO_1;
+#endif
+#if CONFIG_ONE_WIRE_BUSES > 2
+    settings->buses[2].pin = CONFIG_ONE_WIRE_GPIO_2;
+#endif
+#if CONFIG_ONE_WIRE_BUSES > 3
+    settings->buses[3].pin = CONFIG_ONE_WIRE_GPIO_3;
+#endif
+#ifdef CONFIG_DS2482
+    for (int c = 0; c < CONFIG_DS2482_BUSES; ++c)
+    {
+        settings->buses[settings->num_buses++] = (settings_bus_t) { .type = SETTINGS_BUS_DS2482, .pin = c };
+    }
+#endif
+
+    // Search for a known ROM code (LSB first):
+    // For example: 0x1502162ca5b2ee28
+    settings->has_known_device = true;
+    settings->known_device = (OneWireBus_ROMCode) {
+        .fields.family = { 0x28 },
+        .fields.serial_number = { 0xee, 0xb2, 0xa5, 0x2c, 0x16, 0x02 },
+        .fields.crc = { 0x15 },
+    };
+
+    strncpy(settings->zones, CONFIG_ZONES, sizeof(settings->zones) - 1);
+    strncpy(settings->alarms, CONFIG_ALARM_RULES, sizeof(settings->alarms) - 1);
+#ifdef CONFIG_MODBUS_TCP
+    settings->modbus_tcp_port = CONFIG_MODBUS_TCP_PORT;
+#else
+    settings->modbus_tcp_port = DEFAULT_MODBUS_PORT;
+#endif
+}
+
+bool settings_parse(settings_t * settings, const char * json, int length)
+{
+    reader_t reader = { .p = json, .end = json + length, .ok = true };
+    reader_t * r = &reader;
+
+    bool first = true;
+    char key[KEY_LENGTH];
+    while (_next_member(r, &first, key, sizeof(key)))
+    {
+        if (strcmp(key, "period_ms") == 0)
+        {
+            settings->period_ms = _integer(r, 10, 3600000);
+        }
+        else if (strcmp(key, "resolution") == 0)
+        {
+            settings->resolution = _integer(r, DS18B20_RESOLUTION_9_BIT, DS18B20_RESOLUTION_12_BIT);
+        }
+        else if (strcmp(key, "buses") == 0)
+        {
+            bool first_bus = true;
+            settings->num_buses = 0;
+            while (_next_element(r, &first_bus))
+            {
+                if (settings->num_buses >= SETTINGS_MAX_BUSES)
+                {
+                    r->ok = false;
+                    break;
+                }
+                settings_bus_t * bus = &settings->buses[settings->num_buses++];
+                if (_peek(r) == '{')
+                {
+                    _bus(r, bus);
+                }
+                else
+                {
+                    bus->type = SETTINGS_BUS_RMT;
+                    bus->pin = _gpio(r);
+                }
+            }
+        }
+        else if (strcmp(key, "known_device") == 0)
+        {
+            settings->has_known_device = !_literal(r, "null");
+            if (settings->has_known_device)
+            {
+                memset(&settings->known_device, 0, sizeof(settings->known_device));
+                _rom_code(r, NULL, &settings->known_device);
+            }
+        }
+        else if (strcmp(key, "devices") == 0)
+        {
+            bool first_device = true;
+            settings->num_devices = 0;
+            while (_next_element(r, &first_device))
+            {
+                if (settings->num_devices >= SENSORS_MAX_DEVICES)
+                {
+                    r->ok = false;
+                    break;
+                }
+                _device(r, &settings->devices[settings->num_devices++]);
+            }
+        }
+        else if (strcmp(key, "zones") == 0)
+        {
+            _string_value(r, settings->zones, sizeof(settings->zones));
+        }
+        else if (strcmp(key, "alarms") == 0)
+        {
+            _string_value(r, settings->alarms, sizeof(settings->alarms));
+        }
+        else if (strcmp(key, "modbus_tcp_port") == 0)
+        {
+            settings->modbus_tcp_port = _integer(r, 1, 65535);
+        }
+        else
+        {
+            _skip_value(r, 1);
+        }
+    }
+
+    if (r->ok && _peek(r) != '\0')
+    {
+        r->ok = false;    // trailing content
+    }
+    if (!r->ok)
+    {
+        ESP_LOGE(TAG, "invalid settings at offset %d", (int)(r->p - json));
+    }
+    return r->ok;
+}
+
+bool settings_load(settings_t * settings)
+{
+    settings_init(settings);
+
+#ifdef CONFIG_RUNTIME_SETTINGS
+    // static, so that loading needs neither heap nor a large stack
+    static char buffer[SETTINGS_MAX_SIZE];
+
+    nvs_handle_t handle;
+    if (nvs_flash_init() != ESP_OK || nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        ESP_LOGI(TAG, "no stored settings, using defaults");
+        return true;
+    }
+    size_t size = sizeof(buffer);
+    esp_err_t err = nvs_get_blob(handle, SETTINGS_NVS_KEY, buffer, &size);
+    nvs_close(handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGI(TAG, "no stored settings (%s), using defaults", esp_err_to_name(err));
+        return true;
+    }
+
+    int64_t start = esp_timer_get_time();
+    bool ok = settings_parse(settings, buffer, size);
+    settings->parse_time = esp_timer_get_time() - start;
+    settings->source_size = size;
+    ESP_LOGI(TAG, "metric settings bytes=%d devices=%d ok=%d parse_us=%" PRId64,
+             settings->source_size, settings->num_devices, ok, settings->parse_time);
+
+    if (!ok)
+    {
+        // a partly applied document could leave buses and devices inconsistent
+        settings_init(settings);
+        return false;
+    }
+#endif
+    return true;
+}
+
+const settings_device_t * settings_find_device(const settings_t * settings, const char * rom_code_s)
+{
+    for (int i = 0; i < settings->num_devices; ++i)
+    {
+        if (strcasecmp(settings->devices[i].rom_code_s, rom_code_s) == 0)
+        {
+            return &settings->devices[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,159 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file settings.h
+ * @brief Runtime settings, loaded from a JSON document stored in NVS.
+ *
+ * Settings start from the compile-time defaults in the project configuration, and are then
+ * overridden by any values found in the document. The document is parsed in a single pass
+ * directly into the fixed-size tables of settings_t, without building a tree and without heap
+ * allocation. Unknown keys are skipped, so documents may carry settings for later versions.
+ *
+ * A bus is given by the GPIO of an RMT-driven bus, as a number or as { "gpio": n } naming an
+ * output-capable pin, or by the channel of a DS2482 bridge bus, as { "ds2482": n }. RMT buses
+ * beyond the number of RMT channel pairs share the last pair, see rmt_share.h.
+ *
+ * Example document:
+ *
+ *     {
+ *       "period_ms": 1000,
+ *       "resolution": 12,
+ *       "buses": [4, 5, { "ds2482": 0 }, { "ds2482": 1 }],
+ *       "known_device": "1502162ca5b2ee28",
+ *       "devices": [
+ *         { "rom": "1502162ca5b2ee28", "name": "tank", "id": 0, "resolution": 11, "offset": -0.25 }
+ *       ],
+ *       "zones": "tank=0,1,2",
+ *       "alarms": "high:*:30:29.5:3",
+ *       "modbus_tcp_port": 502
+ *     }
+ */
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "owb.h"
+#include "ds18b20.h"
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SETTINGS_MAX_RMT_PAIRS    (4)      ///< Pairs of the eight RMT channels, one per dedicated RMT bus
+#define SETTINGS_MAX_BUSES        (SENSORS_MAX_BUSES)
+#define SETTINGS_MAX_SIZE         (2048)   ///< Maximum size of the stored document, in bytes
+#define SETTINGS_SPEC_LENGTH      (256)    ///< Maximum length of a zone or alarm specification
+#define SETTINGS_NVS_NAMESPACE    "ds18b20"
+#define SETTINGS_NVS_KEY          "settings"
+
+/**
+ * @brief Bus drivers.
+ */
+typedef enum
+{
+    SETTINGS_BUS_RMT = 0,        ///< Driven by the RMT peripheral on a GPIO
+    SETTINGS_BUS_DS2482,         ///< A channel of a DS2482 I2C bridge
+} settings_bus_type_t;
+
+/**
+ * @brief Settings for a bus.
+ */
+typedef struct
+{
+    settings_bus_type_t type;    ///< Driver
+    int pin;                     ///< GPIO of an RMT bus, or channel of a DS2482 bus
+} settings_bus_t;
+
+/**
+ * @brief Settings for a specific device, matched by ROM code.
+ */
+typedef struct
+{
+    char rom_code_s[OWB_ROM_CODE_STRING_LENGTH];   ///< ROM code as a 16-digit hexadecimal string
+    char name[SENSORS_NAME_LENGTH];                ///< Name, or empty
+    uint16_t logical_id;                           ///< Logical ID, or SENSORS_NO_LOGICAL_ID
+    DS18B20_RESOLUTION resolution;                 ///< Resolution, or DS18B20_RESOLUTION_INVALID for the default
+    int16_t calibration;                           ///< Offset added to each reading, in 1/16 degrees C
+} settings_device_t;
+
+/**
+ * @brief All runtime settings.
+ */
+typedef struct
+{
+    uint32_t period_ms;                            ///< Sample period, in milliseconds
+    DS18B20_RESOLUTION resolution;                 ///< Default resolution
+    int num_buses;                                 ///< Number of 1-Wire buses
+    settings_bus_t buses[SETTINGS_MAX_BUSES];      ///< Driver and pin of each bus
+    bool has_known_device;                         ///< True if known_device is set
+    OneWireBus_ROMCode known_device;               ///< Device to check for after searching
+    int num_devices;                               ///< Number of entries in devices
+    settings_device_t devices[SENSORS_MAX_DEVICES];
+    char zones[SETTINGS_SPEC_LENGTH];              ///< Zone definitions, see zones_parse()
+    char alarms[SETTINGS_SPEC_LENGTH];             ///< Alarm rules, see alarms_compile()
+    uint16_t modbus_tcp_port;                      ///< Modbus TCP port
+
+    int source_size;                               ///< Size of the document loaded, or 0 if none
+    int64_t parse_time;                            ///< Time taken to parse the document, in microseconds
+} settings_t;
+
+/**
+ * @brief Initialise settings to the compile-time defaults.
+ */
+void settings_init(settings_t * settings);
+
+/**
+ * @brief Parse a JSON document into settings, overriding the values it contains.
+ * @param[in,out] settings Settings to update. Values parsed before an error are retained.
+ * @param[in] json Document, which need not be terminated.
+ * @param[in] length Length of the document, in bytes.
+ * @return True if the document is valid.
+ */
+bool settings_parse(settings_t * settings, const char * json, int length);
+
+/**
+ * @brief Initialise settings to the compile-time defaults, then apply the document stored in NVS, if any.
+ *
+ * The size of the document and the time taken to parse it are recorded in settings.
+ * @return True if the defaults were used or a valid document was applied.
+ */
+bool settings_load(settings_t * settings);
+
+/**
+ * @brief Find the settings for a device.
+ * @return Pointer to the device's settings, or NULL if there are none.
+ */
+const settings_device_t * settings_find_device(const settings_t * settings, const char * rom_code_s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SETTINGS_H
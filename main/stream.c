@@ -0,0 +1,343 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_WEB_STREAM
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+
+#include "stream.h"
+
+#define DEVICE_ENTRY_SIZE   (24)     // "[65535,-32768,-1]," plus margin
+#define FRAME_HEADER_SIZE   (4)      // WebSocket header of an unmasked frame of up to 65535 bytes
+#define RECV_BUFFER_SIZE    (64)     // largest incoming frame accepted
+#define TASK_STACK_SIZE     (3072)
+#define TASK_PRIORITY       (4)
+#define RETRY_MS            (20)     // interval between writes while a frame is in flight
+
+static const char * TAG = "stream";
+
+static const char PAGE[] =
+    "<!DOCTYPE html><html><head><title>DS18B20</title></head><body>"
+    "<h3>DS18B20 live view</h3><p id=c></p><table id=t></table><script>"
+    "var t=document.getElementById('t'),c=document.getElementById('c'),r={};"
+    "var w=new WebSocket('ws://'+location.host+'/ws');"
+    "w.onmessage=function(e){var f=JSON.parse(e.data);c.textContent='cycle '+f.cycle;"
+    "f.d.forEach(function(d){var x=r[d[0]];if(!x){x=r[d[0]]=t.insertRow();x.insertCell();x.insertCell();}"
+    "x.cells[0].textContent=d[0];x.cells[1].textContent=d[2]?'error '+d[2]:(d[1]/16).toFixed(2);});};"
+    "</script></body></html>";
+
+static esp_err_t _page_handler(httpd_req_t * req)
+{
+    httpd_resp_set_type(req, "text/html");
+    return httpd_resp_send(req, PAGE, HTTPD_RESP_USE_STRLEN);
+}
+
+// Reset a slot for a newly connected client, keeping its frame buffer
+static void _accept(stream_t * stream, stream_client_t * client, int fd)
+{
+    uint8_t * frame = client->frame;
+    memset(client, 0, sizeof(*client));
+    client->frame = frame;
+    client->fd = fd;
+    client->full = true;
+    client->due = stream->ready;
+    client->connect_time = esp_timer_get_time();
+}
+
+static void _release(stream_client_t * client)
+{
+    int64_t connected = esp_timer_get_time() - client->connect_time;
+    ESP_LOGI(TAG, "metric stream fd=%d frames=%u skipped=%u bytes=%u encode_us=%" PRId64 " send_us=%" PRId64 " connected_ms=%u",
+             client->fd, (unsigned int)client->frames_sent, (unsigned int)client->frames_skipped,
+             (unsigned int)client->bytes_sent, client->encode_time, client->send_time, (unsigned int)(connected / 1000));
+    client->fd = -1;
+    client->head = client->tail = 0;
+}
+
+static esp_err_t _ws_handler(httpd_req_t * req)
+{
+    stream_t * stream = req->user_ctx;
+
+    if (req->method == HTTP_GET)
+    {
+        // Handshake: allocate a client slot. A slot that still holds this socket belongs to a
+        // closed connection whose descriptor has been reused, so it is reset for the new client.
+        int fd = httpd_req_to_sockfd(req);
+        stream_client_t * slot = NULL;
+        xSemaphoreTake(stream->mutex, portMAX_DELAY);
+        for (int c = 0; c < STREAM_MAX_CLIENTS; ++c)
+        {
+            stream_client_t * client = &stream->clients[c];
+            if (client->fd == fd)
+            {
+                _release(client);
+                slot = client;
+                break;
+            }
+            if (client->fd < 0 && slot == NULL)
+            {
+                slot = client;
+            }
+        }
+        if (slot != NULL)
+        {
+            _accept(stream, slot, fd);
+        }
+        xSemaphoreGive(stream->mutex);
+        ESP_LOGI(TAG, "client %d %s", fd, slot != NULL ? "connected" : "rejected, too many clients");
+        if (slot != NULL)
+        {
+            xTaskNotifyGive(stream->task);
+        }
+        return slot != NULL ? ESP_OK : ESP_FAIL;
+    }
+
+    // incoming frames are not used, but must be consumed
+    httpd_ws_frame_t frame = { 0 };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK || frame.len == 0)
+    {
+        return err;
+    }
+    uint8_t payload[RECV_BUFFER_SIZE];
+    if (frame.len > sizeof(payload))
+    {
+        return ESP_FAIL;
+    }
+    frame.payload = payload;
+    return httpd_ws_recv_frame(req, &frame, frame.len);
+}
+
+// Encode a delta frame for a client and update its baseline. Called with the mutex held.
+static void _encode(stream_t * stream, stream_client_t * client)
+{
+    int64_t start = esp_timer_get_time();
+    char * payload = (char *)client->frame + FRAME_HEADER_SIZE;
+    char * p = payload;
+    char * end = (char *)client->frame + stream->frame_size;
+    p += snprintf(p, end - p, "{\"cycle\":%u,\"full\":%s,\"d\":[", (unsigned int)stream->cycle, client->full ? "true" : "false");
+
+    bool first = true;
+    for (int i = 0; i < stream->num_devices; ++i)
+    {
+        if (!client->full && client->value[i] == stream->value[i] && client->status[i] == stream->status[i])
+        {
+            continue;
+        }
+        client->value[i] = stream->value[i];
+        client->status[i] = stream->status[i];
+        p += snprintf(p, end - p, "%s[%u,%d,%d]", first ? "" : ",", stream->id[i], stream->value[i], stream->status[i]);
+        first = false;
+    }
+    p += snprintf(p, end - p, "]}");
+    client->full = false;
+    client->due = false;
+
+    // unmasked final text frame, with the header placed immediately before the payload
+    size_t len = p - payload;
+    uint8_t * header;
+    if (len < 126)
+    {
+        header = client->frame + FRAME_HEADER_SIZE - 2;
+        header[1] = (uint8_t)len;
+    }
+    else
+    {
+        header = client->frame;
+        header[1] = 126;
+        header[2] = (uint8_t)(len >> 8);
+        header[3] = (uint8_t)len;
+    }
+    header[0] = 0x81;
+    client->head = header - client->frame;
+    client->tail = FRAME_HEADER_SIZE + len;
+    client->encode_time += esp_timer_get_time() - start;
+}
+
+// Write as much of a client's frame as the socket accepts. Called with the mutex held.
+static void _write(stream_t * stream, stream_client_t * client)
+{
+    int64_t start = esp_timer_get_time();
+    ssize_t n = send(client->fd, client->frame + client->head, client->tail - client->head, MSG_DONTWAIT);
+    client->send_time += esp_timer_get_time() - start;
+    if (n < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            httpd_sess_trigger_close(stream->server, client->fd);
+            _release(client);
+        }
+        return;
+    }
+    client->head += n;
+    client->bytes_sent += n;
+    if (client->head == client->tail)
+    {
+        ++client->frames_sent;
+    }
+}
+
+// Encodes and sends frames, so that no client's socket blocks the HTTP server or other clients
+static void _stream_task(void * parameter)
+{
+    stream_t * stream = parameter;
+    bool in_flight = false;
+    while (1)
+    {
+        // wake for each published cycle and new client, and periodically while a frame is in flight
+        ulTaskNotifyTake(pdTRUE, in_flight ? pdMS_TO_TICKS(RETRY_MS) : portMAX_DELAY);
+
+        in_flight = false;
+        xSemaphoreTake(stream->mutex, portMAX_DELAY);
+        for (int c = 0; c < STREAM_MAX_CLIENTS; ++c)
+        {
+            stream_client_t * client = &stream->clients[c];
+            if (client->fd < 0)
+            {
+                continue;
+            }
+            if (httpd_ws_get_fd_info(stream->server, client->fd) != HTTPD_WS_CLIENT_WEBSOCKET)
+            {
+                // the connection has closed
+                _release(client);
+                continue;
+            }
+            if (client->head < client->tail)
+            {
+                _write(stream, client);
+            }
+            if (client->fd >= 0 && client->head == client->tail && client->due)
+            {
+                // the previous frame has gone, so send the latest cycle
+                _encode(stream, client);
+                _write(stream, client);
+            }
+            in_flight |= client->fd >= 0 && client->head < client->tail;
+        }
+        xSemaphoreGive(stream->mutex);
+    }
+}
+
+stream_t * stream_malloc(httpd_handle_t server)
+{
+    if (server == NULL)
+    {
+        return NULL;
+    }
+
+    stream_t * stream = calloc(1, sizeof(*stream));
+    if (stream == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+    stream->server = server;
+    stream->mutex = xSemaphoreCreateMutex();
+    stream->frame_size = FRAME_HEADER_SIZE + 64 + SENSORS_MAX_DEVICES * DEVICE_ENTRY_SIZE;
+    bool ok = stream->mutex != NULL;
+    for (int c = 0; c < STREAM_MAX_CLIENTS; ++c)
+    {
+        stream->clients[c].fd = -1;
+        stream->clients[c].frame = malloc(stream->frame_size);
+        ok = ok && stream->clients[c].frame != NULL;
+    }
+    if (ok && xTaskCreate(_stream_task, "stream", TASK_STACK_SIZE, stream, TASK_PRIORITY, &stream->task) != pdPASS)
+    {
+        ok = false;
+    }
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        for (int c = 0; c < STREAM_MAX_CLIENTS; ++c)
+        {
+            free(stream->clients[c].frame);
+        }
+        if (stream->mutex != NULL)
+        {
+            vSemaphoreDelete(stream->mutex);
+        }
+        free(stream);
+        return NULL;
+    }
+
+    httpd_uri_t page = {
+        .uri = "/",
+        .method = HTTP_GET,
+        .handler = _page_handler,
+        .user_ctx = stream,
+    };
+    httpd_uri_t ws = {
+        .uri = "/ws",
+        .method = HTTP_GET,
+        .handler = _ws_handler,
+        .user_ctx = stream,
+        .is_websocket = true,
+    };
+    httpd_register_uri_handler(server, &page);
+    httpd_register_uri_handler(server, &ws);
+    return stream;
+}
+
+void stream_publish(stream_t * stream, const sensors_t * sensors, const sensors_snapshot_t * snapshot)
+{
+    xSemaphoreTake(stream->mutex, portMAX_DELAY);
+    stream->ready = true;
+    stream->cycle = snapshot->cycle;
+    stream->num_devices = snapshot->num_devices;
+    for (int i = 0; i < snapshot->num_devices; ++i)
+    {
+        uint16_t id = sensors->cold[i].logical_id;
+        stream->id[i] = id != SENSORS_NO_LOGICAL_ID ? id : i;
+        stream->value[i] = snapshot->value[i];
+        stream->status[i] = snapshot->status[i];
+    }
+
+    for (int c = 0; c < STREAM_MAX_CLIENTS; ++c)
+    {
+        stream_client_t * client = &stream->clients[c];
+        if (client->fd < 0)
+        {
+            continue;
+        }
+        if (client->head < client->tail || client->due)
+        {
+            // back-pressure: the next frame sent will include this cycle's changes
+            ++client->frames_skipped;
+        }
+        client->due = true;
+    }
+    xSemaphoreGive(stream->mutex);
+    xTaskNotifyGive(stream->task);
+}
+
+#endif  // CONFIG_WEB_STREAM
@@ -0,0 +1,129 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file stream.h
+ * @brief WebSocket live stream of per-cycle readings, sent as deltas.
+ *
+ * Each cycle's published values are copied into a snapshot, and the stream's task is woken.
+ * For every connected client, the task encodes a frame containing only the devices whose
+ * value or status differs from what that client last received, and writes it to the client's
+ * socket without blocking. A frame that does not fit in the socket's send buffer stays in
+ * flight, and the task writes the rest as the client drains it. A client that still has a frame
+ * in flight when the next cycle arrives skips that cycle; because deltas are taken against the
+ * client's own baseline, the next frame it receives brings it fully up to date. A slow client
+ * therefore delays only itself, never other clients or the HTTP server.
+ *
+ * Frames are JSON text:
+ *
+ *     {"cycle":123,"full":false,"d":[[id,raw,status],...]}
+ *
+ * where id is the device's logical ID or index, and raw is in 1/16 degrees C. The first
+ * frame sent to a client is a full frame.
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_http_server.h"
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STREAM_MAX_CLIENTS   (4)     ///< Maximum number of simultaneous stream clients
+
+/**
+ * @brief Per-client state.
+ */
+typedef struct
+{
+    int fd;                                    ///< Socket, or -1 if the slot is free
+    bool full;                                 ///< The next frame must contain every device
+    bool due;                                  ///< A cycle has been published since the last frame was encoded
+    uint8_t * frame;                           ///< Frame being sent, WebSocket header and payload
+    size_t head;                               ///< Offset of the next byte of frame to write
+    size_t tail;                               ///< Offset of the end of frame; the frame is in flight while head < tail
+    uint32_t frames_sent;                      ///< Frames delivered
+    uint32_t frames_skipped;                   ///< Cycles skipped because of back-pressure
+    uint32_t bytes_sent;                       ///< Bytes written to the socket, headers included
+    int64_t connect_time;                      ///< Time the client connected, in microseconds
+    int64_t encode_time;                       ///< Time spent encoding frames, in microseconds
+    int64_t send_time;                         ///< Time spent writing frames to the socket, in microseconds
+    int16_t value[SENSORS_MAX_DEVICES];        ///< Values the client last received
+    int8_t status[SENSORS_MAX_DEVICES];        ///< Statuses the client last received
+} stream_client_t;
+
+/**
+ * @brief Stream state.
+ */
+typedef struct
+{
+    httpd_handle_t server;                     ///< HTTP server
+    TaskHandle_t task;                         ///< Task that encodes and sends frames
+    SemaphoreHandle_t mutex;                   ///< Protects the snapshot and client slots
+    bool ready;                                ///< A snapshot has been published
+    uint32_t cycle;                            ///< Cycle of the snapshot
+    int num_devices;                           ///< Devices in the snapshot
+    uint16_t id[SENSORS_MAX_DEVICES];          ///< Snapshot device IDs
+    int16_t value[SENSORS_MAX_DEVICES];        ///< Snapshot values
+    int8_t status[SENSORS_MAX_DEVICES];        ///< Snapshot statuses
+    size_t frame_size;                         ///< Size of each client's frame buffer
+    stream_client_t clients[STREAM_MAX_CLIENTS];
+} stream_t;
+
+/**
+ * @brief Construct a stream and register its handlers on an HTTP server.
+ *
+ * Registers "/" for a live view page and "/ws" for the WebSocket endpoint, and starts the
+ * task that sends frames. Frames are written directly to client sockets, so the server must
+ * not use TLS.
+ *
+ * @return Pointer to the new instance, or NULL if it cannot be created.
+ */
+stream_t * stream_malloc(httpd_handle_t server);
+
+/**
+ * @brief Publish the processed readings of a cycle to all clients.
+ *
+ * Does not wait for any client; frames are sent by the stream's task.
+ * @param[in] stream Pointer to stream instance.
+ * @param[in] sensors Devices, for their logical IDs.
+ * @param[in] snapshot Processed readings at the end of the cycle.
+ */
+void stream_publish(stream_t * stream, const sensors_t * sensors, const sensors_snapshot_t * snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // STREAM_H
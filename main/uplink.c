@@ -0,0 +1,377 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_UPLINK
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
+
+#include "network.h"
+#include "uplink.h"
+
+#define CYCLE_MAX_BYTES(n)   (10 + 3 * (n))   // two 5-byte varints, and up to 3 bytes per device
+#define PLAIN_CYCLE_BYTES(n) (8 + 2 * (n))    // cycle, time and 16-bit values, for the compression ratio
+#define FLAG_COMPRESSED      (1 << 0)
+#define HTTP_TIMEOUT_MS      (10000)
+#define BACKOFF_MIN_MS       (1000)           // first retry after a failed POST
+#define BACKOFF_MAX_MS       (60000)
+#define TASK_STACK_SIZE      (4096)
+#define TASK_PRIORITY        (3)
+
+static const char * TAG = "uplink";
+
+// Queue entry header, followed by the block
+typedef struct
+{
+    uint32_t length;             // bytes of the block
+    uint32_t last_cycle;         // last cycle in the block
+    uint32_t plain;              // PLAIN_CYCLE_BYTES() of the cycles in the block
+} entry_t;
+
+uplink_t * uplink_malloc(const sensors_t * sensors, const char * url, int batch, size_t queue_size, uint32_t rate)
+{
+    if (CYCLE_MAX_BYTES(sensors->num_devices) > UPLINK_BLOCK_SIZE)
+    {
+        ESP_LOGE(TAG, "too many devices for a block");
+        return NULL;
+    }
+    uplink_t * uplink = calloc(1, sizeof(*uplink));
+    if (uplink == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+    strncpy(uplink->url, url, sizeof(uplink->url) - 1);
+    uplink->num_devices = sensors->num_devices;
+    uplink->batch = batch > 0 ? batch : 1;
+    uplink->rate = rate > 0 ? rate : 1;
+    uplink->mutex = xSemaphoreCreateMutex();
+    uplink->payload = malloc(UPLINK_BLOCK_SIZE);
+    uplink->previous = calloc(sensors->num_devices > 0 ? sensors->num_devices : 1, sizeof(int16_t));
+    uplink->compressed = malloc(UPLINK_HEADER_SIZE + UPLINK_BLOCK_SIZE);
+    uplink->ring = malloc(queue_size);
+    uplink->ring_size = queue_size;
+    if (uplink->mutex == NULL || uplink->payload == NULL || uplink->previous == NULL || uplink->compressed == NULL
+        || uplink->ring == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        free(uplink->payload);
+        free(uplink->previous);
+        free(uplink->compressed);
+        free(uplink->ring);
+        free(uplink);
+        return NULL;
+    }
+    ESP_LOGI(TAG, "%d cycles per block, %u byte queue, %u bytes/s to %s", uplink->batch, (unsigned int)queue_size,
+             (unsigned int)uplink->rate, uplink->url);
+    return uplink;
+}
+
+static void _ring_write(uplink_t * uplink, const void * data, size_t length)
+{
+    size_t offset = (uplink->head + uplink->used) % uplink->ring_size;
+    size_t first = length < uplink->ring_size - offset ? length : uplink->ring_size - offset;
+    memcpy(&uplink->ring[offset], data, first);
+    memcpy(uplink->ring, (const uint8_t *)data + first, length - first);
+    uplink->used += length;
+}
+
+static void _ring_read(const uplink_t * uplink, size_t position, void * data, size_t length)
+{
+    size_t offset = (uplink->head + position) % uplink->ring_size;
+    size_t first = length < uplink->ring_size - offset ? length : uplink->ring_size - offset;
+    memcpy(data, &uplink->ring[offset], first);
+    memcpy((uint8_t *)data + first, uplink->ring, length - first);
+}
+
+// Remove the oldest block from the queue. Called with the mutex held.
+static void _ring_pop(uplink_t * uplink)
+{
+    entry_t entry;
+    _ring_read(uplink, 0, &entry, sizeof(entry));
+    uplink->head = (uplink->head + sizeof(entry) + entry.length) % uplink->ring_size;
+    uplink->used -= sizeof(entry) + entry.length;
+    --uplink->queued;
+}
+
+static void _queue(uplink_t * uplink, const uint8_t * block, size_t length, uint32_t last_cycle, uint32_t plain)
+{
+    entry_t entry = { .length = length, .last_cycle = last_cycle, .plain = plain };
+    xSemaphoreTake(uplink->mutex, portMAX_DELAY);
+    if (sizeof(entry) + length > uplink->ring_size)
+    {
+        ++uplink->blocks_dropped;
+    }
+    else
+    {
+        // the oldest blocks make way for the newest
+        while (uplink->ring_size - uplink->used < sizeof(entry) + length)
+        {
+            _ring_pop(uplink);
+            ++uplink->blocks_dropped;
+        }
+        _ring_write(uplink, &entry, sizeof(entry));
+        _ring_write(uplink, block, length);
+        ++uplink->queued;
+        uplink->queued_last_cycle = last_cycle;
+    }
+    xSemaphoreGive(uplink->mutex);
+
+    if (uplink->task != NULL)
+    {
+        xTaskNotifyGive(uplink->task);
+    }
+}
+
+static size_t _put_varint(uint8_t * p, uint32_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        p[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (uint8_t)value;
+    return n;
+}
+
+static void _put_u16(uint8_t * p, uint16_t value)
+{
+    p[0] = (uint8_t)(value & 0xff);
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void _put_u32(uint8_t * p, uint32_t value)
+{
+    _put_u16(p, (uint16_t)(value & 0xffff));
+    _put_u16(p + 2, (uint16_t)(value >> 16));
+}
+
+void uplink_flush(uplink_t * uplink)
+{
+    if (uplink->block_cycles == 0)
+    {
+        return;
+    }
+
+    uint8_t * header = uplink->compressed;
+    size_t length = lz_compress(uplink->payload, uplink->payload_length, header + UPLINK_HEADER_SIZE,
+                                uplink->payload_length - 1, uplink->table);
+    header[0] = UPLINK_VERSION;
+    header[1] = length > 0 ? FLAG_COMPRESSED : 0;
+    _put_u16(&header[2], (uint16_t)uplink->num_devices);
+    _put_u32(&header[4], uplink->first_cycle);
+    _put_u32(&header[8], uplink->first_time_ms);
+    _put_u16(&header[12], (uint16_t)uplink->block_cycles);
+    _put_u16(&header[14], (uint16_t)uplink->payload_length);
+    if (length == 0)
+    {
+        // incompressible, so sent as it is
+        memcpy(header + UPLINK_HEADER_SIZE, uplink->payload, uplink->payload_length);
+        length = uplink->payload_length;
+    }
+
+    _queue(uplink, header, UPLINK_HEADER_SIZE + length, uplink->last_cycle,
+           uplink->block_cycles * PLAIN_CYCLE_BYTES(uplink->num_devices));
+    uplink->block_cycles = 0;
+    uplink->payload_length = 0;
+}
+
+// Append a cycle to the block being built. If status is not NULL, devices whose status is not
+// DS18B20_OK are added with no value.
+static void _add(uplink_t * uplink, uint32_t cycle, uint32_t time_ms, const int16_t * values, const int8_t * status,
+                 int num_devices)
+{
+    if (uplink->block_cycles > 0 && (cycle <= uplink->last_cycle || time_ms < uplink->last_time_ms))
+    {
+        uplink_flush(uplink);
+    }
+    if (uplink->payload_length + CYCLE_MAX_BYTES(uplink->num_devices) > UPLINK_BLOCK_SIZE)
+    {
+        uplink_flush(uplink);
+    }
+    if (uplink->block_cycles == 0)
+    {
+        uplink->first_cycle = uplink->last_cycle = cycle;
+        uplink->first_time_ms = uplink->last_time_ms = time_ms;
+        memset(uplink->previous, 0, uplink->num_devices * sizeof(int16_t));
+    }
+
+    uint8_t * p = &uplink->payload[uplink->payload_length];
+    p += _put_varint(p, cycle - uplink->last_cycle);
+    p += _put_varint(p, time_ms - uplink->last_time_ms);
+    for (int i = 0; i < uplink->num_devices; ++i)
+    {
+        int16_t value = i < num_devices && (status == NULL || status[i] == DS18B20_OK) ? values[i] : UPLINK_NO_VALUE;
+        if (value == UPLINK_NO_VALUE)
+        {
+            *p++ = 0;
+            continue;
+        }
+        int32_t delta = (int32_t)value - uplink->previous[i];
+        uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        p += _put_varint(p, zigzag + 1);
+        uplink->previous[i] = value;
+    }
+    uplink->payload_length = p - uplink->payload;
+    uplink->last_cycle = cycle;
+    uplink->last_time_ms = time_ms;
+
+    if (++uplink->block_cycles >= uplink->batch)
+    {
+        uplink_flush(uplink);
+    }
+}
+
+void uplink_add_values(uplink_t * uplink, uint32_t cycle, uint32_t time_ms, const int16_t * values, int num_devices)
+{
+    _add(uplink, cycle, time_ms, values, NULL, num_devices);
+}
+
+void uplink_add_cycle(uplink_t * uplink, const sensors_snapshot_t * snapshot)
+{
+    // encoded straight from the snapshot, as a copy of its values would not fit on a worker's stack
+    int num_devices = snapshot->num_devices < uplink->num_devices ? snapshot->num_devices : uplink->num_devices;
+    uint32_t time_ms = uplink->time_offset_ms + (uint32_t)(esp_timer_get_time() / 1000);
+    _add(uplink, snapshot->cycle, time_ms, snapshot->value, snapshot->status, num_devices);
+}
+
+uint32_t uplink_delivered_cycle(uplink_t * uplink)
+{
+    xSemaphoreTake(uplink->mutex, portMAX_DELAY);
+    uint32_t cycle = uplink->delivered_cycle;
+    xSemaphoreGive(uplink->mutex);
+    return cycle;
+}
+
+// Copy the oldest block out of the queue, leaving it queued. Returns its length, or 0 if the queue is empty.
+static size_t _peek(uplink_t * uplink, uint8_t * block, entry_t * entry, uint32_t * removed)
+{
+    size_t length = 0;
+    xSemaphoreTake(uplink->mutex, portMAX_DELAY);
+    if (uplink->queued > 0)
+    {
+        _ring_read(uplink, 0, entry, sizeof(*entry));
+        _ring_read(uplink, sizeof(*entry), block, entry->length);
+        length = entry->length;
+        *removed = uplink->blocks_sent + uplink->blocks_dropped;
+    }
+    xSemaphoreGive(uplink->mutex);
+    return length;
+}
+
+static void _print_stats(const uplink_t * uplink)
+{
+    ESP_LOGI(TAG, "metric uplink sent=%u dropped=%u failures=%u queued=%d backlog=%u ratio=%.2f throughput=%u",
+             (unsigned int)uplink->blocks_sent, (unsigned int)uplink->blocks_dropped, (unsigned int)uplink->send_failures,
+             uplink->queued, (unsigned int)uplink->used,
+             uplink->bytes_sent > 0 ? (double)uplink->bytes_plain / uplink->bytes_sent : 0.0,
+             uplink->send_time > 0 ? (unsigned int)(uplink->bytes_sent * 1000000 / uplink->send_time) : 0u);
+}
+
+static void _drain_task(void * pvParameter)
+{
+    uplink_t * uplink = pvParameter;
+    uint8_t * block = malloc(UPLINK_HEADER_SIZE + UPLINK_BLOCK_SIZE);
+    esp_http_client_config_t config = {
+        .url = uplink->url,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = HTTP_TIMEOUT_MS,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (block == NULL || client == NULL)
+    {
+        ESP_LOGE(TAG, "failed to start");
+        vTaskDelete(NULL);
+        return;
+    }
+    esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+
+    uint32_t backoff_ms = BACKOFF_MIN_MS;
+    while (1)
+    {
+        entry_t entry;
+        uint32_t removed = 0;
+        size_t length = _peek(uplink, block, &entry, &removed);
+        if (length == 0)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        network_wait_connected(portMAX_DELAY);
+
+        esp_http_client_set_post_field(client, (const char *)block, (int)length);
+        int64_t start = esp_timer_get_time();
+        esp_err_t err = esp_http_client_perform(client);
+        int status = err == ESP_OK ? esp_http_client_get_status_code(client) : 0;
+        int64_t elapsed = esp_timer_get_time() - start;
+        if (status < 200 || status >= 300)
+        {
+            xSemaphoreTake(uplink->mutex, portMAX_DELAY);
+            ++uplink->send_failures;
+            xSemaphoreGive(uplink->mutex);
+            ESP_LOGW(TAG, "POST failed: %s, status %d, retrying in %u ms", esp_err_to_name(err), status, (unsigned int)backoff_ms);
+            vTaskDelay(backoff_ms / portTICK_PERIOD_MS);
+            backoff_ms = backoff_ms * 2 < BACKOFF_MAX_MS ? backoff_ms * 2 : BACKOFF_MAX_MS;
+            continue;
+        }
+        backoff_ms = BACKOFF_MIN_MS;
+
+        xSemaphoreTake(uplink->mutex, portMAX_DELAY);
+        // the block is still at the head unless the queue overflowed while it was being sent
+        if (uplink->blocks_sent + uplink->blocks_dropped == removed)
+        {
+            _ring_pop(uplink);
+        }
+        ++uplink->blocks_sent;
+        uplink->bytes_plain += entry.plain;
+        uplink->bytes_sent += length;
+        uplink->send_time += elapsed;
+        uplink->delivered_cycle = entry.last_cycle;
+        _print_stats(uplink);
+        xSemaphoreGive(uplink->mutex);
+
+        // pace sends to the rate, so that a backlog drains gradually after an outage
+        int64_t paced_us = (int64_t)length * 1000000 / uplink->rate - elapsed;
+        if (paced_us > 0)
+        {
+            vTaskDelay((TickType_t)(paced_us / 1000 / portTICK_PERIOD_MS) + 1);
+        }
+    }
+}
+
+bool uplink_start(uplink_t * uplink)
+{
+    return xTaskCreate(_drain_task, "uplink", TASK_STACK_SIZE, uplink, TASK_PRIORITY, &uplink->task) == pdPASS;
+}
+
+#endif  // CONFIG_UPLINK
@@ -0,0 +1,177 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file uplink.h
+ * @brief Store-and-forward uplink of per-cycle readings, in compressed batches over HTTP.
+ *
+ * Cycles are batched into blocks of up to a configured number of cycles. When a block is
+ * complete it is delta encoded, compressed with lz_compress() and appended to a queue held
+ * in a RAM ring. While the queue is full the oldest blocks are dropped, so that an outage
+ * loses the oldest data rather than the newest. A drain task POSTs queued blocks, oldest
+ * first, while the network is connected. After a failed POST it backs off exponentially, and
+ * sends are paced to a byte rate, so that a backlog built up during an outage drains
+ * gradually instead of flooding the network when it returns.
+ *
+ * Each block is independently decodable. It is a 16-byte header, all fields little-endian:
+ *
+ *     uint8   version         UPLINK_VERSION
+ *     uint8   flags           bit 0: the payload is compressed
+ *     uint16  num_devices     values in each cycle
+ *     uint32  first_cycle     cycle number of the first cycle
+ *     uint32  first_time_ms   time of the first cycle
+ *     uint16  num_cycles      cycles in the block
+ *     uint16  length          length of the payload before compression
+ *
+ * followed by the payload. For each cycle, the payload holds base-128 varints (least
+ * significant group first): the increase in cycle number and in time since the previous
+ * cycle (both 0 for the first), then for each device 0 if there is no value, otherwise the
+ * zigzag-encoded change in value since the device's previous value in the block, plus 1.
+ * Values are calibrated readings in 1/16 degrees C; the previous value at the start of a
+ * block is 0.
+ */
+
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "sensors.h"
+#include "lz.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UPLINK_VERSION        (1)           ///< Block format version
+#define UPLINK_HEADER_SIZE    (16)          ///< Size of a block header, in bytes
+#define UPLINK_BLOCK_SIZE     (8192)        ///< Largest payload before compression, in bytes
+#define UPLINK_NO_VALUE       (INT16_MIN)   ///< Passed in place of a failed reading
+#define UPLINK_URL_LENGTH     (128)         ///< Maximum length of the URL, including terminator
+
+/**
+ * @brief Uplink state.
+ */
+typedef struct
+{
+    SemaphoreHandle_t mutex;                 ///< Protects the queue, the delivered cycle and the statistics
+    TaskHandle_t task;                       ///< Drain task
+    char url[UPLINK_URL_LENGTH];             ///< URL blocks are POSTed to
+    int num_devices;                         ///< Devices in each cycle
+    int batch;                               ///< Cycles per block
+    uint32_t rate;                           ///< Largest average send rate, in bytes per second
+    uint32_t time_offset_ms;                 ///< Added to time since boot, so that times continue across reboots
+
+    // block being built, used only by the caller of uplink_add_values()
+    uint8_t * payload;                       ///< Payload of the block being built
+    size_t payload_length;                   ///< Length of payload
+    int16_t * previous;                      ///< Previous value of each device in the block
+    int block_cycles;                        ///< Cycles in the block
+    uint32_t first_cycle;                    ///< Cycle of the first cycle in the block
+    uint32_t first_time_ms;                  ///< Time of the first cycle in the block
+    uint32_t last_cycle;                     ///< Cycle of the most recent cycle in the block
+    uint32_t last_time_ms;                   ///< Time of the most recent cycle in the block
+    uint8_t * compressed;                    ///< Header and compressed payload of a completed block
+    uint16_t table[LZ_TABLE_SIZE];           ///< Compressor work space
+
+    // queue of completed blocks, each a 12-byte entry header (block length, last cycle and plain
+    // size, see uplink.c) followed by the block, wrapping around the ring
+    uint8_t * ring;                          ///< Ring buffer
+    size_t ring_size;                        ///< Size of ring
+    size_t head;                             ///< Offset of the oldest block
+    size_t used;                             ///< Bytes in use
+    int queued;                              ///< Blocks in the queue
+    uint32_t queued_last_cycle;              ///< Last cycle of the most recently queued block
+
+    uint32_t delivered_cycle;                ///< Last cycle of the most recently delivered block, or 0
+
+    // statistics
+    uint32_t blocks_sent;                    ///< Blocks delivered
+    uint32_t blocks_dropped;                 ///< Blocks dropped because the queue was full
+    uint32_t send_failures;                  ///< POSTs that failed or were refused
+    uint64_t bytes_plain;                    ///< Size of the delivered cycles as plain 16-bit values, with cycle and time
+    uint64_t bytes_sent;                     ///< Bytes of the delivered blocks
+    int64_t send_time;                       ///< Time spent in successful POSTs, in microseconds
+} uplink_t;
+
+/**
+ * @brief Construct an uplink.
+ * @param[in] sensors Devices whose readings are sent.
+ * @param[in] url URL to POST blocks to.
+ * @param[in] batch Cycles per block.
+ * @param[in] queue_size Bytes of RAM for queued blocks.
+ * @param[in] rate Largest average send rate, in bytes per second.
+ * @return Pointer to the new instance, or NULL if it cannot be created.
+ */
+uplink_t * uplink_malloc(const sensors_t * sensors, const char * url, int batch, size_t queue_size, uint32_t rate);
+
+/**
+ * @brief Start the drain task.
+ * @return True if the task was created.
+ */
+bool uplink_start(uplink_t * uplink);
+
+/**
+ * @brief Add the processed readings of a completed cycle.
+ * @param[in] uplink Pointer to uplink instance.
+ * @param[in] snapshot Processed readings at the end of the cycle.
+ */
+void uplink_add_cycle(uplink_t * uplink, const sensors_snapshot_t * snapshot);
+
+/**
+ * @brief Add a cycle of readings, such as one replayed from retention.
+ *
+ * Cycles must be added in order. A cycle whose number or time is lower than the previous one
+ * starts a new block.
+ *
+ * @param[in] uplink Pointer to uplink instance.
+ * @param[in] cycle Cycle number.
+ * @param[in] time_ms Time of the cycle, including the time offset.
+ * @param[in] values Calibrated readings in 1/16 degrees C, indexed by device, or UPLINK_NO_VALUE.
+ * @param[in] num_devices Number of values.
+ */
+void uplink_add_values(uplink_t * uplink, uint32_t cycle, uint32_t time_ms, const int16_t * values, int num_devices);
+
+/**
+ * @brief Queue the block being built, even if it is not full.
+ */
+void uplink_flush(uplink_t * uplink);
+
+/**
+ * @brief Return the last cycle delivered, or 0 if none has been.
+ *
+ * All cycles up to and including it have been delivered or dropped.
+ */
+uint32_t uplink_delivered_cycle(uplink_t * uplink);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // UPLINK_H
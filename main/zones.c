@@ -0,0 +1,207 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "zones.h"
+
+static const char * TAG = "zones";
+
+static void _reset(zone_accumulator_t * accumulator)
+{
+    accumulator->count = 0;
+    accumulator->sum = 0;
+    accumulator->min = INT16_MAX;
+    accumulator->max = INT16_MIN;
+}
+
+zones_t * zones_malloc(void)
+{
+    zones_t * zones = calloc(1, sizeof(*zones));
+    if (zones == NULL)
+    {
+        ESP_LOGE(TAG, "malloc failed");
+        return NULL;
+    }
+    zones->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    return zones;
+}
+
+int zones_add(zones_t * zones, const char * name)
+{
+    if (zones->num_zones >= ZONES_MAX)
+    {
+        return -1;
+    }
+    int zone = zones->num_zones++;
+    strncpy(zones->name[zone], name, ZONES_NAME_LENGTH - 1);
+    return zone;
+}
+
+void zones_add_device(zones_t * zones, int zone, int device)
+{
+    if (zone >= 0 && zone < zones->num_zones && device >= 0 && device < SENSORS_MAX_DEVICES)
+    {
+        zones->mask[device] |= 1 << zone;
+    }
+}
+
+int zones_parse(zones_t * zones, const sensors_t * sensors, const char * spec)
+{
+    char * copy = strdup(spec);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+
+    int count = 0;
+    char * zone_save = NULL;
+    for (char * def = strtok_r(copy, ";", &zone_save); def != NULL; def = strtok_r(NULL, ";", &zone_save))
+    {
+        char * members = strchr(def, '=');
+        if (members == NULL)
+        {
+            ESP_LOGE(TAG, "zone definition without '=': %s", def);
+            count = -1;
+            break;
+        }
+        *members++ = '\0';
+
+        int zone = zones_add(zones, def);
+        if (zone < 0)
+        {
+            ESP_LOGE(TAG, "too many zones");
+            count = -1;
+            break;
+        }
+        ++count;
+
+        char * member_save = NULL;
+        for (char * token = strtok_r(members, ",", &member_save); token != NULL; token = strtok_r(NULL, ",", &member_save))
+        {
+            while (isspace((unsigned char)*token))
+            {
+                ++token;
+            }
+            int device = sensors_find_member(sensors, token);
+            if (device < 0)
+            {
+                ESP_LOGW(TAG, "zone %s: member %s not found", zones->name[zone], token);
+            }
+            zones_add_device(zones, zone, device);
+        }
+    }
+
+    free(copy);
+    return count;
+}
+
+void zones_complete(zones_t * zones, const sensors_snapshot_t * snapshot)
+{
+    // add up outside the lock, so that readers of the previous results are not held up
+    zone_accumulator_t accumulator[ZONES_MAX];
+    for (int z = 0; z < zones->num_zones; ++z)
+    {
+        _reset(&accumulator[z]);
+    }
+
+    for (int i = 0; i < snapshot->num_devices; ++i)
+    {
+        uint16_t mask = zones->mask[i];
+        if (mask == 0 || snapshot->status[i] != DS18B20_OK)
+        {
+            continue;
+        }
+
+        int16_t value = snapshot->value[i];
+        for (int z = 0; mask != 0; ++z, mask >>= 1)
+        {
+            if (mask & 1)
+            {
+                zone_accumulator_t * a = &accumulator[z];
+                ++a->count;
+                a->sum += value;
+                a->min = value < a->min ? value : a->min;
+                a->max = value > a->max ? value : a->max;
+            }
+        }
+    }
+
+    zone_result_t results[ZONES_MAX];
+    for (int z = 0; z < zones->num_zones; ++z)
+    {
+        const zone_accumulator_t * a = &accumulator[z];
+        zone_result_t * r = &results[z];
+        if (a->count > 0)
+        {
+            r->count = a->count;
+            r->mean = (int16_t)((a->sum + (a->sum >= 0 ? a->count / 2 : -a->count / 2)) / a->count);
+            r->min = a->min;
+            r->max = a->max;
+            r->spread = a->max - a->min;
+        }
+        else
+        {
+            memset(r, 0, sizeof(*r));
+        }
+    }
+
+    portENTER_CRITICAL(&zones->lock);
+    memcpy(zones->result, results, zones->num_zones * sizeof(results[0]));
+    zones->result_cycle = snapshot->cycle;
+    portEXIT_CRITICAL(&zones->lock);
+}
+
+uint32_t zones_snapshot(zones_t * zones, zone_result_t results[ZONES_MAX])
+{
+    portENTER_CRITICAL(&zones->lock);
+    memcpy(results, zones->result, sizeof(zones->result));
+    uint32_t cycle = zones->result_cycle;
+    portEXIT_CRITICAL(&zones->lock);
+    return cycle;
+}
+
+void zones_print(zones_t * zones)
+{
+    zone_result_t results[ZONES_MAX];
+    zones_snapshot(zones, results);
+    for (int z = 0; z < zones->num_zones; ++z)
+    {
+        const zone_result_t * r = &results[z];
+        if (r->count > 0)
+        {
+            printf("  zone %s: mean %.2f  min %.1f  max %.1f  spread %.1f  (%d devices)\n", zones->name[z],
+                   sensors_raw_to_celsius(r->mean), sensors_raw_to_celsius(r->min),
+                   sensors_raw_to_celsius(r->max), sensors_raw_to_celsius(r->spread), r->count);
+        }
+        else
+        {
+            printf("  zone %s: no readings\n", zones->name[z]);
+        }
+    }
+}
@@ -0,0 +1,141 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file zones.h
+ * @brief Aggregates over groups of devices, computed once per cycle from its snapshot.
+ *
+ * A zone is a named group of devices. When a cycle completes, the held reading of every
+ * member is taken from the cycle's snapshot, so that a zone covers all of its members
+ * whether or not they were due in that cycle, and members whose most recent read failed
+ * are left out. The mean, minimum, maximum and spread are then published alongside the
+ * individual readings. A device may belong to several zones.
+ */
+
+#ifndef ZONES_H
+#define ZONES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZONES_MAX            (16)    ///< Maximum number of zones
+#define ZONES_NAME_LENGTH    (16)    ///< Maximum length of a zone name, including terminator
+
+/**
+ * @brief Running totals for a zone while its members are added up.
+ */
+typedef struct
+{
+    int count;                       ///< Number of good readings
+    int32_t sum;                     ///< Sum of readings, in 1/16 degrees C
+    int16_t min;                     ///< Lowest reading, in 1/16 degrees C
+    int16_t max;                     ///< Highest reading, in 1/16 degrees C
+} zone_accumulator_t;
+
+/**
+ * @brief Aggregate values for a zone from a completed cycle.
+ */
+typedef struct
+{
+    int count;                       ///< Number of good readings contributing
+    int16_t mean;                    ///< Mean reading, rounded, in 1/16 degrees C
+    int16_t min;                     ///< Lowest reading, in 1/16 degrees C
+    int16_t max;                     ///< Highest reading, in 1/16 degrees C
+    int16_t spread;                  ///< Highest minus lowest, in 1/16 degrees C
+} zone_result_t;
+
+/**
+ * @brief Zone definitions, accumulators and results.
+ */
+typedef struct
+{
+    int num_zones;                                  ///< Number of zones defined
+    char name[ZONES_MAX][ZONES_NAME_LENGTH];        ///< Zone names
+    uint16_t mask[SENSORS_MAX_DEVICES];             ///< Bit z set if the device belongs to zone z
+
+    portMUX_TYPE lock;                              ///< Protects results
+    uint32_t result_cycle;                          ///< Cycle of the most recent results
+    zone_result_t result[ZONES_MAX];                ///< Most recent results
+} zones_t;
+
+/**
+ * @brief Construct an empty set of zones.
+ * @return Pointer to the new instance, or NULL if it cannot be created.
+ */
+zones_t * zones_malloc(void);
+
+/**
+ * @brief Define a new, empty zone.
+ * @return Index of the zone, or -1 if no more zones can be defined.
+ */
+int zones_add(zones_t * zones, const char * name);
+
+/**
+ * @brief Add a device to a zone.
+ */
+void zones_add_device(zones_t * zones, int zone, int device);
+
+/**
+ * @brief Define zones from a specification string.
+ *
+ * The specification is a semicolon-separated list of zones, each a name followed by '='
+ * and a comma-separated list of members, for example "tank=0,1,2;room=28ff64...,3".
+ * A member is either a 16-digit hexadecimal ROM code, or a decimal number which is a
+ * logical ID if the device has one, otherwise a device index.
+ *
+ * @return Number of zones defined, or -1 if the specification is invalid.
+ */
+int zones_parse(zones_t * zones, const sensors_t * sensors, const char * spec);
+
+/**
+ * @brief Compute the results for a completed cycle from the held readings of all members.
+ * @param[in] zones Pointer to zones instance.
+ * @param[in] snapshot Processed readings of all devices at the end of the cycle.
+ */
+void zones_complete(zones_t * zones, const sensors_snapshot_t * snapshot);
+
+/**
+ * @brief Take a consistent copy of the most recent results.
+ * @return Cycle the results belong to.
+ */
+uint32_t zones_snapshot(zones_t * zones, zone_result_t results[ZONES_MAX]);
+
+/**
+ * @brief Print the most recent results to the console.
+ */
+void zones_print(zones_t * zones);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ZONES_H
@@ -0,0 +1,395 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host test and benchmark of the alarm engine (main/alarms.c).
+//
+// Each rule type is driven through readings processed by main/sensors.c, checking that
+// events are raised and cleared on the reading expected from the set and clear thresholds
+// and the hold-off, and that rules bind only to their target devices. The benchmark then
+// evaluates tables of up to ALARMS_MAX_SOURCE_RULES rules on every device and reports the
+// time per rule evaluation and per frame. Exits non-zero if any check fails.
+//
+// Build and run on the host:
+//
+//     $ cc -O2 -I tools/host -I main -o alarms_test tools/alarms_test.c main/alarms.c main/sensors.c main/loss.c tools/host/host.c -lpthread -lm
+//     $ ./alarms_test [num_devices]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "alarms.h"
+
+#define NUM_BUSES        (4)
+#define PERIOD_US        (1000000)    // one reading per device per second
+
+static int failures;
+
+#define CHECK(condition, ...)                                                   \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                         \
+            printf(__VA_ARGS__);                                                \
+            printf("\n");                                                       \
+            ++failures;                                                         \
+        }                                                                       \
+    } while (0)
+
+// The firmware compiles its rules once and never frees them
+static void _free(alarms_t * alarms)
+{
+    if (alarms != NULL)
+    {
+        vQueueDelete(alarms->events);
+        free(alarms->rules);
+        free(alarms->state);
+        free(alarms);
+    }
+}
+
+static sensors_t * _devices(int num_devices)
+{
+    sensors_t * sensors = sensors_malloc();
+    sensors->num_devices = num_devices;
+    sensors->num_buses = NUM_BUSES;
+    for (int i = 0; i < num_devices; ++i)
+    {
+        sensors->bus[i] = (uint8_t)(i * NUM_BUSES / num_devices);
+        sensors->divisor[i] = 1;
+        sensors->target_divisor[i] = 1;
+        sensors->cold[i].logical_id = SENSORS_NO_LOGICAL_ID;
+    }
+    return sensors;
+}
+
+// Process and evaluate one reading of a single device, at the given time in seconds
+static void _reading(alarms_t * alarms, sensors_t * sensors, int index, int seconds, float celsius, int status)
+{
+    sensors_frame_t frame = { .cycle = (uint32_t)seconds + 1, .bus = sensors->bus[index], .count = 1 };
+    frame.index[0] = (uint16_t)index;
+    frame.raw[0] = (int16_t)(celsius * 16.0f);
+    frame.status[0] = (int8_t)status;
+    frame.timestamp[0] = (int64_t)(seconds + 1) * PERIOD_US;
+    frame.sequence[0] = ++sensors->sequence[index];
+
+    sensors_summary_t summary;
+    sensors_summary_init(&summary);
+    sensors_process_frame(sensors, &frame, &summary);
+    alarms_evaluate(alarms, sensors, &frame);
+}
+
+// Return 1 if an event was raised, -1 if one was cleared, or 0 if none is queued
+static int _event(alarms_t * alarms, alarms_event_t * event)
+{
+    if (xQueueReceive(alarms->events, event, 0) != pdTRUE)
+    {
+        return 0;
+    }
+    return event->active ? 1 : -1;
+}
+
+// Feed readings one per second, returning the second at which the first event is queued, or -1
+static int _first_event(alarms_t * alarms, sensors_t * sensors, int index, int * seconds,
+                        const float * celsius, const int * status, int count, alarms_event_t * event)
+{
+    for (int n = 0; n < count; ++n)
+    {
+        _reading(alarms, sensors, index, *seconds, celsius[n], status != NULL ? status[n] : DS18B20_OK);
+        ++*seconds;
+        if (_event(alarms, event) != 0)
+        {
+            return n;
+        }
+    }
+    return -1;
+}
+
+static void _test_high(void)
+{
+    sensors_t * sensors = _devices(4);
+    alarms_t * alarms = alarms_compile(sensors, "high:*:30:29.5:3", NULL);
+    CHECK(alarms != NULL && alarms->num_rules == 4, "high rule compiled to %d rules", alarms ? alarms->num_rules : -1);
+    alarms_event_t event;
+    int t = 0;
+
+    // three consecutive readings at or above 30 are needed; an interrupted run starts again
+    const float rise[] = { 29.0f, 30.0f, 30.0f, 29.9f, 30.0f, 30.5f, 31.0f, 31.0f };
+    int n = _first_event(alarms, sensors, 1, &t, rise, NULL, 8, &event);
+    CHECK(n == 6, "raised after reading %d, expected 6", n);
+    CHECK(event.active && event.device == 1 && event.metric == ALARMS_RULE_HIGH && event.value == 31 * 16,
+          "raised event device %u metric %u value %d", event.device, event.metric, (int)event.value);
+    CHECK(event.timestamp == (int64_t)t * PERIOD_US, "event timestamp %lld", (long long)event.timestamp);
+
+    // between the thresholds the alarm stays raised; it clears after three readings below 29.5
+    const float fall[] = { 29.8f, 29.5f, 29.6f, 29.4f, 29.0f, 29.4f };
+    n = _first_event(alarms, sensors, 1, &t, fall, NULL, 6, &event);
+    CHECK(n == 5 && !event.active, "cleared after reading %d, expected 5", n);
+
+    // a failed read is not a reading below the clear threshold, and breaks the run
+    const float again[] = { 31.0f, 31.0f, 31.0f, 20.0f, 20.0f, 20.0f, 20.0f, 20.0f };
+    const int status[] = { 0, 0, 0, 0, DS18B20_ERROR_CRC, 0, 0, 0 };
+    n = _first_event(alarms, sensors, 1, &t, again, status, 3, &event);
+    CHECK(n == 2 && event.active, "raised again after reading %d, expected 2", n);
+    n = _first_event(alarms, sensors, 1, &t, again + 3, status + 3, 5, &event);
+    CHECK(n == 4 && !event.active, "cleared after reading %d, expected 4", n);
+
+    // other devices were not affected
+    CHECK(_event(alarms, &event) == 0, "unexpected event on device %u", event.device);
+    _free(alarms);
+    sensors_free(&sensors);
+}
+
+static void _test_low_and_target(void)
+{
+    sensors_t * sensors = _devices(4);
+    alarms_t * alarms = alarms_compile(sensors, "low:2:5:6:1", NULL);
+    CHECK(alarms != NULL && alarms->num_rules == 1, "targeted rule compiled to %d rules", alarms ? alarms->num_rules : -1);
+    alarms_event_t event;
+    int t = 0;
+
+    const float cold[] = { 4.0f, 4.0f };
+    int n = _first_event(alarms, sensors, 1, &t, cold, NULL, 2, &event);
+    CHECK(n == -1, "rule for device 2 raised on device 1");
+    n = _first_event(alarms, sensors, 2, &t, cold, NULL, 2, &event);
+    CHECK(n == 0 && event.active && event.device == 2, "low raised after reading %d on device %u", n, event.device);
+
+    // up to the clear threshold of 6 degrees the alarm holds, above it clears
+    const float warm[] = { 5.5f, 6.0f, 6.0625f };
+    n = _first_event(alarms, sensors, 2, &t, warm, NULL, 3, &event);
+    CHECK(n == 2 && !event.active, "low cleared after reading %d, expected 2", n);
+
+    CHECK(alarms_compile(sensors, "low:9:5:6:1", NULL) == NULL, "rule for a missing device compiled");
+    CHECK(alarms_compile(sensors, "warm:*:5:6:1", NULL) == NULL, "unknown rule type compiled");
+    CHECK(alarms_compile(sensors, "high:*:5", NULL) == NULL, "incomplete rule compiled");
+    _free(alarms);
+    sensors_free(&sensors);
+}
+
+static void _test_rate(void)
+{
+    sensors_t * sensors = _devices(1);
+    alarms_t * alarms = alarms_compile(sensors, "rate:*:2:1:2", NULL);
+    alarms_event_t event;
+    int t = 0;
+
+    // 1/16 degree per second is 3.75 degrees per minute; 1/64 per second is under 1 per minute
+    const float ramp[] = { 20.0f, 20.0f, 20.0625f, 20.125f, 20.1875f };
+    int n = _first_event(alarms, sensors, 0, &t, ramp, NULL, 5, &event);
+    CHECK(n == 3 && event.active && event.value == 60, "rate raised after reading %d value %d", n, (int)event.value);
+
+    // the ramp's last step was not fed, so the first of these still rises
+    const float level[] = { 20.1875f, 20.1875f, 20.1875f };
+    n = _first_event(alarms, sensors, 0, &t, level, NULL, 3, &event);
+    CHECK(n == 2 && !event.active, "rate cleared after reading %d, expected 2", n);
+    _free(alarms);
+    sensors_free(&sensors);
+}
+
+static void _test_stale(void)
+{
+    sensors_t * sensors = _devices(1);
+    alarms_t * alarms = alarms_compile(sensors, "stale:*:5000:1000:1", NULL);
+    alarms_event_t event;
+    int t = 0;
+
+    // the age of the last good reading reaches 5 s on the fifth failed read after it
+    float readings[8] = { 0 };
+    int status[8] = { DS18B20_OK };
+    for (int n = 1; n < 8; ++n)
+    {
+        status[n] = DS18B20_ERROR_CRC;
+    }
+    int n = _first_event(alarms, sensors, 0, &t, readings, status, 8, &event);
+    CHECK(n == 5 && event.active && event.value == 5000, "stale raised after reading %d value %d", n, (int)event.value);
+
+    const float good[] = { 21.0f };
+    n = _first_event(alarms, sensors, 0, &t, good, NULL, 1, &event);
+    CHECK(n == 0 && !event.active, "stale cleared after reading %d, expected 0", n);
+    _free(alarms);
+    sensors_free(&sensors);
+}
+
+static void _test_errors(void)
+{
+    sensors_t * sensors = _devices(1);
+    alarms_t * alarms = alarms_compile(sensors, "errors:*:500:100:1", NULL);
+    alarms_event_t event;
+    int t = 0;
+
+    // the smoothed rate moves an eighth of the way to 1000 or 0 per thousand on each read
+    float readings[32] = { 0 };
+    int status[32];
+    for (int n = 0; n < 32; ++n)
+    {
+        status[n] = DS18B20_ERROR_CRC;
+    }
+    int n = _first_event(alarms, sensors, 0, &t, readings, status, 32, &event);
+    CHECK(n == 5 && event.active, "error rate raised after read %d, expected 5", n);
+
+    for (int k = 0; k < 32; ++k)
+    {
+        readings[k] = 20.0f;
+        status[k] = DS18B20_OK;
+    }
+    n = _first_event(alarms, sensors, 0, &t, readings, status, 32, &event);
+    CHECK(n == 12 && !event.active, "error rate cleared after read %d, expected 12", n);
+    _free(alarms);
+    sensors_free(&sensors);
+}
+
+static void _test_queue_full(void)
+{
+    // more events in one frame than the queue holds are dropped and counted
+    sensors_t * sensors = _devices(64);
+    loss_t loss;
+    loss_init(&loss);
+    alarms_t * alarms = alarms_compile(sensors, "high:*:30:29:1", &loss);
+    sensors_frame_t frame = { .cycle = 1, .bus = 0, .count = SENSORS_FRAME_DEVICES };
+    for (int n = 0; n < SENSORS_FRAME_DEVICES; ++n)
+    {
+        frame.index[n] = (uint16_t)n;
+        frame.raw[n] = 40 * 16;
+        frame.timestamp[n] = PERIOD_US;
+        frame.sequence[n] = 1;
+    }
+    sensors_summary_t summary;
+    sensors_summary_init(&summary);
+    sensors_process_frame(sensors, &frame, &summary);
+    alarms_evaluate(alarms, sensors, &frame);
+    frame.cycle = 2;
+    for (int n = 0; n < SENSORS_FRAME_DEVICES; ++n)
+    {
+        frame.index[n] = (uint16_t)(SENSORS_FRAME_DEVICES + n);
+    }
+    sensors_process_frame(sensors, &frame, &summary);
+    alarms_evaluate(alarms, sensors, &frame);
+
+    loss_counter_t counters[LOSS_HANDOFF_COUNT];
+    loss_snapshot(&loss, counters);
+    const loss_counter_t * counts = &counters[LOSS_HANDOFF_ALARM];
+    CHECK(counts->passed == ALARMS_EVENT_QUEUE_LENGTH && counts->dropped == 2 * SENSORS_FRAME_DEVICES - ALARMS_EVENT_QUEUE_LENGTH,
+          "events passed %u dropped %u", (unsigned int)counts->passed, (unsigned int)counts->dropped);
+    _free(alarms);
+    sensors_free(&sensors);
+}
+
+static int64_t _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Evaluate num_rules rules on every device for a number of cycles of full frames
+static void _benchmark(int num_devices, int num_rules, int num_cycles)
+{
+    // a mix of every rule type with thresholds that are rarely crossed, as in normal running
+    static const char * mix[] = { "high:*:80:79:3", "low:*:-20:-19:3", "rate:*:5:4:2", "stale:*:60000:30000:1", "errors:*:300:200:1" };
+    char spec[ALARMS_MAX_SOURCE_RULES * 32] = "";
+    for (int r = 0; r < num_rules; ++r)
+    {
+        strcat(spec, mix[r % 5]);
+        strcat(spec, ";");
+    }
+    spec[strlen(spec) - 1] = '\0';
+
+    sensors_t * sensors = _devices(num_devices);
+    alarms_t * alarms = alarms_compile(sensors, spec, NULL);
+    static sensors_frame_t frames[SENSORS_MAX_DEVICES / SENSORS_FRAME_DEVICES + NUM_BUSES];
+
+    int64_t elapsed = 0;
+    int num_frames = 0;
+    uint32_t evaluations = 0;
+    for (int c = 1; c <= num_cycles; ++c)
+    {
+        for (int i = 0; i < num_devices; ++i)
+        {
+            sensors->raw[i] = (int16_t)(20 * 16 + (i + c) % 32);
+            sensors->status[i] = (i * 31 + c) % 97 == 0 ? DS18B20_ERROR_CRC : DS18B20_OK;
+            sensors->timestamp[i] = (int64_t)c * PERIOD_US;
+            ++sensors->sequence[i];
+        }
+        num_frames = 0;
+        sensors_summary_t summary;
+        sensors_summary_init(&summary);
+        for (int bus = 0; bus < NUM_BUSES; ++bus)
+        {
+            for (int start = 0; start >= 0; )
+            {
+                sensors_frame_t * frame = &frames[num_frames++];
+                start = sensors_capture_frame(sensors, bus, start, (uint32_t)c, frame);
+                sensors_process_frame(sensors, frame, &summary);
+            }
+        }
+
+        int64_t t0 = _now_ns();
+        for (int f = 0; f < num_frames; ++f)
+        {
+            alarms_evaluate(alarms, sensors, &frames[f]);
+        }
+        elapsed += _now_ns() - t0;
+
+        alarms_event_t event;
+        while (xQueueReceive(alarms->events, &event, 0) == pdTRUE)
+        {
+        }
+    }
+    evaluations = alarms->evaluations;
+
+    printf("  %5d %6d %8d %12.2f %12.2f %12.2f\n", num_rules, num_devices, alarms->num_rules,
+           (double)elapsed / evaluations, (double)elapsed / num_cycles / num_frames / 1000.0,
+           (double)elapsed / num_cycles / 1000.0);
+    _free(alarms);
+    sensors_free(&sensors);
+}
+
+int main(int argc, char * argv[])
+{
+    int num_devices = argc > 1 ? atoi(argv[1]) : SENSORS_MAX_DEVICES;
+    if (num_devices < NUM_BUSES || num_devices > SENSORS_MAX_DEVICES)
+    {
+        fprintf(stderr, "usage: %s [num_devices %d-%d]\n", argv[0], NUM_BUSES, SENSORS_MAX_DEVICES);
+        return 2;
+    }
+
+    _test_high();
+    _test_low_and_target();
+    _test_rate();
+    _test_stale();
+    _test_errors();
+    _test_queue_full();
+    printf("%s: %d failures\n", failures == 0 ? "tests passed" : "TESTS FAILED", failures);
+
+    printf("rules per device x devices, frames of up to %d devices on %d buses:\n", SENSORS_FRAME_DEVICES, NUM_BUSES);
+    printf("  %5s %6s %8s %12s %12s %12s\n", "rules", "devices", "compiled", "ns/rule", "us/frame", "us/cycle");
+    static const int rule_counts[] = { 1, 4, 8, 16, ALARMS_MAX_SOURCE_RULES };
+    for (size_t r = 0; r < sizeof(rule_counts) / sizeof(rule_counts[0]); ++r)
+    {
+        _benchmark(num_devices, rule_counts[r], 200);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host-side bus capacity planner.
+//
+// Uses the same timing model as the firmware (main/capacity.c) to report, for a target
+// sample period, the maximum number of DS18B20 devices per bus and per controller in
+// each sampling mode.
+//
+// Build and run on the host:
+//
+//     $ cc -I main -o capacity_planner tools/capacity_planner.c main/capacity.c
+//     $ ./capacity_planner [period_ms] [num_buses]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "capacity.h"
+
+int main(int argc, char ** argv)
+{
+    int period_ms = argc > 1 ? atoi(argv[1]) : 1000;
+    int num_buses = argc > 2 ? atoi(argv[2]) : 4;
+    if (period_ms <= 0 || num_buses <= 0)
+    {
+        fprintf(stderr, "usage: %s [period_ms] [num_buses]\n", argv[0]);
+        return 1;
+    }
+    uint32_t period_us = (uint32_t)period_ms * 1000;
+
+    printf("Sample period %d ms, %d bus%s\n\n", period_ms, num_buses, num_buses == 1 ? "" : "es");
+    printf("resolution  crc  convert (us)  read (us)  max/bus  max/controller\n");
+    for (int resolution = 9; resolution <= 12; ++resolution)
+    {
+        for (int use_crc = 1; use_crc >= 0; --use_crc)
+        {
+            capacity_mode_t mode = { .resolution = resolution, .use_crc = use_crc, .solo = false };
+            printf("%7d-bit  %3s  %12u  %9u  %7d  %14d\n",
+                   resolution, use_crc ? "yes" : "no",
+                   (unsigned int)capacity_convert_time_us(&mode),
+                   (unsigned int)capacity_read_time_us(&mode),
+                   capacity_max_devices_per_bus(&mode, period_us),
+                   capacity_max_devices_per_controller(&mode, period_us, num_buses));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,663 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host test and benchmark of the DS2482 bridge driver (main/ds2482.c).
+//
+// The driver is built against an emulated DS2482-800 on the I2C bus, and each of its eight
+// channels carries emulated DS18B20s that are driven one time slot at a time, so ROM searches,
+// addressing and CRCs run exactly as on a real bus. The tests check that the triplet search and
+// the generic bit-by-bit search find every device on every channel, and that temperatures read
+// through the ds18b20 layer are correct while the bridge switches between channels.
+//
+// The emulator keeps a virtual clock: each I2C transaction costs its bits at 400 kHz, and each
+// 1-Wire command keeps the bridge busy for its datasheet time, so status polls are counted as
+// the driver makes them. Read and search times are compared with the RMT timing model in
+// main/capacity.c.
+//
+// Build and run on the host:
+//
+//     $ cc -O2 -I tools/host -I main -o ds2482_test tools/ds2482_test.c main/ds2482.c main/capacity.c tools/host/host.c -lpthread -lm
+//     $ ./ds2482_test [devices_per_channel]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/i2c.h"
+#include "ds18b20.h"
+
+#include "capacity.h"
+#include "ds2482.h"
+
+#define I2C_PORT            (0)
+#define MAX_DEVICES         (64)       // per channel
+
+#define I2C_BIT_NS          (2500)     // 400 kHz
+#define RESET_NS            (1148000)  // 1-Wire reset, tRSTL + tRSTH
+#define SLOT_NS             (73000)    // 1-Wire time slot, tSLOT + tREC
+
+#define CHECK(condition, ...)                                                   \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                         \
+            printf(__VA_ARGS__);                                                \
+            printf("\n");                                                       \
+            ++failures;                                                         \
+        }                                                                       \
+    } while (0)
+
+static int failures;
+
+// A DS18B20, as a state machine advanced by each time slot on its bus
+typedef enum
+{
+    SLAVE_IDLE,           // not selected, waiting for a reset
+    SLAVE_ROM_COMMAND,    // receiving a ROM command
+    SLAVE_SEARCH,         // taking part in a search
+    SLAVE_MATCH,          // receiving a ROM code to compare with its own
+    SLAVE_SEND,           // sending the ROM code or the scratchpad
+    SLAVE_FUNCTION,       // selected, receiving a function command
+} slave_state_t;
+
+typedef struct
+{
+    OneWireBus_ROMCode rom_code;
+    int16_t raw;                  // temperature, 1/16 degrees C
+    uint8_t scratchpad[9];
+    slave_state_t state;
+    uint8_t shift;                // command bits received so far
+    int bit;                      // bit position within the current state
+    int phase;                    // search: 0 sends the bit, 1 its complement, 2 receives the direction
+    const uint8_t * send;         // bytes being sent
+    int send_bits;
+} slave_t;
+
+typedef struct
+{
+    slave_t devices[MAX_DEVICES];
+    int num_devices;
+} wire_t;
+
+// The bridge, its registers, and the time at which the 1-Wire operation in progress completes
+typedef struct
+{
+    uint8_t address;
+    uint8_t status;
+    uint8_t data;
+    uint8_t config;
+    int channel;
+    uint8_t read_pointer;
+    int64_t busy_until_ns;
+    wire_t wires[DS2482_MAX_CHANNELS];
+} bridge_t;
+
+static bridge_t bridge;
+static int64_t now_ns;
+static uint32_t transactions;
+
+static const uint8_t CHANNEL_CODES[DS2482_MAX_CHANNELS] = { 0xf0, 0xe1, 0xd2, 0xc3, 0xb4, 0xa5, 0x96, 0x87 };
+static const uint8_t CHANNEL_READBACK[DS2482_MAX_CHANNELS] = { 0xb8, 0xb1, 0xaa, 0xa3, 0x9c, 0x95, 0x8e, 0x87 };
+
+static int _rom_bit(const slave_t * slave, int bit)
+{
+    return (slave->rom_code.bytes[bit / 8] >> (bit % 8)) & 1;
+}
+
+static void _start_send(slave_t * slave, const uint8_t * bytes, int len)
+{
+    slave->state = SLAVE_SEND;
+    slave->send = bytes;
+    slave->send_bits = len * 8;
+    slave->bit = 0;
+}
+
+// The bit a device drives in this slot: 0 pulls the bus low, 1 leaves it to the pull-up
+static int _output(const slave_t * slave)
+{
+    switch (slave->state)
+    {
+    case SLAVE_SEARCH:
+        return slave->phase == 0 ? _rom_bit(slave, slave->bit)
+               : slave->phase == 1 ? !_rom_bit(slave, slave->bit) : 1;
+    case SLAVE_SEND:
+        return (slave->send[slave->bit / 8] >> (slave->bit % 8)) & 1;
+    default:
+        return 1;
+    }
+}
+
+static void _receive_byte(slave_t * slave, int value)
+{
+    slave->shift |= value << slave->bit;
+    if (++slave->bit < 8)
+    {
+        return;
+    }
+
+    uint8_t command = slave->shift;
+    slave->shift = 0;
+    slave->bit = 0;
+    if (slave->state == SLAVE_ROM_COMMAND)
+    {
+        switch (command)
+        {
+        case OWB_ROM_SEARCH:
+            slave->state = SLAVE_SEARCH;
+            slave->phase = 0;
+            break;
+        case OWB_ROM_MATCH:
+            slave->state = SLAVE_MATCH;
+            break;
+        case OWB_ROM_SKIP:
+            slave->state = SLAVE_FUNCTION;
+            break;
+        case OWB_ROM_READ:
+            _start_send(slave, slave->rom_code.bytes, sizeof(slave->rom_code.bytes));
+            break;
+        default:
+            slave->state = SLAVE_IDLE;
+            break;
+        }
+    }
+    else if (command == 0xbe)    // READ SCRATCHPAD
+    {
+        _start_send(slave, slave->scratchpad, sizeof(slave->scratchpad));
+    }
+    else                         // CONVERT T and others complete at once
+    {
+        slave->state = SLAVE_IDLE;
+    }
+}
+
+// Advance a device past a slot in which the bus carried a value
+static void _advance(slave_t * slave, int value)
+{
+    switch (slave->state)
+    {
+    case SLAVE_ROM_COMMAND:
+    case SLAVE_FUNCTION:
+        _receive_byte(slave, value);
+        break;
+    case SLAVE_SEARCH:
+        if (slave->phase < 2)
+        {
+            ++slave->phase;
+        }
+        else if (value != _rom_bit(slave, slave->bit))
+        {
+            slave->state = SLAVE_IDLE;    // lost at a discrepancy
+        }
+        else
+        {
+            slave->phase = 0;
+            slave->state = ++slave->bit < 64 ? SLAVE_SEARCH : SLAVE_IDLE;
+        }
+        break;
+    case SLAVE_MATCH:
+        if (value != _rom_bit(slave, slave->bit))
+        {
+            slave->state = SLAVE_IDLE;
+        }
+        else if (++slave->bit == 64)
+        {
+            slave->state = SLAVE_FUNCTION;
+            slave->bit = 0;
+        }
+        break;
+    case SLAVE_SEND:
+        if (++slave->bit == slave->send_bits)
+        {
+            slave->state = SLAVE_IDLE;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static bool _wire_reset(wire_t * wire)
+{
+    for (int i = 0; i < wire->num_devices; ++i)
+    {
+        slave_t * slave = &wire->devices[i];
+        slave->state = SLAVE_ROM_COMMAND;
+        slave->shift = 0;
+        slave->bit = 0;
+    }
+    return wire->num_devices > 0;
+}
+
+// One time slot: the master writes a bit, or reads by writing 1, and the bus is the wired-AND
+static int _wire_slot(wire_t * wire, int master)
+{
+    int value = master;
+    for (int i = 0; i < wire->num_devices; ++i)
+    {
+        value &= _output(&wire->devices[i]);
+    }
+    for (int i = 0; i < wire->num_devices; ++i)
+    {
+        _advance(&wire->devices[i], value);
+    }
+    return value;
+}
+
+// DS2482-800 emulation
+
+#define STATUS_1WB   (0x01)
+#define STATUS_PPD   (0x02)
+#define STATUS_RST   (0x10)
+#define STATUS_SBR   (0x20)
+#define STATUS_TSB   (0x40)
+#define STATUS_DIR   (0x80)
+
+#define REG_STATUS   (0xf0)
+#define REG_DATA     (0xe1)
+#define REG_CHANNEL  (0xd2)
+#define REG_CONFIG   (0xc3)
+
+static void _i2c_transaction(size_t bytes)
+{
+    // start, address byte and data bytes with their acknowledge bits, stop
+    now_ns += (int64_t)(2 + 9 * (1 + bytes)) * I2C_BIT_NS;
+    ++transactions;
+}
+
+static void _busy(int64_t duration_ns)
+{
+    bridge.status |= STATUS_1WB;
+    bridge.busy_until_ns = now_ns + duration_ns;
+    bridge.read_pointer = REG_STATUS;
+}
+
+esp_err_t i2c_master_write_to_device(i2c_port_t i2c_num, uint8_t device_address, const uint8_t * write_buffer,
+                                     size_t write_size, TickType_t ticks_to_wait)
+{
+    _i2c_transaction(write_size);
+    if (i2c_num != I2C_PORT || device_address != bridge.address || write_size < 1)
+    {
+        return ESP_FAIL;    // not acknowledged
+    }
+    if ((bridge.status & STATUS_1WB) && now_ns < bridge.busy_until_ns)
+    {
+        return ESP_OK;      // commands are ignored while the bus is busy
+    }
+    bridge.status &= ~STATUS_1WB;
+
+    uint8_t param = write_size > 1 ? write_buffer[1] : 0;
+    wire_t * wire = &bridge.wires[bridge.channel];
+    switch (write_buffer[0])
+    {
+    case 0xf0:    // device reset
+        bridge.status = STATUS_RST;
+        bridge.config = 0;
+        bridge.channel = 0;
+        bridge.read_pointer = REG_STATUS;
+        break;
+    case 0xd2:    // write configuration, with its complement in the upper nibble
+        if ((param >> 4) != (~param & 0x0f))
+        {
+            return ESP_FAIL;
+        }
+        bridge.config = param & 0x0f;
+        bridge.status &= ~STATUS_RST;
+        bridge.read_pointer = REG_CONFIG;
+        break;
+    case 0xc3:    // channel select
+        for (int c = 0; c < DS2482_MAX_CHANNELS; ++c)
+        {
+            if (CHANNEL_CODES[c] == param)
+            {
+                bridge.channel = c;
+            }
+        }
+        bridge.read_pointer = REG_CHANNEL;
+        break;
+    case 0xe1:    // set read pointer
+        bridge.read_pointer = param;
+        break;
+    case 0xb4:    // 1-Wire reset
+        bridge.status = (bridge.status & ~(STATUS_PPD | STATUS_SBR)) | (_wire_reset(wire) ? STATUS_PPD : 0);
+        _busy(RESET_NS);
+        break;
+    case 0x87:    // 1-Wire single bit
+        bridge.status = _wire_slot(wire, param >> 7) ? bridge.status | STATUS_SBR : bridge.status & ~STATUS_SBR;
+        _busy(SLOT_NS);
+        break;
+    case 0xa5:    // 1-Wire write byte
+        for (int i = 0; i < 8; ++i)
+        {
+            _wire_slot(wire, (param >> i) & 1);
+        }
+        _busy(8 * SLOT_NS);
+        break;
+    case 0x96:    // 1-Wire read byte
+        bridge.data = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            bridge.data |= _wire_slot(wire, 1) << i;
+        }
+        _busy(8 * SLOT_NS);
+        break;
+    case 0x78:    // 1-Wire triplet: two read slots, then the direction written
+    {
+        int id_bit = _wire_slot(wire, 1);
+        int cmp_id_bit = _wire_slot(wire, 1);
+        int direction = id_bit != cmp_id_bit ? id_bit : (id_bit ? 1 : param >> 7);
+        _wire_slot(wire, direction);
+        bridge.status &= ~(STATUS_SBR | STATUS_TSB | STATUS_DIR);
+        bridge.status |= (id_bit ? STATUS_SBR : 0) | (cmp_id_bit ? STATUS_TSB : 0) | (direction ? STATUS_DIR : 0);
+        _busy(3 * SLOT_NS);
+        break;
+    }
+    default:
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_read_from_device(i2c_port_t i2c_num, uint8_t device_address, uint8_t * read_buffer,
+                                      size_t read_size, TickType_t ticks_to_wait)
+{
+    _i2c_transaction(read_size);
+    if (i2c_num != I2C_PORT || device_address != bridge.address)
+    {
+        return ESP_FAIL;
+    }
+    if ((bridge.status & STATUS_1WB) && now_ns >= bridge.busy_until_ns)
+    {
+        bridge.status &= ~STATUS_1WB;
+    }
+    uint8_t value = 0;
+    switch (bridge.read_pointer)
+    {
+    case REG_STATUS:
+        value = bridge.status;
+        break;
+    case REG_DATA:
+        value = bridge.data;
+        break;
+    case REG_CHANNEL:
+        value = CHANNEL_READBACK[bridge.channel];
+        break;
+    case REG_CONFIG:
+        value = bridge.config;
+        break;
+    default:
+        break;
+    }
+    memset(read_buffer, value, read_size);
+    return ESP_OK;
+}
+
+// Test set-up
+
+static int _compare_rom(const void * a, const void * b)
+{
+    return memcmp(a, b, sizeof(OneWireBus_ROMCode));
+}
+
+static void _add_device(wire_t * wire, uint8_t family, int16_t raw)
+{
+    slave_t * slave = &wire->devices[wire->num_devices++];
+    memset(slave, 0, sizeof(*slave));
+    slave->rom_code.bytes[0] = family;
+    for (int i = 1; i < 7; ++i)
+    {
+        slave->rom_code.bytes[i] = (uint8_t)rand();
+    }
+    slave->rom_code.bytes[7] = owb_crc8_bytes(0, slave->rom_code.bytes, 7);
+
+    // temperature, TH, TL, 12-bit configuration, reserved bytes, CRC
+    uint8_t scratchpad[9] = { (uint8_t)raw, (uint8_t)(raw >> 8), 0x4b, 0x46, 0x7f, 0xff, 0x01, 0x10 };
+    scratchpad[8] = owb_crc8_bytes(0, scratchpad, 8);
+    memcpy(slave->scratchpad, scratchpad, sizeof(scratchpad));
+    slave->raw = raw;
+}
+
+// Devices on each channel: a single device on channel 0 for SKIP ROM, none on channel 5, and
+// otherwise a mix of families so that searches branch within the family byte as well
+static void _populate(int devices_per_channel)
+{
+    memset(bridge.wires, 0, sizeof(bridge.wires));
+    for (int c = 0; c < DS2482_MAX_CHANNELS; ++c)
+    {
+        int n = c == 0 ? 1 : c == 5 ? 0 : devices_per_channel;
+        for (int i = 0; i < n; ++i)
+        {
+            _add_device(&bridge.wires[c], i % 4 == 3 ? 0x22 : 0x28, (int16_t)(rand() % (180 * 16) - 55 * 16));
+        }
+    }
+}
+
+typedef owb_status (*search_fn)(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device);
+
+static int _search(const OneWireBus * bus, search_fn first, search_fn next, OneWireBus_ROMCode * found, int max)
+{
+    OneWireBus_SearchState state;
+    bool found_device = false;
+    int n = 0;
+    first(bus, &state, &found_device);
+    while (found_device && n < max)
+    {
+        found[n++] = state.rom_code;
+        next(bus, &state, &found_device);
+    }
+    return n;
+}
+
+static void _test_init(ds2482_t * chip)
+{
+    bridge.address = DS2482_DEFAULT_ADDRESS;
+    bridge.status = 0;
+    CHECK(!ds2482_init_chip(chip, I2C_PORT, DS2482_DEFAULT_ADDRESS + 1, 8), "bridge found at an unused address");
+    CHECK(ds2482_init_chip(chip, I2C_PORT, DS2482_DEFAULT_ADDRESS, 8), "bridge not found");
+    CHECK(bridge.config == 0x01, "configuration 0x%02x, expected active pull-up", bridge.config);
+
+    ds2482_driver_info info;
+    CHECK(ds2482_initialize(&info, chip, DS2482_MAX_CHANNELS) == NULL, "channel %d accepted", DS2482_MAX_CHANNELS);
+    CHECK(ds2482_initialize(&info, chip, -1) == NULL, "channel -1 accepted");
+}
+
+static void _test_search(ds2482_driver_info * infos)
+{
+    static OneWireBus_ROMCode triplet[MAX_DEVICES + 1];
+    static OneWireBus_ROMCode bitwise[MAX_DEVICES + 1];
+    static OneWireBus_ROMCode expected[MAX_DEVICES];
+    for (int c = 0; c < DS2482_MAX_CHANNELS; ++c)
+    {
+        const wire_t * wire = &bridge.wires[c];
+        const OneWireBus * bus = &infos[c].bus;
+        int n = _search(bus, ds2482_search_first, ds2482_search_next, triplet, MAX_DEVICES + 1);
+        int m = _search(bus, owb_search_first, owb_search_next, bitwise, MAX_DEVICES + 1);
+        CHECK(n == wire->num_devices, "channel %d: triplet search found %d devices, expected %d", c, n, wire->num_devices);
+        CHECK(m == n && memcmp(triplet, bitwise, n * sizeof(triplet[0])) == 0,
+              "channel %d: bit-level search found %d devices, differing from the triplet search", c, m);
+
+        for (int i = 0; i < wire->num_devices; ++i)
+        {
+            expected[i] = wire->devices[i].rom_code;
+        }
+        qsort(expected, wire->num_devices, sizeof(expected[0]), _compare_rom);
+        qsort(triplet, n, sizeof(triplet[0]), _compare_rom);
+        CHECK(n != wire->num_devices || memcmp(triplet, expected, n * sizeof(triplet[0])) == 0,
+              "channel %d: search found different ROM codes", c);
+    }
+}
+
+static void _test_read(ds2482_driver_info * infos)
+{
+    // round-robin across channels, so the bridge switches channel before every read
+    int reads = 0;
+    for (int i = 0; i < MAX_DEVICES; ++i)
+    {
+        for (int c = 0; c < DS2482_MAX_CHANNELS; ++c)
+        {
+            const wire_t * wire = &bridge.wires[c];
+            if (i >= wire->num_devices)
+            {
+                continue;
+            }
+            const slave_t * slave = &wire->devices[i];
+            DS18B20_Info device;
+            if (wire->num_devices == 1)
+            {
+                ds18b20_init_solo(&device, &infos[c].bus);
+            }
+            else
+            {
+                ds18b20_init(&device, &infos[c].bus, slave->rom_code);
+            }
+            ds18b20_use_crc(&device, true);
+
+            float value = 0.0f;
+            DS18B20_ERROR err = ds18b20_read_temp(&device, &value);
+            CHECK(err == DS18B20_OK && value == slave->raw / 16.0f, "channel %d device %d: error %d, %.4f, expected %.4f",
+                  c, i, err, value, slave->raw / 16.0f);
+            ++reads;
+        }
+    }
+
+    DS18B20_Info device;
+    ds18b20_init_solo(&device, &infos[5].bus);
+    CHECK(ds18b20_read_temp(&device, NULL) == DS18B20_ERROR_DEVICE, "read from an empty channel");
+    CHECK(reads > 0, "no devices read");
+}
+
+// Virtual time, I2C transactions and status polls for an operation, per repetition
+typedef struct
+{
+    double us;
+    double transactions;
+    double polls;
+} cost_t;
+
+static cost_t _measure_start(const ds2482_t * chip)
+{
+    cost_t start = { now_ns / 1000.0, transactions, chip->polls };
+    return start;
+}
+
+static cost_t _measure_end(const ds2482_t * chip, cost_t start, int count)
+{
+    cost_t cost = { (now_ns / 1000.0 - start.us) / count, (transactions - start.transactions) / count,
+                    (chip->polls - start.polls) / count };
+    return cost;
+}
+
+static void _print(const char * name, cost_t cost, uint32_t rmt_us)
+{
+    printf("  %-28s %9.0f %6.1f %6.1f %9u %6.2f\n", name, cost.us, cost.transactions, cost.polls,
+           (unsigned int)rmt_us, cost.us / rmt_us);
+}
+
+static void _benchmark(ds2482_t * chip, ds2482_driver_info * infos, int devices_per_channel)
+{
+    const int channel = 1;
+    const wire_t * wire = &bridge.wires[channel];
+    const OneWireBus * bus = &infos[channel].bus;
+    static OneWireBus_ROMCode found[MAX_DEVICES];
+
+    printf("emulated DS2482-800 at 400 kHz against the RMT model, %d devices on the bus:\n", wire->num_devices);
+    printf("  %-28s %9s %6s %6s %9s %6s\n", "operation", "us", "i2c", "polls", "rmt us", "ratio");
+
+    // reads on one channel, so no channel selects
+    capacity_mode_t mode = { .resolution = 12, .use_crc = true, .solo = false };
+    cost_t start = _measure_start(chip);
+    for (int i = 0; i < wire->num_devices; ++i)
+    {
+        DS18B20_Info device;
+        ds18b20_init(&device, bus, wire->devices[i].rom_code);
+        ds18b20_use_crc(&device, true);
+        ds18b20_read_temp(&device, NULL);
+    }
+    _print("read, addressed with CRC", _measure_end(chip, start, wire->num_devices), capacity_read_time_us(&mode));
+
+    mode.use_crc = false;
+    start = _measure_start(chip);
+    for (int i = 0; i < wire->num_devices; ++i)
+    {
+        bool is_present = false;
+        uint8_t data[CAPACITY_TRUNCATED_READ_BYTES];
+        owb_reset(bus, &is_present);
+        owb_write_byte(bus, OWB_ROM_MATCH);
+        owb_write_rom_code(bus, wire->devices[i].rom_code);
+        owb_write_byte(bus, 0xbe);
+        owb_read_bytes(bus, data, sizeof(data));
+    }
+    _print("read, addressed, truncated", _measure_end(chip, start, wire->num_devices), capacity_read_time_us(&mode));
+
+    // a search step is three slots; the RMT driver makes each one a separate transaction
+    uint32_t rmt_search_us = CAPACITY_RESET_US + 8 * CAPACITY_SLOT_US + CAPACITY_BYTE_OVERHEAD_US
+                             + 64 * 3 * (CAPACITY_SLOT_US + CAPACITY_BYTE_OVERHEAD_US);
+    start = _measure_start(chip);
+    int n = _search(bus, ds2482_search_first, ds2482_search_next, found, MAX_DEVICES);
+    _print("search, triplet", _measure_end(chip, start, n), rmt_search_us);
+    start = _measure_start(chip);
+    n = _search(bus, owb_search_first, owb_search_next, found, MAX_DEVICES);
+    _print("search, bit-level", _measure_end(chip, start, n), rmt_search_us);
+
+    // a read after switching channel adds the select and its readback
+    start = _measure_start(chip);
+    for (int i = 0; i < devices_per_channel; ++i)
+    {
+        for (int c = 1; c <= 2; ++c)
+        {
+            DS18B20_Info device;
+            ds18b20_init(&device, &infos[c].bus, bridge.wires[c].devices[i].rom_code);
+            ds18b20_use_crc(&device, true);
+            ds18b20_read_temp(&device, NULL);
+        }
+    }
+    mode.use_crc = true;
+    _print("read, after channel switch", _measure_end(chip, start, 2 * devices_per_channel), capacity_read_time_us(&mode));
+}
+
+int main(int argc, char * argv[])
+{
+    int devices_per_channel = argc > 1 ? atoi(argv[1]) : 16;
+    if (devices_per_channel < 2 || devices_per_channel > MAX_DEVICES)
+    {
+        fprintf(stderr, "usage: %s [devices_per_channel 2-%d]\n", argv[0], MAX_DEVICES);
+        return 2;
+    }
+
+    srand(1);
+    _populate(devices_per_channel);
+    ds2482_t chip;
+    ds2482_driver_info infos[DS2482_MAX_CHANNELS];
+    _test_init(&chip);
+    for (int c = 0; c < DS2482_MAX_CHANNELS; ++c)
+    {
+        ds2482_initialize(&infos[c], &chip, c);
+    }
+    _test_search(infos);
+    _test_read(infos);
+    printf("%s: %d failures\n", failures == 0 ? "tests passed" : "TESTS FAILED", failures);
+
+    _benchmark(&chip, infos, devices_per_channel);
+    return failures == 0 ? 0 : 1;
+}
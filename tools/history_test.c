@@ -0,0 +1,321 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host test and benchmark of history queries (main/history.c).
+//
+// Cycles of readings are appended with the timestamps of a real deployment, each bus reading
+// its devices in turn, so that times in a block are not in device order. Random raw and
+// bucketed queries are compared with a scan of every sample still held, including after the
+// ring has wrapped. The benchmark then fills the store with several days of readings and
+// reports the latency and blocks touched by typical queries. Exits non-zero on any mismatch.
+//
+// Build and run on the host:
+//
+//     $ cc -O2 -I tools/host -I main -o history_test tools/history_test.c main/history.c main/sensors.c tools/host/host.c -lpthread -lm
+//     $ ./history_test [num_devices] [days] [period_s]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "history.h"
+
+#define NUM_BUSES        (4)
+#define READ_TIME_MS     (12)         // time to read one device at 12-bit resolution, see capacity.h
+#define NUM_QUERIES      (2000)
+
+static int failures;
+
+#define CHECK(condition, ...)                                                   \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                         \
+            printf(__VA_ARGS__);                                                \
+            printf("\n");                                                       \
+            ++failures;                                                         \
+        }                                                                       \
+    } while (0)
+
+// Every sample appended, in order, as the reference for queries
+static history_sample_t * appended;
+static int num_appended;
+
+static sensors_snapshot_t snapshot;
+
+static sensors_t * _devices(int num_devices)
+{
+    sensors_t * sensors = sensors_malloc();
+    sensors->num_devices = num_devices;
+    sensors->num_buses = NUM_BUSES;
+    for (int i = 0; i < num_devices; ++i)
+    {
+        sensors->bus[i] = (uint8_t)(i * NUM_BUSES / num_devices);
+        sensors->cold[i].logical_id = SENSORS_NO_LOGICAL_ID;
+    }
+    return sensors;
+}
+
+static int16_t _value(int device, uint32_t cycle)
+{
+    return (int16_t)(20 * 16 + (int)((device * 13 + cycle * 7) % 200) - 100);
+}
+
+// Append one cycle. Each bus reads its devices in turn from the start of the cycle, and a
+// few devices fail or are not due, so are not recorded.
+static void _cycle(history_t * history, int num_devices, uint32_t cycle, uint32_t period_ms)
+{
+    int per_bus = (num_devices + NUM_BUSES - 1) / NUM_BUSES;
+    snapshot.cycle = cycle;
+    snapshot.num_devices = num_devices;
+    for (int i = 0; i < num_devices; ++i)
+    {
+        snapshot.value[i] = _value(i, cycle);
+        snapshot.status[i] = (i * 31 + cycle) % 53 == 0 ? DS18B20_ERROR_CRC : DS18B20_OK;
+        snapshot.timestamp[i] = ((int64_t)cycle * period_ms + (i % per_bus) * READ_TIME_MS) * 1000;
+        snapshot.fresh[i] = (i * 17 + cycle) % 41 != 0;
+    }
+    history_append(history, &snapshot);
+
+    // the reference holds each device recorded this cycle, as the next cycle it is due shows
+    for (int i = 0; i < num_devices; ++i)
+    {
+        if (history->next_cycle[i] == cycle + history->interval)
+        {
+            appended[num_appended++] = (history_sample_t) {
+                .time_ms = (uint32_t)(snapshot.timestamp[i] / 1000),
+                .device = (uint16_t)i,
+                .value = snapshot.value[i],
+            };
+        }
+    }
+}
+
+// Samples still held: the newest blocks, the oldest of which may be partly overwritten
+static int _oldest_held(const history_t * history)
+{
+    int held = (history->used - 1) * HISTORY_BLOCK_SAMPLES + history->index[history->head].count;
+    return num_appended - held;
+}
+
+static int _reference(const history_t * history, const history_query_t * query, history_point_t * points, int max_points)
+{
+    int buckets = query->points < max_points ? query->points : max_points;
+    uint64_t span = (uint64_t)query->to_ms - query->from_ms + 1;
+    for (int b = 0; b < buckets; ++b)
+    {
+        points[b] = (history_point_t) { .time_ms = query->from_ms + (uint32_t)(b * span / buckets) };
+    }
+    int num_points = buckets;
+    for (int s = _oldest_held(history); s < num_appended; ++s)
+    {
+        const history_sample_t * sample = &appended[s];
+        if (sample->device != query->device || sample->time_ms < query->from_ms || sample->time_ms > query->to_ms)
+        {
+            continue;
+        }
+        if (buckets > 0)
+        {
+            history_point_t * point = &points[(uint64_t)(sample->time_ms - query->from_ms) * buckets / span];
+            point->min = point->count == 0 || sample->value < point->min ? sample->value : point->min;
+            point->max = point->count == 0 || sample->value > point->max ? sample->value : point->max;
+            point->sum += sample->value;
+            ++point->count;
+        }
+        else if (num_points < max_points)
+        {
+            points[num_points++] = (history_point_t) { .time_ms = sample->time_ms, .mean = sample->value, .count = 1 };
+        }
+    }
+    return num_points;
+}
+
+static void _compare(history_t * history, const history_query_t * query)
+{
+    static history_point_t got[HISTORY_MAX_POINTS];
+    static history_point_t want[HISTORY_MAX_POINTS];
+    int num_got = history_query(history, query, got, HISTORY_MAX_POINTS, NULL);
+    int num_want = _reference(history, query, want, HISTORY_MAX_POINTS);
+    int mismatch = num_got != num_want ? 0 : -1;
+    for (int p = 0; p < num_got && p < num_want && mismatch < 0; ++p)
+    {
+        bool same = got[p].time_ms == want[p].time_ms && got[p].count == want[p].count;
+        if (query->points > 0)
+        {
+            same = same && got[p].sum == want[p].sum && (got[p].count == 0 || (got[p].min == want[p].min && got[p].max == want[p].max));
+        }
+        else
+        {
+            same = same && got[p].mean == want[p].mean;
+        }
+        mismatch = same ? -1 : p;
+    }
+    CHECK(mismatch < 0, "device %d from %u to %u points %d: %d points, expected %d, first difference at %d",
+          query->device, (unsigned int)query->from_ms, (unsigned int)query->to_ms, query->points, num_got, num_want, mismatch);
+}
+
+static void _test_queries(int num_devices, int num_blocks, int num_cycles, uint32_t period_ms)
+{
+    sensors_t * sensors = _devices(num_devices);
+    history_t * history = history_malloc(sensors, num_blocks, 2);
+    num_appended = 0;
+    for (uint32_t c = 1; c <= (uint32_t)num_cycles; ++c)
+    {
+        _cycle(history, num_devices, c, period_ms);
+    }
+
+    uint32_t end_ms = (uint32_t)(num_cycles + 1) * period_ms;
+    srand(1);
+    int before = failures;
+    for (int q = 0; q < NUM_QUERIES && failures - before < 5; ++q)
+    {
+        uint32_t a = (uint32_t)rand() % end_ms;
+        uint32_t b = (uint32_t)rand() % end_ms;
+        if (q % 4 == 0)
+        {
+            b = a + (uint32_t)rand() % (2 * period_ms);    // within a cycle or two
+        }
+        history_query_t query = {
+            .device = rand() % num_devices,
+            .from_ms = a < b ? a : b,
+            .to_ms = a < b ? b : a,
+            .points = q % 2 == 0 ? 0 : 1 + rand() % 50,
+        };
+        _compare(history, &query);
+    }
+
+    // short ranges stepped across single cycles, where blocks of devices on different buses
+    // overlap in time
+    uint32_t cycle_ms = (uint32_t)((num_devices + NUM_BUSES - 1) / NUM_BUSES) * READ_TIME_MS;
+    for (int c = num_cycles - 40; c < num_cycles && failures - before < 5; ++c)
+    {
+        for (uint32_t offset = 0; offset < cycle_ms; offset += 50)
+        {
+            for (int device = 0; device < num_devices && failures - before < 5; device += 5)
+            {
+                uint32_t start = (uint32_t)c * period_ms + offset;
+                history_query_t query = { .device = device, .from_ms = start, .to_ms = start + 300 };
+                _compare(history, &query);
+            }
+        }
+    }
+
+    // an empty or inverted range returns empty buckets
+    history_point_t points[4];
+    history_query_t inverted = { .device = 0, .from_ms = 1000, .to_ms = 999, .points = 4 };
+    CHECK(history_query(history, &inverted, points, 4, NULL) == 0, "inverted range returned points");
+
+    printf("%d devices, %d cycles of %u ms into %d blocks (%s): %d samples held of %d appended\n",
+           num_devices, num_cycles, (unsigned int)period_ms, num_blocks, history->used == num_blocks ? "wrapped" : "not wrapped",
+           num_appended - _oldest_held(history), num_appended);
+    vSemaphoreDelete(history->mutex);
+    free(history->index);
+    free(history->blocks);
+    free(history);
+    sensors_free(&sensors);
+}
+
+static int64_t _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _benchmark(int num_devices, int days, int period_s)
+{
+    int num_cycles = days * 86400 / period_s;
+    sensors_t * sensors = _devices(num_devices);
+    int num_blocks = (int)((int64_t)num_cycles * num_devices / HISTORY_BLOCK_SAMPLES + 2);
+    history_t * history = history_malloc(sensors, num_blocks, 1);
+    num_appended = 0;
+    appended = realloc(appended, ((size_t)num_cycles * num_devices + 1) * sizeof(history_sample_t));
+    for (uint32_t c = 1; c <= (uint32_t)num_cycles; ++c)
+    {
+        _cycle(history, num_devices, c, (uint32_t)period_s * 1000);
+    }
+
+    printf("%d devices every %d s for %d days: %d samples in %d blocks, %zu KB\n", num_devices, period_s, days,
+           num_appended, history->used, (size_t)history->used * (HISTORY_BLOCK_SAMPLES * sizeof(history_sample_t) + sizeof(history_index_t)) / 1024);
+    printf("  %-22s %8s %8s %8s %8s %10s\n", "query", "points", "blocks", "skipped", "samples", "us");
+
+    uint32_t end_ms = (uint32_t)num_cycles * period_s * 1000;
+    struct
+    {
+        const char * name;
+        uint32_t span_ms;
+        int points;
+    } cases[] = {
+        { "last hour, raw", 3600000, 0 },
+        { "last day, 100 points", 86400000, 100 },
+        { "day a week ago, 100 points", 86400000, 100 },
+        { "all, 500 points", end_ms, HISTORY_MAX_POINTS },
+    };
+    static history_point_t points[HISTORY_MAX_POINTS];
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); ++k)
+    {
+        uint32_t span = cases[k].span_ms < end_ms ? cases[k].span_ms : end_ms;
+        uint32_t to = k == 2 && end_ms > 7 * 86400000u ? end_ms - 6 * 86400000u : end_ms;
+        history_query_t query = { .device = num_devices / 3, .from_ms = to - span, .to_ms = to, .points = cases[k].points };
+        history_stats_t stats;
+        int n = 0;
+        int repeats = 50;
+        int64_t t0 = _now_ns();
+        for (int r = 0; r < repeats; ++r)
+        {
+            n = history_query(history, &query, points, HISTORY_MAX_POINTS, &stats);
+        }
+        double us = (double)(_now_ns() - t0) / repeats / 1000.0;
+        printf("  %-22s %8d %8d %8d %8d %10.1f\n", cases[k].name, n, stats.blocks_scanned, stats.blocks_skipped, stats.samples_scanned, us);
+    }
+    vSemaphoreDelete(history->mutex);
+    free(history->index);
+    free(history->blocks);
+    free(history);
+    sensors_free(&sensors);
+}
+
+int main(int argc, char * argv[])
+{
+    int num_devices = argc > 1 ? atoi(argv[1]) : 64;
+    int days = argc > 2 ? atoi(argv[2]) : 7;
+    int period_s = argc > 3 ? atoi(argv[3]) : 60;
+    if (num_devices < NUM_BUSES || num_devices > SENSORS_MAX_DEVICES || days < 1 || period_s < 1)
+    {
+        fprintf(stderr, "usage: %s [num_devices %d-%d] [days] [period_s]\n", argv[0], NUM_BUSES, SENSORS_MAX_DEVICES);
+        return 2;
+    }
+
+    appended = malloc(400 * SENSORS_MAX_DEVICES * sizeof(history_sample_t));
+    _test_queries(16, 64, 400, 1000);
+    _test_queries(SENSORS_MAX_DEVICES, 256, 400, 10000);
+    _test_queries(SENSORS_MAX_DEVICES, 64, 400, 10000);
+    printf("%s: %d failures\n", failures == 0 ? "tests passed" : "TESTS FAILED", failures);
+
+    _benchmark(num_devices, days, period_s);
+    free(appended);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host stand-in for the esp32-ds18b20 component. Reads fail with DS18B20_ERROR_DEVICE unless
+// a tool supplies its own devices, see host.c.
+
+#ifndef HOST_DS18B20_H
+#define HOST_DS18B20_H
+
+#include "owb.h"
+
+typedef enum
+{
+    DS18B20_ERROR_UNKNOWN = -1,
+    DS18B20_OK = 0,
+    DS18B20_ERROR_DEVICE,
+    DS18B20_ERROR_CRC,
+    DS18B20_ERROR_OWB,
+    DS18B20_ERROR_NULL,
+} DS18B20_ERROR;
+
+typedef enum
+{
+    DS18B20_RESOLUTION_INVALID = -1,
+    DS18B20_RESOLUTION_9_BIT = 9,
+    DS18B20_RESOLUTION_10_BIT = 10,
+    DS18B20_RESOLUTION_11_BIT = 11,
+    DS18B20_RESOLUTION_12_BIT = 12,
+} DS18B20_RESOLUTION;
+
+typedef struct
+{
+    bool init;
+    bool solo;
+    bool use_crc;
+    const OneWireBus * bus;
+    OneWireBus_ROMCode rom_code;
+    DS18B20_RESOLUTION resolution;
+} DS18B20_Info;
+
+DS18B20_Info * ds18b20_malloc(void);
+void ds18b20_free(DS18B20_Info ** ds18b20_info);
+void ds18b20_init(DS18B20_Info * ds18b20_info, const OneWireBus * bus, OneWireBus_ROMCode rom_code);
+void ds18b20_init_solo(DS18B20_Info * ds18b20_info, const OneWireBus * bus);
+void ds18b20_use_crc(DS18B20_Info * ds18b20_info, bool use_crc);
+bool ds18b20_set_resolution(DS18B20_Info * ds18b20_info, DS18B20_RESOLUTION resolution);
+DS18B20_ERROR ds18b20_read_temp(const DS18B20_Info * ds18b20_info, float * value);
+
+#endif  // HOST_DS18B20_H
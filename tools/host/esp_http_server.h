@@ -0,0 +1,125 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HOST_ESP_HTTP_SERVER_H
+#define HOST_ESP_HTTP_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+// A single-threaded server, as esp_http_server is: GET requests, one per connection, and
+// WebSocket endpoints, with control frames handled by the server. See host.c.
+
+typedef void * httpd_handle_t;
+
+typedef enum
+{
+    HTTP_DELETE = 0,
+    HTTP_GET = 1,
+    HTTP_HEAD = 2,
+    HTTP_POST = 3,
+} httpd_method_t;
+
+typedef struct httpd_req
+{
+    httpd_handle_t handle;
+    int method;                 ///< HTTP_GET for a request or WebSocket handshake, 0 for a WebSocket frame
+    const char uri[512 + 1];
+    size_t content_len;
+    void * aux;
+    void * user_ctx;
+} httpd_req_t;
+
+typedef struct httpd_uri
+{
+    const char * uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t * r);
+    void * user_ctx;
+    bool is_websocket;
+    bool handle_ws_control_frames;
+    const char * supported_subprotocol;
+} httpd_uri_t;
+
+typedef void (*httpd_close_func_t)(httpd_handle_t hd, int sockfd);
+typedef bool (*httpd_uri_match_func_t)(const char * reference_uri, const char * uri_to_match, size_t match_upto);
+
+typedef struct
+{
+    uint16_t server_port;
+    uint16_t max_open_sockets;
+    uint16_t max_uri_handlers;
+    bool lru_purge_enable;
+    httpd_close_func_t close_fn;
+    httpd_uri_match_func_t uri_match_fn;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() { .server_port = 80, .max_open_sockets = 7, .max_uri_handlers = 8 }
+
+#define HTTPD_RESP_USE_STRLEN (-1)
+
+typedef enum
+{
+    HTTPD_WS_TYPE_CONTINUE = 0x0,
+    HTTPD_WS_TYPE_TEXT = 0x1,
+    HTTPD_WS_TYPE_BINARY = 0x2,
+    HTTPD_WS_TYPE_CLOSE = 0x8,
+    HTTPD_WS_TYPE_PING = 0x9,
+    HTTPD_WS_TYPE_PONG = 0xA,
+} httpd_ws_type_t;
+
+typedef struct
+{
+    bool final;
+    bool fragmented;
+    httpd_ws_type_t type;
+    uint8_t * payload;
+    size_t len;
+} httpd_ws_frame_t;
+
+typedef enum
+{
+    HTTPD_WS_CLIENT_INVALID = 0x0,
+    HTTPD_WS_CLIENT_HTTP = 0x1,
+    HTTPD_WS_CLIENT_WEBSOCKET = 0x2,
+} httpd_ws_client_info_t;
+
+esp_err_t httpd_start(httpd_handle_t * handle, const httpd_config_t * config);
+esp_err_t httpd_stop(httpd_handle_t handle);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t * uri_handler);
+bool httpd_uri_match_wildcard(const char * uri_template, const char * uri_to_match, size_t match_upto);
+
+int httpd_req_to_sockfd(httpd_req_t * r);
+esp_err_t httpd_resp_set_type(httpd_req_t * r, const char * type);
+esp_err_t httpd_resp_send(httpd_req_t * r, const char * buf, ssize_t buf_len);
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t * req, httpd_ws_frame_t * pkt, size_t max_len);
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd);
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd);
+
+#endif  // HOST_ESP_HTTP_SERVER_H
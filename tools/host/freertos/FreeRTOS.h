@@ -0,0 +1,61 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host stand-in for FreeRTOS, backed by POSIX threads, see host.c.
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE                   (1)
+#define pdFALSE                  (0)
+#define pdPASS                   (1)
+#define pdFAIL                   (0)
+#define portMAX_DELAY            (0xffffffffu)
+#define portTICK_PERIOD_MS       (1)
+#define portNUM_PROCESSORS       (2)
+#define configMAX_TASK_NAME_LEN  (16)
+#define configMAX_PRIORITIES     (25)
+#define tskNO_AFFINITY           (0x7fffffff)
+#define pdMS_TO_TICKS(ms)        ((TickType_t)(ms) / portTICK_PERIOD_MS)
+
+// Critical sections are a mutex per lock; there is no interrupt context on the host
+typedef struct
+{
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED  { PTHREAD_MUTEX_INITIALIZER }
+#define portENTER_CRITICAL(mux)       pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux)        pthread_mutex_unlock(&(mux)->mutex)
+
+#endif  // HOST_FREERTOS_H
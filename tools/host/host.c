@@ -0,0 +1,1452 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host stand-ins for the parts of ESP-IDF, FreeRTOS and the 1-Wire components that firmware
+// modules use, so that the modules can be built unchanged into host tests and benchmarks.
+//
+// Tools build with this directory ahead of main/ on the include path, and link this file:
+//
+//     $ cc -O2 -I tools/host -I main -o <tool> tools/<tool>.c main/<module>.c ... tools/host/host.c -lpthread -lm
+//
+// FreeRTOS queues, semaphores, tasks and task notifications are backed by POSIX threads, and
+// critical sections by a mutex per lock. Ticks are milliseconds. The 1-Wire layer performs
+// byte-level transactions through the bus driver, as the esp32-owb component does, and
+// DS18B20 reads use the real scratchpad protocol, so an emulated bus driver sees the same
+// traffic as on the device. A UART is a pseudo-terminal, lwIP sockets are the host's own, and
+// the HTTP server is a minimal single-threaded server with WebSocket support.
+
+#define _GNU_SOURCE    // posix_openpt() and ptsname_r(), for the UART
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
+#include "esp_http_server.h"
+#include "driver/uart.h"
+#include "owb.h"
+#include "ds18b20.h"
+#include "network.h"
+
+#define HTTP_BUFFER_SIZE   (512)
+
+// Queues and semaphores
+
+struct host_queue
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t * items;
+};
+
+// Wait for the queue to change. Called with the mutex held. Returns false on timeout.
+static bool _wait(struct host_queue * queue, const struct timespec * deadline)
+{
+    if (deadline == NULL)
+    {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(&queue->changed, &queue->mutex, deadline) != ETIMEDOUT;
+}
+
+static struct timespec * _deadline(TickType_t wait, struct timespec * deadline)
+{
+    if (wait == portMAX_DELAY)
+    {
+        return NULL;
+    }
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += wait / 1000;
+    deadline->tv_nsec += (long)(wait % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_nsec -= 1000000000;
+        ++deadline->tv_sec;
+    }
+    return deadline;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue * queue = calloc(1, sizeof(*queue));
+    if (queue == NULL || (queue->items = calloc(length > 0 ? length : 1, item_size > 0 ? item_size : 1)) == NULL)
+    {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->changed);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void * item, TickType_t wait)
+{
+    struct timespec time;
+    struct timespec * deadline = _deadline(wait, &time);
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length)
+    {
+        if (wait == 0 || !_wait(queue, deadline))
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    if (queue->item_size > 0)
+    {
+        memcpy(&queue->items[((queue->head + queue->count) % queue->length) * queue->item_size], item, queue->item_size);
+    }
+    ++queue->count;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void * item, TickType_t wait)
+{
+    struct timespec time;
+    struct timespec * deadline = _deadline(wait, &time);
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0)
+    {
+        if (wait == 0 || !_wait(queue, deadline))
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    if (queue->item_size > 0)
+    {
+        memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    --queue->count;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    SemaphoreHandle_t semaphore = xQueueCreate(max, 0);
+    if (semaphore != NULL)
+    {
+        semaphore->count = initial;
+    }
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    uint8_t token;
+    return xQueueReceive(semaphore, &token, wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    uint8_t token = 0;
+    return xQueueSend(semaphore, &token, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    vQueueDelete(semaphore);
+}
+
+// Tasks and notifications
+
+struct host_task
+{
+    pthread_t thread;
+    TaskFunction_t function;
+    void * parameter;
+    pthread_mutex_t mutex;
+    pthread_cond_t notified;
+    uint32_t notifications;
+};
+
+static __thread struct host_task * current_task;
+
+static struct host_task * _task_malloc(TaskFunction_t function, void * parameter)
+{
+    struct host_task * task = calloc(1, sizeof(*task));
+    if (task != NULL)
+    {
+        task->function = function;
+        task->parameter = parameter;
+        pthread_mutex_init(&task->mutex, NULL);
+        pthread_cond_init(&task->notified, NULL);
+    }
+    return task;
+}
+
+static void * _task_entry(void * parameter)
+{
+    current_task = parameter;
+    current_task->function(current_task->parameter);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char * name, uint32_t stack_size, void * parameter,
+                                   UBaseType_t priority, TaskHandle_t * handle, BaseType_t core)
+{
+    struct host_task * task = _task_malloc(function, parameter);
+    if (task == NULL || pthread_create(&task->thread, NULL, _task_entry, task) != 0)
+    {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    if (handle != NULL)
+    {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char * name, uint32_t stack_size, void * parameter,
+                       UBaseType_t priority, TaskHandle_t * handle)
+{
+    return xTaskCreatePinnedToCore(function, name, stack_size, parameter, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == current_task)
+    {
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (current_task == NULL)
+    {
+        // a thread not created by xTaskCreate, such as the tool's main thread
+        current_task = _task_malloc(NULL, NULL);
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->mutex);
+    ++task->notifications;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->mutex);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+    struct host_task * task = xTaskGetCurrentTaskHandle();
+    struct timespec time;
+    struct timespec * deadline = _deadline(wait, &time);
+    pthread_mutex_lock(&task->mutex);
+    while (task->notifications == 0 && wait != 0)
+    {
+        if (deadline == NULL)
+        {
+            pthread_cond_wait(&task->notified, &task->mutex);
+        }
+        else if (pthread_cond_timedwait(&task->notified, &task->mutex, deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    uint32_t value = task->notifications;
+    if (value > 0)
+    {
+        task->notifications = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return value;
+}
+
+// Time, errors and network
+
+static _Atomic int64_t fixed_time = -1;
+
+int64_t esp_timer_get_time(void)
+{
+    int64_t time = atomic_load(&fixed_time);
+    if (time >= 0)
+    {
+        return time;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void host_timer_set(int64_t time)
+{
+    atomic_store(&fixed_time, time);
+}
+
+const char * esp_err_to_name(esp_err_t error)
+{
+    switch (error)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    default:
+        return "ESP_FAIL";
+    }
+}
+
+bool network_wait_connected(TickType_t timeout)
+{
+    return true;
+}
+
+bool network_is_connected(void)
+{
+    return true;
+}
+
+// 1-Wire, through the bus driver
+
+owb_status owb_use_crc(OneWireBus * bus, bool use_crc)
+{
+    bus->use_crc = use_crc;
+    return OWB_STATUS_OK;
+}
+
+owb_status owb_reset(const OneWireBus * bus, bool * is_present)
+{
+    return bus->driver->reset(bus, is_present);
+}
+
+owb_status owb_read_byte(const OneWireBus * bus, uint8_t * out)
+{
+    return bus->driver->read_bits(bus, out, 8);
+}
+
+owb_status owb_read_bytes(const OneWireBus * bus, uint8_t * buffer, unsigned int len)
+{
+    owb_status status = OWB_STATUS_OK;
+    for (unsigned int i = 0; i < len && status == OWB_STATUS_OK; ++i)
+    {
+        status = owb_read_byte(bus, &buffer[i]);
+    }
+    return status;
+}
+
+owb_status owb_write_byte(const OneWireBus * bus, uint8_t data)
+{
+    return bus->driver->write_bits(bus, data, 8);
+}
+
+owb_status owb_write_bytes(const OneWireBus * bus, const uint8_t * buffer, int len)
+{
+    owb_status status = OWB_STATUS_OK;
+    for (int i = 0; i < len && status == OWB_STATUS_OK; ++i)
+    {
+        status = owb_write_byte(bus, buffer[i]);
+    }
+    return status;
+}
+
+owb_status owb_write_rom_code(const OneWireBus * bus, OneWireBus_ROMCode rom_code)
+{
+    return owb_write_bytes(bus, rom_code.bytes, sizeof(rom_code.bytes));
+}
+
+uint8_t owb_crc8_bytes(uint8_t crc, const uint8_t * data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        uint8_t byte = data[i];
+        for (int b = 0; b < 8; ++b)
+        {
+            uint8_t mix = (crc ^ byte) & 0x01;
+            crc >>= 1;
+            if (mix)
+            {
+                crc ^= 0x8C;
+            }
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+// Maxim search algorithm, one slot at a time, as the esp32-owb component does
+static owb_status _search(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device)
+{
+    *found_device = false;
+    if (state->last_device_flag)
+    {
+        return OWB_STATUS_OK;
+    }
+
+    bool is_present = false;
+    owb_status status = owb_reset(bus, &is_present);
+    if (status != OWB_STATUS_OK || !is_present)
+    {
+        return status;
+    }
+    owb_write_byte(bus, OWB_ROM_SEARCH);
+
+    int last_zero = 0;
+    for (int id_bit_number = 1; id_bit_number <= 64; ++id_bit_number)
+    {
+        uint8_t id_bit = 0;
+        uint8_t cmp_id_bit = 0;
+        bus->driver->read_bits(bus, &id_bit, 1);
+        bus->driver->read_bits(bus, &cmp_id_bit, 1);
+        if (id_bit && cmp_id_bit)
+        {
+            return OWB_STATUS_OK;    // no devices took part
+        }
+
+        int byte = (id_bit_number - 1) / 8;
+        uint8_t mask = 1u << ((id_bit_number - 1) % 8);
+        bool direction;
+        if (id_bit != cmp_id_bit)
+        {
+            direction = id_bit;
+        }
+        else
+        {
+            direction = id_bit_number < state->last_discrepancy
+                        ? (state->rom_code.bytes[byte] & mask) != 0
+                        : id_bit_number == state->last_discrepancy;
+            if (!direction)
+            {
+                last_zero = id_bit_number;
+                if (last_zero < 9)
+                {
+                    state->last_family_discrepancy = last_zero;
+                }
+            }
+        }
+        state->rom_code.bytes[byte] = direction ? state->rom_code.bytes[byte] | mask : state->rom_code.bytes[byte] & ~mask;
+        bus->driver->write_bits(bus, direction, 1);
+    }
+
+    if (owb_crc8_bytes(0, state->rom_code.bytes, sizeof(state->rom_code.bytes)) == 0)
+    {
+        state->last_discrepancy = last_zero;
+        state->last_device_flag = last_zero == 0;
+        *found_device = true;
+    }
+    return OWB_STATUS_OK;
+}
+
+owb_status owb_search_first(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device)
+{
+    memset(state, 0, sizeof(*state));
+    return _search(bus, state, found_device);
+}
+
+owb_status owb_search_next(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device)
+{
+    return _search(bus, state, found_device);
+}
+
+char * owb_string_from_rom_code(OneWireBus_ROMCode rom_code, char * buffer, size_t len)
+{
+    size_t n = 0;
+    for (int i = sizeof(rom_code.bytes) - 1; i >= 0 && n + 2 < len; --i, n += 2)
+    {
+        sprintf(&buffer[n], "%02x", rom_code.bytes[i]);
+    }
+    return buffer;
+}
+
+// DS18B20, through the 1-Wire layer
+
+#define DS18B20_READ_SCRATCHPAD   (0xBE)
+#define DS18B20_SCRATCHPAD_SIZE   (9)
+
+DS18B20_Info * ds18b20_malloc(void)
+{
+    return calloc(1, sizeof(DS18B20_Info));
+}
+
+void ds18b20_free(DS18B20_Info ** ds18b20_info)
+{
+    free(*ds18b20_info);
+    *ds18b20_info = NULL;
+}
+
+void ds18b20_init(DS18B20_Info * ds18b20_info, const OneWireBus * bus, OneWireBus_ROMCode rom_code)
+{
+    memset(ds18b20_info, 0, sizeof(*ds18b20_info));
+    ds18b20_info->init = true;
+    ds18b20_info->bus = bus;
+    ds18b20_info->rom_code = rom_code;
+    ds18b20_info->resolution = DS18B20_RESOLUTION_12_BIT;
+}
+
+void ds18b20_init_solo(DS18B20_Info * ds18b20_info, const OneWireBus * bus)
+{
+    OneWireBus_ROMCode rom_code = { 0 };
+    ds18b20_init(ds18b20_info, bus, rom_code);
+    ds18b20_info->solo = true;
+}
+
+void ds18b20_use_crc(DS18B20_Info * ds18b20_info, bool use_crc)
+{
+    ds18b20_info->use_crc = use_crc;
+}
+
+bool ds18b20_set_resolution(DS18B20_Info * ds18b20_info, DS18B20_RESOLUTION resolution)
+{
+    ds18b20_info->resolution = resolution;
+    return true;
+}
+
+DS18B20_ERROR ds18b20_read_temp(const DS18B20_Info * ds18b20_info, float * value)
+{
+    const OneWireBus * bus = ds18b20_info != NULL ? ds18b20_info->bus : NULL;
+    if (bus == NULL || bus->driver == NULL)
+    {
+        return DS18B20_ERROR_NULL;
+    }
+
+    bool is_present = false;
+    if (owb_reset(bus, &is_present) != OWB_STATUS_OK)
+    {
+        return DS18B20_ERROR_OWB;
+    }
+    if (!is_present)
+    {
+        return DS18B20_ERROR_DEVICE;
+    }
+    if (ds18b20_info->solo)
+    {
+        owb_write_byte(bus, OWB_ROM_SKIP);
+    }
+    else
+    {
+        owb_write_byte(bus, OWB_ROM_MATCH);
+        owb_write_rom_code(bus, ds18b20_info->rom_code);
+    }
+    owb_write_byte(bus, DS18B20_READ_SCRATCHPAD);
+
+    uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
+    if (owb_read_bytes(bus, scratchpad, sizeof(scratchpad)) != OWB_STATUS_OK)
+    {
+        return DS18B20_ERROR_OWB;
+    }
+    if (ds18b20_info->use_crc && owb_crc8_bytes(0, scratchpad, sizeof(scratchpad)) != 0)
+    {
+        return DS18B20_ERROR_CRC;
+    }
+    if (value != NULL)
+    {
+        *value = (int16_t)(scratchpad[0] | (scratchpad[1] << 8)) / 16.0f;
+    }
+    return DS18B20_OK;
+}
+
+// HTTP client, for http://host[:port]/path URLs
+
+struct esp_http_client
+{
+    char host[128];
+    char port[8];
+    char path[256];
+    int timeout_ms;
+    const char * post_data;
+    int post_length;
+    char content_type[64];
+    int status;
+};
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t * config)
+{
+    const char * url = config->url;
+    if (strncmp(url, "http://", 7) != 0)
+    {
+        return NULL;
+    }
+    struct esp_http_client * client = calloc(1, sizeof(*client));
+    if (client == NULL)
+    {
+        return NULL;
+    }
+    url += 7;
+    size_t host_length = strcspn(url, ":/");
+    snprintf(client->host, sizeof(client->host), "%.*s", (int)host_length, url);
+    url += host_length;
+    strcpy(client->port, "80");
+    if (*url == ':')
+    {
+        size_t port_length = strcspn(++url, "/");
+        snprintf(client->port, sizeof(client->port), "%.*s", (int)port_length, url);
+        url += port_length;
+    }
+    snprintf(client->path, sizeof(client->path), "%s", *url != '\0' ? url : "/");
+    client->timeout_ms = config->timeout_ms > 0 ? config->timeout_ms : 5000;
+    strcpy(client->content_type, "application/octet-stream");
+    return client;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char * key, const char * value)
+{
+    if (strcasecmp(key, "Content-Type") == 0)
+    {
+        snprintf(client->content_type, sizeof(client->content_type), "%s", value);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char * data, int len)
+{
+    client->post_data = data;
+    client->post_length = len;
+    return ESP_OK;
+}
+
+static bool _send_all(int fd, const void * data, size_t length)
+{
+    const char * p = data;
+    while (length > 0)
+    {
+        ssize_t sent = send(fd, p, length, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        p += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    client->status = 0;
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo * addresses = NULL;
+    if (getaddrinfo(client->host, client->port, &hints, &addresses) != 0)
+    {
+        return ESP_FAIL;
+    }
+    int fd = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+    struct timeval timeout = { .tv_sec = client->timeout_ms / 1000, .tv_usec = (client->timeout_ms % 1000) * 1000 };
+    bool ok = fd >= 0
+        && setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0
+        && connect(fd, addresses->ai_addr, addresses->ai_addrlen) == 0;
+    freeaddrinfo(addresses);
+
+    char buffer[HTTP_BUFFER_SIZE];
+    if (ok)
+    {
+        int length = snprintf(buffer, sizeof(buffer),
+                              "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+                              client->path, client->host, client->content_type, client->post_length);
+        ok = _send_all(fd, buffer, length) && _send_all(fd, client->post_data, client->post_length);
+    }
+    if (ok)
+    {
+        // only the status line is needed
+        ssize_t received = recv(fd, buffer, sizeof(buffer) - 1, 0);
+        ok = received > 0;
+        if (ok)
+        {
+            buffer[received] = '\0';
+            ok = sscanf(buffer, "HTTP/1.%*d %d", &client->status) == 1;
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    free(client);
+    return ESP_OK;
+}
+
+// HTTP server: a single thread serving GET requests, one per connection, and WebSocket
+// endpoints, as esp_http_server does. Handlers run on the server thread. The server answers
+// WebSocket pings and close frames itself, and passes data frames to the endpoint's handler.
+// The handshake response omits Sec-WebSocket-Accept, which the host tools' clients ignore.
+
+#define HTTPD_MAX_SESSIONS     (8)
+#define HTTPD_REQUEST_SIZE     (1024)
+#define HTTPD_WS_PAYLOAD_SIZE  (1024)
+#define HTTPD_SEND_BUFFER      (5744)    // TCP_SND_BUF in ESP-IDF's default lwIP configuration
+
+struct host_httpd_session
+{
+    int fd;                      // -1 if the slot is free
+    bool websocket;
+    bool closing;                // close requested by another thread
+    const httpd_uri_t * uri;     // WebSocket endpoint, once upgraded
+    size_t length;
+    char request[HTTPD_REQUEST_SIZE];
+};
+
+struct host_httpd
+{
+    httpd_config_t config;
+    int listen_fd;
+    int wake[2];                 // pipe that wakes the server thread
+    pthread_t thread;
+    pthread_mutex_t mutex;       // protects the session table
+    atomic_bool stop;
+    httpd_uri_t * uris;
+    int num_uris;
+    struct host_httpd_session sessions[HTTPD_MAX_SESSIONS];
+};
+
+// Passed to handlers as req->aux
+struct host_httpd_aux
+{
+    struct host_httpd_session * session;
+    const char * content_type;
+    httpd_ws_frame_t frame;
+    uint8_t payload[HTTPD_WS_PAYLOAD_SIZE];
+};
+
+static bool _recv_all(int fd, void * data, size_t length)
+{
+    return length == 0 || recv(fd, data, length, MSG_WAITALL) == (ssize_t)length;
+}
+
+static void _httpd_wake(struct host_httpd * server)
+{
+    char c = 0;
+    (void)!write(server->wake[1], &c, 1);
+}
+
+static void _httpd_close(struct host_httpd * server, struct host_httpd_session * session)
+{
+    pthread_mutex_lock(&server->mutex);
+    int fd = session->fd;
+    session->fd = -1;
+    pthread_mutex_unlock(&server->mutex);
+    if (server->config.close_fn != NULL)
+    {
+        server->config.close_fn(server, fd);
+    }
+    else
+    {
+        close(fd);
+    }
+}
+
+static bool _httpd_ws_send(int fd, httpd_ws_type_t type, const uint8_t * payload, size_t length)
+{
+    uint8_t header[2] = { 0x80 | type, (uint8_t)length };
+    return length < 126 && _send_all(fd, header, sizeof(header)) && _send_all(fd, payload, length);
+}
+
+// Read one WebSocket frame into aux->frame
+static bool _httpd_ws_read(int fd, struct host_httpd_aux * aux)
+{
+    uint8_t header[2];
+    uint8_t mask[4] = { 0 };
+    if (!_recv_all(fd, header, sizeof(header)))
+    {
+        return false;
+    }
+    size_t length = header[1] & 0x7f;
+    if (length == 126)
+    {
+        uint8_t extended[2];
+        if (!_recv_all(fd, extended, sizeof(extended)))
+        {
+            return false;
+        }
+        length = (extended[0] << 8) | extended[1];
+    }
+    if (length > sizeof(aux->payload) || ((header[1] & 0x80) && !_recv_all(fd, mask, sizeof(mask)))
+        || !_recv_all(fd, aux->payload, length))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; ++i)
+    {
+        aux->payload[i] ^= mask[i % 4];
+    }
+    aux->frame.final = header[0] & 0x80;
+    aux->frame.type = header[0] & 0x0f;
+    aux->frame.payload = aux->payload;
+    aux->frame.len = length;
+    return true;
+}
+
+static const httpd_uri_t * _httpd_find(struct host_httpd * server, const char * uri)
+{
+    size_t length = strcspn(uri, "?");
+    for (int u = 0; u < server->num_uris; ++u)
+    {
+        const httpd_uri_t * handler = &server->uris[u];
+        bool match = server->config.uri_match_fn != NULL
+            ? server->config.uri_match_fn(handler->uri, uri, length)
+            : strlen(handler->uri) == length && strncmp(handler->uri, uri, length) == 0;
+        if (match && handler->method == HTTP_GET)
+        {
+            return handler;
+        }
+    }
+    return NULL;
+}
+
+// Serve a readable session. Returns false if the session should be closed.
+static bool _httpd_serve(struct host_httpd * server, struct host_httpd_session * session)
+{
+    static struct host_httpd_aux aux;    // only the server thread uses it
+    memset(&aux, 0, sizeof(aux));
+    aux.session = session;
+    aux.content_type = "text/html";
+    httpd_req_t req = { .handle = server, .aux = &aux };
+
+    if (session->websocket)
+    {
+        if (!_httpd_ws_read(session->fd, &aux))
+        {
+            return false;
+        }
+        switch (aux.frame.type)
+        {
+        case HTTPD_WS_TYPE_CLOSE:
+            _httpd_ws_send(session->fd, HTTPD_WS_TYPE_CLOSE, NULL, 0);
+            return false;
+        case HTTPD_WS_TYPE_PING:
+            return _httpd_ws_send(session->fd, HTTPD_WS_TYPE_PONG, aux.payload, aux.frame.len);
+        case HTTPD_WS_TYPE_PONG:
+            return true;
+        default:
+            req.user_ctx = session->uri->user_ctx;
+            return session->uri->handler(&req) == ESP_OK;
+        }
+    }
+
+    ssize_t received = recv(session->fd, session->request + session->length,
+                            sizeof(session->request) - 1 - session->length, 0);
+    if (received <= 0)
+    {
+        return false;
+    }
+    session->length += received;
+    session->request[session->length] = '\0';
+    if (strstr(session->request, "\r\n\r\n") == NULL)
+    {
+        return session->length < sizeof(session->request) - 1;
+    }
+
+    char * uri = (char *)req.uri;
+    if (sscanf(session->request, "GET %512s HTTP/1.%*d", uri) != 1)
+    {
+        return false;
+    }
+    const httpd_uri_t * handler = _httpd_find(server, uri);
+    if (handler == NULL)
+    {
+        static const char NOT_FOUND[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        _send_all(session->fd, NOT_FOUND, strlen(NOT_FOUND));
+        return false;
+    }
+    req.method = HTTP_GET;
+    req.user_ctx = handler->user_ctx;
+    if (!handler->is_websocket)
+    {
+        // one request per connection
+        handler->handler(&req);
+        return false;
+    }
+
+    static const char UPGRADE[] = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n";
+    if (strcasestr(session->request, "Upgrade: websocket") == NULL || !_send_all(session->fd, UPGRADE, strlen(UPGRADE)))
+    {
+        return false;
+    }
+    pthread_mutex_lock(&server->mutex);
+    session->websocket = true;
+    session->uri = handler;
+    pthread_mutex_unlock(&server->mutex);
+    return handler->handler(&req) == ESP_OK;
+}
+
+static void _httpd_accept(struct host_httpd * server)
+{
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+        return;
+    }
+    int size = HTTPD_SEND_BUFFER;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pthread_mutex_lock(&server->mutex);
+    struct host_httpd_session * session = NULL;
+    for (int s = 0; s < HTTPD_MAX_SESSIONS && session == NULL; ++s)
+    {
+        if (server->sessions[s].fd < 0)
+        {
+            session = &server->sessions[s];
+            memset(session, 0, sizeof(*session));
+            session->fd = fd;
+        }
+    }
+    pthread_mutex_unlock(&server->mutex);
+    if (session == NULL)
+    {
+        close(fd);
+    }
+}
+
+static void * _httpd_thread(void * parameter)
+{
+    struct host_httpd * server = parameter;
+    while (!server->stop)
+    {
+        struct pollfd fds[2 + HTTPD_MAX_SESSIONS];
+        struct host_httpd_session * polled[HTTPD_MAX_SESSIONS];
+        fds[0] = (struct pollfd){ .fd = server->listen_fd, .events = POLLIN };
+        fds[1] = (struct pollfd){ .fd = server->wake[0], .events = POLLIN };
+        int num_polled = 0;
+        for (int s = 0; s < HTTPD_MAX_SESSIONS; ++s)
+        {
+            struct host_httpd_session * session = &server->sessions[s];
+            if (session->fd >= 0 && session->closing)
+            {
+                _httpd_close(server, session);
+            }
+            else if (session->fd >= 0)
+            {
+                fds[2 + num_polled] = (struct pollfd){ .fd = session->fd, .events = POLLIN };
+                polled[num_polled++] = session;
+            }
+        }
+
+        if (poll(fds, 2 + num_polled, -1) <= 0)
+        {
+            continue;
+        }
+        if (fds[1].revents)
+        {
+            char buffer[16];
+            (void)!read(server->wake[0], buffer, sizeof(buffer));
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            _httpd_accept(server);
+        }
+        for (int p = 0; p < num_polled; ++p)
+        {
+            if (fds[2 + p].revents && !_httpd_serve(server, polled[p]))
+            {
+                _httpd_close(server, polled[p]);
+            }
+        }
+    }
+    return NULL;
+}
+
+esp_err_t httpd_start(httpd_handle_t * handle, const httpd_config_t * config)
+{
+    struct host_httpd * server = calloc(1, sizeof(*server));
+    if (server == NULL || (server->uris = calloc(config->max_uri_handlers, sizeof(httpd_uri_t))) == NULL)
+    {
+        free(server);
+        return ESP_ERR_NO_MEM;
+    }
+    server->config = *config;
+    pthread_mutex_init(&server->mutex, NULL);
+    for (int s = 0; s < HTTPD_MAX_SESSIONS; ++s)
+    {
+        server->sessions[s].fd = -1;
+    }
+
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(config->server_port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int one = 1;
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0
+        || setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+        || bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(server->listen_fd, HTTPD_MAX_SESSIONS) != 0
+        || pipe(server->wake) != 0
+        || pthread_create(&server->thread, NULL, _httpd_thread, server) != 0)
+    {
+        if (server->listen_fd >= 0)
+        {
+            close(server->listen_fd);
+        }
+        free(server->uris);
+        free(server);
+        return ESP_FAIL;
+    }
+    *handle = server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    struct host_httpd * server = handle;
+    server->stop = true;
+    _httpd_wake(server);
+    pthread_join(server->thread, NULL);
+    for (int s = 0; s < HTTPD_MAX_SESSIONS; ++s)
+    {
+        if (server->sessions[s].fd >= 0)
+        {
+            _httpd_close(server, &server->sessions[s]);
+        }
+    }
+    close(server->listen_fd);
+    close(server->wake[0]);
+    close(server->wake[1]);
+    free(server->uris);
+    free(server);
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t * uri_handler)
+{
+    struct host_httpd * server = handle;
+    if (server->num_uris >= server->config.max_uri_handlers)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    server->uris[server->num_uris++] = *uri_handler;
+    return ESP_OK;
+}
+
+bool httpd_uri_match_wildcard(const char * uri_template, const char * uri_to_match, size_t match_upto)
+{
+    size_t length = strlen(uri_template);
+    if (length > 0 && uri_template[length - 1] == '*')
+    {
+        return match_upto >= length - 1 && strncmp(uri_template, uri_to_match, length - 1) == 0;
+    }
+    return length == match_upto && strncmp(uri_template, uri_to_match, length) == 0;
+}
+
+int httpd_req_to_sockfd(httpd_req_t * r)
+{
+    return ((struct host_httpd_aux *)r->aux)->session->fd;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t * r, const char * type)
+{
+    ((struct host_httpd_aux *)r->aux)->content_type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t * r, const char * buf, ssize_t buf_len)
+{
+    struct host_httpd_aux * aux = r->aux;
+    size_t length = buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : (size_t)buf_len;
+    char header[HTTP_BUFFER_SIZE];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+                                 aux->content_type, (unsigned int)length);
+    return _send_all(aux->session->fd, header, header_length) && _send_all(aux->session->fd, buf, length) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t * req, httpd_ws_frame_t * pkt, size_t max_len)
+{
+    const httpd_ws_frame_t * frame = &((struct host_httpd_aux *)req->aux)->frame;
+    pkt->final = frame->final;
+    pkt->type = frame->type;
+    pkt->len = frame->len;
+    if (max_len == 0)
+    {
+        return ESP_OK;
+    }
+    if (pkt->payload == NULL || max_len < frame->len)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(pkt->payload, frame->payload, frame->len);
+    return ESP_OK;
+}
+
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd)
+{
+    struct host_httpd * server = hd;
+    httpd_ws_client_info_t info = HTTPD_WS_CLIENT_INVALID;
+    pthread_mutex_lock(&server->mutex);
+    for (int s = 0; s < HTTPD_MAX_SESSIONS; ++s)
+    {
+        if (server->sessions[s].fd == fd)
+        {
+            info = server->sessions[s].websocket ? HTTPD_WS_CLIENT_WEBSOCKET : HTTPD_WS_CLIENT_HTTP;
+        }
+    }
+    pthread_mutex_unlock(&server->mutex);
+    return info;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    struct host_httpd * server = handle;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    pthread_mutex_lock(&server->mutex);
+    for (int s = 0; s < HTTPD_MAX_SESSIONS; ++s)
+    {
+        if (server->sessions[s].fd == sockfd)
+        {
+            server->sessions[s].closing = true;
+            err = ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&server->mutex);
+    _httpd_wake(server);
+    return err;
+}
+
+// UART, backed by a pseudo-terminal
+
+#define UART_FIFO_FULL    (120)    // bytes received before the driver reports data without a timeout
+
+struct host_uart
+{
+    int master;                  // pty master, the UART's side of the line
+    int slave;                   // held open so the master does not see a hang-up between clients
+    char path[64];
+    QueueHandle_t events;
+    int baud_rate;
+    int timeout_symbols;
+    pthread_mutex_t mutex;
+    pthread_cond_t received;
+    uint8_t * ring;
+    size_t size;
+    size_t head;
+    size_t count;
+};
+
+static struct host_uart * uarts[UART_NUM_MAX];
+
+static void _uart_event(struct host_uart * uart, uart_event_type_t type, size_t size, bool timeout)
+{
+    uart_event_t event = { .type = type, .size = size, .timeout_flag = timeout };
+    if (uart->events != NULL)
+    {
+        xQueueSend(uart->events, &event, 0);
+    }
+}
+
+// Move bytes from the pty into the receive buffer, reporting them as the driver's interrupt does
+static void * _uart_receive(void * parameter)
+{
+    struct host_uart * uart = parameter;
+    size_t pending = 0;
+    while (1)
+    {
+        pthread_mutex_lock(&uart->mutex);
+        int64_t character_ns = 10 * 1000000000LL / (uart->baud_rate > 0 ? uart->baud_rate : 115200);
+        int64_t timeout_ns = uart->timeout_symbols * character_ns;
+        pthread_mutex_unlock(&uart->mutex);
+
+        struct pollfd fd = { .fd = uart->master, .events = POLLIN };
+        struct timespec timeout = { .tv_sec = timeout_ns / 1000000000, .tv_nsec = timeout_ns % 1000000000 };
+        int ready = ppoll(&fd, 1, pending > 0 ? &timeout : NULL, NULL);
+        if (ready == 0)
+        {
+            _uart_event(uart, UART_DATA, pending, true);    // the line has gone quiet
+            pending = 0;
+            continue;
+        }
+
+        uint8_t buffer[UART_FIFO_FULL];
+        ssize_t n = ready > 0 ? read(uart->master, buffer, sizeof(buffer)) : -1;
+        if (n <= 0)
+        {
+            usleep(1000);
+            continue;
+        }
+        pthread_mutex_lock(&uart->mutex);
+        bool full = uart->count + n > uart->size;
+        for (ssize_t i = 0; i < n && !full; ++i)
+        {
+            uart->ring[(uart->head + uart->count++) % uart->size] = buffer[i];
+        }
+        pthread_cond_broadcast(&uart->received);
+        pthread_mutex_unlock(&uart->mutex);
+
+        if (full)
+        {
+            _uart_event(uart, UART_BUFFER_FULL, 0, false);
+            pending = 0;
+            continue;
+        }
+        pending += n;
+        if (pending >= UART_FIFO_FULL)
+        {
+            _uart_event(uart, UART_DATA, pending, false);
+            pending = 0;
+        }
+    }
+    return NULL;
+}
+
+static struct host_uart * _uart(uart_port_t uart_num)
+{
+    return uart_num >= 0 && uart_num < UART_NUM_MAX ? uarts[uart_num] : NULL;
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size,
+                              QueueHandle_t * uart_queue, int intr_alloc_flags)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX || uarts[uart_num] != NULL || rx_buffer_size <= 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct host_uart * uart = calloc(1, sizeof(*uart));
+    uint8_t * ring = malloc(rx_buffer_size);
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (uart == NULL || ring == NULL || master < 0 || grantpt(master) != 0 || unlockpt(master) != 0
+        || ptsname_r(master, uart->path, sizeof(uart->path)) != 0)
+    {
+        free(uart);
+        free(ring);
+        if (master >= 0)
+        {
+            close(master);
+        }
+        return ESP_FAIL;
+    }
+
+    // a raw line, without echo or line discipline
+    uart->slave = open(uart->path, O_RDWR | O_NOCTTY);
+    struct termios termios;
+    tcgetattr(uart->slave, &termios);
+    cfmakeraw(&termios);
+    tcsetattr(uart->slave, TCSANOW, &termios);
+
+    uart->master = master;
+    uart->ring = ring;
+    uart->size = rx_buffer_size;
+    uart->baud_rate = 115200;
+    uart->timeout_symbols = 10;
+    pthread_mutex_init(&uart->mutex, NULL);
+    pthread_cond_init(&uart->received, NULL);
+    if (uart_queue != NULL && queue_size > 0)
+    {
+        uart->events = xQueueCreate(queue_size, sizeof(uart_event_t));
+        *uart_queue = uart->events;
+    }
+    uarts[uart_num] = uart;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, _uart_receive, uart);
+    pthread_detach(thread);
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t * uart_config)
+{
+    struct host_uart * uart = _uart(uart_num);
+    if (uart == NULL || uart_config->baud_rate <= 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&uart->mutex);
+    uart->baud_rate = uart_config->baud_rate;
+    pthread_mutex_unlock(&uart->mutex);
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+    return _uart(uart_num) != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_mode(uart_port_t uart_num, uart_mode_t mode)
+{
+    return _uart(uart_num) != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_rx_timeout(uart_port_t uart_num, const uint8_t tout_thresh)
+{
+    struct host_uart * uart = _uart(uart_num);
+    if (uart == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&uart->mutex);
+    uart->timeout_symbols = tout_thresh > 0 ? tout_thresh : 1;
+    pthread_mutex_unlock(&uart->mutex);
+    return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void * buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    struct host_uart * uart = _uart(uart_num);
+    if (uart == NULL)
+    {
+        return -1;
+    }
+    struct timespec deadline;
+    struct timespec * until = _deadline(ticks_to_wait, &deadline);
+    uint8_t * dst = buf;
+    uint32_t n = 0;
+    pthread_mutex_lock(&uart->mutex);
+    while (n < length)
+    {
+        if (uart->count == 0)
+        {
+            if (ticks_to_wait == 0 || (until != NULL
+                && pthread_cond_timedwait(&uart->received, &uart->mutex, until) == ETIMEDOUT))
+            {
+                break;
+            }
+            if (until == NULL)
+            {
+                pthread_cond_wait(&uart->received, &uart->mutex);
+            }
+            continue;
+        }
+        dst[n++] = uart->ring[uart->head];
+        uart->head = (uart->head + 1) % uart->size;
+        --uart->count;
+    }
+    pthread_mutex_unlock(&uart->mutex);
+    return (int)n;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void * src, size_t size)
+{
+    struct host_uart * uart = _uart(uart_num);
+    if (uart == NULL)
+    {
+        return -1;
+    }
+    const uint8_t * p = src;
+    for (size_t left = size; left > 0; )
+    {
+        ssize_t n = write(uart->master, p, left);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        p += n;
+        left -= n;
+    }
+    return (int)size;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart_num)
+{
+    struct host_uart * uart = _uart(uart_num);
+    if (uart == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&uart->mutex);
+    uart->head = 0;
+    uart->count = 0;
+    pthread_mutex_unlock(&uart->mutex);
+    return ESP_OK;
+}
+
+const char * host_uart_path(uart_port_t uart_num)
+{
+    struct host_uart * uart = _uart(uart_num);
+    return uart != NULL ? uart->path : NULL;
+}
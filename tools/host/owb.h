@@ -0,0 +1,106 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host stand-in for the esp32-owb component: the types the firmware uses, and byte-level
+// transactions dispatched to the bus driver, see host.c.
+
+#ifndef HOST_OWB_H
+#define HOST_OWB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OWB_ROM_SEARCH              (0xF0)
+#define OWB_ROM_READ                (0x33)
+#define OWB_ROM_MATCH               (0x55)
+#define OWB_ROM_SKIP                (0xCC)
+#define OWB_ROM_CODE_STRING_LENGTH  (17)
+
+typedef enum
+{
+    OWB_STATUS_NOT_SET = -1,
+    OWB_STATUS_OK = 0,
+    OWB_STATUS_NOT_INITIALIZED,
+    OWB_STATUS_PARAMETER_NULL,
+    OWB_STATUS_DEVICE_NOT_RESPONDING,
+    OWB_STATUS_CRC_FAILED,
+    OWB_STATUS_TOO_MANY_BITS,
+    OWB_STATUS_HW_ERROR,
+} owb_status;
+
+struct owb_driver;
+
+typedef struct
+{
+    const void * timing;
+    bool use_crc;
+    bool use_parasitic_power;
+    int strong_pullup_gpio;
+    const struct owb_driver * driver;
+} OneWireBus;
+
+typedef union
+{
+    struct fields
+    {
+        uint8_t family[1];
+        uint8_t serial_number[6];
+        uint8_t crc[1];
+    } fields;
+    uint8_t bytes[8];
+} OneWireBus_ROMCode;
+
+typedef struct
+{
+    OneWireBus_ROMCode rom_code;
+    int last_discrepancy;
+    int last_family_discrepancy;
+    int last_device_flag;
+} OneWireBus_SearchState;
+
+struct owb_driver
+{
+    const char * name;
+    owb_status (*uninitialize)(const OneWireBus * bus);
+    owb_status (*reset)(const OneWireBus * bus, bool * is_present);
+    owb_status (*write_bits)(const OneWireBus * bus, uint8_t out, int number_of_bits_to_write);
+    owb_status (*read_bits)(const OneWireBus * bus, uint8_t * in, int number_of_bits_to_read);
+};
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+owb_status owb_use_crc(OneWireBus * bus, bool use_crc);
+owb_status owb_reset(const OneWireBus * bus, bool * is_present);
+owb_status owb_read_byte(const OneWireBus * bus, uint8_t * out);
+owb_status owb_read_bytes(const OneWireBus * bus, uint8_t * buffer, unsigned int len);
+owb_status owb_write_byte(const OneWireBus * bus, uint8_t data);
+owb_status owb_write_bytes(const OneWireBus * bus, const uint8_t * buffer, int len);
+owb_status owb_write_rom_code(const OneWireBus * bus, OneWireBus_ROMCode rom_code);
+owb_status owb_search_first(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device);
+owb_status owb_search_next(const OneWireBus * bus, OneWireBus_SearchState * state, bool * found_device);
+uint8_t owb_crc8_bytes(uint8_t crc, const uint8_t * data, size_t len);
+char * owb_string_from_rom_code(OneWireBus_ROMCode rom_code, char * buffer, size_t len);
+
+#endif  // HOST_OWB_H
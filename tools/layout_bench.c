@@ -0,0 +1,430 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host benchmark of the per-device data layout in main/sensors.h.
+//
+// Times the three passes made over every device each cycle: storing a read result, capturing
+// and processing the cycle's frames into calibrated values and a summary, and taking the
+// snapshot that outputs read. The firmware's layout, dense per-device arrays of hot fields
+// with the rest in cold records, is driven through main/sensors.c. It is compared with the
+// same passes over an array of one record per device holding every field, as the state was
+// kept before the split. Each pass is timed with the data in cache, and after evicting it,
+// which is closer to a target where the state sits in PSRAM behind a small cache.
+//
+// Build and run on the host:
+//
+//     $ cc -O2 -I tools/host -I main -o layout_bench tools/layout_bench.c main/sensors.c tools/host/host.c -lpthread -lm
+//     $ ./layout_bench [num_devices] [num_cycles]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sensors.h"
+
+#define NUM_BUSES        (4)
+#define EVICT_SIZE       (64 * 1024 * 1024)    // larger than any last-level cache
+
+enum { PASS_READ, PASS_PROCESS, PASS_SNAPSHOT, NUM_PASSES };
+static const char * pass_names[NUM_PASSES] = { "read", "process", "snapshot" };
+
+// Every per-device field of sensors_t in a single record
+typedef struct
+{
+    DS18B20_Info * info;
+    OneWireBus_ROMCode rom_code;
+    char rom_code_s[OWB_ROM_CODE_STRING_LENGTH];
+    char name[SENSORS_NAME_LENGTH];
+    DS18B20_RESOLUTION resolution;
+    uint16_t logical_id;
+    uint32_t errors_count;
+    uint32_t samples_lost;
+    uint16_t faults[SENSORS_FAULT_COUNT];
+    uint8_t bus;
+    int16_t raw;
+    int8_t status;
+    int64_t timestamp;
+    uint32_t sequence;
+    int16_t calibration;
+    int16_t value;
+    int8_t value_status;
+    int64_t value_time;
+    uint32_t value_cycle;
+    uint32_t value_sequence;
+    uint8_t divisor;
+    uint8_t target_divisor;
+} record_t;
+
+typedef struct
+{
+    int num_devices;
+    record_t device[SENSORS_MAX_DEVICES];
+    uint32_t bus_faults[SENSORS_MAX_BUSES][SENSORS_FAULT_COUNT];
+} records_t;
+
+static uint8_t * evict_buffer;
+static volatile uint8_t evict_sink;
+
+static int64_t _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _evict(void)
+{
+    uint8_t sum = 0;
+    for (size_t i = 0; i < EVICT_SIZE; i += 64)
+    {
+        evict_buffer[i] += 1;
+        sum += evict_buffer[i];
+    }
+    evict_sink = sum;
+}
+
+// The result of reading a device in a cycle: mostly good, with an occasional CRC error
+static void _result(int index, uint32_t cycle, int16_t * raw, int * status)
+{
+    *raw = (int16_t)(20 * 16 + (int)((index * 7 + cycle) % 64));
+    *status = (index * 31 + cycle) % 97 == 0 ? DS18B20_ERROR_CRC : DS18B20_OK;
+}
+
+// Firmware layout, through main/sensors.c
+
+static void _sensors_init(sensors_t * sensors, int num_devices)
+{
+    sensors->num_devices = num_devices;
+    sensors->num_buses = NUM_BUSES;
+    for (int i = 0; i < num_devices; ++i)
+    {
+        sensors->bus[i] = (uint8_t)(i * NUM_BUSES / num_devices);
+        sensors->divisor[i] = 1;
+        sensors->target_divisor[i] = 1;
+        sensors->calibration[i] = (int16_t)(i % 5 - 2);
+        sensors->cold[i].logical_id = SENSORS_NO_LOGICAL_ID;
+        snprintf(sensors->cold[i].name, sizeof(sensors->cold[i].name), "device %d", i);
+    }
+}
+
+// As sensors_read_device() stores a result, without the bus transfer
+static void _sensors_read(sensors_t * sensors, uint32_t cycle)
+{
+    for (int i = 0; i < sensors->num_devices; ++i)
+    {
+        int16_t raw;
+        int error;
+        evict_sink = sensors->cold[i].info != NULL;    // the driver instance the read goes through
+        _result(i, cycle, &raw, &error);
+        portENTER_CRITICAL(&sensors->lock);
+        sensors->timestamp[i] = (int64_t)cycle * 1000000 + i;
+        sensors->status[i] = (int8_t)error;
+        sensors->sequence[i] += 1;
+        if (error == DS18B20_OK)
+        {
+            sensors->raw[i] = raw;
+        }
+        portEXIT_CRITICAL(&sensors->lock);
+    }
+}
+
+static void _sensors_process(sensors_t * sensors, uint32_t cycle, sensors_summary_t * summary)
+{
+    static sensors_frame_t frame;
+    sensors_summary_init(summary);
+    for (int bus = 0; bus < sensors->num_buses; ++bus)
+    {
+        int start = 0;
+        while (start >= 0)
+        {
+            start = sensors_capture_frame(sensors, bus, start, cycle, &frame);
+            sensors_process_frame(sensors, &frame, summary);
+        }
+    }
+}
+
+// Record per device layout, the same passes
+
+static void _records_init(records_t * records, int num_devices)
+{
+    records->num_devices = num_devices;
+    for (int i = 0; i < num_devices; ++i)
+    {
+        record_t * device = &records->device[i];
+        device->bus = (uint8_t)(i * NUM_BUSES / num_devices);
+        device->divisor = 1;
+        device->target_divisor = 1;
+        device->calibration = (int16_t)(i % 5 - 2);
+        device->logical_id = SENSORS_NO_LOGICAL_ID;
+        snprintf(device->name, sizeof(device->name), "device %d", i);
+    }
+}
+
+static void _records_read(records_t * records, portMUX_TYPE * lock, uint32_t cycle)
+{
+    for (int i = 0; i < records->num_devices; ++i)
+    {
+        record_t * device = &records->device[i];
+        int16_t raw;
+        int error;
+        evict_sink = device->info != NULL;
+        _result(i, cycle, &raw, &error);
+        portENTER_CRITICAL(lock);
+        device->timestamp = (int64_t)cycle * 1000000 + i;
+        device->status = (int8_t)error;
+        device->sequence += 1;
+        if (error == DS18B20_OK)
+        {
+            device->raw = raw;
+        }
+        portEXIT_CRITICAL(lock);
+    }
+}
+
+static int _records_capture(const records_t * records, int bus, int start, uint32_t cycle, sensors_frame_t * frame)
+{
+    frame->cycle = cycle;
+    frame->bus = (uint8_t)bus;
+    frame->count = 0;
+
+    int i = start;
+    for (; i < records->num_devices && frame->count < SENSORS_FRAME_DEVICES; ++i)
+    {
+        const record_t * device = &records->device[i];
+        if (device->bus == bus && ((cycle + (uint32_t)i) & (device->divisor - 1u)) == 0)
+        {
+            int n = frame->count++;
+            frame->index[n] = (uint16_t)i;
+            frame->raw[n] = device->raw;
+            frame->status[n] = device->status;
+            frame->timestamp[n] = device->timestamp;
+            frame->sequence[n] = device->sequence;
+        }
+    }
+    for (; i < records->num_devices; ++i)
+    {
+        const record_t * device = &records->device[i];
+        if (device->bus == bus && ((cycle + (uint32_t)i) & (device->divisor - 1u)) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void _records_process_frame(records_t * records, portMUX_TYPE * lock, const sensors_frame_t * frame, sensors_summary_t * summary)
+{
+    for (int n = 0; n < frame->count; ++n)
+    {
+        record_t * device = &records->device[frame->index[n]];
+        uint32_t gap = frame->sequence[n] - device->value_sequence;
+        if ((int32_t)gap <= 0)
+        {
+            continue;
+        }
+        if (gap > 1)
+        {
+            device->samples_lost += gap - 1;
+        }
+        device->value_sequence = frame->sequence[n];
+        device->value_status = frame->status[n];
+        device->value_time = frame->timestamp[n];
+        device->value_cycle = frame->cycle;
+
+        if (frame->status[n] != DS18B20_OK)
+        {
+            sensors_fault_t fault = sensors_classify(frame->status[n]);
+            portENTER_CRITICAL(lock);
+            if (device->faults[fault] < UINT16_MAX)
+            {
+                ++device->faults[fault];
+            }
+            ++records->bus_faults[frame->bus][fault];
+            portEXIT_CRITICAL(lock);
+            ++device->errors_count;
+            ++summary->num_errors;
+            continue;
+        }
+
+        int16_t value = frame->raw[n] + device->calibration;
+        device->value = value;
+        ++summary->num_ok;
+        if (value < summary->min_raw)
+        {
+            summary->min_raw = value;
+        }
+        if (value > summary->max_raw)
+        {
+            summary->max_raw = value;
+        }
+    }
+}
+
+static void _records_process(records_t * records, portMUX_TYPE * lock, uint32_t cycle, sensors_summary_t * summary)
+{
+    static sensors_frame_t frame;
+    sensors_summary_init(summary);
+    for (int bus = 0; bus < NUM_BUSES; ++bus)
+    {
+        int start = 0;
+        while (start >= 0)
+        {
+            start = _records_capture(records, bus, start, cycle, &frame);
+            _records_process_frame(records, lock, &frame, summary);
+        }
+    }
+}
+
+static void _records_snapshot(const records_t * records, uint32_t cycle, sensors_snapshot_t * snapshot)
+{
+    snapshot->cycle = cycle;
+    snapshot->num_devices = records->num_devices;
+    for (int i = 0; i < records->num_devices; ++i)
+    {
+        const record_t * device = &records->device[i];
+        snapshot->value[i] = device->value;
+        snapshot->status[i] = device->value_status;
+        snapshot->timestamp[i] = device->value_time;
+        snapshot->sequence[i] = device->value_sequence;
+        snapshot->fresh[i] = device->value_cycle == cycle;
+    }
+}
+
+// Run both layouts for the given number of cycles, accumulating nanoseconds per pass
+static void _run(sensors_t * sensors, records_t * records, int num_cycles, bool evict,
+                 int64_t split_ns[NUM_PASSES], int64_t records_ns[NUM_PASSES])
+{
+    static sensors_snapshot_t snapshot;
+    static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    sensors_summary_t split_summary;
+    sensors_summary_t records_summary;
+
+    for (int c = 1; c <= num_cycles; ++c)
+    {
+        uint32_t cycle = (uint32_t)c;
+        int64_t t[NUM_PASSES + 1];
+
+        if (evict) _evict();
+        t[0] = _now_ns();
+        _sensors_read(sensors, cycle);
+        if (evict) { split_ns[PASS_READ] += _now_ns() - t[0]; _evict(); }
+        t[1] = _now_ns();
+        _sensors_process(sensors, cycle, &split_summary);
+        if (evict) { split_ns[PASS_PROCESS] += _now_ns() - t[1]; _evict(); }
+        t[2] = _now_ns();
+        sensors_snapshot(sensors, cycle, &snapshot);
+        t[3] = _now_ns();
+        split_ns[PASS_SNAPSHOT] += t[3] - t[2];
+        if (!evict)
+        {
+            split_ns[PASS_READ] += t[1] - t[0];
+            split_ns[PASS_PROCESS] += t[2] - t[1];
+        }
+
+        if (evict) _evict();
+        t[0] = _now_ns();
+        _records_read(records, &lock, cycle);
+        if (evict) { records_ns[PASS_READ] += _now_ns() - t[0]; _evict(); }
+        t[1] = _now_ns();
+        _records_process(records, &lock, cycle, &records_summary);
+        if (evict) { records_ns[PASS_PROCESS] += _now_ns() - t[1]; _evict(); }
+        t[2] = _now_ns();
+        _records_snapshot(records, cycle, &snapshot);
+        t[3] = _now_ns();
+        records_ns[PASS_SNAPSHOT] += t[3] - t[2];
+        if (!evict)
+        {
+            records_ns[PASS_READ] += t[1] - t[0];
+            records_ns[PASS_PROCESS] += t[2] - t[1];
+        }
+
+        if (memcmp(&split_summary, &records_summary, sizeof(split_summary)) != 0)
+        {
+            fprintf(stderr, "cycle %u: summaries differ\n", (unsigned int)cycle);
+            exit(1);
+        }
+    }
+}
+
+static void _report(const char * title, int num_devices, int num_cycles,
+                    const int64_t split_ns[NUM_PASSES], const int64_t records_ns[NUM_PASSES])
+{
+    printf("%s, ns per device:\n", title);
+    printf("  %-10s %10s %10s %8s\n", "pass", "split", "records", "ratio");
+    double split_total = 0.0;
+    double records_total = 0.0;
+    for (int p = 0; p < NUM_PASSES; ++p)
+    {
+        double split = (double)split_ns[p] / num_cycles / num_devices;
+        double records = (double)records_ns[p] / num_cycles / num_devices;
+        split_total += split;
+        records_total += records;
+        printf("  %-10s %10.2f %10.2f %8.2f\n", pass_names[p], split, records, records / split);
+    }
+    printf("  %-10s %10.2f %10.2f %8.2f\n", "total", split_total, records_total, records_total / split_total);
+}
+
+int main(int argc, char * argv[])
+{
+    int num_devices = argc > 1 ? atoi(argv[1]) : SENSORS_MAX_DEVICES;
+    int num_cycles = argc > 2 ? atoi(argv[2]) : 2000;
+    if (num_devices < NUM_BUSES || num_devices > SENSORS_MAX_DEVICES || num_cycles < 1)
+    {
+        fprintf(stderr, "usage: %s [num_devices %d-%d] [num_cycles]\n", argv[0], NUM_BUSES, SENSORS_MAX_DEVICES);
+        return 2;
+    }
+
+    sensors_t * sensors = sensors_malloc();
+    records_t * records = calloc(1, sizeof(*records));
+    evict_buffer = calloc(1, EVICT_SIZE);
+    if (sensors == NULL || records == NULL || evict_buffer == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    _sensors_init(sensors, num_devices);
+    _records_init(records, num_devices);
+
+    printf("%d devices on %d buses, record %zu bytes, split hot %zu + cold %zu bytes per device\n",
+           num_devices, NUM_BUSES, sizeof(record_t),
+           (sizeof(*sensors) - sizeof(sensors->cold) - sizeof(sensors->by_logical_id)) / SENSORS_MAX_DEVICES,
+           sizeof(sensor_cold_t));
+
+    int64_t split_ns[NUM_PASSES] = { 0 };
+    int64_t records_ns[NUM_PASSES] = { 0 };
+    _run(sensors, records, num_cycles, false, split_ns, records_ns);
+    _report("in cache", num_devices, num_cycles, split_ns, records_ns);
+
+    int evicted_cycles = num_cycles / 10 > 0 ? num_cycles / 10 : 1;
+    memset(split_ns, 0, sizeof(split_ns));
+    memset(records_ns, 0, sizeof(records_ns));
+    _run(sensors, records, evicted_cycles, true, split_ns, records_ns);
+    _report("evicted before each pass", num_devices, evicted_cycles, split_ns, records_ns);
+
+    sensors_free(&sensors);
+    free(records);
+    free(evict_buffer);
+    return 0;
+}
@@ -0,0 +1,539 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host test and benchmark of the Modbus server (main/modbus.c).
+//
+// The register map is filled from a snapshot of devices, some with logical IDs, and the TCP
+// server is started on a loopback port. Clients connect over TCP as a SCADA system would and
+// check the header, both device ranges, zones, exceptions, frames split across and combined
+// within TCP segments, and the client limit. The RTU server is run on a pseudo-terminal
+// standing in for its UART, and is sent frames split by short pauses, frames separated by the
+// inter-frame silence, corrupt and foreign frames, and an over-long frame.
+//
+// The benchmark measures requests per second over loopback for several concurrent clients,
+// each reading the largest block of registers a request allows, and the cost of answering a
+// request without the transport.
+//
+// Build and run on the host:
+//
+//     $ cc -O2 -I tools/host -I main -o modbus_test tools/modbus_test.c main/modbus.c main/sensors.c tools/host/host.c -lpthread -lm
+//     $ ./modbus_test [num_devices] [tcp_port]
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+
+#include "driver/uart.h"
+#include "lwip/sockets.h"
+
+#include "modbus.h"
+
+#define RTU_UART         (1)
+#define RTU_ADDRESS      (17)
+#define RTU_BAUD_RATE    (9600)
+#define CHARACTER_US     (10 * 1000000 / RTU_BAUD_RATE)
+#define MAX_CLIENTS      (4)          // TCP_MAX_CLIENTS in modbus.c
+#define REPLY_MS         (500)        // longest wait for a response
+
+#define CHECK(condition, ...)                                                   \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                         \
+            printf(__VA_ARGS__);                                                \
+            printf("\n");                                                       \
+            ++failures;                                                         \
+        }                                                                       \
+    } while (0)
+
+static int failures;
+static uint16_t tcp_port;
+
+static double _now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint16_t _get_u16(const uint8_t * src)
+{
+    return (src[0] << 8) | src[1];
+}
+
+// Register map contents, as the test expects them
+
+static sensors_t * sensors;
+static sensors_snapshot_t snapshot;
+
+static int16_t _value(int i)
+{
+    return (int16_t)(i * 7 - 200);
+}
+
+// Devices 0 and 2 have logical IDs 1 and 0, which are also the indexes of other devices;
+// device 3 has logical ID 300. The others have none.
+static void _fill(modbus_t * modbus, int num_devices)
+{
+    sensors = sensors_malloc();
+    sensors->num_devices = num_devices;
+    for (int i = 0; i < num_devices; ++i)
+    {
+        sensors->cold[i].logical_id = SENSORS_NO_LOGICAL_ID;
+    }
+    sensors_set_logical_id(sensors, 0, 1);
+    sensors_set_logical_id(sensors, 2, 0);
+    sensors_set_logical_id(sensors, 3, 300);
+
+    snapshot.cycle = 0x12345;
+    snapshot.num_devices = num_devices;
+    for (int i = 0; i < num_devices; ++i)
+    {
+        snapshot.value[i] = _value(i);
+        snapshot.status[i] = i % 5 == 4 ? SENSORS_ERROR_NO_PRESENCE : DS18B20_OK;
+        snapshot.sequence[i] = 0x10000u * i + 3;
+    }
+    sensors_summary_t summary = { .num_ok = num_devices - num_devices / 5, .num_errors = num_devices / 5,
+                                  .min_raw = -200, .max_raw = _value(num_devices - 1) };
+    modbus_update(modbus, sensors, &snapshot, &summary);
+
+    zone_result_t zones[2] = {
+        { .count = 3, .mean = 320, .min = 300, .max = 350, .spread = 50 },
+        { .count = 1, .mean = -16, .min = -16, .max = -16, .spread = 0 },
+    };
+    modbus_update_zones(modbus, zones, 2);
+}
+
+// Check a device block read from the map against the device expected there, or zero
+static void _check_block(const uint8_t * reg, int device, const char * where)
+{
+    int16_t value = device >= 0 ? _value(device) : 0;
+    int16_t status = device >= 0 ? snapshot.status[device] : 0;
+    uint32_t sequence = device >= 0 ? snapshot.sequence[device] : 0;
+    CHECK((int16_t)_get_u16(&reg[0]) == value && (int16_t)_get_u16(&reg[2]) == status
+          && ((uint32_t)_get_u16(&reg[4]) << 16 | _get_u16(&reg[6])) == sequence,
+          "%s: block %d/%d/%u, expected device %d", where, (int16_t)_get_u16(&reg[0]), (int16_t)_get_u16(&reg[2]),
+          (unsigned int)((uint32_t)_get_u16(&reg[4]) << 16 | _get_u16(&reg[6])), device);
+}
+
+// Modbus TCP client
+
+static int _connect(void)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(tcp_port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    for (int attempt = 0; attempt < 100; ++attempt)
+    {
+        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            int nodelay = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            return sock;
+        }
+        usleep(10000);    // the server task may not be listening yet
+    }
+    close(sock);
+    return -1;
+}
+
+static size_t _tcp_request(uint8_t * frame, uint16_t transaction, uint8_t function, uint16_t start, uint16_t quantity)
+{
+    uint8_t request[12] = { transaction >> 8, transaction & 0xff, 0, 0, 0, 6, 1, function,
+                            start >> 8, start & 0xff, quantity >> 8, quantity & 0xff };
+    memcpy(frame, request, sizeof(request));
+    return sizeof(request);
+}
+
+// Read exactly len bytes, waiting at most REPLY_MS for each. Returns false on timeout or close.
+static bool _read_all(int fd, uint8_t * buffer, size_t len)
+{
+    while (len > 0)
+    {
+        struct pollfd p = { .fd = fd, .events = POLLIN };
+        if (poll(&p, 1, REPLY_MS) != 1)
+        {
+            return false;
+        }
+        ssize_t n = read(fd, buffer, len);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Read one response, checking its header. Returns the PDU length, or -1 if none arrived.
+static int _tcp_response(int sock, uint16_t transaction, uint8_t * pdu)
+{
+    uint8_t header[7];
+    if (!_read_all(sock, header, sizeof(header)))
+    {
+        return -1;
+    }
+    uint16_t length = _get_u16(&header[4]);
+    if (_get_u16(&header[0]) != transaction || _get_u16(&header[2]) != 0 || header[6] != 1
+        || length < 2 || length > MODBUS_MAX_PDU + 1 || !_read_all(sock, pdu, length - 1))
+    {
+        return -1;
+    }
+    return length - 1;
+}
+
+// Read registers over TCP. Returns the PDU length of the response, or -1.
+static int _tcp_read(int sock, uint16_t transaction, uint8_t function, uint16_t start, uint16_t quantity, uint8_t * pdu)
+{
+    uint8_t frame[12];
+    size_t len = _tcp_request(frame, transaction, function, start, quantity);
+    if (write(sock, frame, len) != (ssize_t)len)
+    {
+        return -1;
+    }
+    return _tcp_response(sock, transaction, pdu);
+}
+
+// Read a device block through a read of the registers around it
+static void _tcp_block(int sock, int base, int block, uint8_t * reg)
+{
+    uint8_t pdu[MODBUS_MAX_PDU];
+    int n = _tcp_read(sock, 99, 0x04, base + block * MODBUS_DEVICE_REGISTERS, MODBUS_DEVICE_REGISTERS, pdu);
+    CHECK(n == 2 + MODBUS_DEVICE_REGISTERS * 2 && pdu[0] == 0x04, "block %d at %d: response of %d bytes", block, base, n);
+    memcpy(reg, &pdu[2], MODBUS_DEVICE_REGISTERS * 2);
+}
+
+static void _test_tcp(int num_devices)
+{
+    int sock = _connect();
+    CHECK(sock >= 0, "cannot connect to port %u", tcp_port);
+    if (sock < 0)
+    {
+        return;
+    }
+
+    // header
+    uint8_t pdu[MODBUS_MAX_PDU];
+    int n = _tcp_read(sock, 1, 0x03, 0, MODBUS_HEADER_REGISTERS, pdu);
+    CHECK(n == 2 + MODBUS_HEADER_REGISTERS * 2 && pdu[0] == 0x03 && pdu[1] == MODBUS_HEADER_REGISTERS * 2,
+          "header: response of %d bytes", n);
+    CHECK(_get_u16(&pdu[2]) == 0x1 && _get_u16(&pdu[4]) == 0x2345 && _get_u16(&pdu[6]) == num_devices,
+          "header: cycle %04x%04x, %d devices", _get_u16(&pdu[2]), _get_u16(&pdu[4]), _get_u16(&pdu[6]));
+    CHECK((int16_t)_get_u16(&pdu[12]) == -200, "header: minimum %d", (int16_t)_get_u16(&pdu[12]));
+
+    // every device in the index range, including those whose index is another's logical ID
+    uint8_t reg[MODBUS_DEVICE_REGISTERS * 2];
+    for (int i = 0; i < num_devices; ++i)
+    {
+        _tcp_block(sock, MODBUS_HEADER_REGISTERS, i, reg);
+        _check_block(reg, i, "index range");
+    }
+
+    // devices with logical IDs at their IDs, and nothing at IDs no device has
+    static const int ids[][2] = { { 0, 2 }, { 1, 0 }, { 2, -1 }, { 300, 3 }, { SENSORS_MAX_DEVICES - 1, -1 } };
+    for (size_t k = 0; k < sizeof(ids) / sizeof(ids[0]); ++k)
+    {
+        _tcp_block(sock, MODBUS_LOGICAL_BASE, ids[k][0], reg);
+        _check_block(reg, ids[k][1], "logical range");
+    }
+
+    // zones
+    n = _tcp_read(sock, 2, 0x03, MODBUS_ZONE_BASE, 2 * MODBUS_ZONE_REGISTERS, pdu);
+    CHECK(n == 2 + 4 * MODBUS_ZONE_REGISTERS && _get_u16(&pdu[2]) == 320 && _get_u16(&pdu[10]) == 3
+          && (int16_t)_get_u16(&pdu[12]) == -16 && _get_u16(&pdu[20]) == 1, "zones: response of %d bytes", n);
+
+    // exceptions
+    n = _tcp_read(sock, 3, 0x06, 0, 1, pdu);
+    CHECK(n == 2 && pdu[0] == 0x86 && pdu[1] == 0x01, "write function: %d bytes, %02x %02x", n, pdu[0], pdu[1]);
+    n = _tcp_read(sock, 4, 0x03, MODBUS_NUM_REGISTERS - 1, 2, pdu);
+    CHECK(n == 2 && pdu[0] == 0x83 && pdu[1] == 0x02, "read past the end: %d bytes, %02x %02x", n, pdu[0], pdu[1]);
+    n = _tcp_read(sock, 5, 0x04, 0, 126, pdu);
+    CHECK(n == 2 && pdu[0] == 0x84 && pdu[1] == 0x03, "126 registers: %d bytes, %02x %02x", n, pdu[0], pdu[1]);
+    n = _tcp_read(sock, 6, 0x04, 0, 0, pdu);
+    CHECK(n == 2 && pdu[0] == 0x84 && pdu[1] == 0x03, "0 registers: %d bytes, %02x %02x", n, pdu[0], pdu[1]);
+
+    // a request split across segments, and two requests in one segment
+    uint8_t frames[24];
+    _tcp_request(frames, 7, 0x03, 0, 1);
+    CHECK(write(sock, frames, 5) == 5, "write");
+    usleep(20000);
+    CHECK(write(sock, &frames[5], 7) == 7, "write");
+    n = _tcp_response(sock, 7, pdu);
+    CHECK(n == 4, "split request: response of %d bytes", n);
+    _tcp_request(frames, 8, 0x03, 0, 1);
+    _tcp_request(&frames[12], 9, 0x03, 2, 1);
+    CHECK(write(sock, frames, 24) == 24, "write");
+    n = _tcp_response(sock, 8, pdu);
+    int m = _tcp_response(sock, 9, pdu);
+    CHECK(n == 4 && m == 4 && _get_u16(&pdu[2]) == num_devices, "combined requests: responses of %d and %d bytes", n, m);
+
+    // the server holds a limited number of clients, and closes any more
+    int others[MAX_CLIENTS];
+    for (int c = 0; c < MAX_CLIENTS; ++c)
+    {
+        others[c] = _connect();
+    }
+    usleep(50000);
+    uint8_t byte;
+    CHECK(_read_all(others[MAX_CLIENTS - 1], &byte, 1) == false, "client beyond the limit was served");
+    for (int c = 0; c < MAX_CLIENTS; ++c)
+    {
+        close(others[c]);
+    }
+    usleep(50000);
+
+    // a malformed header closes the connection
+    uint8_t bad[12];
+    _tcp_request(bad, 10, 0x03, 0, 1);
+    bad[2] = 1;    // protocol identifier other than Modbus
+    CHECK(write(sock, bad, sizeof(bad)) == sizeof(bad), "write");
+    CHECK(_tcp_response(sock, 10, pdu) < 0, "response to a frame with protocol identifier 1");
+    close(sock);
+}
+
+// Modbus RTU client, on the other side of the pty
+
+static uint16_t _crc16(const uint8_t * data, size_t len)
+{
+    uint16_t crc = 0xffff;
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static size_t _rtu_request(uint8_t * frame, uint8_t address, uint16_t start, uint16_t quantity)
+{
+    uint8_t request[6] = { address, 0x03, start >> 8, start & 0xff, quantity >> 8, quantity & 0xff };
+    memcpy(frame, request, sizeof(request));
+    uint16_t crc = _crc16(frame, 6);
+    frame[6] = crc & 0xff;
+    frame[7] = crc >> 8;
+    return 8;
+}
+
+// Read one response. Returns its length with a good CRC, or -1 if none arrived.
+static int _rtu_response(int fd, uint8_t * frame, uint16_t quantity)
+{
+    size_t len = 5 + quantity * 2;
+    if (!_read_all(fd, frame, 3))
+    {
+        return -1;
+    }
+    if (frame[1] & 0x80)
+    {
+        len = 5;
+    }
+    if (!_read_all(fd, &frame[3], len - 3) || _crc16(frame, len) != 0)
+    {
+        return -1;
+    }
+    return (int)len;
+}
+
+// True if nothing more arrives within the reply time
+static bool _rtu_silent(int fd)
+{
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    return poll(&p, 1, REPLY_MS / 2) == 0;
+}
+
+static void _test_rtu(int num_devices)
+{
+    const char * path = host_uart_path(RTU_UART);
+    for (int attempt = 0; attempt < 100 && path == NULL; ++attempt)
+    {
+        usleep(10000);    // the server task installs the driver
+        path = host_uart_path(RTU_UART);
+    }
+    int fd = path != NULL ? open(path, O_RDWR | O_NOCTTY) : -1;
+    CHECK(fd >= 0, "cannot open the RTU pty");
+    if (fd < 0)
+    {
+        return;
+    }
+    usleep(50000);    // until the server is waiting for frames
+
+    // a request whose characters arrive in bursts, less than the silence apart, is one frame
+    uint8_t frame[300];
+    uint8_t response[MODBUS_MAX_PDU + 3];
+    size_t len = _rtu_request(frame, RTU_ADDRESS, 0, 3);
+    for (size_t i = 0; i < len; i += 2)
+    {
+        CHECK(write(fd, &frame[i], 2) == 2, "write");
+        usleep(CHARACTER_US);
+    }
+    int n = _rtu_response(fd, response, 3);
+    CHECK(n == 11 && response[0] == RTU_ADDRESS && _get_u16(&response[7]) == num_devices,
+          "request in bursts: response of %d bytes", n);
+
+    // requests separated by the silence are separate frames, however close
+    for (int gap = 6; gap <= 20; gap += 7)
+    {
+        _rtu_request(frame, RTU_ADDRESS, 0, 1);
+        _rtu_request(&frame[8], RTU_ADDRESS, 2, 1);
+        CHECK(write(fd, frame, 8) == 8, "write");
+        usleep(gap * CHARACTER_US);
+        CHECK(write(fd, &frame[8], 8) == 8, "write");
+        n = _rtu_response(fd, response, 1);
+        int m = _rtu_response(fd, &response[16], 1);
+        CHECK(n == 7 && m == 7 && _get_u16(&response[3]) == 0x1 && _get_u16(&response[19]) == num_devices,
+              "requests %d characters apart: responses of %d and %d bytes", gap, n, m);
+    }
+
+    // a corrupt frame, a frame for another server, and an over-long frame get no response,
+    // and do not disturb the next
+    len = _rtu_request(frame, RTU_ADDRESS, 0, 1);
+    frame[3] ^= 1;
+    CHECK(write(fd, frame, len) == (ssize_t)len, "write");
+    CHECK(_rtu_silent(fd), "response to a corrupt frame");
+    len = _rtu_request(frame, RTU_ADDRESS + 1, 0, 1);
+    CHECK(write(fd, frame, len) == (ssize_t)len, "write");
+    CHECK(_rtu_silent(fd), "response to another server's frame");
+    memset(frame, 0, sizeof(frame));
+    len = _rtu_request(frame, RTU_ADDRESS, 0, 1);
+    uint16_t crc = _crc16(frame, sizeof(frame) - 2);    // a valid CRC over a frame too long to be Modbus
+    frame[sizeof(frame) - 2] = crc & 0xff;
+    frame[sizeof(frame) - 1] = crc >> 8;
+    CHECK(write(fd, frame, sizeof(frame)) == sizeof(frame), "write");
+    CHECK(_rtu_silent(fd), "response to an over-long frame");
+
+    len = _rtu_request(frame, RTU_ADDRESS, MODBUS_NUM_REGISTERS, 1);
+    CHECK(write(fd, frame, len) == (ssize_t)len, "write");
+    n = _rtu_response(fd, response, 1);
+    CHECK(n == 5 && response[1] == 0x83 && response[2] == 0x02, "read past the end: response of %d bytes", n);
+    close(fd);
+}
+
+// Benchmark
+
+typedef struct
+{
+    int requests;
+    int errors;
+} load_t;
+
+static void * _load(void * parameter)
+{
+    load_t * load = parameter;
+    int sock = _connect();
+    uint8_t pdu[MODBUS_MAX_PDU];
+    for (int r = 0; r < load->requests; ++r)
+    {
+        uint16_t start = (uint16_t)((r * 37) % (MODBUS_NUM_REGISTERS - 125));
+        if (sock < 0 || _tcp_read(sock, (uint16_t)r, 0x03, start, 125, pdu) != 252)
+        {
+            ++load->errors;
+        }
+    }
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    return NULL;
+}
+
+static void _benchmark(modbus_t * modbus)
+{
+    printf("Modbus TCP over loopback, reads of 125 registers:\n");
+    printf("  %7s %9s %12s %10s\n", "clients", "requests", "requests/s", "us each");
+    for (int clients = 1; clients <= MAX_CLIENTS; clients *= 2)
+    {
+        pthread_t threads[MAX_CLIENTS];
+        load_t loads[MAX_CLIENTS];
+        double start = _now();
+        for (int c = 0; c < clients; ++c)
+        {
+            loads[c] = (load_t){ .requests = 20000 / clients };
+            pthread_create(&threads[c], NULL, _load, &loads[c]);
+        }
+        int total = 0;
+        for (int c = 0; c < clients; ++c)
+        {
+            pthread_join(threads[c], NULL);
+            CHECK(loads[c].errors == 0, "%d clients: %d failed requests", clients, loads[c].errors);
+            total += loads[c].requests;
+        }
+        double elapsed = _now() - start;
+        printf("  %7d %9d %12.0f %10.1f\n", clients, total, total / elapsed, elapsed * 1e6 / total * clients);
+        usleep(50000);    // the server notices the closed connections
+    }
+
+    // the server's own cost, without the transport
+    uint8_t request[5] = { 0x03, 0, 0, 0, 125 };
+    uint8_t response[MODBUS_MAX_PDU];
+    int count = 1000000;
+    double start = _now();
+    for (int r = 0; r < count; ++r)
+    {
+        request[2] = r & 0xff;
+        modbus_handle_pdu(modbus, request, sizeof(request), response);
+    }
+    printf("  modbus_handle_pdu, 125 registers: %.0f ns per request\n", (_now() - start) * 1e9 / count);
+}
+
+int main(int argc, char * argv[])
+{
+    int num_devices = argc > 1 ? atoi(argv[1]) : 64;
+    tcp_port = argc > 2 ? (uint16_t)atoi(argv[2]) : 15502;
+    if (num_devices < 4 || num_devices > SENSORS_MAX_DEVICES)
+    {
+        fprintf(stderr, "usage: %s [num_devices 4-%d] [tcp_port]\n", argv[0], SENSORS_MAX_DEVICES);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    modbus_t * modbus = modbus_malloc();
+    _fill(modbus, num_devices);
+    modbus_start_tcp(modbus, tcp_port);
+    modbus_rtu_config_t rtu_config = {
+        .uart_num = RTU_UART,
+        .baud_rate = RTU_BAUD_RATE,
+        .tx_gpio = -1,
+        .rx_gpio = -1,
+        .rts_gpio = -1,
+        .address = RTU_ADDRESS,
+    };
+    modbus_start_rtu(modbus, &rtu_config);
+
+    _test_tcp(num_devices);
+    _test_rtu(num_devices);
+    printf("%s: %d failures\n", failures == 0 ? "tests passed" : "TESTS FAILED", failures);
+
+    _benchmark(modbus);
+    printf("%u requests, %u exceptions\n", (unsigned int)modbus->requests, (unsigned int)modbus->exceptions);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,290 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host test and benchmark of the per-device quantile sketches (main/quantiles.c).
+//
+// A day of readings at one per second is generated for several kinds of device: a room with
+// a daily cycle, a fridge whose door is opened, a probe that sweeps its whole range, and a
+// steady bath with rare outliers. Each day is added to a sketch and the quantiles it reports
+// are compared with the exact quantiles of the same readings, checking that every estimate
+// lies within the error bound the sketch reports. The update cost is then measured for a
+// full set of devices, through quantiles_add_frame() as post-processing calls it.
+//
+// Build and run on the host:
+//
+//     $ cc -O2 -I tools/host -I main -o quantiles_test tools/quantiles_test.c main/quantiles.c main/sensors.c tools/host/host.c -lpthread -lm
+//     $ ./quantiles_test [num_devices] [num_cycles]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "quantiles.h"
+
+#define DAY              (86400)      // readings in a day, one per second
+#define NUM_BUSES        (4)
+
+static const float QUANTILES[] = { 0.0f, 0.01f, 0.05f, 0.25f, 0.5f, 0.75f, 0.95f, 0.99f, 1.0f };
+#define NUM_QUANTILES    ((int)(sizeof(QUANTILES) / sizeof(QUANTILES[0])))
+
+typedef enum { ROOM, FRIDGE, SWEEP, BATH, NUM_KINDS } kind_t;
+static const char * kind_names[NUM_KINDS] = { "room", "fridge", "sweep", "bath" };
+
+static int failures;
+
+// Uniform noise in [-1, 1)
+static float _noise(void)
+{
+    return (float)rand() / ((float)RAND_MAX / 2.0f) - 1.0f;
+}
+
+// A reading in 1/16 degrees C at second t of the day
+static int16_t _reading(kind_t kind, int t)
+{
+    float celsius = 0.0f;
+    switch (kind)
+    {
+    case ROOM:      // 18 to 24 degrees over the day
+        celsius = 21.0f + 3.0f * sinf(2.0f * (float)M_PI * t / DAY) + 0.2f * _noise();
+        break;
+    case FRIDGE:    // 4 degrees, rising towards 12 for a few minutes after each of 20 door openings
+    {
+        int since = t % (DAY / 20);
+        celsius = 4.0f + 0.3f * _noise() + (since < 300 ? 8.0f * expf(-since / 60.0f) : 0.0f);
+        break;
+    }
+    case SWEEP:     // -55 to +125 degrees and back, the whole range of the device
+        celsius = -55.0f + 180.0f * (t < DAY / 2 ? (float)t : (float)(DAY - t)) / (DAY / 2);
+        break;
+    case BATH:      // 37 degrees held closely, with a reading of 85 once an hour
+        celsius = t % 3600 == 1800 ? 85.0f : 37.0f + 0.05f * _noise();
+        break;
+    default:
+        break;
+    }
+    return (int16_t)lroundf(celsius * 16.0f);
+}
+
+static int _compare_int16(const void * a, const void * b)
+{
+    return *(const int16_t *)a - *(const int16_t *)b;
+}
+
+static sensors_t * _devices(int num_devices)
+{
+    sensors_t * sensors = sensors_malloc();
+    sensors->num_devices = num_devices;
+    sensors->num_buses = NUM_BUSES;
+    for (int i = 0; i < num_devices; ++i)
+    {
+        sensors->bus[i] = (uint8_t)(i * NUM_BUSES / num_devices);
+        sensors->divisor[i] = 1;
+        sensors->cold[i].logical_id = SENSORS_NO_LOGICAL_ID;
+    }
+    return sensors;
+}
+
+// Add readings to device 0, one frame per reading
+static void _add(quantiles_t * quantiles, sensors_t * sensors, const int16_t * readings, int count)
+{
+    sensors_frame_t frame = { .count = 1 };
+    for (int t = 0; t < count; ++t)
+    {
+        sensors->value[0] = readings[t];
+        frame.status[0] = DS18B20_OK;
+        quantiles_add_frame(quantiles, sensors, &frame);
+    }
+}
+
+static void _test_accuracy(void)
+{
+    static int16_t readings[DAY];
+    static int16_t sorted[DAY];
+    sensors_t * sensors = _devices(1);
+    srand(1);
+
+    printf("accuracy over a day of %d readings, degrees C:\n", DAY);
+    printf("  %-7s %7s %7s", "device", "count", "bound");
+    for (int k = 0; k < NUM_QUANTILES; ++k)
+    {
+        char label[16];
+        snprintf(label, sizeof(label), "p%g", QUANTILES[k] * 100.0f);
+        printf(" %8s", label);
+    }
+    printf(" %9s\n", "max error");
+
+    for (kind_t kind = 0; kind < NUM_KINDS; ++kind)
+    {
+        for (int t = 0; t < DAY; ++t)
+        {
+            readings[t] = _reading(kind, t);
+        }
+        memcpy(sorted, readings, sizeof(sorted));
+        qsort(sorted, DAY, sizeof(sorted[0]), _compare_int16);
+
+        quantiles_t * quantiles = quantiles_malloc(sensors, 24 * 60);
+        _add(quantiles, sensors, readings, DAY);
+
+        int16_t values[NUM_QUANTILES];
+        int16_t error = 0;
+        uint32_t count = quantiles_query(quantiles, 0, QUANTILES, values, NUM_QUANTILES, &error);
+        if (count != DAY)
+        {
+            printf("FAIL %s: %u readings in sketch, expected %d\n", kind_names[kind], (unsigned int)count, DAY);
+            ++failures;
+        }
+
+        printf("  %-7s %7u %7.4f", kind_names[kind], (unsigned int)count, sensors_raw_to_celsius(error));
+        int worst = 0;
+        for (int k = 0; k < NUM_QUANTILES; ++k)
+        {
+            // the same rank as the sketch: the nearest to q * (count - 1)
+            int16_t exact = sorted[(int)(QUANTILES[k] * (DAY - 1) + 0.5f)];
+            int deviation = abs(values[k] - exact);
+            worst = deviation > worst ? deviation : worst;
+            printf(" %8.3f", sensors_raw_to_celsius(values[k]));
+            if (deviation > error)
+            {
+                printf("\nFAIL %s p%g: %.4f, exact %.4f, bound %.4f\n", kind_names[kind], QUANTILES[k] * 100.0f,
+                       sensors_raw_to_celsius(values[k]), sensors_raw_to_celsius(exact), sensors_raw_to_celsius(error));
+                ++failures;
+            }
+        }
+        printf(" %9.4f\n", sensors_raw_to_celsius(worst));
+        free(quantiles->sketches);
+        free(quantiles);
+    }
+    sensors_free(&sensors);
+}
+
+static void _test_roll(void)
+{
+    // a new window starts empty, and a stale bin layout from the last window is not reused
+    sensors_t * sensors = _devices(1);
+    quantiles_t * quantiles = quantiles_malloc(sensors, 1);
+    int16_t hot[100];
+    int16_t cold[100];
+    for (int t = 0; t < 100; ++t)
+    {
+        hot[t] = (int16_t)(100 * 16 + t);
+        cold[t] = (int16_t)(-20 * 16 - t);
+    }
+    _add(quantiles, sensors, hot, 100);
+    quantiles_roll(quantiles, quantiles->window_start + quantiles->window);
+
+    float median = 0.5f;
+    int16_t value = 0;
+    int16_t error = 0;
+    uint32_t count = quantiles_query(quantiles, 0, &median, &value, 1, &error);
+    if (count != 0)
+    {
+        printf("FAIL roll: %u readings after the window ended\n", (unsigned int)count);
+        ++failures;
+    }
+    // the new window is centred on its first reading, -20 degrees, so the readings below it
+    // collapse the bins once; the hot window's bins would be 64 times as wide
+    _add(quantiles, sensors, cold, 100);
+    count = quantiles_query(quantiles, 0, &median, &value, 1, &error);
+    int16_t exact = cold[49];
+    if (count != 100 || error > 1 || abs(value - exact) > error)
+    {
+        printf("FAIL roll: %u readings, median %d, error %d, expected 100, %d, at most 1\n", (unsigned int)count, value, error, exact);
+        ++failures;
+    }
+    free(quantiles->sketches);
+    free(quantiles);
+    sensors_free(&sensors);
+}
+
+static int64_t _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Time quantiles_add_frame() over full frames of every device, as post-processing calls it
+static void _benchmark(int num_devices, int num_cycles)
+{
+    sensors_t * sensors = _devices(num_devices);
+    quantiles_t * quantiles = quantiles_malloc(sensors, 24 * 60);
+    static sensors_frame_t frames[SENSORS_MAX_DEVICES / SENSORS_FRAME_DEVICES + NUM_BUSES];
+    int num_frames = 0;
+    for (int bus = 0; bus < NUM_BUSES; ++bus)
+    {
+        for (int start = 0; start >= 0; )
+        {
+            start = sensors_capture_frame(sensors, bus, start, 1, &frames[num_frames++]);
+        }
+    }
+    for (int f = 0; f < num_frames; ++f)
+    {
+        for (int n = 0; n < frames[f].count; ++n)
+        {
+            frames[f].status[n] = DS18B20_OK;
+        }
+    }
+
+    // each device follows its own kind, from a different point in the day
+    int64_t elapsed = 0;
+    for (int c = 0; c < num_cycles; ++c)
+    {
+        for (int i = 0; i < num_devices; ++i)
+        {
+            sensors->value[i] = _reading((kind_t)(i % NUM_KINDS), (c + i * 97) % DAY);
+        }
+        int64_t t0 = _now_ns();
+        for (int f = 0; f < num_frames; ++f)
+        {
+            quantiles_add_frame(quantiles, sensors, &frames[f]);
+        }
+        elapsed += _now_ns() - t0;
+    }
+
+    printf("update cost, %d devices in %d frames, %d cycles: %.1f ns per reading, %.1f us per cycle, %u bytes of sketches\n",
+           num_devices, num_frames, num_cycles, (double)elapsed / num_cycles / num_devices,
+           (double)elapsed / num_cycles / 1000.0, (unsigned int)(num_devices * sizeof(quantiles_sketch_t)));
+    free(quantiles->sketches);
+    free(quantiles);
+    sensors_free(&sensors);
+}
+
+int main(int argc, char * argv[])
+{
+    int num_devices = argc > 1 ? atoi(argv[1]) : SENSORS_MAX_DEVICES;
+    int num_cycles = argc > 2 ? atoi(argv[2]) : 3600;
+    if (num_devices < NUM_BUSES || num_devices > SENSORS_MAX_DEVICES || num_cycles < 1)
+    {
+        fprintf(stderr, "usage: %s [num_devices %d-%d] [num_cycles]\n", argv[0], NUM_BUSES, SENSORS_MAX_DEVICES);
+        return 2;
+    }
+
+    _test_accuracy();
+    _test_roll();
+    printf("%s: %d failures\n", failures == 0 ? "tests passed" : "TESTS FAILED", failures);
+    _benchmark(num_devices, num_cycles);
+    return failures == 0 ? 0 : 1;
+}
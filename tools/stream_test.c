@@ -0,0 +1,567 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host test and benchmark of the WebSocket live stream (main/stream.c).
+//
+// The stream is registered on the HTTP server (main/web.c) on a loopback port, and clients
+// connect as browsers would. Each client rebuilds the device table from the frames it
+// receives, and the test checks it against the published snapshot: the first frame is full,
+// later frames carry only changes, a client that connects late starts with a full frame, and a
+// client whose socket descriptor is reused by a new connection is not sent stale deltas.
+// A client that stops reading must skip cycles without delaying other clients or the
+// publisher, and must be brought fully up to date once it reads again.
+//
+// The benchmark streams cycles with a varying fraction of devices changing to several
+// clients, and reports each client's CPU time spent encoding and writing frames, and the
+// bandwidth it uses.
+//
+// Build and run on the host:
+//
+//     $ cc -O2 -I tools/host -I main -o stream_test tools/stream_test.c main/stream.c main/web.c main/sensors.c tools/host/host.c -lpthread -lm
+//     $ ./stream_test [num_devices] [port]
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+
+#include "stream.h"
+#include "web.h"
+
+#define NUM_CLIENTS       (STREAM_MAX_CLIENTS)
+#define LOGICAL_DEVICE    (3)          // the only device with a logical ID
+#define LOGICAL_ID        (SENSORS_MAX_DEVICES - 1)
+#define WAIT_MS           (2000)       // longest wait for frames to arrive
+#define SLOW_RCVBUF       (2048)       // receive buffer of the client that stops reading
+#define FRAME_BUFFER_SIZE (64 + SENSORS_MAX_DEVICES * 24)
+
+#define CHECK(condition, ...)                                                   \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                         \
+            printf(__VA_ARGS__);                                                \
+            printf("\n");                                                       \
+            ++failures;                                                         \
+        }                                                                       \
+    } while (0)
+
+static int failures;
+static uint16_t port;
+static int num_devices;
+static sensors_t * sensors;
+static sensors_snapshot_t snapshot;
+static stream_t * stream;
+static httpd_handle_t server;
+
+static double _now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Publish a cycle in which the given number of devices, spread across the set, change value.
+// Every seventh changed device also changes status. Returns the time stream_publish() took.
+static double _publish(uint32_t cycle, int changes)
+{
+    snapshot.cycle = cycle;
+    for (int k = 0; k < changes; ++k)
+    {
+        int i = (int)(((int64_t)k * num_devices / changes + cycle) % num_devices);
+        snapshot.value[i] = (int16_t)(snapshot.value[i] + 1 + (int)(cycle % 5));
+        if (k % 7 == 0)
+        {
+            snapshot.status[i] = snapshot.status[i] == DS18B20_OK ? SENSORS_ERROR_NO_PRESENCE : DS18B20_OK;
+        }
+    }
+    double start = _now();
+    stream_publish(stream, sensors, &snapshot);
+    return _now() - start;
+}
+
+// WebSocket client, rebuilding the device table from the frames it receives
+
+typedef struct
+{
+    int sock;
+    pthread_t thread;
+    atomic_bool paused;         // stop reading, to apply back-pressure
+    atomic_bool stop;
+    pthread_mutex_t mutex;
+    uint32_t frames;
+    uint32_t full_frames;
+    bool first_full;            // the first frame received was full
+    int last_entries;           // devices in the most recent frame
+    uint32_t last_cycle;
+    uint32_t bad_frames;
+    uint64_t bytes;
+    int16_t value[SENSORS_MAX_DEVICES];
+    int8_t status[SENSORS_MAX_DEVICES];
+    bool known[SENSORS_MAX_DEVICES];
+} client_t;
+
+static client_t clients[NUM_CLIENTS + 1];
+
+static int _device(unsigned int id)
+{
+    return id == LOGICAL_ID ? LOGICAL_DEVICE : id != LOGICAL_DEVICE && id < (unsigned int)num_devices ? (int)id : -1;
+}
+
+// Apply a frame to the client's table. Called with the client's mutex held.
+static bool _apply(client_t * client, char * json)
+{
+    unsigned int cycle;
+    char full[6];
+    char * p = strstr(json, "\"d\":[");
+    if (p == NULL || sscanf(json, "{\"cycle\":%u,\"full\":%5[a-z],", &cycle, full) != 2)
+    {
+        return false;
+    }
+    bool is_full = strcmp(full, "true") == 0;
+    if (client->frames == 0)
+    {
+        client->first_full = is_full;
+    }
+    p += 5;
+    int entries = 0;
+    while (*p == '[')
+    {
+        unsigned int id;
+        int raw, status, n;
+        if (sscanf(p, "[%u,%d,%d]%n", &id, &raw, &status, &n) != 3 || _device(id) < 0)
+        {
+            return false;
+        }
+        int i = _device(id);
+        client->value[i] = (int16_t)raw;
+        client->status[i] = (int8_t)status;
+        client->known[i] = true;
+        ++entries;
+        p += n;
+        if (*p == ',')
+        {
+            ++p;
+        }
+    }
+    ++client->frames;
+    client->full_frames += is_full;
+    client->last_entries = entries;
+    client->last_cycle = cycle;
+    return strcmp(p, "]}") == 0;
+}
+
+static bool _read_exact(client_t * client, uint8_t * buffer, size_t len)
+{
+    while (len > 0)
+    {
+        if (client->stop)
+        {
+            return false;
+        }
+        struct pollfd p = { .fd = client->sock, .events = POLLIN };
+        if (client->paused || poll(&p, 1, 10) != 1)
+        {
+            if (client->paused)
+            {
+                usleep(1000);
+            }
+            continue;
+        }
+        ssize_t n = recv(client->sock, buffer, len, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void * _client_thread(void * parameter)
+{
+    client_t * client = parameter;
+    static _Thread_local char payload[FRAME_BUFFER_SIZE + 1];
+    while (1)
+    {
+        uint8_t header[4];
+        if (!_read_exact(client, header, 2))
+        {
+            break;
+        }
+        size_t len = header[1] & 0x7f;
+        if (len == 126)
+        {
+            if (!_read_exact(client, header + 2, 2))
+            {
+                break;
+            }
+            len = (header[2] << 8) | header[3];
+        }
+        if (header[0] != 0x81 || (header[1] & 0x80) || len > FRAME_BUFFER_SIZE || !_read_exact(client, (uint8_t *)payload, len))
+        {
+            break;
+        }
+        payload[len] = '\0';
+        pthread_mutex_lock(&client->mutex);
+        client->bytes += len + (len < 126 ? 2 : 4);
+        if (!_apply(client, payload))
+        {
+            ++client->bad_frames;
+        }
+        pthread_mutex_unlock(&client->mutex);
+    }
+    return NULL;
+}
+
+// Connect and complete the WebSocket handshake. Returns false on failure.
+static bool _connect(client_t * client, int rcvbuf)
+{
+    memset(client, 0, sizeof(*client));
+    pthread_mutex_init(&client->mutex, NULL);
+    client->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf > 0)
+    {
+        setsockopt(client->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (connect(client->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(client->sock);
+        return false;
+    }
+    static const char REQUEST[] = "GET /ws HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    send(client->sock, REQUEST, strlen(REQUEST), 0);
+
+    // read the response a byte at a time, so that no frame bytes are consumed
+    char response[256];
+    size_t len = 0;
+    while (len < sizeof(response) - 1 && (len < 4 || memcmp(response + len - 4, "\r\n\r\n", 4) != 0))
+    {
+        struct pollfd p = { .fd = client->sock, .events = POLLIN };
+        if (poll(&p, 1, WAIT_MS) != 1 || recv(client->sock, response + len, 1, 0) != 1)
+        {
+            break;
+        }
+        ++len;
+    }
+    response[len] = '\0';
+    if (strncmp(response, "HTTP/1.1 101", 12) != 0)
+    {
+        close(client->sock);
+        return false;
+    }
+    pthread_create(&client->thread, NULL, _client_thread, client);
+    return true;
+}
+
+static void _disconnect(client_t * client)
+{
+    client->stop = true;
+    pthread_join(client->thread, NULL);
+    close(client->sock);
+}
+
+// Wait until a client has received at least the given number of frames and the given cycle
+static bool _wait_for(client_t * client, uint32_t frames, uint32_t cycle)
+{
+    double deadline = _now() + WAIT_MS / 1000.0;
+    while (_now() < deadline)
+    {
+        pthread_mutex_lock(&client->mutex);
+        bool done = client->frames >= frames && client->last_cycle == cycle;
+        pthread_mutex_unlock(&client->mutex);
+        if (done)
+        {
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+// Check a client's table against the snapshot
+static void _check_table(client_t * client, const char * where)
+{
+    int mismatches = 0;
+    pthread_mutex_lock(&client->mutex);
+    for (int i = 0; i < num_devices; ++i)
+    {
+        mismatches += !client->known[i] || client->value[i] != snapshot.value[i] || client->status[i] != snapshot.status[i];
+    }
+    CHECK(client->bad_frames == 0, "%s: %u malformed frames", where, (unsigned int)client->bad_frames);
+    pthread_mutex_unlock(&client->mutex);
+    CHECK(mismatches == 0, "%s: %d of %d devices differ from the snapshot", where, mismatches, num_devices);
+}
+
+// Server-side descriptors of the connected clients, as a bit set
+static uint64_t _slot_fds(void)
+{
+    uint64_t fds = 0;
+    xSemaphoreTake(stream->mutex, portMAX_DELAY);
+    for (int c = 0; c < STREAM_MAX_CLIENTS; ++c)
+    {
+        if (stream->clients[c].fd >= 0 && stream->clients[c].fd < 64)
+        {
+            fds |= 1ull << stream->clients[c].fd;
+        }
+    }
+    xSemaphoreGive(stream->mutex);
+    return fds;
+}
+
+// Tests
+
+static uint32_t cycle;
+
+static void _test_deltas(void)
+{
+    client_t * a = &clients[0];
+    client_t * b = &clients[1];
+    CHECK(_connect(a, 0), "deltas: handshake failed");
+
+    _publish(++cycle, num_devices);
+    CHECK(_wait_for(a, 1, cycle), "deltas: no first frame");
+    CHECK(a->first_full && a->last_entries == num_devices, "deltas: first frame full %d with %d devices",
+          a->first_full, a->last_entries);
+    _check_table(a, "deltas: first frame");
+
+    _publish(++cycle, 3);
+    CHECK(_wait_for(a, 2, cycle), "deltas: no second frame");
+    CHECK(a->full_frames == 1 && a->last_entries == 3, "deltas: second frame has %d devices, %u full frames",
+          a->last_entries, (unsigned int)a->full_frames);
+    _check_table(a, "deltas: second frame");
+
+    _publish(++cycle, 0);
+    CHECK(_wait_for(a, 3, cycle), "deltas: no frame for an unchanged cycle");
+    CHECK(a->last_entries == 0, "deltas: unchanged cycle has %d devices", a->last_entries);
+
+    // a client connecting between cycles is sent the current snapshot at once
+    CHECK(_connect(b, 0), "deltas: late handshake failed");
+    CHECK(_wait_for(b, 1, cycle), "deltas: late client has no frame");
+    CHECK(b->first_full && b->last_entries == num_devices, "deltas: late client's first frame full %d with %d devices",
+          b->first_full, b->last_entries);
+    _check_table(b, "deltas: late client");
+
+    _disconnect(a);
+    _disconnect(b);
+}
+
+static void _test_fd_reuse(void)
+{
+    client_t * a = &clients[0];
+    client_t * b = &clients[1];
+
+    // wait for the previous test's clients to be released
+    double deadline = _now() + WAIT_MS / 1000.0;
+    while (_slot_fds() != 0 && _now() < deadline)
+    {
+        _publish(++cycle, 0);
+        usleep(10000);
+    }
+    CHECK(_slot_fds() == 0, "fd reuse: slots of closed clients not released");
+
+    CHECK(_connect(a, 0), "fd reuse: handshake failed");
+    CHECK(_wait_for(a, 1, cycle), "fd reuse: no first frame");
+    uint64_t fds = _slot_fds();
+    int fd = fds != 0 ? __builtin_ctzll(fds) : -1;
+
+    // close the connection, and wait for the server to close its socket, without waking the stream
+    _disconnect(a);
+    deadline = _now() + WAIT_MS / 1000.0;
+    while (httpd_ws_get_fd_info(server, fd) != HTTPD_WS_CLIENT_INVALID && _now() < deadline)
+    {
+        usleep(1000);
+    }
+
+    CHECK(_connect(b, 0), "fd reuse: second handshake failed");
+    uint64_t reused = _slot_fds();
+    CHECK(reused == fds, "fd reuse: slots hold fds 0x%llx, expected only %d", (unsigned long long)reused, fd);
+    CHECK(_wait_for(b, 1, cycle), "fd reuse: no first frame");
+    CHECK(b->first_full && b->last_entries == num_devices, "fd reuse: first frame full %d with %d devices",
+          b->first_full, b->last_entries);
+
+    _publish(++cycle, 1);
+    CHECK(_wait_for(b, 2, cycle), "fd reuse: no delta");
+    usleep(50000);
+    CHECK(b->frames == 2 && b->last_entries == 1, "fd reuse: %u frames, last with %d devices, expected 2 and 1",
+          (unsigned int)b->frames, b->last_entries);
+    _check_table(b, "fd reuse");
+    _disconnect(b);
+}
+
+static void _test_back_pressure(int cycles, int period_us)
+{
+    client_t * slow = &clients[NUM_CLIENTS - 1];
+    for (int c = 0; c < NUM_CLIENTS - 1; ++c)
+    {
+        CHECK(_connect(&clients[c], 0), "back-pressure: handshake %d failed", c);
+    }
+    CHECK(_connect(slow, SLOW_RCVBUF), "back-pressure: slow handshake failed");
+    slow->paused = true;
+    usleep(50000);
+
+    double max_publish = 0.0;
+    for (int k = 0; k < cycles; ++k)
+    {
+        double t = _publish(++cycle, num_devices);
+        max_publish = t > max_publish ? t : max_publish;
+        usleep(period_us);
+    }
+    for (int c = 0; c < NUM_CLIENTS - 1; ++c)
+    {
+        CHECK(_wait_for(&clients[c], 1, cycle), "back-pressure: client %d did not reach the last cycle", c);
+        _check_table(&clients[c], "back-pressure: reading client");
+    }
+
+    uint32_t slow_frames = slow->frames;
+    uint32_t fast_frames = clients[0].frames;
+    xSemaphoreTake(stream->mutex, portMAX_DELAY);
+    uint32_t slow_skipped = 0;
+    for (int c = 0; c < STREAM_MAX_CLIENTS; ++c)
+    {
+        slow_skipped = stream->clients[c].frames_skipped > slow_skipped ? stream->clients[c].frames_skipped : slow_skipped;
+    }
+    xSemaphoreGive(stream->mutex);
+    printf("back-pressure: %d cycles, reading clients %u frames, stalled client %u frames and %u skipped, longest publish %.0f us\n",
+           cycles, (unsigned int)fast_frames, (unsigned int)slow_frames, (unsigned int)slow_skipped, max_publish * 1e6);
+    CHECK(slow_skipped > 0, "back-pressure: the stalled client skipped no cycles");
+    CHECK(fast_frames > 2 * slow_frames, "back-pressure: reading clients received %u frames, stalled client %u",
+          (unsigned int)fast_frames, (unsigned int)slow_frames);
+    CHECK(max_publish < 0.05, "back-pressure: publishing took up to %.0f us", max_publish * 1e6);
+
+    // once it reads again, the stalled client catches up from its own baseline
+    slow->paused = false;
+    CHECK(_wait_for(slow, 1, cycle), "back-pressure: stalled client did not catch up");
+    _check_table(slow, "back-pressure: stalled client");
+
+    for (int c = 0; c < NUM_CLIENTS; ++c)
+    {
+        _disconnect(&clients[c]);
+    }
+}
+
+// Benchmark
+
+static void _benchmark(int cycles, int period_us)
+{
+    static const int PERCENT[] = { 1, 10, 100 };
+    for (size_t p = 0; p < sizeof(PERCENT) / sizeof(PERCENT[0]); ++p)
+    {
+        for (int c = 0; c < NUM_CLIENTS; ++c)
+        {
+            _connect(&clients[c], 0);
+        }
+        for (int c = 0; c < NUM_CLIENTS; ++c)
+        {
+            _wait_for(&clients[c], 1, cycle);
+        }
+
+        int changes = num_devices * PERCENT[p] / 100 > 0 ? num_devices * PERCENT[p] / 100 : 1;
+        for (int k = 0; k < cycles; ++k)
+        {
+            _publish(++cycle, changes);
+            usleep(period_us);
+        }
+        for (int c = 0; c < NUM_CLIENTS; ++c)
+        {
+            _wait_for(&clients[c], 1, cycle);
+        }
+
+        printf("%d%% of %d devices changing, %d cycles:\n", PERCENT[p], num_devices, cycles);
+        xSemaphoreTake(stream->mutex, portMAX_DELAY);
+        int64_t now = esp_timer_get_time();
+        for (int c = 0; c < STREAM_MAX_CLIENTS; ++c)
+        {
+            const stream_client_t * client = &stream->clients[c];
+            if (client->fd < 0 || client->frames_sent == 0)
+            {
+                continue;
+            }
+            double seconds = (now - client->connect_time) * 1e-6;
+            printf("  client %d: %u frames, %u skipped, encode %.1f us/frame, send %.1f us/frame, %.0f bytes/frame, %.1f kB/s\n",
+                   c, (unsigned int)client->frames_sent, (unsigned int)client->frames_skipped,
+                   (double)client->encode_time / client->frames_sent, (double)client->send_time / client->frames_sent,
+                   (double)client->bytes_sent / client->frames_sent, client->bytes_sent / seconds / 1000.0);
+        }
+        xSemaphoreGive(stream->mutex);
+
+        for (int c = 0; c < NUM_CLIENTS; ++c)
+        {
+            _disconnect(&clients[c]);
+        }
+        usleep(50000);
+        _publish(++cycle, 0);    // release the closed clients' slots
+        usleep(50000);
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    num_devices = argc > 1 ? atoi(argv[1]) : 256;
+    port = argc > 2 ? (uint16_t)atoi(argv[2]) : 18080;
+    if (num_devices < 8 || num_devices >= LOGICAL_ID)
+    {
+        fprintf(stderr, "usage: %s [num_devices 8-%d] [port]\n", argv[0], LOGICAL_ID - 1);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    sensors = sensors_malloc();
+    sensors->num_devices = num_devices;
+    for (int i = 0; i < num_devices; ++i)
+    {
+        sensors->cold[i].logical_id = SENSORS_NO_LOGICAL_ID;
+        snapshot.value[i] = (int16_t)(i * 7 - 200);
+        snapshot.status[i] = DS18B20_OK;
+    }
+    sensors_set_logical_id(sensors, LOGICAL_DEVICE, LOGICAL_ID);
+    snapshot.num_devices = num_devices;
+
+    server = web_start(port);
+    stream = stream_malloc(server);
+    if (stream == NULL)
+    {
+        fprintf(stderr, "failed to start the stream on port %u\n", port);
+        return 1;
+    }
+
+    _test_deltas();
+    _test_fd_reuse();
+    _test_back_pressure(300, 2000);
+    printf("%s: %d failures\n", failures == 0 ? "tests passed" : "TESTS FAILED", failures);
+
+    _benchmark(500, 2000);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,420 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Host round-trip test of the store-and-forward uplink (main/uplink.c).
+//
+// Readings for a number of devices and cycles are fed to the uplink while a local HTTP
+// stand-in refuses every POST, as during an outage, so that a backlog builds up. The stand-in
+// then accepts POSTs and the uplink's drain task delivers the backlog, paced to its rate.
+// Every block received is decoded from the format documented in main/uplink.h, independently
+// of the encoder, and compared with the readings fed in. Reports the blocks delivered, the
+// compression ratio and the delivery throughput, and exits non-zero on any mismatch.
+//
+// Build and run on the host:
+//
+//     $ cc -O2 -I tools/host -I main -o uplink_roundtrip tools/uplink_roundtrip.c main/uplink.c main/lz.c tools/host/host.c -lpthread -lm
+//     $ ./uplink_roundtrip [num_devices] [num_cycles] [rate_bytes_per_s]
+
+#define _GNU_SOURCE    // for strcasestr
+
+#include <math.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esp_timer.h"
+#include "uplink.h"
+
+#define BATCH             (60)             // cycles per block
+#define QUEUE_SIZE        (256 * 1024)     // enough to hold the whole backlog
+#define OUTAGE_MS         (2500)           // POSTs are refused for this long
+#define MAX_BLOCKS        (4096)
+#define REQUEST_SIZE      (1024)
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    int fd;
+    bool outage;
+    int refused;
+    int num_blocks;
+    uint8_t * blocks[MAX_BLOCKS];
+    size_t lengths[MAX_BLOCKS];
+    int64_t first_time;               // when the first block was accepted
+    int64_t last_time;                // when the most recent block was accepted
+} standin_t;
+
+// Readings fed to the uplink, indexed by cycle then device
+static int16_t * expected;
+static int num_devices;
+static int num_cycles;
+
+static int16_t _reading(int cycle, int device)
+{
+    // slowly varying temperatures with a little noise, and an occasional failed read
+    if ((cycle * 31 + device * 17) % 211 == 0)
+    {
+        return UPLINK_NO_VALUE;
+    }
+    double degrees = 20.0 + device * 0.5 + 3.0 * sin(cycle / 600.0 + device) + ((cycle * 7 + device * 13) % 5 - 2) * 0.0625;
+    return (int16_t)lround(degrees * 16);
+}
+
+static bool _recv_all(int fd, uint8_t * buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t received = recv(fd, buffer, length, 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        buffer += received;
+        length -= received;
+    }
+    return true;
+}
+
+// Read one request, store the body of a POST unless the stand-in is in an outage, and respond
+static void _handle(standin_t * standin, int fd)
+{
+    char request[REQUEST_SIZE + 1];
+    size_t length = 0;
+    char * body = NULL;
+    while (body == NULL && length < REQUEST_SIZE)
+    {
+        ssize_t received = recv(fd, &request[length], REQUEST_SIZE - length, 0);
+        if (received <= 0)
+        {
+            return;
+        }
+        length += received;
+        request[length] = '\0';
+        body = strstr(request, "\r\n\r\n");
+    }
+    const char * field = body != NULL ? strcasestr(request, "Content-Length:") : NULL;
+    if (field == NULL)
+    {
+        return;
+    }
+    body += 4;
+    size_t content_length = strtoul(field + 15, NULL, 10);
+    size_t have = length - (body - request);
+    uint8_t * block = malloc(content_length > 0 ? content_length : 1);
+    memcpy(block, body, have);
+    if (!_recv_all(fd, block + have, content_length - have))
+    {
+        free(block);
+        return;
+    }
+
+    pthread_mutex_lock(&standin->mutex);
+    const char * response = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+    if (standin->outage || standin->num_blocks == MAX_BLOCKS)
+    {
+        ++standin->refused;
+        free(block);
+    }
+    else
+    {
+        response = "HTTP/1.1 204 No Content\r\n\r\n";
+        standin->last_time = esp_timer_get_time();
+        if (standin->num_blocks == 0)
+        {
+            standin->first_time = standin->last_time;
+        }
+        standin->blocks[standin->num_blocks] = block;
+        standin->lengths[standin->num_blocks++] = content_length;
+    }
+    pthread_mutex_unlock(&standin->mutex);
+    send(fd, response, strlen(response), MSG_NOSIGNAL);
+}
+
+static void * _standin_thread(void * parameter)
+{
+    standin_t * standin = parameter;
+    while (1)
+    {
+        int fd = accept(standin->fd, NULL, NULL);
+        if (fd >= 0)
+        {
+            _handle(standin, fd);
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+// Decompress an LZ stream as described in main/lz.h. Returns the decompressed length, or 0 if malformed.
+static size_t _lz_decompress(const uint8_t * in, size_t length, uint8_t * out, size_t capacity)
+{
+    const uint8_t * end = in + length;
+    size_t n = 0;
+    while (in < end)
+    {
+        uint8_t token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15)
+        {
+            uint8_t more;
+            do
+            {
+                if (in == end)
+                {
+                    return 0;
+                }
+                more = *in++;
+                literals += more;
+            } while (more == 255);
+        }
+        if (literals > (size_t)(end - in) || n + literals > capacity)
+        {
+            return 0;
+        }
+        memcpy(&out[n], in, literals);
+        n += literals;
+        in += literals;
+        if (in == end)
+        {
+            break;    // the last sequence has no match
+        }
+
+        if (end - in < 2)
+        {
+            return 0;
+        }
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t match = (token & 0x0f);
+        if (match == 15)
+        {
+            uint8_t more;
+            do
+            {
+                if (in == end)
+                {
+                    return 0;
+                }
+                more = *in++;
+                match += more;
+            } while (more == 255);
+        }
+        match += 4;
+        if (offset == 0 || offset > n || n + match > capacity)
+        {
+            return 0;
+        }
+        for (size_t k = 0; k < match; ++k, ++n)
+        {
+            out[n] = out[n - offset];    // may overlap the bytes being written
+        }
+    }
+    return n;
+}
+
+static bool _get_varint(const uint8_t ** p, const uint8_t * end, uint32_t * value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (*p == end)
+        {
+            return false;
+        }
+        uint8_t byte = *(*p)++;
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t _get_u32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Decode a block and check every reading in it. Returns the number of cycles, or -1 on a mismatch.
+static int _check_block(const uint8_t * block, size_t length, uint32_t * next_cycle)
+{
+    static uint8_t payload[UPLINK_BLOCK_SIZE];
+    if (length < UPLINK_HEADER_SIZE || block[0] != UPLINK_VERSION)
+    {
+        return -1;
+    }
+    int devices = block[2] | (block[3] << 8);
+    uint32_t cycle = _get_u32(&block[4]);
+    uint32_t time_ms = _get_u32(&block[8]);
+    int cycles = block[12] | (block[13] << 8);
+    size_t plain_length = block[14] | (block[15] << 8);
+    size_t decoded = length - UPLINK_HEADER_SIZE;
+    if (block[1] & 1)
+    {
+        decoded = _lz_decompress(block + UPLINK_HEADER_SIZE, length - UPLINK_HEADER_SIZE, payload, sizeof(payload));
+    }
+    else if (decoded <= sizeof(payload))
+    {
+        memcpy(payload, block + UPLINK_HEADER_SIZE, decoded);
+    }
+    if (devices != num_devices || decoded != plain_length)
+    {
+        return -1;
+    }
+
+    const uint8_t * p = payload;
+    const uint8_t * end = payload + decoded;
+    int32_t previous[SENSORS_MAX_DEVICES] = { 0 };
+    for (int c = 0; c < cycles; ++c)
+    {
+        uint32_t cycle_delta;
+        uint32_t time_delta;
+        if (!_get_varint(&p, end, &cycle_delta) || !_get_varint(&p, end, &time_delta))
+        {
+            return -1;
+        }
+        cycle += cycle_delta;
+        time_ms += time_delta;
+        if ((int32_t)(cycle - *next_cycle) < 0 || cycle < 1 || cycle > (uint32_t)num_cycles || time_ms != cycle * 1000)
+        {
+            return -1;    // out of order, repeated, or not a cycle that was fed in
+        }
+        *next_cycle = cycle + 1;
+
+        for (int i = 0; i < devices; ++i)
+        {
+            uint32_t code;
+            if (!_get_varint(&p, end, &code))
+            {
+                return -1;
+            }
+            int32_t value = UPLINK_NO_VALUE;
+            if (code > 0)
+            {
+                uint32_t zigzag = code - 1;
+                previous[i] += (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+                value = previous[i];
+            }
+            if (value != expected[(cycle - 1) * num_devices + i])
+            {
+                fprintf(stderr, "cycle %u device %d: got %d, expected %d\n", (unsigned int)cycle, i, (int)value,
+                        expected[(cycle - 1) * num_devices + i]);
+                return -1;
+            }
+        }
+    }
+    return p == end ? cycles : -1;
+}
+
+int main(int argc, char ** argv)
+{
+    num_devices = argc > 1 ? atoi(argv[1]) : 16;
+    num_cycles = argc > 2 ? atoi(argv[2]) : 3600;
+    uint32_t rate = argc > 3 ? (uint32_t)atoi(argv[3]) : 20000;
+    if (num_devices <= 0 || num_devices > SENSORS_MAX_DEVICES || num_cycles <= 0 || rate == 0)
+    {
+        fprintf(stderr, "usage: %s [num_devices] [num_cycles] [rate_bytes_per_s]\n", argv[0]);
+        return 1;
+    }
+
+    static standin_t standin = { .mutex = PTHREAD_MUTEX_INITIALIZER, .outage = true };
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t address_length = sizeof(address);
+    standin.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (standin.fd < 0 || bind(standin.fd, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(standin.fd, 4) != 0 || getsockname(standin.fd, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("stand-in");
+        return 1;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, _standin_thread, &standin);
+
+    char url[UPLINK_URL_LENGTH];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/uplink", ntohs(address.sin_port));
+    static sensors_t sensors;
+    sensors.num_devices = num_devices;
+    uplink_t * uplink = uplink_malloc(&sensors, url, BATCH, QUEUE_SIZE, rate);
+    if (uplink == NULL || !uplink_start(uplink))
+    {
+        return 1;
+    }
+
+    // the whole run is fed in during the outage, so that it is delivered as a backlog
+    expected = malloc((size_t)num_cycles * num_devices * sizeof(int16_t));
+    int16_t values[SENSORS_MAX_DEVICES];
+    for (int c = 1; c <= num_cycles; ++c)
+    {
+        for (int i = 0; i < num_devices; ++i)
+        {
+            values[i] = expected[(c - 1) * num_devices + i] = _reading(c, i);
+        }
+        uplink_add_values(uplink, (uint32_t)c, (uint32_t)c * 1000, values, num_devices);
+    }
+    uplink_flush(uplink);
+    usleep(OUTAGE_MS * 1000);
+    pthread_mutex_lock(&standin.mutex);
+    standin.outage = false;
+    pthread_mutex_unlock(&standin.mutex);
+
+    // allow for the backoff after the outage, and for the backlog to drain at the rate
+    int64_t deadline = esp_timer_get_time() + ((int64_t)QUEUE_SIZE * 1000000 / rate + 120 * 1000000);
+    while (uplink_delivered_cycle(uplink) != (uint32_t)num_cycles && esp_timer_get_time() < deadline)
+    {
+        usleep(100 * 1000);
+    }
+
+    pthread_mutex_lock(&standin.mutex);
+    int received_cycles = 0;
+    uint32_t next_cycle = 1;
+    size_t received_bytes = 0;
+    bool ok = true;
+    for (int b = 0; b < standin.num_blocks && ok; ++b)
+    {
+        int cycles = _check_block(standin.blocks[b], standin.lengths[b], &next_cycle);
+        ok = cycles >= 0;
+        received_cycles += cycles;
+        received_bytes += standin.lengths[b];
+    }
+    double elapsed = (standin.last_time - standin.first_time) / 1e6;
+    xSemaphoreTake(uplink->mutex, portMAX_DELAY);
+    uint32_t dropped = uplink->blocks_dropped;
+    xSemaphoreGive(uplink->mutex);
+    ok = ok && (dropped > 0 || received_cycles == num_cycles);
+
+    double plain_bytes = (double)received_cycles * (8 + 2 * num_devices);
+    printf("%d devices, %d cycles, %d cycles per block, rate %u bytes/s\n", num_devices, num_cycles, BATCH, (unsigned int)rate);
+    printf("POSTs refused during outage: %d\n", standin.refused);
+    printf("blocks delivered: %d, dropped: %u, cycles delivered: %d\n", standin.num_blocks, (unsigned int)dropped, received_cycles);
+    printf("bytes delivered: %zu, as plain 16-bit values: %.0f, compression ratio: %.2f\n",
+           received_bytes, plain_bytes, received_bytes > 0 ? plain_bytes / received_bytes : 0.0);
+    printf("drain throughput: %.0f bytes/s over %.2f s\n", elapsed > 0 ? (received_bytes - standin.lengths[0]) / elapsed : 0.0, elapsed);
+    printf("%s\n", ok ? "round trip OK" : "round trip FAILED");
+    pthread_mutex_unlock(&standin.mutex);
+    return ok ? 0 : 1;
+}